@@ -1,6 +1,7 @@
 #include "acceptor_state.h"
 #include "recovery_manager.h"
 #include "ring_voter.h"
+#include "trace.h"
 #include <mordor/assert.h>
 #include <mordor/log.h>
 #include <mordor/statistics.h>
@@ -31,17 +32,27 @@ CountStatistic<uint64_t>& g_pendingInstances =
     Statistics::registerStatistic("acceptor_state.pending_instances",
                                   CountStatistic<uint64_t>());
 
+AcceptorState::Shard::Shard()
+    : epochGeneration(0)
+{}
+
 AcceptorState::AcceptorState(uint32_t pendingInstancesSpan,
+                             uint32_t shardCount,
                              IOManager* ioManager,
                              RecoveryManager::ptr recoveryManager,
                              CommitTracker::ptr commitTracker,
                              ValueCache::ptr    valueCache)
     : pendingInstancesSpan_(pendingInstancesSpan),
+      shardCount_(shardCount),
+      shards_(new Shard[shardCount]),
+      epochGeneration_(0),
       ioManager_(ioManager),
       recoveryManager_(recoveryManager),
       commitTracker_(commitTracker),
       valueCache_(valueCache)
-{}
+{
+    MORDOR_ASSERT(shardCount_ > 0);
+}
 
 AcceptorState::Status AcceptorState::nextBallot(const Guid& epoch,
                                                 InstanceId instanceId,
@@ -50,10 +61,12 @@ AcceptorState::Status AcceptorState::nextBallot(const Guid& epoch,
                                                 BallotId* highestVoted,
                                                 Value*    lastVote)
 {
-    FiberMutex::ScopedLock lk(mutex_);
-    updateEpoch(epoch);
+    Shard& shard = shardFor(instanceId);
+    FiberMutex::ScopedLock lk(shard.mutex);
+    updateEpoch(epoch, &shard);
     if(valueCache_) { // HACK(skywalker)
-        switch(tryNextBallotOnCommitted(instanceId,
+        switch(tryNextBallotOnCommitted(epoch,
+                                        instanceId,
                                         ballotId,
                                         highestPromised,
                                         highestVoted,
@@ -71,7 +84,7 @@ AcceptorState::Status AcceptorState::nextBallot(const Guid& epoch,
                 break;
         }
     }
-    AcceptorInstance* instance = lookupInstance(instanceId);
+    AcceptorInstance* instance = lookupInstance(&shard, instanceId);
     if(!instance) {
         MORDOR_LOG_TRACE(g_log) << this << " nextBallot(" << instanceId <<
                                    ") refused";
@@ -87,13 +100,14 @@ AcceptorState::Status AcceptorState::nextBallot(const Guid& epoch,
 }
 
 ValueCache::QueryResult AcceptorState::tryNextBallotOnCommitted(
+    const Guid& epoch,
     InstanceId instanceId,
     BallotId   ballotId,
     BallotId*  highestPromised,
     BallotId*  highestVoted,
     Value*     lastVote)
 {
-    auto result = valueCache_->query(epoch_, instanceId, lastVote);
+    auto result = valueCache_->query(epoch, instanceId, lastVote);
     if(result == ValueCache::OK) {
         MORDOR_LOG_TRACE(g_log) << this << " nextBallot(" << instanceId <<
             ", " << ballotId << ") hit committed " << *lastVote;
@@ -108,10 +122,11 @@ AcceptorState::Status AcceptorState::beginBallot(const Guid& epoch,
                                                  BallotId ballotId,
                                                  const Value& value)
 {
-    FiberMutex::ScopedLock lk(mutex_);
-    updateEpoch(epoch);
+    Shard& shard = shardFor(instanceId);
+    FiberMutex::ScopedLock lk(shard.mutex);
+    updateEpoch(epoch, &shard);
     if(valueCache_) { // HACK(skywalker)
-        switch(tryBeginBallotOnCommitted(instanceId, ballotId, value)) {
+        switch(tryBeginBallotOnCommitted(epoch, instanceId, ballotId, value)) {
             case ValueCache::OK:
                 return OK;
                 break;
@@ -125,7 +140,7 @@ AcceptorState::Status AcceptorState::beginBallot(const Guid& epoch,
         }
     }
 
-    AcceptorInstance* instance = lookupInstance(instanceId);
+    AcceptorInstance* instance = lookupInstance(&shard, instanceId);
     if(!instance) {
         MORDOR_LOG_TRACE(g_log) << this << " beginBallot(" << instanceId <<
                                    ") refused";
@@ -141,12 +156,13 @@ AcceptorState::Status AcceptorState::beginBallot(const Guid& epoch,
 }
 
 ValueCache::QueryResult AcceptorState::tryBeginBallotOnCommitted(
+    const Guid& epoch,
     InstanceId instanceId,
     BallotId   ballotId,
     const Value& value)
 {
     Value committedValue;
-    auto result = valueCache_->query(epoch_, instanceId, &committedValue);
+    auto result = valueCache_->query(epoch, instanceId, &committedValue);
     if(result == ValueCache::OK) {
         MORDOR_LOG_TRACE(g_log) << this << " beginBallot(" << instanceId <<
             ", " << ballotId << ", " << value << ") hit committed " <<
@@ -160,10 +176,11 @@ AcceptorState::Status AcceptorState::vote(const Guid& epoch,
                                           const Vote& vote,
                                           BallotId* highestPromised)
 {
-    FiberMutex::ScopedLock lk(mutex_);
-    updateEpoch(epoch);
+    Shard& shard = shardFor(vote.instance());
+    FiberMutex::ScopedLock lk(shard.mutex);
+    updateEpoch(epoch, &shard);
     if(valueCache_) { // HACK(skywalker)
-        switch(tryVoteOnCommitted(vote, highestPromised)) {
+        switch(tryVoteOnCommitted(epoch, vote, highestPromised)) {
             case ValueCache::OK:
                 return OK;
                 break;
@@ -176,7 +193,7 @@ AcceptorState::Status AcceptorState::vote(const Guid& epoch,
                 break;
         }
     }
-    AcceptorInstance* instance = lookupInstance(vote.instance());
+    AcceptorInstance* instance = lookupInstance(&shard, vote.instance());
     if(!instance) {
         MORDOR_LOG_TRACE(g_log) << this << " " << vote << " refused";
         return REFUSED;
@@ -187,11 +204,12 @@ AcceptorState::Status AcceptorState::vote(const Guid& epoch,
 }
 
 ValueCache::QueryResult AcceptorState::tryVoteOnCommitted(
+    const Guid& epoch,
     const Vote& vote,
     BallotId* highestBallotPromised)
 {
     Value committedValue;
-    auto result = valueCache_->query(epoch_, vote.instance(), &committedValue);
+    auto result = valueCache_->query(epoch, vote.instance(), &committedValue);
     if(result == ValueCache::OK) {
         MORDOR_LOG_TRACE(g_log) << this << " vote " << vote <<
             " hit committed value " << committedValue;
@@ -205,10 +223,11 @@ AcceptorState::Status AcceptorState::commit(const Guid& epoch,
                                             InstanceId instanceId,
                                             const Guid& valueId)
 {
-    FiberMutex::ScopedLock lk(mutex_);
-    updateEpoch(epoch);
+    Shard& shard = shardFor(instanceId);
+    FiberMutex::ScopedLock lk(shard.mutex);
+    updateEpoch(epoch, &shard);
     if(valueCache_) { // HACK(skywalker)
-        switch(tryCommitOnCommitted(instanceId, valueId)) {
+        switch(tryCommitOnCommitted(epoch, instanceId, valueId)) {
             case ValueCache::OK:
                 return OK;
                 break;
@@ -222,7 +241,7 @@ AcceptorState::Status AcceptorState::commit(const Guid& epoch,
         }
     }
 
-    AcceptorInstance* instance = lookupInstance(instanceId);
+    AcceptorInstance* instance = lookupInstance(&shard, instanceId);
     if(!instance) {
         MORDOR_LOG_TRACE(g_log) << this << "commit(" << instanceId <<
                                    ") refused";
@@ -240,26 +259,32 @@ AcceptorState::Status AcceptorState::commit(const Guid& epoch,
         if(!instance->value(&value, &ballot)) {
             MORDOR_ASSERT(1 == 0);
         }
-        commitTracker_->push(epoch_, instanceId, ballot, value);
-        pendingInstances_.erase(instanceId);
+        if(Tracer::sampled(instanceId)) {
+            Tracer::record(TRACE_DELIVERED, instanceId);
+        }
+        // All shards meet here: the tracker needs the commits of every
+        // shard to find the gaps (see CommitTracker).
+        commitTracker_->push(epoch, instanceId, ballot, value);
+        shard.pendingInstances.erase(instanceId);
         g_pendingInstances.decrement();
     } else {
         MORDOR_LOG_TRACE(g_log) << this << " commit(" << instanceId << ")" <<
                                    " failed, scheduling recovery";
         ioManager_->schedule(boost::bind(&AcceptorState::startRecovery,
                                          this,
-                                         epoch_,
+                                         epoch,
                                          instanceId));
     }
     return boolToStatus(result);
 }
 
 ValueCache::QueryResult AcceptorState::tryCommitOnCommitted(
+    const Guid& epoch,
     InstanceId instanceId,
     const Guid& valueId)
 {
     Value committedValue;
-    auto result = valueCache_->query(epoch_, instanceId, &committedValue);
+    auto result = valueCache_->query(epoch, instanceId, &committedValue);
     if(result == ValueCache::OK) {
         MORDOR_LOG_TRACE(g_log) << this << " commit(" << instanceId <<
             ", " << valueId << " is a recommit(" <<
@@ -269,20 +294,22 @@ ValueCache::QueryResult AcceptorState::tryCommitOnCommitted(
     return result;
 }
 
-AcceptorInstance* AcceptorState::lookupInstance(InstanceId instanceId) {
+AcceptorInstance* AcceptorState::lookupInstance(Shard* shard,
+                                                InstanceId instanceId)
+{
     // A precondition for calling this function is that the value cache
     // query returned NOT_YET.
     // Thus we only need to check whether the pending instance span
     // constraint is violated by inserting a new instance.
-    auto instanceIter = pendingInstances_.find(instanceId);
-    if(instanceIter != pendingInstances_.end()) {
+    auto instanceIter = shard->pendingInstances.find(instanceId);
+    if(instanceIter != shard->pendingInstances.end()) {
         return &instanceIter->second;
     } else {
-        if(canInsert(instanceId)) {
+        if(canInsert(*shard, instanceId)) {
             MORDOR_LOG_TRACE(g_log) << this << " new pending iid=" <<
                 instanceId;
-            auto freshIter = pendingInstances_.insert(make_pair(instanceId,
-                                                      AcceptorInstance()));
+            auto freshIter = shard->pendingInstances.insert(
+                                 make_pair(instanceId, AcceptorInstance()));
             MORDOR_ASSERT(freshIter.second);
             g_pendingInstances.increment();
 
@@ -294,16 +321,32 @@ AcceptorInstance* AcceptorState::lookupInstance(InstanceId instanceId) {
 }
 
 InstanceId AcceptorState::firstNotCommittedInstanceId(const Guid& epoch) {
-    FiberMutex::ScopedLock lk(mutex_);
-    updateEpoch(epoch);
+    // Lock-free unless the epoch changes, like updateEpoch(epoch, shard).
+    // epoch_ is read as a seqlock: epochGeneration_ is odd while
+    // updateGlobalEpoch() writes it and changes once it is done.
+    const uint64_t generation = epochGeneration_;
+    if(generation % 2 == 0) {
+        __sync_synchronize();
+        const bool sameEpoch = (epoch_ == epoch);
+        __sync_synchronize();
+        if(sameEpoch && epochGeneration_ == generation) {
+            return commitTracker_->firstNotCommittedInstanceId();
+        }
+    }
+    {
+        FiberMutex::ScopedLock lk(epochMutex_);
+        updateGlobalEpoch(epoch);
+    }
     return commitTracker_->firstNotCommittedInstanceId();
 }
 
-bool AcceptorState::canInsert(InstanceId instanceId) const {
-    if(pendingInstances_.empty()) {
+bool AcceptorState::canInsert(const Shard& shard,
+                              InstanceId instanceId) const
+{
+    if(shard.pendingInstances.empty()) {
         return true;
     } else {
-        auto maxPendingIter = --(pendingInstances_.end());
+        auto maxPendingIter = --(shard.pendingInstances.end());
         InstanceId maxPendingInstanceId = maxPendingIter->first;
         InstanceId minPendingInstanceId =
             commitTracker_->firstNotCommittedInstanceId();
@@ -341,19 +384,56 @@ AcceptorState::Status AcceptorState::boolToStatus(const bool boolean) const
     return boolean ? OK : NACKED;
 }
 
-void AcceptorState::updateEpoch(const Guid& epoch) {
+AcceptorState::Shard& AcceptorState::shardFor(InstanceId instanceId) {
+    return shards_[instanceId % shardCount_];
+}
+
+void AcceptorState::updateEpoch(const Guid& epoch, Shard* shard) {
+    if(epoch == shard->epoch && shard->epochGeneration == epochGeneration_) {
+        return;
+    }
+
+    FiberMutex::ScopedLock lk(epochMutex_);
+    updateGlobalEpoch(epoch);
+    syncShard(shard);
+}
+
+void AcceptorState::syncShard(Shard* shard) {
+    if(shard->epochGeneration != epochGeneration_) {
+        reset(shard);
+        shard->epoch = epoch_;
+        shard->epochGeneration = epochGeneration_;
+    }
+}
+
+void AcceptorState::syncAllShards() {
+    for(uint32_t i = 0; i < shardCount_; ++i) {
+        Shard* shard = &shards_[i];
+        FiberMutex::ScopedLock lk(shard->mutex);
+        FiberMutex::ScopedLock epochLk(epochMutex_);
+        syncShard(shard);
+    }
+}
+
+void AcceptorState::updateGlobalEpoch(const Guid& epoch) {
     if(epoch != epoch_) {
         MORDOR_LOG_INFO(g_log) << this << " epoch change from " << epoch_ <<
                                   " to " << epoch;
-        reset();
         commitTracker_->updateEpoch(epoch);
+        // Odd while epoch_ is written, see firstNotCommittedInstanceId().
+        ++epochGeneration_;
         epoch_ = epoch;
+        ++epochGeneration_;
+        // Not inline: the shard mutexes come before epochMutex_.
+        ioManager_->schedule(boost::bind(&AcceptorState::syncAllShards,
+                                         this));
     }
 }
 
-void AcceptorState::reset() {
-    pendingInstances_.clear();
-    g_pendingInstances.reset();
+void AcceptorState::reset(Shard* shard) {
+    // Wraps around to a subtraction.
+    g_pendingInstances.add(-uint64_t(shard->pendingInstances.size()));
+    shard->pendingInstances.clear();
 }
 
 }  // namespace lightning
@@ -7,10 +7,12 @@
 #include "recovery_manager.h"
 #include "value.h"
 #include "value_cache.h"
+#include <mordor/atomic.h>
 #include <mordor/fibersynchronization.h>
 #include <mordor/iomanager.h>
 #include <mordor/timer.h>
 #include <boost/enable_shared_from_this.hpp>
+#include <boost/scoped_array.hpp>
 #include <functional>
 #include <map>
 #include <queue>
@@ -21,6 +23,10 @@ namespace lightning {
 class Vote;
 
 //! TODO(skywalker): document the new acceptor state logic.
+//  Pending instances are partitioned into shards by instance id
+//  modulo the shard count, each shard with its own lock and its own
+//  pending window, so that handlers running on different threads
+//  only contend when they touch the same shard.
 class AcceptorState : public boost::enable_shared_from_this<AcceptorState> {
     typedef paxos::AcceptorInstance AcceptorInstance;
     typedef paxos::InstanceId InstanceId;
@@ -38,6 +44,7 @@ public:
     };
 
     AcceptorState(uint32_t pendingInstancesSpan,
+                  uint32_t shardCount,
                   Mordor::IOManager* ioManager,
                   RecoveryManager::ptr recoveryManager,
                   CommitTracker::ptr   commitTracker,
@@ -68,57 +75,103 @@ public:
                   InstanceId instanceId,
                   const Guid& valueId);
 
+    //! Only takes epochMutex_ when the epoch changes.
     InstanceId firstNotCommittedInstanceId(const Guid& epoch);
 private:
-    void updateEpoch(const Guid& epoch);
-    ValueCache::QueryResult tryNextBallotOnCommitted(InstanceId instanceId,
+    typedef std::map<InstanceId, AcceptorInstance> InstanceMap;
+
+    //! The pending instances whose ids fall into one residue class
+    //  modulo the shard count.
+    struct Shard {
+        Shard();
+
+        //! The epoch the contents of this shard belong to.
+        Guid epoch;
+        //! Value of AcceptorState::epochGeneration_ at the time
+        //  the shard was last synchronized with the global epoch.
+        uint64_t epochGeneration;
+        //! Stores the pending (not committed) instances of this shard.
+        InstanceMap pendingInstances;
+
+        Mordor::FiberMutex mutex;
+    };
+
+    Shard& shardFor(InstanceId instanceId);
+
+    //! Makes sure that the shard belongs to the given epoch, switching
+    //  the global epoch if necessary. Must be called with the shard
+    //  mutex held.
+    void updateEpoch(const Guid& epoch, Shard* shard);
+
+    //! Switches the global epoch, notifying the commit tracker and
+    //  scheduling syncAllShards(). Must be called with epochMutex_ held.
+    void updateGlobalEpoch(const Guid& epoch);
+
+    //! Resets the shard if it lags behind the global epoch. Must be
+    //  called with the shard mutex and epochMutex_ held.
+    void syncShard(Shard* shard);
+
+    //! Resets every shard lagging behind the global epoch, so that idle
+    //  shards do not keep the instances of an old epoch. Scheduled on
+    //  each epoch change.
+    void syncAllShards();
+
+    ValueCache::QueryResult tryNextBallotOnCommitted(const Guid& epoch,
+                                                     InstanceId instanceId,
                                                      BallotId   ballotId,
                                                      BallotId*  highestPromised,
                                                      BallotId*  highestVoted,
                                                      Value*     lastVote);
 
-    ValueCache::QueryResult tryBeginBallotOnCommitted(InstanceId instanceId,
+    ValueCache::QueryResult tryBeginBallotOnCommitted(const Guid& epoch,
+                                                      InstanceId instanceId,
                                                       BallotId   ballotId,
                                                       const Value& value);
 
-    ValueCache::QueryResult tryVoteOnCommitted(const Vote& vote,
+    ValueCache::QueryResult tryVoteOnCommitted(const Guid& epoch,
+                                               const Vote& vote,
                                                BallotId* highestBallotPromised);
 
-    ValueCache::QueryResult tryCommitOnCommitted(InstanceId instanceId,
+    ValueCache::QueryResult tryCommitOnCommitted(const Guid& epoch,
+                                                 InstanceId instanceId,
                                                  const Guid& valueId);
 
-    //! Reset the state to empty. Called on master epoch change.
-    void reset();
-
-    typedef std::map<InstanceId, AcceptorInstance> InstanceMap;
+    //! Reset the shard to empty. Called on master epoch change.
+    void reset(Shard* shard);
 
     //! Looks up the instance by its id. If not found, inserts it if
     //  possible.
     //  Returns NULL iff not found and impossible to insert.
-    AcceptorInstance* lookupInstance(InstanceId instanceId);
+    AcceptorInstance* lookupInstance(Shard* shard, InstanceId instanceId);
 
     Status boolToStatus(const bool boolean) const;
 
-    //! Checks whether a new instance can be inserted
+    //! Checks whether a new instance can be inserted into the shard
     //  without exceeding the pending instances span limit.
-    bool canInsert(InstanceId instanceId) const;
+    bool canInsert(const Shard& shard, InstanceId instanceId) const;
 
     void startRecovery(const Guid epoch, InstanceId instanceId);
 
     const uint32_t pendingInstancesSpan_;
+    const uint32_t shardCount_;
 
-    //! The last known master epoch.
-    Guid epoch_;
+    boost::scoped_array<Shard> shards_;
 
-    //! Stores all pending (not committed) instances.
-    InstanceMap pendingInstances_;
+    //! The last known master epoch. Guarded by epochMutex_.
+    Guid epoch_;
+    //! Incremented twice on every epoch change, odd while epoch_ is
+    //  being written. Shards lagging behind it drop their contents on
+    //  next access, or when syncAllShards() gets to them.
+    Mordor::Atomic<uint64_t> epochGeneration_;
 
     Mordor::IOManager* ioManager_;
     RecoveryManager::ptr recoveryManager_;
     CommitTracker::ptr   commitTracker_;
     ValueCache::ptr      valueCache_;
 
-    mutable Mordor::FiberMutex mutex_;
+    //! Lock ordering: a shard mutex may be held while acquiring
+    //  epochMutex_, never the other way around.
+    Mordor::FiberMutex epochMutex_;
 };
 
 }  // namespace lightning
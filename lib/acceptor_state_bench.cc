@@ -0,0 +1,87 @@
+#include "acceptor_state.h"
+#include "benchmark.h"
+#include "commit_tracker.h"
+#include "guid.h"
+#include "value.h"
+#include "value_cache.h"
+#include "vote.h"
+#include <mordor/assert.h>
+#include <boost/shared_ptr.hpp>
+#include <string>
+#include <vector>
+
+using lightning::AcceptorState;
+using lightning::CommitTracker;
+using lightning::Guid;
+using lightning::GuidGenerator;
+using lightning::RecoveryManager;
+using lightning::RingVoter;
+using lightning::RpcMessageData;
+using lightning::ValueCache;
+using lightning::Vote;
+using lightning::VoteData;
+using lightning::benchmarkIOManager;
+using lightning::resetBenchmarkCounters;
+using lightning::paxos::BallotId;
+using lightning::paxos::Value;
+using std::string;
+using std::vector;
+
+// An acceptor in the ring steady state: every instance gets its phase 2
+// request, then the vote of its predecessor, then the commit, in order.
+// Commits go through the commit tracker into the value cache as on the
+// acceptors; recovery never kicks in.
+static const uint32_t kPendingInstancesSpan = 1 << 14;
+static const uint32_t kShardCount = 4;
+static const uint64_t kCacheSize = 1 << 16;
+static const uint64_t kRecoveryGracePeriodUs = 10000000;
+static const size_t kDistinctValues = 1024;
+static const size_t kValueSize = 1000;
+
+LIGHTNING_BENCHMARK(acceptor_state_begin_ballot_vote_commit) {
+    ValueCache::ptr valueCache(new ValueCache(kCacheSize));
+    CommitTracker::ptr commitTracker(
+        new CommitTracker(kRecoveryGracePeriodUs,
+                          valueCache,
+                          RecoveryManager::ptr(),
+                          benchmarkIOManager()));
+    AcceptorState::ptr acceptorState(
+        new AcceptorState(kPendingInstancesSpan,
+                          kShardCount,
+                          benchmarkIOManager(),
+                          RecoveryManager::ptr(),
+                          commitTracker,
+                          valueCache));
+    GuidGenerator guidGenerator;
+    const Guid epoch = guidGenerator.generate();
+    boost::shared_ptr<string> data(new string(kValueSize, 'x'));
+    vector<Value> values;
+    for(size_t i = 0; i < kDistinctValues; ++i) {
+        values.push_back(Value(guidGenerator.generate(), data));
+    }
+    // Stands for the vote parsed from each datagram; updated in place so
+    // that only the acceptor state is measured.
+    boost::shared_ptr<RpcMessageData> voteMessage(new RpcMessageData);
+    voteMessage->set_type(RpcMessageData::PAXOS_PHASE2);
+    guidGenerator.generate().serialize(voteMessage->mutable_uuid());
+    VoteData* voteData = voteMessage->mutable_vote();
+    epoch.serialize(voteData->mutable_epoch());
+    voteData->set_ring_id(0);
+    voteData->set_ballot(1);
+    const Vote vote(voteMessage, boost::shared_ptr<RingVoter>());
+    resetBenchmarkCounters();
+
+    for(size_t i = 0; i < iterations; ++i) {
+        const Value& value = values[i % kDistinctValues];
+        voteData->set_instance(i);
+        value.valueId().serialize(voteData->mutable_value_id());
+        BallotId highestPromised;
+        AcceptorState::Status status =
+            acceptorState->beginBallot(epoch, i, 1, value);
+        MORDOR_ASSERT(status == AcceptorState::OK);
+        status = acceptorState->vote(epoch, vote, &highestPromised);
+        MORDOR_ASSERT(status == AcceptorState::OK);
+        status = acceptorState->commit(epoch, i, value.valueId());
+        MORDOR_ASSERT(status == AcceptorState::OK);
+    }
+}
@@ -1,4 +1,5 @@
 #include "batch_phase1_request.h"
+#include "multicast_util.h"
 #include <mordor/assert.h>
 #include <mordor/log.h>
 #include <algorithm>
@@ -38,6 +39,7 @@ BatchPhase1Request::BatchPhase1Request(
     request->set_ballot_id(ballotId);
     request->set_start_instance_id(instanceRangeBegin);
     request->set_end_instance_id(instanceRangeEnd);
+    requestData_.set_steering_key(instanceSteeringKey(instanceRangeBegin));
 
     MORDOR_LOG_TRACE(g_log) << this << " BatchP1(" << epoch << ", " <<
                                ring->ringId() << ", " << ballotId << ", [" <<
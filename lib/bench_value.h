@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <string.h>
+#include <stdint.h>
+
+namespace lightning {
+
+//! Values submitted by benchmark clients (submit_random_values) start
+//  with kBenchValueMagic and the TimerManager::now() of the submission,
+//  so that learners on the same machine can tell their delivery latency
+//  (with learner.benchvalues set, see tools/loopback_bench.py).
+//  TimerManager::now() reads CLOCK_MONOTONIC, which is the same for all
+//  the processes of a machine.
+const char kBenchValueMagic[8] = { 'L', 'B', 'E', 'N', 'C', 'H', '0', '1' };
+
+const size_t kBenchValueHeaderSize = sizeof(kBenchValueMagic) +
+                                     sizeof(uint64_t);
+
+//! Overwrites the start of data, which must hold at least
+//  kBenchValueHeaderSize bytes.
+inline void stampBenchValue(uint64_t submittedUs, std::string* data) {
+    memcpy(&(*data)[0], kBenchValueMagic, sizeof(kBenchValueMagic));
+    memcpy(&(*data)[sizeof(kBenchValueMagic)],
+           &submittedUs,
+           sizeof(submittedUs));
+}
+
+//! Returns false if data is not a benchmark value.
+inline bool parseBenchValue(const std::string& data, uint64_t* submittedUs) {
+    if(data.size() < kBenchValueHeaderSize ||
+       memcmp(data.data(), kBenchValueMagic, sizeof(kBenchValueMagic)) != 0)
+    {
+        return false;
+    }
+    memcpy(submittedUs,
+           data.data() + sizeof(kBenchValueMagic),
+           sizeof(*submittedUs));
+    return true;
+}
+
+}  // namespace lightning
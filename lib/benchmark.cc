@@ -0,0 +1,120 @@
+#include "benchmark.h"
+#include <mordor/assert.h>
+#include <mordor/scheduler.h>
+#include <mordor/timer.h>
+#include <iomanip>
+#include <new>
+#include <stdlib.h>
+#include <utility>
+#include <vector>
+
+namespace {
+
+//! Number of operator new calls so far. Zero-initialized before any
+//  static constructor allocates.
+volatile uint64_t g_allocations = 0;
+
+void* countedAllocate(size_t size) {
+    __sync_fetch_and_add(&g_allocations, 1);
+    return malloc(size ? size : 1);
+}
+
+}  // anonymous namespace
+
+// Replaces the global allocation functions of the binaries this is linked
+// into; the array forms call these.
+void* operator new(size_t size) throw(std::bad_alloc) {
+    void* p = countedAllocate(size);
+    if(!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) throw() {
+    return countedAllocate(size);
+}
+
+void operator delete(void* p) throw() {
+    free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) throw() {
+    free(p);
+}
+
+namespace lightning {
+
+using Mordor::IOManager;
+using Mordor::Scheduler;
+using Mordor::TimerManager;
+using std::make_pair;
+using std::ostream;
+using std::pair;
+using std::setw;
+using std::string;
+using std::vector;
+
+typedef vector<pair<string, BenchmarkFunction> > BenchmarkRegistry;
+
+//! Function-local so that it is constructed before the first registration
+//  regardless of the static initialization order.
+static BenchmarkRegistry& registry() {
+    static BenchmarkRegistry benchmarks;
+    return benchmarks;
+}
+
+//! Start of the current run, see resetBenchmarkCounters().
+static uint64_t g_runStartUs = 0;
+static uint64_t g_runStartAllocations = 0;
+
+void resetBenchmarkCounters() {
+    g_runStartUs = TimerManager::now();
+    g_runStartAllocations = g_allocations;
+}
+
+IOManager* benchmarkIOManager() {
+    IOManager* ioManager = dynamic_cast<IOManager*>(Scheduler::getThis());
+    MORDOR_ASSERT(ioManager);
+    return ioManager;
+}
+
+bool registerBenchmark(const string& name, BenchmarkFunction function) {
+    registry().push_back(make_pair(name, function));
+    return true;
+}
+
+size_t runBenchmarks(const string& prefix, ostream& os) {
+    size_t benchmarksRun = 0;
+    const BenchmarkRegistry& benchmarks = registry();
+    for(size_t i = 0; i < benchmarks.size(); ++i) {
+        const string& name = benchmarks[i].first;
+        if(name.compare(0, prefix.size(), prefix) != 0) {
+            continue;
+        }
+        size_t iterations = 1;
+        uint64_t elapsedUs = 0;
+        uint64_t allocations = 0;
+        while(true) {
+            resetBenchmarkCounters();
+            benchmarks[i].second(iterations);
+            elapsedUs = TimerManager::now() - g_runStartUs;
+            allocations = g_allocations - g_runStartAllocations;
+            if(elapsedUs >= kMinRunTimeUs) {
+                break;
+            }
+            iterations *= 2;
+        }
+        os << std::left << setw(48) << name << std::right <<
+              setw(12) << iterations << " iterations " <<
+              setw(12) << std::fixed << std::setprecision(1) <<
+              (elapsedUs * 1000.0 / iterations) << " ns/op " <<
+              setw(8) << std::setprecision(2) <<
+              (double(allocations) / iterations) << " allocs/op" <<
+              std::endl;
+        ++benchmarksRun;
+    }
+    return benchmarksRun;
+}
+
+}  // namespace lightning
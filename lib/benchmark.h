@@ -0,0 +1,52 @@
+#pragma once
+
+#include <mordor/iomanager.h>
+#include <boost/function.hpp>
+#include <iostream>
+#include <stdint.h>
+#include <string>
+
+namespace lightning {
+
+//! A minimal microbenchmark registry.
+//
+//  A benchmark is a function that performs the measured operation the
+//  given number of times. The runner keeps doubling the iteration count
+//  until a run takes at least kMinRunTimeUs and reports the time and
+//  the number of heap allocations (operator new calls, counted by
+//  run_benchmarks only) per iteration of that run.
+//
+//  Benchmarks are defined with LIGHTNING_BENCHMARK(name) at namespace
+//  scope and linked into run_benchmarks. They run on a fiber of a
+//  single threaded IOManager, see benchmarkIOManager().
+typedef boost::function<void (size_t)> BenchmarkFunction;
+
+//! Returns true, so that it can be used to initialize a static.
+bool registerBenchmark(const std::string& name, BenchmarkFunction function);
+
+//! Runs all benchmarks whose names start with prefix, writes results to
+//  os. Returns the number of benchmarks run.
+size_t runBenchmarks(const std::string& prefix, std::ostream& os);
+
+//! Excludes everything the current run did so far, e.g. its setup, from
+//  the time and allocations reported for it.
+void resetBenchmarkCounters();
+
+//! The IOManager the benchmarks run on, for the classes that need one.
+Mordor::IOManager* benchmarkIOManager();
+
+//! Keeps the compiler from optimizing away the computation of value.
+template<typename T>
+inline void benchmarkUse(const T& value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+const uint64_t kMinRunTimeUs = 200000;
+
+}  // namespace lightning
+
+#define LIGHTNING_BENCHMARK(name)                                         \
+    static void name##_benchmark(size_t iterations);                      \
+    static bool name##_registered =                                       \
+        ::lightning::registerBenchmark(#name, &name##_benchmark);         \
+    static void name##_benchmark(size_t iterations)
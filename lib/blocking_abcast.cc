@@ -1,44 +1,81 @@
 #include "blocking_abcast.h"
+#include "metrics.h"
 #include <mordor/assert.h>
 #include <mordor/log.h>
+#include <mordor/timer.h>
 
 namespace lightning {
 
+const size_t BlockingAbcast::kDefaultCapacity;
+
 using Mordor::FiberEvent;
 using Mordor::FiberMutex;
 using Mordor::Log;
 using Mordor::Logger;
+using Mordor::TimerManager;
 using paxos::BallotId;
 using paxos::InstanceId;
 using paxos::Value;
-using std::make_pair;
+using std::vector;
 
 static Logger::ptr g_log = Log::lookup("lightning:blocking_abcast");
 
-BlockingAbcast::BlockingAbcast()
-    : nextIdToDeliver_(0),
+static Histogram& g_commitToDelivery =
+    Metrics::registerHistogram("abcast.commit_to_delivery");
+
+BlockingAbcast::BlockingAbcast(size_t initialCapacity)
+    : values_(initialCapacity),
+      pushTimesUs_(initialCapacity, 0),
+      presentBits_((initialCapacity + 63) / 64, 0),
+      nextIdToDeliver_(0),
       nextValueAvailable_(false)
 {
+    MORDOR_ASSERT(initialCapacity > 0 &&
+                  (initialCapacity & (initialCapacity - 1)) == 0);
+}
+
+void BlockingAbcast::updateEpoch(const Guid& epoch) {
+    FiberMutex::ScopedLock lk(mutex_);
+    if(epoch != epoch_) {
+        MORDOR_LOG_TRACE(g_log) << this << " epoch change: " << epoch_ <<
+                                   " -> " << epoch;
+        epoch_ = epoch;
+        for(size_t i = 0; i < values_.size(); ++i) {
+            values_[i].reset();
+        }
+        presentBits_.assign(presentBits_.size(), 0);
+        nextIdToDeliver_ = 0;
+        nextValueAvailable_.reset();
+    }
 }
 
-void BlockingAbcast::push(const Guid& epoch,
-                          InstanceId instanceId,
+void BlockingAbcast::push(InstanceId instanceId,
                           BallotId,
                           Value value)
 {
     FiberMutex::ScopedLock lk(mutex_);
-    updateEpoch(epoch);
-
-    valueBuffer_.push(make_pair(instanceId, value));
+    MORDOR_LOG_TRACE(g_log) << this << " push(" << instanceId << ", " <<
+                               value << "), nextIdToDeliver=" <<
+                               nextIdToDeliver_;
+    if(instanceId < nextIdToDeliver_ || (instanceId - nextIdToDeliver_ <
+                                         values_.size() &&
+                                         isPresent(instanceId)))
+    {
+        MORDOR_LOG_TRACE(g_log) << this << " duplicate " << instanceId;
+        return;
+    }
+    if(instanceId - nextIdToDeliver_ >= values_.size()) {
+        grow(instanceId);
+    }
+    const size_t index = instanceId & (values_.size() - 1);
+    values_[index] = value;
+    pushTimesUs_[index] = TimerManager::now();
+    setPresent(instanceId, true);
     if(instanceId == nextIdToDeliver_) {
         MORDOR_LOG_TRACE(g_log) << this << " next value " <<
                                    nextIdToDeliver_ << " now available";
         nextValueAvailable_.set();
     }
-
-    MORDOR_LOG_TRACE(g_log) << this << " push(" << instanceId << ", " <<
-                               value << "), nextIdToDeliver=" <<
-                               nextIdToDeliver_;
 }
 
 bool BlockingAbcast::nextValue(const Guid& expectedEpoch,
@@ -46,31 +83,39 @@ bool BlockingAbcast::nextValue(const Guid& expectedEpoch,
 {
     nextValueAvailable_.wait();
     FiberMutex::ScopedLock lk(mutex_);
-    if(epoch_ != expectedEpoch) {
-        MORDOR_LOG_TRACE(g_log) << this << " nextValue: expectedEpoch=" <<
-                                   expectedEpoch << ", have " << epoch_;
+    if(!readyToDeliver(expectedEpoch)) {
         return false;
     }
-
-    if(!nextValueAvailable()) {
-        return false;
-    }
-
-    const auto& top = valueBuffer_.top();
-    MORDOR_ASSERT(top.first == nextIdToDeliver_);
-    MORDOR_LOG_TRACE(g_log) << this << " delivering (" << top.first << ", " <<
-                               top.second << ")";
-    *value = top.second;
-
-    valueBuffer_.pop();
-    ++nextIdToDeliver_;
-
+    popNextValue(value);
     if(!nextValueAvailable()) {
         MORDOR_LOG_TRACE(g_log) << this << " next value " <<
                                    nextIdToDeliver_ << " not available";
         nextValueAvailable_.reset();
     }
+    return true;
+}
 
+bool BlockingAbcast::nextValues(const Guid& expectedEpoch,
+                                size_t maxCount,
+                                vector<Value>* values)
+{
+    MORDOR_ASSERT(maxCount > 0);
+    nextValueAvailable_.wait();
+    FiberMutex::ScopedLock lk(mutex_);
+    if(!readyToDeliver(expectedEpoch)) {
+        return false;
+    }
+    size_t count = 0;
+    while(count < maxCount && nextValueAvailable()) {
+        values->push_back(Value());
+        popNextValue(&values->back());
+        ++count;
+    }
+    MORDOR_LOG_TRACE(g_log) << this << " delivered " << count <<
+                               " values, next " << nextIdToDeliver_;
+    if(!nextValueAvailable()) {
+        nextValueAvailable_.reset();
+    }
     return true;
 }
 
@@ -79,21 +124,71 @@ const Guid BlockingAbcast::epoch() const {
     return epoch_;
 }
 
-void BlockingAbcast::updateEpoch(const Guid& epoch) {
-    if(epoch != epoch_) {
-        MORDOR_LOG_TRACE(g_log) << this << " epoch change: " << epoch_ <<
-                                   " -> " << epoch;
-    valueBuffer_ = BoundValueHeap();
-    nextIdToDeliver_ = 0;
-    nextValueAvailable_.reset();
+bool BlockingAbcast::readyToDeliver(const Guid& expectedEpoch) {
+    if(epoch_ != expectedEpoch) {
+        MORDOR_LOG_TRACE(g_log) << this << " nextValue: expectedEpoch=" <<
+                                   expectedEpoch << ", have " << epoch_;
+        return false;
     }
+    return nextValueAvailable();
+}
+
+void BlockingAbcast::popNextValue(Value* value) {
+    const size_t index = nextIdToDeliver_ & (values_.size() - 1);
+    Value& next = values_[index];
+    MORDOR_LOG_TRACE(g_log) << this << " delivering (" << nextIdToDeliver_ <<
+                               ", " << next << ")";
+    *value = next;
+    next.reset();
+    g_commitToDelivery.record(TimerManager::now() - pushTimesUs_[index]);
+    setPresent(nextIdToDeliver_, false);
+    ++nextIdToDeliver_;
 }
 
 bool BlockingAbcast::nextValueAvailable() const {
-    if(valueBuffer_.empty()) {
-        return false;
+    return isPresent(nextIdToDeliver_);
+}
+
+bool BlockingAbcast::isPresent(InstanceId instanceId) const {
+    const size_t index = instanceId & (values_.size() - 1);
+    return (presentBits_[index / 64] >> (index % 64)) & 1;
+}
+
+void BlockingAbcast::setPresent(InstanceId instanceId, bool present) {
+    const size_t index = instanceId & (values_.size() - 1);
+    if(present) {
+        presentBits_[index / 64] |= uint64_t(1) << (index % 64);
+    } else {
+        presentBits_[index / 64] &= ~(uint64_t(1) << (index % 64));
+    }
+}
+
+void BlockingAbcast::grow(InstanceId instanceId) {
+    size_t capacity = values_.size();
+    while(instanceId - nextIdToDeliver_ >= capacity) {
+        capacity *= 2;
+    }
+    MORDOR_LOG_DEBUG(g_log) << this << " growing to " << capacity <<
+                               " slots for " << instanceId <<
+                               ", nextIdToDeliver=" << nextIdToDeliver_;
+    vector<Value> values(capacity);
+    vector<uint64_t> pushTimesUs(capacity, 0);
+    vector<uint64_t> presentBits((capacity + 63) / 64, 0);
+    for(InstanceId iid = nextIdToDeliver_;
+        iid < nextIdToDeliver_ + values_.size();
+        ++iid)
+    {
+        if(isPresent(iid)) {
+            const size_t index = iid & (capacity - 1);
+            const size_t oldIndex = iid & (values_.size() - 1);
+            values[index] = values_[oldIndex];
+            pushTimesUs[index] = pushTimesUs_[oldIndex];
+            presentBits[index / 64] |= uint64_t(1) << (index % 64);
+        }
     }
-    return valueBuffer_.top().first == nextIdToDeliver_;
+    values_.swap(values);
+    pushTimesUs_.swap(pushTimesUs);
+    presentBits_.swap(presentBits);
 }
 
 }  // namespace lightning
@@ -5,22 +5,32 @@
 #include "paxos_defs.h"
 #include "value.h"
 #include <mordor/fibersynchronization.h>
-#include <queue>
-#include <utility>
+#include <stdint.h>
+#include <vector>
 
 namespace lightning {
 
 //! Buffers the committed Paxos instances and delivers them in the
 //  instance id order.
+//
+//  Out-of-order values wait in a circular array indexed by instance id
+//  modulo its capacity, with a bitmap telling which slots are filled.
+//  The array starts with initialCapacity slots (a power of 2) and
+//  doubles whenever an instance lands too far ahead of the next one to
+//  deliver, so nothing committed is ever dropped.
+//  The time every value waits here for the ones before it is recorded
+//  in the abcast.commit_to_delivery histogram.
 //  Single consumer only.
 class BlockingAbcast : public InstanceSink {
 public:
-    BlockingAbcast();
+    BlockingAbcast(size_t initialCapacity = kDefaultCapacity);
 
-    //! Pushes the (instanceId, value) binding for a given epoch.
-    //  Changing the epoch resets the internal state of BlockingAbcast.
-    virtual void push(const Guid& epoch,
-                      paxos::InstanceId instanceId,
+    //! Changing the epoch resets the internal state of BlockingAbcast.
+    virtual void updateEpoch(const Guid& newEpoch);
+
+    //! Pushes the (instanceId, value) binding for the current epoch.
+    //  Values already delivered or buffered are ignored.
+    virtual void push(paxos::InstanceId instanceId,
                       paxos::BallotId ballotId,
                       paxos::Value value);
 
@@ -30,29 +40,38 @@ public:
     //  Otherwise returns false.
     bool nextValue(const Guid& expectedEpoch, paxos::Value* value);
 
+    //! Like nextValue(), but appends all the values that are ready to be
+    //  delivered, up to maxCount, to values in one go.
+    bool nextValues(const Guid& expectedEpoch,
+                    size_t maxCount,
+                    std::vector<paxos::Value>* values);
+
     //! The current epoch.
     const Guid epoch() const;
+
+    static const size_t kDefaultCapacity = 1 << 16;
 private:
-    void updateEpoch(const Guid& epoch);
+    //! Must be called with mutex_ held.
+    bool readyToDeliver(const Guid& expectedEpoch);
+
+    //! Delivers the next value. Must be called with mutex_ held.
+    void popNextValue(paxos::Value* value);
 
     bool nextValueAvailable() const;
 
-    typedef std::pair<paxos::InstanceId, paxos::Value> BoundValue;
+    bool isPresent(paxos::InstanceId instanceId) const;
 
-    //! Compare by instance id.
-    struct BoundValueCompare {
-        bool operator()(const BoundValue& a, const BoundValue& b) const {
-            return a.first < b.first;
-        }
-    };
+    void setPresent(paxos::InstanceId instanceId, bool present);
 
-    typedef std::priority_queue<BoundValue,
-                                std::vector<BoundValue>,
-                                BoundValueCompare>
-            BoundValueHeap;
+    //! Makes room for instanceId. Must be called with mutex_ held.
+    void grow(paxos::InstanceId instanceId);
 
     Guid epoch_;
-    BoundValueHeap valueBuffer_;
+    std::vector<paxos::Value> values_;
+    //! When values_[i] was pushed (TimerManager::now()).
+    std::vector<uint64_t> pushTimesUs_;
+    //! Bit i is set iff values_[i] holds an undelivered value.
+    std::vector<uint64_t> presentBits_;
     paxos::InstanceId nextIdToDeliver_;
 
     Mordor::FiberEvent nextValueAvailable_;
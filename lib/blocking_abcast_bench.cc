@@ -0,0 +1,59 @@
+#include "benchmark.h"
+#include "blocking_abcast.h"
+#include "guid.h"
+#include "value.h"
+#include <mordor/assert.h>
+#include <boost/shared_ptr.hpp>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using lightning::BlockingAbcast;
+using lightning::Guid;
+using lightning::GuidGenerator;
+using lightning::resetBenchmarkCounters;
+using lightning::paxos::Value;
+using std::min;
+using std::string;
+using std::vector;
+
+static const size_t kValueSize = 1000;
+
+//! Pushes instances in windows of reorderWindow, each window in reverse,
+//  and delivers every window once it is complete, like a learner
+//  draining the abcast after the commits of a phase 2 batch arrived out
+//  of order.
+static void pushReordered(size_t reorderWindow, size_t iterations) {
+    BlockingAbcast abcast;
+    GuidGenerator guidGenerator;
+    const Guid epoch = guidGenerator.generate();
+    const Value value(guidGenerator.generate(),
+                      boost::shared_ptr<string>(new string(kValueSize, 'x')));
+    abcast.updateEpoch(epoch);
+    vector<Value> delivered;
+    delivered.reserve(reorderWindow);
+    resetBenchmarkCounters();
+
+    for(size_t start = 0; start < iterations; start += reorderWindow) {
+        const size_t end = min(start + reorderWindow, iterations);
+        for(size_t i = end; i > start; --i) {
+            abcast.push(i - 1, 1, value);
+        }
+        delivered.clear();
+        const bool sameEpoch =
+            abcast.nextValues(epoch, reorderWindow, &delivered);
+        MORDOR_ASSERT(sameEpoch && delivered.size() == end - start);
+    }
+}
+
+LIGHTNING_BENCHMARK(blocking_abcast_in_order) {
+    pushReordered(1, iterations);
+}
+
+LIGHTNING_BENCHMARK(blocking_abcast_reorder_16) {
+    pushReordered(16, iterations);
+}
+
+LIGHTNING_BENCHMARK(blocking_abcast_reorder_1024) {
+    pushReordered(1024, iterations);
+}
@@ -0,0 +1,163 @@
+#include "blocking_abcast.h"
+#include "guid.h"
+#include "value.h"
+#include <mordor/test/test.h>
+#include <mordor/workerpool.h>
+#include <boost/shared_ptr.hpp>
+#include <string>
+#include <vector>
+
+using namespace Mordor;
+using namespace lightning;
+using lightning::paxos::InstanceId;
+using lightning::paxos::Value;
+using std::string;
+using std::vector;
+
+namespace {
+
+//! Small enough for the tests to wrap around and grow it.
+const size_t kCapacity = 4;
+
+//! The ids of the pushed values tell the instances apart.
+class AbcastFixture {
+public:
+    AbcastFixture()
+        : abcast(kCapacity),
+          epoch(guidGenerator.generate())
+    {
+        abcast.updateEpoch(epoch);
+    }
+
+    void push(InstanceId instanceId) {
+        while(valueIds.size() <= instanceId) {
+            valueIds.push_back(guidGenerator.generate());
+        }
+        abcast.push(instanceId, 1,
+                    Value(valueIds[instanceId],
+                          boost::shared_ptr<string>(new string("x"))));
+    }
+
+    //! Expects exactly the values of [firstId, endId).
+    void expectDelivered(const vector<Value>& values,
+                         InstanceId firstId,
+                         InstanceId endId) const
+    {
+        MORDOR_TEST_ASSERT_EQUAL(values.size(), endId - firstId);
+        for(size_t i = 0; i < values.size(); ++i) {
+            MORDOR_TEST_ASSERT(values[i].valueId() == valueIds[firstId + i]);
+        }
+    }
+
+    GuidGenerator guidGenerator;
+    BlockingAbcast abcast;
+    const Guid epoch;
+    vector<Guid> valueIds;
+};
+
+}  // anonymous namespace
+
+MORDOR_UNITTEST(BlockingAbcastTest, WrapsAroundInOrder) {
+    WorkerPool workerPool;
+    AbcastFixture fixture;
+    for(InstanceId iid = 0; iid < 10 * kCapacity; ++iid) {
+        fixture.push(iid);
+        Value value;
+        MORDOR_TEST_ASSERT(fixture.abcast.nextValue(fixture.epoch, &value));
+        MORDOR_TEST_ASSERT(value.valueId() == fixture.valueIds[iid]);
+    }
+}
+
+MORDOR_UNITTEST(BlockingAbcastTest, WrapsAroundReordered) {
+    WorkerPool workerPool;
+    AbcastFixture fixture;
+    // Every window fills the buffer exactly, in reverse.
+    for(InstanceId start = 0; start < 10 * kCapacity; start += kCapacity) {
+        for(InstanceId iid = start + kCapacity; iid > start; --iid) {
+            fixture.push(iid - 1);
+        }
+        vector<Value> values;
+        MORDOR_TEST_ASSERT(fixture.abcast.nextValues(fixture.epoch,
+                                                     kCapacity,
+                                                     &values));
+        fixture.expectDelivered(values, start, start + kCapacity);
+    }
+}
+
+MORDOR_UNITTEST(BlockingAbcastTest, GrowsInsteadOfDropping) {
+    WorkerPool workerPool;
+    AbcastFixture fixture;
+    // Deliver a few first, so that the buffer has wrapped when it grows.
+    for(InstanceId iid = 0; iid < 3; ++iid) {
+        fixture.push(iid);
+    }
+    vector<Value> values;
+    MORDOR_TEST_ASSERT(fixture.abcast.nextValues(fixture.epoch, 100, &values));
+    fixture.expectDelivered(values, 0, 3);
+
+    fixture.push(4);
+    fixture.push(6);
+    // Far beyond the capacity.
+    fixture.push(3 + 4 * kCapacity);
+    for(InstanceId iid = 3; iid < 3 + 4 * kCapacity; ++iid) {
+        if(iid != 4 && iid != 6) {
+            fixture.push(iid);
+        }
+    }
+    values.clear();
+    MORDOR_TEST_ASSERT(fixture.abcast.nextValues(fixture.epoch, 100, &values));
+    fixture.expectDelivered(values, 3, 4 + 4 * kCapacity);
+}
+
+MORDOR_UNITTEST(BlockingAbcastTest, NextValuesBatchesUpToGap) {
+    WorkerPool workerPool;
+    AbcastFixture fixture;
+    for(InstanceId iid = 0; iid < 10; ++iid) {
+        fixture.push(iid);
+    }
+    fixture.push(11);
+    vector<Value> values;
+    MORDOR_TEST_ASSERT(fixture.abcast.nextValues(fixture.epoch, 3, &values));
+    fixture.expectDelivered(values, 0, 3);
+    // Stops at the missing instance 10.
+    values.clear();
+    MORDOR_TEST_ASSERT(fixture.abcast.nextValues(fixture.epoch, 100, &values));
+    fixture.expectDelivered(values, 3, 10);
+    fixture.push(10);
+    values.clear();
+    MORDOR_TEST_ASSERT(fixture.abcast.nextValues(fixture.epoch, 100, &values));
+    fixture.expectDelivered(values, 10, 12);
+}
+
+MORDOR_UNITTEST(BlockingAbcastTest, IgnoresDuplicates) {
+    WorkerPool workerPool;
+    AbcastFixture fixture;
+    fixture.push(0);
+    fixture.push(1);
+    fixture.push(1);
+    vector<Value> values;
+    MORDOR_TEST_ASSERT(fixture.abcast.nextValues(fixture.epoch, 100, &values));
+    fixture.expectDelivered(values, 0, 2);
+    // Already delivered.
+    fixture.push(0);
+    fixture.push(2);
+    values.clear();
+    MORDOR_TEST_ASSERT(fixture.abcast.nextValues(fixture.epoch, 100, &values));
+    fixture.expectDelivered(values, 2, 3);
+}
+
+MORDOR_UNITTEST(BlockingAbcastTest, EpochChangeResets) {
+    WorkerPool workerPool;
+    AbcastFixture fixture;
+    fixture.push(0);
+    fixture.push(1);
+    const Guid newEpoch = fixture.guidGenerator.generate();
+    fixture.abcast.updateEpoch(newEpoch);
+    MORDOR_TEST_ASSERT(fixture.abcast.epoch() == newEpoch);
+    fixture.push(0);
+    vector<Value> values;
+    MORDOR_TEST_ASSERT(!fixture.abcast.nextValues(fixture.epoch, 100, &values));
+    MORDOR_TEST_ASSERT(values.empty());
+    MORDOR_TEST_ASSERT(fixture.abcast.nextValues(newEpoch, 100, &values));
+    fixture.expectDelivered(values, 0, 1);
+}
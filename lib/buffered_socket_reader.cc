@@ -0,0 +1,64 @@
+#include "buffered_socket_reader.h"
+#include <mordor/assert.h>
+#include <mordor/exception.h>
+#include <mordor/log.h>
+#include <algorithm>
+#include <string.h>
+
+namespace lightning {
+
+using Mordor::Log;
+using Mordor::Logger;
+using Mordor::Socket;
+using std::min;
+
+static Logger::ptr g_log = Log::lookup("lightning:buffered_socket_reader");
+
+BufferedSocketReader::BufferedSocketReader(Socket::ptr socket,
+                                           size_t bufferSize)
+    : socket_(socket),
+      buffer_(bufferSize),
+      begin_(0),
+      end_(0)
+{
+    MORDOR_ASSERT(bufferSize > 0);
+}
+
+void BufferedSocketReader::read(char* destination, size_t bytes) {
+    while(bytes > 0) {
+        if(begin_ == end_) {
+            if(bytes >= buffer_.size()) {
+                // Large reads go straight to the destination.
+                size_t currentRead = socket_->receive(destination, bytes);
+                if(currentRead == 0) {
+                    MORDOR_LOG_DEBUG(g_log) << this << " connection to " <<
+                        *(socket_->remoteAddress()) << " went down";
+                    MORDOR_THROW_EXCEPTION_FROM_LAST_ERROR_API("recv");
+                }
+                destination += currentRead;
+                bytes -= currentRead;
+                continue;
+            }
+            fill();
+        }
+        const size_t chunk = min(bytes, end_ - begin_);
+        memcpy(destination, &buffer_[begin_], chunk);
+        begin_ += chunk;
+        destination += chunk;
+        bytes -= chunk;
+    }
+}
+
+void BufferedSocketReader::fill() {
+    MORDOR_ASSERT(begin_ == end_);
+    size_t currentRead = socket_->receive(&buffer_[0], buffer_.size());
+    if(currentRead == 0) {
+        MORDOR_LOG_DEBUG(g_log) << this << " connection to " <<
+            *(socket_->remoteAddress()) << " went down";
+        MORDOR_THROW_EXCEPTION_FROM_LAST_ERROR_API("recv");
+    }
+    begin_ = 0;
+    end_ = currentRead;
+}
+
+}  // namespace lightning
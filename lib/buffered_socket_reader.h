@@ -0,0 +1,31 @@
+#pragma once
+
+#include <mordor/socket.h>
+#include <boost/noncopyable.hpp>
+#include <vector>
+
+namespace lightning {
+
+//! Reads exact amounts of bytes from a stream socket, receiving as much
+//  as the socket has (up to bufferSize) on each call so that small
+//  reads do not cost a syscall each.
+//  Not fiber-safe.
+class BufferedSocketReader : boost::noncopyable {
+public:
+    BufferedSocketReader(Mordor::Socket::ptr socket, size_t bufferSize);
+
+    //! Throws if the connection goes down before all bytes are read.
+    void read(char* destination, size_t bytes);
+
+    const Mordor::Socket::ptr& socket() const { return socket_; }
+private:
+    //! Receives into the empty buffer.
+    void fill();
+
+    Mordor::Socket::ptr socket_;
+    std::vector<char> buffer_;
+    size_t begin_;
+    size_t end_;
+};
+
+}  // namespace lightning
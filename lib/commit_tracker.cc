@@ -41,7 +41,8 @@ CommitTracker::CommitTracker(const uint64_t recoveryGracePeriodUs,
       sink_(sink),
       recoveryManager_(recoveryManager),
       ioManager_(ioManager),
-      afterLastCommittedInstanceId_(0)
+      afterLastCommittedInstanceId_(0),
+      firstNotCommittedInstanceId_(0)
 {}
 
 void CommitTracker::updateEpoch(const Guid& epoch) {
@@ -57,6 +58,7 @@ void CommitTracker::updateEpochInternal(const Guid& newEpoch) {
         epoch_ = newEpoch;
         notCommittedRecoveryTimers_.clear();
         afterLastCommittedInstanceId_ = 0;
+        firstNotCommittedInstanceId_ = 0;
         g_instancesScheduledForRecovery.reset();
         g_minPendingInstance.reset();
         g_maxCommittedInstance.reset();
@@ -118,6 +120,7 @@ void CommitTracker::push(const Guid& epoch,
         notCommittedRecoveryTimers_.erase(iter);
         g_instancesScheduledForRecovery.decrement();
     }
+    firstNotCommittedInstanceId_ = firstNotCommittedInstanceIdInternal();
 }
 
 bool CommitTracker::needsRecovery(
@@ -162,8 +165,7 @@ void CommitTracker::startRecovery(const Guid epoch,
 }
 
 InstanceId CommitTracker::firstNotCommittedInstanceId() const {
-    FiberMutex::ScopedLock lk(mutex_);
-    return firstNotCommittedInstanceIdInternal();
+    return firstNotCommittedInstanceId_;
 }
 
 InstanceId CommitTracker::firstNotCommittedInstanceIdInternal() const {
@@ -2,6 +2,7 @@
 
 #include "instance_sink.h"
 #include "recovery_manager.h"
+#include <mordor/atomic.h>
 #include <mordor/fibersynchronization.h>
 #include <mordor/iomanager.h>
 #include <mordor/timer.h>
@@ -9,6 +10,16 @@
 
 namespace lightning {
 
+//! Passes committed instances on to the sink and schedules the
+//  recovery of the ones that stay missing for recoveryGracePeriodUs.
+//
+//  push() is serialized on one mutex, even with a sharded acceptor
+//  state. Finding the gaps takes the commits of all shards: an instance
+//  is only missing once a higher one has been committed, whatever shard
+//  it belongs to. The sinks (value cache, abcast, snapshot) also expect
+//  one push at a time. The critical section is a timer map update and
+//  the sink push; the hot-path reader, firstNotCommittedInstanceId(),
+//  does not take the mutex.
 class CommitTracker {
 public:
     typedef boost::shared_ptr<CommitTracker> ptr;
@@ -26,6 +37,9 @@ public:
     bool needsRecovery(const Guid& epoch,
                        paxos::InstanceId instance) const;
 
+    //! Does not take the tracker lock: the value is cached on every
+    //  update, so callers on the hot path (acceptor state shards)
+    //  do not serialize on it.
     paxos::InstanceId firstNotCommittedInstanceId() const;
 
     void updateEpoch(const Guid& epoch);
@@ -47,6 +61,8 @@ private:
     std::map<paxos::InstanceId, Mordor::Timer::ptr>
         notCommittedRecoveryTimers_;
     paxos::InstanceId afterLastCommittedInstanceId_;
+    //! Cached value of firstNotCommittedInstanceIdInternal().
+    Mordor::Atomic<uint64_t> firstNotCommittedInstanceId_;
 
     void startRecovery(const Guid epoch,
                        paxos::InstanceId instanceId);
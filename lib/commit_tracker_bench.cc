@@ -0,0 +1,75 @@
+#include "benchmark.h"
+#include "commit_tracker.h"
+#include "guid.h"
+#include "instance_sink.h"
+#include "value.h"
+#include <boost/shared_ptr.hpp>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using lightning::CommitTracker;
+using lightning::Guid;
+using lightning::GuidGenerator;
+using lightning::InstanceSink;
+using lightning::RecoveryManager;
+using lightning::benchmarkIOManager;
+using lightning::resetBenchmarkCounters;
+using lightning::paxos::BallotId;
+using lightning::paxos::InstanceId;
+using lightning::paxos::Value;
+using std::min;
+using std::string;
+using std::vector;
+
+// The grace period never expires during a run: every gap is filled by a
+// later push, which cancels its recovery timer.
+static const uint64_t kRecoveryGracePeriodUs = 10000000;
+static const size_t kValueSize = 1000;
+
+namespace {
+
+//! Measures the tracker alone.
+class NullSink : public InstanceSink {
+public:
+    virtual void updateEpoch(const Guid&) {}
+
+    virtual void push(InstanceId, BallotId, Value) {}
+};
+
+}  // anonymous namespace
+
+//! Pushes instances in windows of reorderWindow, each window in reverse:
+//  the first push of a window leaves reorderWindow - 1 gaps behind it
+//  and the others fill them.
+static void pushReordered(size_t reorderWindow, size_t iterations) {
+    CommitTracker commitTracker(kRecoveryGracePeriodUs,
+                                InstanceSink::ptr(new NullSink),
+                                RecoveryManager::ptr(),
+                                benchmarkIOManager());
+    GuidGenerator guidGenerator;
+    const Guid epoch = guidGenerator.generate();
+    const Value value(guidGenerator.generate(),
+                      boost::shared_ptr<string>(new string(kValueSize, 'x')));
+    commitTracker.updateEpoch(epoch);
+    resetBenchmarkCounters();
+
+    for(size_t start = 0; start < iterations; start += reorderWindow) {
+        const size_t end = min(start + reorderWindow, iterations);
+        for(size_t i = end; i > start; --i) {
+            commitTracker.push(epoch, i - 1, 1, value);
+        }
+    }
+}
+
+LIGHTNING_BENCHMARK(commit_tracker_push_in_order) {
+    pushReordered(1, iterations);
+}
+
+LIGHTNING_BENCHMARK(commit_tracker_push_gaps_2) {
+    pushReordered(2, iterations);
+}
+
+LIGHTNING_BENCHMARK(commit_tracker_push_gaps_64) {
+    pushReordered(64, iterations);
+}
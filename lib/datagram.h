@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace lightning {
+
+//! The largest UDP payload over IPv4. Receive buffers are this large so
+//  that no datagram is truncated, whatever path MTU the sender assumes.
+const size_t kMaxDatagramSize = 65507;
+
+//! IPv4 header without options plus UDP header.
+const size_t kIpUdpHeaderSize = 28;
+
+//! Every IPv4 host must accept datagrams of this size unfragmented.
+const uint32_t kMinPathMtu = 576;
+
+//! Jumbo frames, what the datagram sizes used to be tuned for.
+const uint32_t kDefaultPathMtu = 9000;
+
+//! The largest UDP payload that fits a single packet on a path
+//  with the given MTU. The MTU is clamped to [kMinPathMtu, 65535].
+inline size_t datagramBudget(uint32_t pathMtu) {
+    if(pathMtu < kMinPathMtu) {
+        pathMtu = kMinPathMtu;
+    }
+    const size_t budget = size_t(pathMtu) - kIpUdpHeaderSize;
+    return (budget < kMaxDatagramSize) ? budget : kMaxDatagramSize;
+}
+
+}  // namespace lightning
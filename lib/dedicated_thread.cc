@@ -0,0 +1,62 @@
+#include "dedicated_thread.h"
+#include <mordor/log.h>
+#include <boost/bind.hpp>
+#include <pthread.h>
+#include <sched.h>
+
+namespace lightning {
+
+using Mordor::IOManager;
+using Mordor::Log;
+using Mordor::Logger;
+namespace JSON = Mordor::JSON;
+using std::string;
+
+static Logger::ptr g_log = Log::lookup("lightning:dedicated_thread");
+
+const int DedicatedThread::kAnyCpu;
+
+DedicatedThread::DedicatedThread(const string& name, int cpu)
+    : name_(name),
+      cpu_(cpu),
+      ioManager_(new IOManager(1, false))
+{
+    if(cpu_ != kAnyCpu) {
+        // The only worker thread picks this up before anything else
+        // scheduled on it.
+        ioManager_->schedule(boost::bind(&DedicatedThread::pin, this));
+    }
+}
+
+IOManager* DedicatedThread::ioManager() {
+    return ioManager_.get();
+}
+
+void DedicatedThread::schedule(boost::function<void()> dg) {
+    ioManager_->schedule(dg);
+}
+
+void DedicatedThread::pin() {
+    if(pinCurrentThread(cpu_)) {
+        MORDOR_LOG_INFO(g_log) << this << " " << name_ <<
+                                  " pinned to cpu " << cpu_;
+    } else {
+        MORDOR_LOG_WARNING(g_log) << this << " " << name_ <<
+                                     " failed to pin to cpu " << cpu_;
+    }
+}
+
+bool pinCurrentThread(int cpu) {
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(cpu, &cpuSet);
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) == 0;
+}
+
+int receiveLoopCpu(const JSON::Value& config, size_t index) {
+    const JSON::Array& cpus = config["receive_loop_cpus"].get<JSON::Array>();
+    return (index < cpus.size()) ? int(cpus[index].get<long long>()) :
+                                   DedicatedThread::kAnyCpu;
+}
+
+}  // namespace lightning
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <mordor/iomanager.h>
+#include <mordor/json.h>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <string>
+
+namespace lightning {
+
+//! An IOManager with a single worker thread of its own, optionally
+//  pinned to a CPU core. Used to give each hot receive loop a core
+//  instead of having it compete with everything else on the main
+//  IOManager.
+//  Sockets read by a loop running here should be created on
+//  ioManager(), so that their events are polled by the same thread.
+class DedicatedThread : boost::noncopyable {
+public:
+    typedef boost::shared_ptr<DedicatedThread> ptr;
+
+    //! Do not pin the thread.
+    static const int kAnyCpu = -1;
+
+    DedicatedThread(const std::string& name, int cpu = kAnyCpu);
+
+    Mordor::IOManager* ioManager();
+
+    void schedule(boost::function<void()> dg);
+private:
+    void pin();
+
+    const std::string name_;
+    const int cpu_;
+    boost::scoped_ptr<Mordor::IOManager> ioManager_;
+};
+
+//! Restricts the calling thread to the given CPU core.
+//  Returns false if the kernel refused.
+bool pinCurrentThread(int cpu);
+
+//! The cpu for the index-th hot receive loop of a process, taken from
+//  the receive_loop_cpus list of config. kAnyCpu past its end.
+int receiveLoopCpu(const Mordor::JSON::Value& config, size_t index);
+
+}  // namespace lightning
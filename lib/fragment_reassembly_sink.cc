@@ -0,0 +1,158 @@
+#include "fragment_reassembly_sink.h"
+#include <mordor/assert.h>
+#include <mordor/log.h>
+#include <mordor/statistics.h>
+
+namespace lightning {
+
+using Mordor::CountStatistic;
+using Mordor::FiberMutex;
+using Mordor::Log;
+using Mordor::Logger;
+using Mordor::Statistics;
+using paxos::BallotId;
+using paxos::InstanceId;
+using paxos::Value;
+using boost::shared_ptr;
+using std::map;
+using std::string;
+
+static Logger::ptr g_log = Log::lookup("lightning:fragment_reassembly_sink");
+
+static CountStatistic<uint64_t>& g_reassembledValues =
+    Statistics::registerStatistic(
+        "fragment_reassembly_sink.reassembled_values",
+        CountStatistic<uint64_t>());
+static CountStatistic<uint64_t>& g_droppedValues =
+    Statistics::registerStatistic(
+        "fragment_reassembly_sink.dropped_values",
+        CountStatistic<uint64_t>());
+
+FragmentReassemblySink::FragmentReassemblySink(InstanceSink::ptr sink,
+                                               size_t historySize)
+    : sink_(sink),
+      historySize_(historySize)
+{
+    MORDOR_ASSERT(historySize_ > 0);
+}
+
+void FragmentReassemblySink::updateEpoch(const Guid& newEpoch) {
+    {
+        FiberMutex::ScopedLock lk(mutex_);
+        if(!pendingValues_.empty()) {
+            MORDOR_LOG_WARNING(g_log) << this << " dropping " <<
+                                         pendingValues_.size() <<
+                                         " incomplete values";
+            g_droppedValues.add(pendingValues_.size());
+            pendingValues_.clear();
+        }
+    }
+    sink_->updateEpoch(newEpoch);
+}
+
+void FragmentReassemblySink::push(InstanceId instanceId,
+                                  BallotId ballotId,
+                                  Value value)
+{
+    if(!value.isFragment()) {
+        sink_->push(instanceId, ballotId, value);
+        return;
+    }
+    const Guid valueId = value.fragmentOf();
+    shared_ptr<string> data;
+    if(!addFragment(instanceId, &value, &data)) {
+        return;
+    }
+    MORDOR_LOG_TRACE(g_log) << this << " reassembled " << valueId <<
+                               " at " << instanceId << ", " <<
+                               data->length() << " bytes";
+    g_reassembledValues.increment();
+    sink_->push(instanceId, ballotId, Value(valueId, data));
+}
+
+bool FragmentReassemblySink::addFragment(InstanceId instanceId,
+                                         Value* fragment,
+                                         shared_ptr<string>* data)
+{
+    const Guid valueId = fragment->fragmentOf();
+    const uint32_t index = fragment->fragmentIndex();
+    const uint32_t count = fragment->fragmentCount();
+    Guid fragmentId;
+    shared_ptr<string> fragmentData;
+    // Decompresses the fragment if needed.
+    if(!fragment->release(&fragmentId, &fragmentData)) {
+        MORDOR_LOG_WARNING(g_log) << this << " dropping corrupt fragment " <<
+                                     index << "/" << count << " of " <<
+                                     valueId;
+        return false;
+    }
+
+    FiberMutex::ScopedLock lk(mutex_);
+    if(completedValues_.count(valueId) > 0) {
+        MORDOR_LOG_DEBUG(g_log) << this << " ignoring late fragment " <<
+                                   index << "/" << count << " of " << valueId;
+        return false;
+    }
+    if(pendingValues_.size() >= historySize_ &&
+       pendingValues_.find(valueId) == pendingValues_.end())
+    {
+        dropOldestPending();
+    }
+    PendingValue& pending = pendingValues_[valueId];
+    if(pending.fragments.empty()) {
+        pending.firstInstanceId = instanceId;
+        pending.fragments.resize(count);
+    }
+    if(pending.fragments.size() != count || index >= count ||
+       pending.fragments[index])
+    {
+        MORDOR_LOG_DEBUG(g_log) << this << " ignoring fragment " << index <<
+                                   "/" << count << " of " << valueId;
+        return false;
+    }
+    pending.fragments[index] = fragmentData;
+    pending.receivedBytes += fragmentData->length();
+    if(++pending.receivedFragments < count) {
+        return false;
+    }
+
+    data->reset(new string);
+    (*data)->reserve(pending.receivedBytes);
+    for(size_t i = 0; i < pending.fragments.size(); ++i) {
+        (*data)->append(*pending.fragments[i]);
+    }
+    pendingValues_.erase(valueId);
+    rememberCompleted(valueId);
+    return true;
+}
+
+void FragmentReassemblySink::dropOldestPending() {
+    map<Guid, PendingValue>::iterator oldest = pendingValues_.begin();
+    for(map<Guid, PendingValue>::iterator it = pendingValues_.begin();
+        it != pendingValues_.end();
+        ++it)
+    {
+        if(it->second.firstInstanceId < oldest->second.firstInstanceId) {
+            oldest = it;
+        }
+    }
+    MORDOR_LOG_WARNING(g_log) << this << " dropping incomplete value " <<
+                                 oldest->first << " started at " <<
+                                 oldest->second.firstInstanceId << ", " <<
+                                 oldest->second.receivedFragments << "/" <<
+                                 oldest->second.fragments.size() <<
+                                 " fragments";
+    g_droppedValues.increment();
+    pendingValues_.erase(oldest);
+}
+
+void FragmentReassemblySink::rememberCompleted(const Guid& valueId) {
+    completedValues_.insert(valueId);
+    completedOrder_.push_back(valueId);
+    if(completedOrder_.size() > historySize_) {
+        completedValues_.erase(completedOrder_.front());
+        completedOrder_.pop_front();
+    }
+}
+
+}  // namespace lightning
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "guid.h"
+#include "instance_sink.h"
+#include <mordor/fibersynchronization.h>
+#include <boost/shared_ptr.hpp>
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace lightning {
+
+//! Puts values split into fragments by the proposer back together.
+//
+//  Other values are passed on to the wrapped sink right away. A
+//  fragmented value is passed on with the instance and ballot of its
+//  last fragment to be pushed, so every learner delivers it at the same
+//  point of the sequence. Fragments are ordinary values and can be
+//  recovered one by one; fragments of values still incomplete when the
+//  epoch changes are dropped.
+//
+//  A value whose first fragments were committed before this learner
+//  started never completes, so at most historySize values are kept
+//  pending, the one that started longest ago is dropped to make room.
+//  The ids of the last historySize reassembled values are remembered so
+//  that fragments arriving late, e.g. recovered a second time, do not
+//  start a new pending value.
+class FragmentReassemblySink : public InstanceSink {
+public:
+    typedef boost::shared_ptr<FragmentReassemblySink> ptr;
+
+    FragmentReassemblySink(InstanceSink::ptr sink, size_t historySize = 1024);
+
+    virtual void updateEpoch(const Guid& newEpoch);
+
+    virtual void push(paxos::InstanceId instanceId,
+                      paxos::BallotId   ballotId,
+                      paxos::Value      value);
+
+private:
+    struct PendingValue {
+        PendingValue() : firstInstanceId(0), receivedFragments(0),
+                         receivedBytes(0) {}
+
+        paxos::InstanceId firstInstanceId;
+        std::vector<boost::shared_ptr<std::string> > fragments;
+        uint32_t receivedFragments;
+        size_t receivedBytes;
+    };
+
+    //! Returns true and fills data once the value is complete.
+    bool addFragment(paxos::InstanceId instanceId,
+                     paxos::Value* fragment,
+                     boost::shared_ptr<std::string>* data);
+
+    //! Drops the pending value with the lowest first instance.
+    void dropOldestPending();
+
+    void rememberCompleted(const Guid& valueId);
+
+    InstanceSink::ptr sink_;
+    const size_t historySize_;
+    std::map<Guid, PendingValue> pendingValues_;
+    std::set<Guid> completedValues_;
+    //! completedValues_ in the order they were reassembled.
+    std::deque<Guid> completedOrder_;
+
+    Mordor::FiberMutex mutex_;
+};
+
+}  // namespace lightning
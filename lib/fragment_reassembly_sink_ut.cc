@@ -0,0 +1,211 @@
+#include "fragment_reassembly_sink.h"
+#include "guid.h"
+#include "value.h"
+#include <mordor/test/test.h>
+#include <mordor/workerpool.h>
+#include <boost/shared_ptr.hpp>
+#include <string>
+#include <vector>
+
+using namespace Mordor;
+using namespace lightning;
+using lightning::paxos::BallotId;
+using lightning::paxos::InstanceId;
+using lightning::paxos::Value;
+using boost::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace {
+
+//! Remembers what reaches it.
+class RecordingSink : public InstanceSink {
+public:
+    struct Push {
+        InstanceId instanceId;
+        Guid valueId;
+        string data;
+    };
+
+    RecordingSink() : epochChanges(0) {}
+
+    virtual void updateEpoch(const Guid&) {
+        ++epochChanges;
+    }
+
+    virtual void push(InstanceId instanceId, BallotId, Value value) {
+        Push push;
+        push.instanceId = instanceId;
+        shared_ptr<string> data;
+        value.release(&push.valueId, &data);
+        push.data = *data;
+        pushes.push_back(push);
+    }
+
+    vector<Push> pushes;
+    int epochChanges;
+};
+
+string valueData(size_t length) {
+    string data(length, '\0');
+    for(size_t i = 0; i < length; ++i) {
+        data[i] = char('a' + i % 26);
+    }
+    return data;
+}
+
+class ReassemblyFixture {
+public:
+    ReassemblyFixture(size_t historySize = 1024)
+        : recorder(new RecordingSink),
+          sink(InstanceSink::ptr(recorder), historySize)
+    {}
+
+    //! Splits a value of length bytes into fragments of fragmentSize.
+    Value split(size_t length, size_t fragmentSize, vector<Value>* fragments) {
+        Value value(guidGenerator.generate(),
+                    shared_ptr<string>(new string(valueData(length))));
+        value.split(fragmentSize, fragments);
+        return value;
+    }
+
+    GuidGenerator guidGenerator;
+    RecordingSink* recorder;
+    FragmentReassemblySink sink;
+};
+
+}  // anonymous namespace
+
+MORDOR_UNITTEST(FragmentReassemblySinkTest, PassesOtherValuesOn) {
+    WorkerPool workerPool;
+    ReassemblyFixture fixture;
+    Value value(fixture.guidGenerator.generate(),
+                shared_ptr<string>(new string("whole")));
+    fixture.sink.push(7, 1, value);
+    MORDOR_TEST_ASSERT_EQUAL(fixture.recorder->pushes.size(), 1u);
+    MORDOR_TEST_ASSERT_EQUAL(fixture.recorder->pushes[0].instanceId, 7u);
+    MORDOR_TEST_ASSERT_EQUAL(fixture.recorder->pushes[0].data, "whole");
+}
+
+MORDOR_UNITTEST(FragmentReassemblySinkTest, ReassemblesOutOfOrder) {
+    WorkerPool workerPool;
+    ReassemblyFixture fixture;
+    vector<Value> fragments;
+    const Value value = fixture.split(10000, 3000, &fragments);
+    MORDOR_TEST_ASSERT_EQUAL(fragments.size(), 4u);
+    const InstanceId order[] = { 2, 0, 3, 1 };
+    for(size_t i = 0; i < fragments.size(); ++i) {
+        fixture.sink.push(100 + i, 1, fragments[order[i]]);
+    }
+    // Delivered whole, at the instance of the last fragment pushed.
+    MORDOR_TEST_ASSERT_EQUAL(fixture.recorder->pushes.size(), 1u);
+    MORDOR_TEST_ASSERT_EQUAL(fixture.recorder->pushes[0].instanceId, 103u);
+    MORDOR_TEST_ASSERT(fixture.recorder->pushes[0].valueId ==
+                       value.valueId());
+    MORDOR_TEST_ASSERT_EQUAL(fixture.recorder->pushes[0].data,
+                             valueData(10000));
+}
+
+MORDOR_UNITTEST(FragmentReassemblySinkTest, WaitsForMissingFragments) {
+    WorkerPool workerPool;
+    ReassemblyFixture fixture;
+    vector<Value> fragments;
+    fixture.split(10000, 3000, &fragments);
+    fixture.sink.push(0, 1, fragments[0]);
+    fixture.sink.push(1, 1, fragments[1]);
+    fixture.sink.push(3, 1, fragments[3]);
+    MORDOR_TEST_ASSERT(fixture.recorder->pushes.empty());
+    // E.g. recovered later.
+    fixture.sink.push(2, 1, fragments[2]);
+    MORDOR_TEST_ASSERT_EQUAL(fixture.recorder->pushes.size(), 1u);
+    MORDOR_TEST_ASSERT_EQUAL(fixture.recorder->pushes[0].instanceId, 2u);
+    MORDOR_TEST_ASSERT_EQUAL(fixture.recorder->pushes[0].data,
+                             valueData(10000));
+}
+
+MORDOR_UNITTEST(FragmentReassemblySinkTest, IgnoresDuplicateFragments) {
+    WorkerPool workerPool;
+    ReassemblyFixture fixture;
+    vector<Value> fragments;
+    fixture.split(5000, 3000, &fragments);
+    MORDOR_TEST_ASSERT_EQUAL(fragments.size(), 2u);
+    fixture.sink.push(0, 1, fragments[0]);
+    fixture.sink.push(1, 1, fragments[0]);
+    MORDOR_TEST_ASSERT(fixture.recorder->pushes.empty());
+    fixture.sink.push(2, 1, fragments[1]);
+    MORDOR_TEST_ASSERT_EQUAL(fixture.recorder->pushes.size(), 1u);
+    MORDOR_TEST_ASSERT_EQUAL(fixture.recorder->pushes[0].data,
+                             valueData(5000));
+}
+
+MORDOR_UNITTEST(FragmentReassemblySinkTest, InterleavesValues) {
+    WorkerPool workerPool;
+    ReassemblyFixture fixture;
+    vector<Value> first;
+    vector<Value> second;
+    const Value firstValue = fixture.split(6000, 3000, &first);
+    const Value secondValue = fixture.split(4000, 3000, &second);
+    fixture.sink.push(0, 1, first[0]);
+    fixture.sink.push(1, 1, second[1]);
+    fixture.sink.push(2, 1, second[0]);
+    fixture.sink.push(3, 1, first[1]);
+    MORDOR_TEST_ASSERT_EQUAL(fixture.recorder->pushes.size(), 2u);
+    MORDOR_TEST_ASSERT(fixture.recorder->pushes[0].valueId ==
+                       secondValue.valueId());
+    MORDOR_TEST_ASSERT_EQUAL(fixture.recorder->pushes[0].data,
+                             valueData(4000));
+    MORDOR_TEST_ASSERT(fixture.recorder->pushes[1].valueId ==
+                       firstValue.valueId());
+    MORDOR_TEST_ASSERT_EQUAL(fixture.recorder->pushes[1].data,
+                             valueData(6000));
+}
+
+MORDOR_UNITTEST(FragmentReassemblySinkTest, EpochChangeDropsIncomplete) {
+    WorkerPool workerPool;
+    ReassemblyFixture fixture;
+    vector<Value> fragments;
+    fixture.split(5000, 3000, &fragments);
+    fixture.sink.push(0, 1, fragments[0]);
+    fixture.sink.updateEpoch(fixture.guidGenerator.generate());
+    MORDOR_TEST_ASSERT_EQUAL(fixture.recorder->epochChanges, 1);
+    // The first fragment is gone, the value never completes.
+    fixture.sink.push(1, 1, fragments[1]);
+    MORDOR_TEST_ASSERT(fixture.recorder->pushes.empty());
+}
+
+MORDOR_UNITTEST(FragmentReassemblySinkTest, IgnoresLateFragments) {
+    WorkerPool workerPool;
+    ReassemblyFixture fixture;
+    vector<Value> fragments;
+    fixture.split(5000, 3000, &fragments);
+    fixture.sink.push(0, 1, fragments[0]);
+    fixture.sink.push(1, 1, fragments[1]);
+    MORDOR_TEST_ASSERT_EQUAL(fixture.recorder->pushes.size(), 1u);
+    // Recovered again after the value was reassembled.
+    fixture.sink.push(2, 1, fragments[0]);
+    fixture.sink.push(3, 1, fragments[1]);
+    MORDOR_TEST_ASSERT_EQUAL(fixture.recorder->pushes.size(), 1u);
+}
+
+MORDOR_UNITTEST(FragmentReassemblySinkTest, DropsOldestIncomplete) {
+    WorkerPool workerPool;
+    ReassemblyFixture fixture(2);
+    vector<Value> first;
+    vector<Value> second;
+    vector<Value> third;
+    fixture.split(5000, 3000, &first);
+    fixture.split(5000, 3000, &second);
+    fixture.split(5000, 3000, &third);
+    // E.g. the first fragment of the first value predates the learner.
+    fixture.sink.push(1, 1, first[1]);
+    fixture.sink.push(2, 1, second[0]);
+    fixture.sink.push(3, 1, third[0]);
+    fixture.sink.push(4, 1, second[1]);
+    fixture.sink.push(5, 1, third[1]);
+    MORDOR_TEST_ASSERT_EQUAL(fixture.recorder->pushes.size(), 2u);
+    MORDOR_TEST_ASSERT_EQUAL(fixture.recorder->pushes[0].instanceId, 4u);
+    MORDOR_TEST_ASSERT_EQUAL(fixture.recorder->pushes[1].instanceId, 5u);
+    // The first value was dropped to make room for the third.
+    fixture.sink.push(6, 1, first[0]);
+    MORDOR_TEST_ASSERT_EQUAL(fixture.recorder->pushes.size(), 2u);
+}
@@ -47,7 +47,13 @@ private:
 class GuidHasher {
 public:
     size_t operator()(const Guid& guid) const {
-        return (size_t(guid.parts_[1]) << 32) + guid.parts_[2];
+        const uint64_t high = (uint64_t(guid.parts_[0]) << 32) +
+                              guid.parts_[1];
+        const uint64_t low = (uint64_t(guid.parts_[2]) << 32) +
+                             guid.parts_[3];
+        // Multiplying by an odd constant spreads the counter in parts_[3]
+        // over the high bits as well.
+        return size_t((high ^ low) * 0x9e3779b97f4a7c15ULL);
     }
 };
 
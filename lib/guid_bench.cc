@@ -0,0 +1,60 @@
+#include "benchmark.h"
+#include "guid.h"
+#include <mordor/assert.h>
+#include <string>
+#include <vector>
+
+using lightning::Guid;
+using lightning::GuidGenerator;
+using lightning::GuidHasher;
+using lightning::benchmarkUse;
+using lightning::resetBenchmarkCounters;
+using std::string;
+using std::vector;
+
+static const size_t kDistinctGuids = 1024;
+
+// Every value and every RPC gets one.
+LIGHTNING_BENCHMARK(guid_generate) {
+    GuidGenerator guidGenerator;
+    for(size_t i = 0; i < iterations; ++i) {
+        const Guid guid = guidGenerator.generate();
+        benchmarkUse(guid);
+    }
+}
+
+// Guids travel serialized in every protobuf message, epochs and value
+// ids are parsed back for every phase 2 request and vote.
+LIGHTNING_BENCHMARK(guid_serialize_parse) {
+    GuidGenerator guidGenerator;
+    vector<Guid> guids;
+    for(size_t i = 0; i < kDistinctGuids; ++i) {
+        guids.push_back(guidGenerator.generate());
+    }
+    string serialized;
+    resetBenchmarkCounters();
+
+    for(size_t i = 0; i < iterations; ++i) {
+        const Guid& guid = guids[i % kDistinctGuids];
+        guid.serialize(&serialized);
+        const Guid parsed = Guid::parse(serialized);
+        MORDOR_ASSERT(parsed == guid);
+    }
+}
+
+// Keys the value owners of the proposer state.
+LIGHTNING_BENCHMARK(guid_hash) {
+    GuidGenerator guidGenerator;
+    vector<Guid> guids;
+    for(size_t i = 0; i < kDistinctGuids; ++i) {
+        guids.push_back(guidGenerator.generate());
+    }
+    GuidHasher hasher;
+    size_t hashes = 0;
+    resetBenchmarkCounters();
+
+    for(size_t i = 0; i < iterations; ++i) {
+        hashes += hasher(guids[i % kDistinctGuids]);
+    }
+    benchmarkUse(hashes);
+}
@@ -87,7 +87,8 @@ void GroupConfiguration::parseHostConfigurations(
 GroupConfiguration::ptr GroupConfiguration::parseAcceptorConfig(
     const Mordor::JSON::Value& json,
     uint32_t thisHostId,
-    Address::ptr groupMulticastAddress)
+    Address::ptr groupMulticastAddress,
+    uint32_t pathMtu)
 {
     vector<HostConfiguration> acceptorConfigurations;
     HostConfiguration learnerConfiguration;
@@ -97,13 +98,15 @@ GroupConfiguration::ptr GroupConfiguration::parseAcceptorConfig(
     return GroupConfiguration::ptr(
                new GroupConfiguration(groupMulticastAddress,
                                       acceptorConfigurations,
-                                      thisHostId));
+                                      thisHostId,
+                                      pathMtu));
 }
 
 GroupConfiguration::ptr GroupConfiguration::parseLearnerConfig(
     const Mordor::JSON::Value& json,
     const string& datacenter,
-    Address::ptr groupMulticastAddress)
+    Address::ptr groupMulticastAddress,
+    uint32_t pathMtu)
 {
     vector<HostConfiguration> acceptorConfigurations;
     HostConfiguration learnerConfiguration;
@@ -114,16 +117,19 @@ GroupConfiguration::ptr GroupConfiguration::parseLearnerConfig(
                new GroupConfiguration(groupMulticastAddress,
                                       acceptorConfigurations,
                                       learnerConfiguration,
-                                      datacenter));
+                                      datacenter,
+                                      pathMtu));
 }
 
 GroupConfiguration::GroupConfiguration(Address::ptr groupMulticastAddress,
                                        const vector<HostConfiguration>& 
                                            acceptorConfigurations,
-                                       uint32_t thisHostId)
+                                       uint32_t thisHostId,
+                                       uint32_t pathMtu)
     : groupMulticastAddress_(groupMulticastAddress),
       acceptorConfigurations_(acceptorConfigurations),
-      thisHostId_(thisHostId)
+      thisHostId_(thisHostId),
+      pathMtu_(pathMtu)
 {
     MORDOR_ASSERT(acceptorConfigurations.size() <= kMaxGroupSize);
     MORDOR_ASSERT(thisHostId < acceptorConfigurations.size());
@@ -137,10 +143,12 @@ GroupConfiguration::GroupConfiguration(Address::ptr groupMulticastAddress,
                                            acceptorConfigurations,
                                        const HostConfiguration&
                                            learnerConfiguration,
-                                       const string& datacenter)
+                                       const string& datacenter,
+                                       uint32_t pathMtu)
     : groupMulticastAddress_(groupMulticastAddress),
       acceptorConfigurations_(acceptorConfigurations),
       thisHostId_(kLearnerHostId),
+      pathMtu_(pathMtu),
       datacenter_(datacenter)
 {
     MORDOR_ASSERT(acceptorConfigurations.size() <= kMaxGroupSize);
@@ -225,7 +233,7 @@ std::ostream& operator<<(std::ostream& os,
             os << ", ";
         }
     }
-    os << "])";
+    os << "], mtu=" << groupConfiguration.pathMtu_ << ")";
     return os;
 }
 
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "datagram.h"
 #include <mordor/json.h>
 #include <mordor/socket.h>
 #include <iostream>
@@ -56,14 +57,16 @@ public:
     GroupConfiguration(const Mordor::Address::ptr groupMulticastAddress,
                        const std::vector<HostConfiguration>&
                            acceptorConfigurations,
-                       uint32_t thisHostId);
+                       uint32_t thisHostId,
+                       uint32_t pathMtu = kDefaultPathMtu);
 
     //! Constructs a configuration on a learner.
     GroupConfiguration(const Mordor::Address::ptr groupMulticastAddress,
                        const std::vector<HostConfiguration>&
                            acceptorConfigurations,
                        const HostConfiguration& learnerConfiguration,
-                       const std::string& datacenter);
+                       const std::string& datacenter,
+                       uint32_t pathMtu = kDefaultPathMtu);
 
     //! Number of hosts in the group
     size_t size() const;
@@ -93,13 +96,24 @@ public:
 
     const std::string& datacenter() const { return datacenter_; }
 
+    //! The smallest MTU on the paths between the group hosts.
+    uint32_t pathMtu() const { return pathMtu_; }
+
+    //! Group messages must fit this many bytes of UDP payload
+    //  to travel unfragmented.
+    size_t datagramBudget() const {
+        return lightning::datagramBudget(pathMtu_);
+    }
+
     static ptr parseAcceptorConfig(const Mordor::JSON::Value& json,
                                    uint32_t thisHostId,
-                                   Mordor::Address::ptr groupMulticastAddress);
+                                   Mordor::Address::ptr groupMulticastAddress,
+                                   uint32_t pathMtu = kDefaultPathMtu);
 
     static ptr parseLearnerConfig(const Mordor::JSON::Value& json,
                                   const std::string& datacenter,
-                                  Mordor::Address::ptr groupMulticastAddress);
+                                  Mordor::Address::ptr groupMulticastAddress,
+                                  uint32_t pathMtu = kDefaultPathMtu);
 
 private:
     static void parseHostConfigurations(
@@ -115,6 +129,7 @@ private:
     const Mordor::Address::ptr groupMulticastAddress_;
     const std::vector<HostConfiguration> acceptorConfigurations_;
     const uint32_t thisHostId_;
+    const uint32_t pathMtu_;
 
     std::string datacenter_;
     HostConfiguration thisHostConfiguration_;
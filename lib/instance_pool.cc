@@ -29,7 +29,9 @@ InstancePool::InstancePool(uint32_t maxOpenInstancesNumber,
                            shared_ptr<FiberEvent> pushMoreOpenInstancesEvent)
     : maxOpenInstancesNumber_(maxOpenInstancesNumber),
       maxReservedInstancesNumber_(maxReservedInstancesNumber),
-      pushMoreOpenInstancesEvent_(pushMoreOpenInstancesEvent)
+      openInstancesNumber_(0),
+      pushMoreOpenInstancesEvent_(pushMoreOpenInstancesEvent),
+      openInstancesNotEmpty_(false)
 {
     FiberMutex::ScopedLock lk(mutex_);
     //! pushing to an empty pool is allowed
@@ -41,29 +43,80 @@ void InstancePool::pushOpenInstance(ProposerInstance::ptr instance) {
                                instance->instanceId();
     FiberMutex::ScopedLock lk(mutex_);
     openInstances_.push(instance);
-    openInstancesNotEmpty_.notify();
-    if(openInstances_.size() > maxOpenInstancesNumber_) {
+    ++openInstancesNumber_;
+    openInstancesNotEmpty_.set();
+    if(openInstancesNumber_ > maxOpenInstancesNumber_) {
         MORDOR_LOG_TRACE(g_log) << this << " maxOpenInstancesNumber threshold reached";
         pushMoreOpenInstancesEvent_->reset();
     }
     g_openInstances.increment();
 }
 
-ProposerInstance::ptr InstancePool::popOpenInstance() {
-    openInstancesNotEmpty_.wait();
+void InstancePool::pushOpenRange(InstanceId startId,
+                                 InstanceId endId,
+                                 BallotId ballotId)
+{
+    if(startId >= endId) {
+        return;
+    }
+    MORDOR_LOG_TRACE(g_log) << this << " pushing open range [" << startId <<
+                               ", " << endId << ") with ballot " << ballotId;
+    OpenRange range;
+    range.startId = startId;
+    range.endId = endId;
+    range.ballotId = ballotId;
     FiberMutex::ScopedLock lk(mutex_);
-    ProposerInstance::ptr instance = openInstances_.top();
-    openInstances_.pop();
-    MORDOR_LOG_TRACE(g_log) << this << " popped open instance " <<
-                               instance->instanceId();
-    if(openInstances_.size() <= maxOpenInstancesNumber_ &&
-       reservedInstances_.size() <= maxReservedInstancesNumber_)
-    {
-        MORDOR_LOG_TRACE(g_log) << this << " signaling to push more open instances";
-        pushMoreOpenInstancesEvent_->set();
+    if(openRanges_.empty() || openRanges_.back().endId <= startId) {
+        openRanges_.push_back(range);
+    } else {
+        // Only after the batcher has been reset to a lower instance id.
+        auto iter = openRanges_.begin();
+        while(iter != openRanges_.end() && iter->startId < startId) {
+            ++iter;
+        }
+        MORDOR_ASSERT(iter == openRanges_.end() || endId <= iter->startId);
+        openRanges_.insert(iter, range);
+    }
+    openInstancesNumber_ += endId - startId;
+    openInstancesNotEmpty_.set();
+    if(openInstancesNumber_ > maxOpenInstancesNumber_) {
+        MORDOR_LOG_TRACE(g_log) << this << " maxOpenInstancesNumber threshold reached";
+        pushMoreOpenInstancesEvent_->reset();
+    }
+    g_openInstances.add(endId - startId);
+}
+
+ProposerInstance::ptr InstancePool::popOpenInstance() {
+    while(true) {
+        openInstancesNotEmpty_.wait();
+        FiberMutex::ScopedLock lk(mutex_);
+        if(openInstancesNumber_ == 0) {
+            continue;
+        }
+        ProposerInstance::ptr instance;
+        if(!openRanges_.empty() &&
+           (openInstances_.empty() ||
+            openRanges_.front().startId < openInstances_.top()->instanceId()))
+        {
+            OpenRange& range = openRanges_.front();
+            instance.reset(new ProposerInstance(range.startId));
+            instance->setBallotId(range.ballotId);
+            if(++range.startId == range.endId) {
+                openRanges_.pop_front();
+            }
+        } else {
+            instance = openInstances_.top();
+            openInstances_.pop();
+        }
+        if(--openInstancesNumber_ == 0) {
+            openInstancesNotEmpty_.reset();
+        }
+        MORDOR_LOG_TRACE(g_log) << this << " popped open instance " <<
+                                   instance->instanceId();
+        updatePushMoreEvent();
+        g_openInstances.decrement();
+        return instance;
     }
-    g_openInstances.decrement();
-    return instance;
 }
 
 void InstancePool::pushReservedInstance(ProposerInstance::ptr instance) {
@@ -87,14 +140,18 @@ ProposerInstance::ptr InstancePool::popReservedInstance() {
     reservedInstances_.pop();
     MORDOR_LOG_TRACE(g_log) << this << " popped reserved instance " <<
                                instance->instanceId();
-    if(openInstances_.size() <= maxOpenInstancesNumber_ &&
+    updatePushMoreEvent();
+    g_reservedInstances.decrement();
+    return instance;
+}
+
+void InstancePool::updatePushMoreEvent() {
+    if(openInstancesNumber_ <= maxOpenInstancesNumber_ &&
        reservedInstances_.size() <= maxReservedInstancesNumber_)
     {
         MORDOR_LOG_TRACE(g_log) << this << " signaling to push more open instances";
         pushMoreOpenInstancesEvent_->set();
     }
-    g_reservedInstances.decrement();
-    return instance;
 }
 
 }  // namespace paxos
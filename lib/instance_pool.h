@@ -5,6 +5,7 @@
 #include <mordor/statistics.h>
 #include <boost/noncopyable.hpp>
 #include <boost/shared_ptr.hpp>
+#include <deque>
 #include <queue>
 #include <vector>
 
@@ -31,6 +32,12 @@ namespace paxos {
 //  instance pool will reset the event to signal the phase 1 batcher
 //  to pause.
 //
+//  Open instances mostly come from batch phase 1 as contiguous ranges
+//  with a common ballot, so they are kept as a sorted deque of such
+//  ranges; a ProposerInstance is only created when one is popped.
+//  Individual open instances (returned by phase 1 retries) go into a
+//  separate heap, popOpenInstance() takes the lower of the two.
+//
 class InstancePool : boost::noncopyable {
 public:
     typedef boost::shared_ptr<InstancePool> ptr;
@@ -44,6 +51,12 @@ public:
     //  Does not block.
     void pushOpenInstance(ProposerInstance::ptr instance);
 
+    //! Pushes open instances [startId, endId), all with ballot ballotId.
+    //  Does not block. O(1) if the range starts after all pushed ranges.
+    void pushOpenRange(InstanceId startId,
+                       InstanceId endId,
+                       BallotId ballotId);
+
     //! Pops the open instance with the lowest instance id.
     //  Blocks if there's none.
     ProposerInstance::ptr popOpenInstance();
@@ -75,11 +88,26 @@ private:
                 InstancePtrCompare>
             InstanceHeap;
 
+    //! Open instances [startId, endId) with ballotId.
+    struct OpenRange {
+        InstanceId startId;
+        InstanceId endId;
+        BallotId ballotId;
+    };
+
+    //! Must be called with mutex_ held.
+    void updatePushMoreEvent();
+
+    //! Sorted and disjoint.
+    std::deque<OpenRange> openRanges_;
     InstanceHeap openInstances_;
+    //! Number of open instances in openRanges_ and openInstances_.
+    uint64_t openInstancesNumber_;
     InstanceHeap reservedInstances_;
 
     boost::shared_ptr<Mordor::FiberEvent> pushMoreOpenInstancesEvent_;
-    Mordor::FiberSemaphore openInstancesNotEmpty_;
+    //! Set while there are open instances.
+    Mordor::FiberEvent openInstancesNotEmpty_;
     Mordor::FiberSemaphore reservedInstancesNotEmpty_;
     Mordor::FiberMutex mutex_;
 };
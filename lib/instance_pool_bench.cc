@@ -0,0 +1,81 @@
+#include "benchmark.h"
+#include "instance_pool.h"
+#include "proposer_instance.h"
+#include <mordor/assert.h>
+#include <mordor/fibersynchronization.h>
+#include <boost/shared_ptr.hpp>
+#include <algorithm>
+
+using Mordor::FiberEvent;
+using lightning::paxos::InstancePool;
+using lightning::paxos::ProposerInstance;
+using lightning::resetBenchmarkCounters;
+using std::min;
+
+// Thresholds are never reached, the phase 1 batcher is not modeled.
+static const uint32_t kMaxOpenInstances = 1 << 30;
+static const uint32_t kMaxReservedInstances = 1 << 30;
+//! Instances per batch phase 1 range.
+static const size_t kRangeSize = 1024;
+//! Instances in the heaps while pushing and popping single ones; each
+//  popped instance is replaced by a later one.
+static const size_t kHeapSize = 1024;
+
+static InstancePool::ptr makeInstancePool() {
+    boost::shared_ptr<FiberEvent> pushMoreEvent(new FiberEvent(false));
+    return InstancePool::ptr(new InstancePool(kMaxOpenInstances,
+                                              kMaxReservedInstances,
+                                              pushMoreEvent));
+}
+
+// The steady state of the master: batch phase 1 pushes ranges, phase 2
+// pops one instance per value.
+LIGHTNING_BENCHMARK(instance_pool_open_range_pop) {
+    InstancePool::ptr instancePool = makeInstancePool();
+    resetBenchmarkCounters();
+
+    for(size_t start = 0; start < iterations; start += kRangeSize) {
+        const size_t end = min(start + kRangeSize, iterations);
+        instancePool->pushOpenRange(start, end, 1);
+        for(size_t i = start; i < end; ++i) {
+            const ProposerInstance::ptr instance =
+                instancePool->popOpenInstance();
+            MORDOR_ASSERT(instance->instanceId() == i);
+        }
+    }
+}
+
+// Phase 1 retries push single open instances back.
+LIGHTNING_BENCHMARK(instance_pool_open_instance_push_pop) {
+    InstancePool::ptr instancePool = makeInstancePool();
+    for(size_t i = 0; i < kHeapSize; ++i) {
+        instancePool->pushOpenInstance(
+            ProposerInstance::ptr(new ProposerInstance(i)));
+    }
+    resetBenchmarkCounters();
+
+    for(size_t i = 0; i < iterations; ++i) {
+        const ProposerInstance::ptr instance =
+            instancePool->popOpenInstance();
+        MORDOR_ASSERT(instance->instanceId() == i);
+        instancePool->pushOpenInstance(ProposerInstance::ptr(
+            new ProposerInstance(i + kHeapSize)));
+    }
+}
+
+LIGHTNING_BENCHMARK(instance_pool_reserved_instance_push_pop) {
+    InstancePool::ptr instancePool = makeInstancePool();
+    for(size_t i = 0; i < kHeapSize; ++i) {
+        instancePool->pushReservedInstance(
+            ProposerInstance::ptr(new ProposerInstance(i)));
+    }
+    resetBenchmarkCounters();
+
+    for(size_t i = 0; i < iterations; ++i) {
+        const ProposerInstance::ptr instance =
+            instancePool->popReservedInstance();
+        MORDOR_ASSERT(instance->instanceId() == i);
+        instancePool->pushReservedInstance(ProposerInstance::ptr(
+            new ProposerInstance(i + kHeapSize)));
+    }
+}
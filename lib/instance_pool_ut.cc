@@ -0,0 +1,93 @@
+#include "instance_pool.h"
+#include <mordor/test/test.h>
+#include <mordor/workerpool.h>
+#include <boost/shared_ptr.hpp>
+
+using namespace Mordor;
+using namespace lightning::paxos;
+using boost::shared_ptr;
+
+namespace {
+
+//! Neither threshold is reached by the tests.
+shared_ptr<InstancePool> newPool() {
+    shared_ptr<FiberEvent> pushMoreEvent(new FiberEvent(false));
+    return shared_ptr<InstancePool>(
+        new InstancePool(1000, 1000, pushMoreEvent));
+}
+
+ProposerInstance::ptr newInstance(InstanceId instanceId, BallotId ballotId) {
+    ProposerInstance::ptr instance(new ProposerInstance(instanceId));
+    instance->setBallotId(ballotId);
+    return instance;
+}
+
+void expectOpen(InstancePool* pool, InstanceId instanceId, BallotId ballotId) {
+    ProposerInstance::ptr instance = pool->popOpenInstance();
+    MORDOR_TEST_ASSERT_EQUAL(instance->instanceId(), instanceId);
+    MORDOR_TEST_ASSERT_EQUAL(instance->ballotId(), ballotId);
+}
+
+}  // anonymous namespace
+
+MORDOR_UNITTEST(InstancePoolTest, RangesAreSplitOnePerPop) {
+    WorkerPool workerPool;
+    shared_ptr<InstancePool> pool = newPool();
+    pool->pushOpenRange(10, 13, 7);
+    // Empty ranges are ignored.
+    pool->pushOpenRange(13, 13, 8);
+    pool->pushOpenRange(13, 15, 9);
+    expectOpen(pool.get(), 10, 7);
+    expectOpen(pool.get(), 11, 7);
+    expectOpen(pool.get(), 12, 7);
+    expectOpen(pool.get(), 13, 9);
+    expectOpen(pool.get(), 14, 9);
+}
+
+MORDOR_UNITTEST(InstancePoolTest, LowerRangeGoesFirst) {
+    WorkerPool workerPool;
+    shared_ptr<InstancePool> pool = newPool();
+    pool->pushOpenRange(100, 102, 1);
+    // As after the batcher has been reset to a lower instance id.
+    pool->pushOpenRange(50, 52, 2);
+    pool->pushOpenRange(60, 61, 3);
+    expectOpen(pool.get(), 50, 2);
+    expectOpen(pool.get(), 51, 2);
+    expectOpen(pool.get(), 60, 3);
+    expectOpen(pool.get(), 100, 1);
+    expectOpen(pool.get(), 101, 1);
+}
+
+MORDOR_UNITTEST(InstancePoolTest, HeapInterleavesWithRanges) {
+    WorkerPool workerPool;
+    shared_ptr<InstancePool> pool = newPool();
+    pool->pushOpenRange(10, 12, 1);
+    pool->pushOpenRange(20, 22, 1);
+    // Individual instances, e.g. returned by phase 1 retries.
+    pool->pushOpenInstance(newInstance(25, 5));
+    pool->pushOpenInstance(newInstance(3, 5));
+    pool->pushOpenInstance(newInstance(15, 6));
+    expectOpen(pool.get(), 3, 5);
+    expectOpen(pool.get(), 10, 1);
+    expectOpen(pool.get(), 11, 1);
+    expectOpen(pool.get(), 15, 6);
+    expectOpen(pool.get(), 20, 1);
+    // New instances keep being merged in order.
+    pool->pushOpenInstance(newInstance(20, 7));
+    pool->pushOpenRange(30, 31, 2);
+    expectOpen(pool.get(), 20, 7);
+    expectOpen(pool.get(), 21, 1);
+    expectOpen(pool.get(), 25, 5);
+    expectOpen(pool.get(), 30, 2);
+}
+
+MORDOR_UNITTEST(InstancePoolTest, ReservedInstancesPopInOrder) {
+    WorkerPool workerPool;
+    shared_ptr<InstancePool> pool = newPool();
+    pool->pushReservedInstance(newInstance(7, 1));
+    pool->pushReservedInstance(newInstance(2, 1));
+    pool->pushReservedInstance(newInstance(5, 1));
+    MORDOR_TEST_ASSERT_EQUAL(pool->popReservedInstance()->instanceId(), 2u);
+    MORDOR_TEST_ASSERT_EQUAL(pool->popReservedInstance()->instanceId(), 5u);
+    MORDOR_TEST_ASSERT_EQUAL(pool->popReservedInstance()->instanceId(), 7u);
+}
@@ -0,0 +1,54 @@
+#include "learner_phase2_handler.h"
+#include "trace.h"
+#include <mordor/assert.h>
+#include <mordor/log.h>
+
+namespace lightning {
+
+using Mordor::Address;
+using Mordor::Logger;
+using Mordor::Log;
+using paxos::BallotId;
+using paxos::InstanceId;
+using paxos::Value;
+
+static Logger::ptr g_log = Log::lookup("lightning:learner_phase2_handler");
+
+LearnerPhase2Handler::LearnerPhase2Handler(LearnerState::ptr learnerState)
+    : learnerState_(learnerState)
+{}
+
+bool LearnerPhase2Handler::handleRequest(Address::ptr,
+                                         const RpcMessageData& request,
+                                         RpcMessageData*)
+{
+    const PaxosPhase2RequestData& paxosRequest =
+        request.phase2_request();
+    Guid requestEpoch = Guid::parse(paxosRequest.epoch());
+    const InstanceId instance = paxosRequest.instance();
+    const BallotId ballot = paxosRequest.ballot();
+    Value value;
+    if(!Value::parse(paxosRequest.value(), &value)) {
+        MORDOR_LOG_WARNING(g_log) << this << " dropping phase2(" <<
+                                     instance << ") with a malformed value";
+        return false;
+    }
+    const bool traced = paxosRequest.traced();
+    if(traced) {
+        Tracer::record(TRACE_PHASE2_RECEIVED, instance);
+    }
+
+    MORDOR_LOG_TRACE(g_log) << this << " phase2(" << instance << ", " <<
+                               ballot << ", " << value << ")";
+    learnerState_->beginBallot(requestEpoch, instance, ballot, value, traced);
+
+    for(int i = 0; i < paxosRequest.commits_size(); ++i) {
+        const CommitData& commit = paxosRequest.commits(i);
+        learnerState_->commit(requestEpoch,
+                              commit.instance(),
+                              Guid::parse(commit.value_id()));
+    }
+    return false;
+}
+
+}  // namespace lightning
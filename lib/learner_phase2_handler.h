@@ -0,0 +1,24 @@
+#pragma once
+
+#include "learner_state.h"
+#include "rpc_handler.h"
+
+namespace lightning {
+
+//! Feeds Phase 2 requests (values and piggybacked commits) to a
+//  LearnerState. Ring ids are not checked: only commits decide what
+//  is delivered, and they carry the value id.
+class LearnerPhase2Handler : public RpcHandler {
+public:
+    LearnerPhase2Handler(LearnerState::ptr learnerState);
+
+private:
+    //! Never replies.
+    bool handleRequest(Mordor::Address::ptr sourceAddress,
+                       const RpcMessageData& request,
+                       RpcMessageData* reply);
+
+    LearnerState::ptr learnerState_;
+};
+
+}  // namespace lightning
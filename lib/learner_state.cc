@@ -0,0 +1,209 @@
+#include "learner_state.h"
+#include "trace.h"
+#include <mordor/assert.h>
+#include <mordor/atomic.h>
+#include <mordor/log.h>
+#include <mordor/statistics.h>
+#include <boost/bind.hpp>
+
+namespace lightning {
+
+using Mordor::CountStatistic;
+using Mordor::IOManager;
+using Mordor::Log;
+using Mordor::Logger;
+using Mordor::Statistics;
+using Mordor::atomicCompareAndSwap;
+using paxos::BallotId;
+using paxos::InstanceId;
+using paxos::Value;
+
+static Logger::ptr g_log = Log::lookup("lightning:learner_state");
+
+static CountStatistic<uint64_t>& g_deliveredValues =
+    Statistics::registerStatistic("learner_state.delivered_values",
+                                  CountStatistic<uint64_t>());
+static CountStatistic<uint64_t>& g_droppedUpdates =
+    Statistics::registerStatistic("learner_state.dropped_updates",
+                                  CountStatistic<uint64_t>());
+static CountStatistic<uint64_t>& g_recoveries =
+    Statistics::registerStatistic("learner_state.recoveries",
+                                  CountStatistic<uint64_t>());
+
+namespace {
+
+//! Holds a slot lock until unlock() or the end of the scope. Only a few
+//  fields are updated under it, so waiters spin.
+class SlotLock : boost::noncopyable {
+public:
+    explicit SlotLock(volatile uint32_t* lock)
+        : lock_(lock)
+    {
+        while(atomicCompareAndSwap(*lock_, uint32_t(1), uint32_t(0)) != 0) {}
+    }
+
+    ~SlotLock() {
+        unlock();
+    }
+
+    void unlock() {
+        if(lock_) {
+            __sync_synchronize();
+            *lock_ = 0;
+            lock_ = NULL;
+        }
+    }
+private:
+    volatile uint32_t* lock_;
+};
+
+}  // anonymous namespace
+
+LearnerState::LearnerState(size_t size,
+                           IOManager* ioManager,
+                           RecoveryManager::ptr recoveryManager,
+                           CommitTracker::ptr commitTracker)
+    : size_(size),
+      slots_(new Slot[size]),
+      ioManager_(ioManager),
+      recoveryManager_(recoveryManager),
+      commitTracker_(commitTracker)
+{
+    MORDOR_ASSERT(size_ > 0 && (size_ & (size_ - 1)) == 0);
+}
+
+void LearnerState::beginBallot(const Guid& epoch,
+                               InstanceId instanceId,
+                               BallotId ballotId,
+                               const Value& value,
+                               bool traced)
+{
+    Slot& slot = slots_[instanceId & (size_ - 1)];
+    Value deliveredValue;
+    bool complete;
+    {
+        SlotLock lock(&slot.lock);
+        Entry* entry = &slot.entry;
+        if(!prepareUpdate(entry, epoch, instanceId)) {
+            lock.unlock();
+            MORDOR_LOG_TRACE(g_log) << this << " beginBallot(" <<
+                                       instanceId << ", " << ballotId <<
+                                       ", " << value << ") dropped";
+            g_droppedUpdates.increment();
+            return;
+        }
+        entry->ballotId = ballotId;
+        entry->value = value;
+        entry->hasValue = true;
+        entry->traced = entry->traced || traced;
+        traced = entry->traced;
+        complete = tryComplete(entry, &deliveredValue);
+    }
+    MORDOR_LOG_TRACE(g_log) << this << " beginBallot(" << instanceId <<
+                               ", " << ballotId << ", " << value << ")";
+    if(complete) {
+        deliver(epoch, instanceId, ballotId, deliveredValue, traced);
+    }
+}
+
+void LearnerState::commit(const Guid& epoch,
+                          InstanceId instanceId,
+                          const Guid& valueId)
+{
+    Slot& slot = slots_[instanceId & (size_ - 1)];
+    Value deliveredValue;
+    bool complete;
+    bool traced;
+    BallotId ballotId;
+    {
+        SlotLock lock(&slot.lock);
+        Entry* entry = &slot.entry;
+        if(!prepareUpdate(entry, epoch, instanceId)) {
+            lock.unlock();
+            MORDOR_LOG_TRACE(g_log) << this << " commit(" << instanceId <<
+                                       ", " << valueId << ") dropped";
+            g_droppedUpdates.increment();
+            return;
+        }
+        entry->committedValueId = valueId;
+        entry->committed = true;
+        traced = entry->traced;
+        ballotId = entry->ballotId;
+        complete = tryComplete(entry, &deliveredValue);
+    }
+    MORDOR_LOG_TRACE(g_log) << this << " commit(" << instanceId << ", " <<
+                               valueId << ") = " << complete;
+    if(traced) {
+        Tracer::record(TRACE_COMMIT_RECEIVED, instanceId);
+    }
+    if(complete) {
+        deliver(epoch, instanceId, ballotId, deliveredValue, traced);
+    } else {
+        // Same as AcceptorState: a commit without the value means
+        // the phase 2 packet was most likely lost.
+        ioManager_->schedule(boost::bind(&LearnerState::startRecovery,
+                                         this,
+                                         epoch,
+                                         instanceId));
+    }
+}
+
+bool LearnerState::prepareUpdate(Entry* entry,
+                                 const Guid& epoch,
+                                 InstanceId instanceId)
+{
+    if(entry->epoch == epoch) {
+        if(entry->instanceId > instanceId ||
+           (entry->instanceId == instanceId && entry->delivered))
+        {
+            return false;
+        }
+        if(entry->instanceId == instanceId) {
+            return true;
+        }
+    }
+    // The slot is unused or holds an older instance, which is given up
+    // on and left to recovery.
+    *entry = Entry();
+    entry->epoch = epoch;
+    entry->instanceId = instanceId;
+    return true;
+}
+
+bool LearnerState::tryComplete(Entry* entry, Value* value) {
+    MORDOR_ASSERT(!entry->delivered);
+    if(!entry->hasValue || !entry->committed ||
+       entry->value.valueId() != entry->committedValueId)
+    {
+        return false;
+    }
+    *value = entry->value;
+    entry->value.reset();
+    entry->hasValue = false;
+    entry->delivered = true;
+    return true;
+}
+
+void LearnerState::deliver(const Guid& epoch,
+                           InstanceId instanceId,
+                           BallotId ballotId,
+                           const Value& value,
+                           bool traced)
+{
+    MORDOR_LOG_TRACE(g_log) << this << " deliver(" << epoch << ", " <<
+                               instanceId << ", " << value << ")";
+    g_deliveredValues.increment();
+    if(traced) {
+        Tracer::record(TRACE_DELIVERED, instanceId);
+    }
+    commitTracker_->push(epoch, instanceId, ballotId, value);
+}
+
+void LearnerState::startRecovery(const Guid epoch, InstanceId instanceId) {
+    MORDOR_LOG_TRACE(g_log) << this << " submitting (" << epoch << ", " <<
+        instanceId << ") to recovery";
+    g_recoveries.increment();
+    recoveryManager_->addInstance(epoch, instanceId);
+}
+
+}  // namespace lightning
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "commit_tracker.h"
+#include "guid.h"
+#include "paxos_defs.h"
+#include "recovery_manager.h"
+#include "value.h"
+#include <mordor/iomanager.h>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/shared_ptr.hpp>
+#include <stdint.h>
+
+namespace lightning {
+
+//! Delivery pipeline of a learner that is not part of the ring.
+//
+//  Such a learner never votes, so it needs no acceptor state: it only
+//  has to match the values multicast in phase 2 with the commits
+//  piggybacked on later phase 2 messages. Both go into a reorder buffer
+//  of size slots indexed by instance id modulo size; as soon as an
+//  instance has both its committed value id and a value with that id,
+//  the value is handed to the commit tracker and on to the sink.
+//
+//  The slots are preallocated and updated in place, nothing is
+//  allocated per instance. Each slot has its own spin lock, held for a
+//  few field updates only: handlers on different threads contend only
+//  when they handle instances of the same slot, and never block a
+//  fiber. Exactly one of them marks an instance delivered.
+//
+//  The buffer is best effort: an entry is simply overwritten by an
+//  instance size slots ahead, a commit without a matching value is
+//  submitted to recovery, and the commit tracker recovers whatever
+//  never shows up.
+class LearnerState : boost::noncopyable {
+    typedef paxos::InstanceId InstanceId;
+    typedef paxos::BallotId   BallotId;
+    typedef paxos::Value      Value;
+public:
+    typedef boost::shared_ptr<LearnerState> ptr;
+
+    //! size must be a power of 2.
+    LearnerState(size_t size,
+                 Mordor::IOManager* ioManager,
+                 RecoveryManager::ptr recoveryManager,
+                 CommitTracker::ptr commitTracker);
+
+    //! Called upon receiving the Phase 2 multicast packet. If traced,
+    //  the commit and delivery of the instance are traced too.
+    void beginBallot(const Guid& epoch,
+                     InstanceId instanceId,
+                     BallotId ballotId,
+                     const Value& value,
+                     bool traced);
+
+    //! Called for every commit piggybacked on a Phase 2 packet.
+    void commit(const Guid& epoch,
+                InstanceId instanceId,
+                const Guid& valueId);
+
+private:
+    struct Entry {
+        Entry() : instanceId(0), ballotId(paxos::kInvalidBallotId),
+                  hasValue(false), committed(false), delivered(false),
+                  traced(false) {}
+
+        Guid epoch;
+        InstanceId instanceId;
+        BallotId ballotId;
+        //! The last value seen in phase 2, valid if hasValue.
+        Value value;
+        //! Valid if committed.
+        Guid committedValueId;
+        bool hasValue;
+        bool committed;
+        //! Once set, the value is released and further updates ignored.
+        bool delivered;
+        bool traced;
+    };
+
+    struct Slot {
+        Slot() : lock(0) {}
+
+        //! 1 while held, see SlotLock in learner_state.cc.
+        volatile uint32_t lock;
+        Entry entry;
+    };
+
+    //! Returns false if the update must be dropped. Otherwise entry
+    //  refers to (epoch, instanceId) afterwards, reset if it held
+    //  another instance.
+    static bool prepareUpdate(Entry* entry,
+                              const Guid& epoch,
+                              InstanceId instanceId);
+
+    //! Marks the entry delivered if it is complete. Returns true if so.
+    static bool tryComplete(Entry* entry, Value* value);
+
+    //! Hands the value over to the commit tracker.
+    void deliver(const Guid& epoch,
+                 InstanceId instanceId,
+                 BallotId ballotId,
+                 const Value& value,
+                 bool traced);
+
+    void startRecovery(const Guid epoch, InstanceId instanceId);
+
+    const size_t size_;
+    boost::scoped_array<Slot> slots_;
+
+    Mordor::IOManager* ioManager_;
+    RecoveryManager::ptr recoveryManager_;
+    CommitTracker::ptr commitTracker_;
+};
+
+}  // namespace lightning
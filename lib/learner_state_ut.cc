@@ -0,0 +1,237 @@
+#include "learner_state.h"
+#include "commit_tracker.h"
+#include "guid.h"
+#include "recovery_manager.h"
+#include "trace.h"
+#include "value.h"
+#include <mordor/iomanager.h>
+#include <mordor/test/test.h>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <stdint.h>
+#include <stdlib.h>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace Mordor;
+using namespace lightning;
+using lightning::paxos::BallotId;
+using lightning::paxos::InstanceId;
+using lightning::paxos::Value;
+using boost::shared_ptr;
+using std::map;
+using std::ostringstream;
+using std::string;
+using std::vector;
+
+namespace {
+
+//! Short, so that IOManager::stop() does not wait long for the gap
+//  timers of the commit tracker.
+const uint64_t kRecoveryGracePeriodUs = 1000;
+
+//! Remembers the instances that reach it.
+class RecordingSink : public InstanceSink {
+public:
+    virtual void updateEpoch(const Guid&) {}
+
+    virtual void push(InstanceId instanceId, BallotId, Value) {
+        instanceIds.push_back(instanceId);
+    }
+
+    vector<InstanceId> instanceIds;
+};
+
+//! The commit tracker drops recommits, so the sink cannot tell whether
+//  LearnerState delivered an instance twice. Deliveries are counted on
+//  the trace instead, LearnerState records them for traced instances.
+map<InstanceId, size_t> tracedDeliveries() {
+    static bool configured = false;
+    if(!configured) {
+        Tracer::configure("learner_state_ut", 1 << 20, 0);
+        configured = true;
+    }
+    ostringstream os;
+    Tracer::dump(os);
+    const string dump = os.str();
+    const string stage = string("\"") +
+                         Tracer::stageName(TRACE_DELIVERED) + "\"";
+    map<InstanceId, size_t> deliveries;
+    for(size_t pos = dump.find(stage);
+        pos != string::npos;
+        pos = dump.find(stage, pos + 1))
+    {
+        const size_t event = dump.rfind('[', pos);
+        ++deliveries[strtoull(dump.c_str() + event + 1, NULL, 10)];
+    }
+    return deliveries;
+}
+
+//! One for the whole run: its queues register process-wide statistics.
+//  Nothing processes them, submitted instances just pile up.
+RecoveryManager::ptr recoveryManager() {
+    static RecoveryManager::ptr recoveryManager(new RecoveryManager);
+    return recoveryManager;
+}
+
+class LearnerFixture {
+public:
+    LearnerFixture(size_t size, IOManager* ioManager)
+        : recorder(new RecordingSink),
+          commitTracker(new CommitTracker(kRecoveryGracePeriodUs,
+                                          InstanceSink::ptr(recorder),
+                                          recoveryManager(),
+                                          ioManager)),
+          learnerState(size, ioManager, recoveryManager(), commitTracker),
+          epoch(guidGenerator.generate())
+    {
+        recoveryManager()->setCommitTracker(commitTracker);
+        tracedDeliveries().swap(deliveriesBefore);
+    }
+
+    Value makeValue() {
+        return Value(guidGenerator.generate(),
+                     shared_ptr<string>(new string("value")));
+    }
+
+    //! Deliveries by instance id since the fixture was set up.
+    map<InstanceId, size_t> deliveries() const {
+        map<InstanceId, size_t> deliveries = tracedDeliveries();
+        for(map<InstanceId, size_t>::const_iterator it =
+                deliveriesBefore.begin();
+            it != deliveriesBefore.end();
+            ++it)
+        {
+            deliveries[it->first] -= it->second;
+        }
+        return deliveries;
+    }
+
+    GuidGenerator guidGenerator;
+    RecordingSink* recorder;
+    CommitTracker::ptr commitTracker;
+    LearnerState learnerState;
+    Guid epoch;
+    map<InstanceId, size_t> deliveriesBefore;
+};
+
+//! Feeds every instance to learnerState, the value before the commit or
+//  the other way around.
+void updateAll(LearnerState* learnerState,
+               const Guid& epoch,
+               const vector<Value>* values,
+               bool valueFirst)
+{
+    for(size_t i = 0; i < values->size(); ++i) {
+        const Value& value = (*values)[i];
+        if(valueFirst) {
+            learnerState->beginBallot(epoch, i, 1, value, true);
+        }
+        learnerState->commit(epoch, i, value.valueId());
+        if(!valueFirst) {
+            learnerState->beginBallot(epoch, i, 1, value, true);
+        }
+    }
+}
+
+}  // anonymous namespace
+
+MORDOR_UNITTEST(LearnerStateTest, DeliversOnceInEitherOrder) {
+    IOManager ioManager;
+    LearnerFixture fixture(16, &ioManager);
+    Value first = fixture.makeValue();
+    Value second = fixture.makeValue();
+
+    fixture.learnerState.beginBallot(fixture.epoch, 0, 1, first, true);
+    fixture.learnerState.commit(fixture.epoch, 0, first.valueId());
+    fixture.learnerState.commit(fixture.epoch, 1, second.valueId());
+    fixture.learnerState.beginBallot(fixture.epoch, 1, 1, second, true);
+    // Retransmissions after the delivery are dropped.
+    fixture.learnerState.beginBallot(fixture.epoch, 0, 1, first, true);
+    fixture.learnerState.commit(fixture.epoch, 0, first.valueId());
+    fixture.learnerState.commit(fixture.epoch, 1, second.valueId());
+    ioManager.stop();
+
+    map<InstanceId, size_t> deliveries = fixture.deliveries();
+    MORDOR_TEST_ASSERT_EQUAL(deliveries[0], 1u);
+    MORDOR_TEST_ASSERT_EQUAL(deliveries[1], 1u);
+    MORDOR_TEST_ASSERT_EQUAL(fixture.recorder->instanceIds.size(), 2u);
+    MORDOR_TEST_ASSERT(!fixture.commitTracker->needsRecovery(fixture.epoch,
+                                                             0));
+    MORDOR_TEST_ASSERT(!fixture.commitTracker->needsRecovery(fixture.epoch,
+                                                             1));
+}
+
+MORDOR_UNITTEST(LearnerStateTest, WaitsForTheCommittedValue) {
+    IOManager ioManager;
+    LearnerFixture fixture(16, &ioManager);
+    Value proposed = fixture.makeValue();
+    Value committed = fixture.makeValue();
+
+    fixture.learnerState.beginBallot(fixture.epoch, 0, 1, proposed, true);
+    fixture.learnerState.commit(fixture.epoch, 0, committed.valueId());
+    MORDOR_TEST_ASSERT_EQUAL(fixture.deliveries()[0], 0u);
+    // The committed value shows up in a later ballot.
+    fixture.learnerState.beginBallot(fixture.epoch, 0, 2, committed, true);
+    ioManager.stop();
+
+    MORDOR_TEST_ASSERT_EQUAL(fixture.deliveries()[0], 1u);
+    MORDOR_TEST_ASSERT_EQUAL(fixture.recorder->instanceIds.size(), 1u);
+}
+
+MORDOR_UNITTEST(LearnerStateTest, OverwrittenInstanceIsLeftToRecovery) {
+    IOManager ioManager;
+    const size_t size = 4;
+    LearnerFixture fixture(size, &ioManager);
+    Value old = fixture.makeValue();
+    Value recent = fixture.makeValue();
+
+    fixture.learnerState.beginBallot(fixture.epoch, 0, 1, old, true);
+    // Same slot, the entry of instance 0 is given up on.
+    fixture.learnerState.beginBallot(fixture.epoch, size, 1, recent, true);
+    fixture.learnerState.commit(fixture.epoch, 0, old.valueId());
+    fixture.learnerState.commit(fixture.epoch, size, recent.valueId());
+    ioManager.stop();
+
+    map<InstanceId, size_t> deliveries = fixture.deliveries();
+    MORDOR_TEST_ASSERT_EQUAL(deliveries[0], 0u);
+    MORDOR_TEST_ASSERT_EQUAL(deliveries[size], 1u);
+    MORDOR_TEST_ASSERT_EQUAL(fixture.recorder->instanceIds.size(), 1u);
+    MORDOR_TEST_ASSERT_EQUAL(fixture.recorder->instanceIds[0],
+                             InstanceId(size));
+    // The gap below instance size is the commit tracker's to recover.
+    for(InstanceId instanceId = 0; instanceId < size; ++instanceId) {
+        MORDOR_TEST_ASSERT(fixture.commitTracker->needsRecovery(
+                               fixture.epoch, instanceId));
+    }
+}
+
+MORDOR_UNITTEST(LearnerStateTest, ConcurrentUpdatesDeliverOnce) {
+    const size_t instances = 4096;
+    const int updaters = 8;
+    IOManager ioManager(4, false);
+    // No overwrites, so that every instance gets delivered.
+    LearnerFixture fixture(instances, &ioManager);
+    vector<Value> values;
+    for(size_t i = 0; i < instances; ++i) {
+        values.push_back(fixture.makeValue());
+    }
+    for(int i = 0; i < updaters; ++i) {
+        ioManager.schedule(boost::bind(&updateAll,
+                                       &fixture.learnerState,
+                                       fixture.epoch,
+                                       &values,
+                                       i % 2 == 0));
+    }
+    ioManager.stop();
+
+    map<InstanceId, size_t> deliveries = fixture.deliveries();
+    for(InstanceId instanceId = 0; instanceId < instances; ++instanceId) {
+        MORDOR_TEST_ASSERT_EQUAL(deliveries[instanceId], 1u);
+        MORDOR_TEST_ASSERT(!fixture.commitTracker->needsRecovery(
+                               fixture.epoch, instanceId));
+    }
+    MORDOR_TEST_ASSERT_EQUAL(fixture.recorder->instanceIds.size(), instances);
+}
@@ -0,0 +1,271 @@
+#include "metrics.h"
+#include <mordor/assert.h>
+#include <mordor/atomic.h>
+#include <mordor/timer.h>
+#include <boost/thread/mutex.hpp>
+#include <algorithm>
+#include <cmath>
+#include <map>
+
+namespace lightning {
+
+using Mordor::atomicAdd;
+using Mordor::atomicCompareAndSwap;
+using Mordor::atomicIncrement;
+using Mordor::TimerManager;
+using std::map;
+using std::max;
+using std::min;
+using std::ostream;
+using std::string;
+using std::vector;
+
+const size_t Histogram::kSubBucketBits;
+const size_t Histogram::kSubBuckets;
+const uint64_t Histogram::kMaxValue;
+const size_t Histogram::kBuckets;
+const size_t Histogram::kShards;
+
+const double Metrics::kQuantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+const size_t Metrics::kQuantileCount =
+    sizeof(Metrics::kQuantiles) / sizeof(Metrics::kQuantiles[0]);
+
+namespace {
+
+//! Shard of the calling thread, assigned round robin on first use.
+__thread size_t t_shardIndex = ~size_t(0);
+volatile size_t g_shardedThreads = 0;
+
+struct Registry {
+    boost::mutex mutex;
+    map<string, Histogram*> histograms;
+    map<string, Metrics::Gauge> gauges;
+};
+
+//! Constructed on first use, histograms are registered from static
+//  initializers of other translation units.
+Registry& registry() {
+    static Registry* registry = new Registry;
+    return *registry;
+}
+
+//! "proposer.phase2_latency" -> "lightning_proposer_phase2_latency".
+string prometheusName(const string& name) {
+    string result = "lightning_" + name;
+    std::replace(result.begin(), result.end(), '.', '_');
+    return result;
+}
+
+}  // anonymous namespace
+
+uint64_t Histogram::Snapshot::percentile(double q) const {
+    if(count == 0) {
+        return 0;
+    }
+    const uint64_t rank = std::max<uint64_t>(1, uint64_t(ceil(q * count)));
+    uint64_t seen = 0;
+    for(size_t i = 0; i < buckets.size(); ++i) {
+        seen += buckets[i];
+        if(seen >= rank) {
+            return min(bucketMaxValue(i), max);
+        }
+    }
+    return max;
+}
+
+double Histogram::Snapshot::mean() const {
+    return count ? double(sum) / count : 0.0;
+}
+
+Histogram::Histogram(const string& units)
+    : units_(units),
+      shards_(new Shard[kShards]())
+{}
+
+Histogram::~Histogram() {
+    delete [] shards_;
+}
+
+void Histogram::record(uint64_t value) {
+    value = min(value, kMaxValue);
+    Shard* shard = shardForThisThread();
+    atomicIncrement(shard->count);
+    atomicAdd(shard->sum, value);
+    atomicIncrement(shard->buckets[bucketIndex(value)]);
+    uint64_t currentMax = shard->max;
+    while(value > currentMax) {
+        const uint64_t seen =
+            atomicCompareAndSwap(shard->max, value, currentMax);
+        if(seen == currentMax) {
+            break;
+        }
+        currentMax = seen;
+    }
+}
+
+void Histogram::snapshot(Snapshot* snapshot) const {
+    snapshot->count = 0;
+    snapshot->sum = 0;
+    snapshot->max = 0;
+    snapshot->buckets.assign(kBuckets, 0);
+    for(size_t i = 0; i < kShards; ++i) {
+        const Shard& shard = shards_[i];
+        snapshot->count += shard.count;
+        snapshot->sum += shard.sum;
+        snapshot->max = max(snapshot->max, shard.max);
+        for(size_t j = 0; j < kBuckets; ++j) {
+            snapshot->buckets[j] += shard.buckets[j];
+        }
+    }
+}
+
+size_t Histogram::bucketIndex(uint64_t value) {
+    value = min(value, kMaxValue);
+    if(value < kSubBuckets) {
+        return size_t(value);
+    }
+    const size_t msb = 63 - __builtin_clzll(value);
+    const size_t shift = msb - (kSubBucketBits - 1);
+    return shift * (kSubBuckets / 2) + size_t(value >> shift);
+}
+
+uint64_t Histogram::bucketMaxValue(size_t index) {
+    MORDOR_ASSERT(index < kBuckets);
+    if(index < kSubBuckets) {
+        return index;
+    }
+    const size_t shift = index / (kSubBuckets / 2) - 1;
+    const uint64_t subBucket = index % (kSubBuckets / 2) + kSubBuckets / 2;
+    return ((subBucket + 1) << shift) - 1;
+}
+
+Histogram::Shard* Histogram::shardForThisThread() {
+    if(t_shardIndex == ~size_t(0)) {
+        t_shardIndex = (atomicIncrement(g_shardedThreads) - 1) % kShards;
+    }
+    return &shards_[t_shardIndex];
+}
+
+RateMeter::RateMeter(uint64_t timeConstantUs)
+    : tickUs_(max<uint64_t>(timeConstantUs / 16, 1)),
+      alpha_(1 - exp(-double(tickUs_) / max<uint64_t>(timeConstantUs, 1))),
+      uncounted_(0),
+      lastTickUs_(TimerManager::now()),
+      rate_(0)
+{}
+
+void RateMeter::mark(uint64_t count) {
+    atomicAdd(uncounted_, count);
+    tickIfNecessary(TimerManager::now());
+}
+
+double RateMeter::rate() {
+    tickIfNecessary(TimerManager::now());
+    return rate_ * 1000000;
+}
+
+void RateMeter::tickIfNecessary(uint64_t now) {
+    const uint64_t lastTick = lastTickUs_;
+    if(now < lastTick + tickUs_) {
+        return;
+    }
+    const uint64_t ticks = (now - lastTick) / tickUs_;
+    if(atomicCompareAndSwap(lastTickUs_,
+                            lastTick + ticks * tickUs_,
+                            lastTick) != lastTick)
+    {
+        // Somebody else is ticking.
+        return;
+    }
+    const uint64_t count = uncounted_;
+    atomicAdd(uncounted_, uint64_t(0) - count);
+    double rate = rate_;
+    rate += alpha_ * (double(count) / tickUs_ - rate);
+    if(ticks > 1) {
+        rate *= pow(1 - alpha_, double(ticks - 1));
+    }
+    rate_ = rate;
+}
+
+Histogram& Metrics::registerHistogram(const string& name,
+                                      const string& units)
+{
+    Registry& r = registry();
+    boost::mutex::scoped_lock lk(r.mutex);
+    MORDOR_ASSERT(r.histograms.find(name) == r.histograms.end());
+    Histogram* histogram = new Histogram(units);
+    r.histograms[name] = histogram;
+    return *histogram;
+}
+
+void Metrics::registerGauge(const string& name, Gauge gauge) {
+    Registry& r = registry();
+    boost::mutex::scoped_lock lk(r.mutex);
+    r.gauges[name] = gauge;
+}
+
+void Metrics::unregisterGauge(const string& name) {
+    Registry& r = registry();
+    boost::mutex::scoped_lock lk(r.mutex);
+    r.gauges.erase(name);
+}
+
+void Metrics::dumpPrometheus(ostream& os) {
+    Registry& r = registry();
+    boost::mutex::scoped_lock lk(r.mutex);
+    Histogram::Snapshot snapshot;
+    for(auto i = r.histograms.begin(); i != r.histograms.end(); ++i) {
+        string name = prometheusName(i->first);
+        if(!i->second->units().empty()) {
+            name += "_" + i->second->units();
+        }
+        i->second->snapshot(&snapshot);
+        os << "# TYPE " << name << " summary\n";
+        for(size_t q = 0; q < kQuantileCount; ++q) {
+            os << name << "{quantile=\"" << kQuantiles[q] << "\"} " <<
+                  snapshot.percentile(kQuantiles[q]) << "\n";
+        }
+        os << name << "_sum " << snapshot.sum << "\n";
+        os << name << "_count " << snapshot.count << "\n";
+        os << "# TYPE " << name << "_max gauge\n";
+        os << name << "_max " << snapshot.max << "\n";
+    }
+    for(auto i = r.gauges.begin(); i != r.gauges.end(); ++i) {
+        const string name = prometheusName(i->first);
+        os << "# TYPE " << name << " gauge\n";
+        os << name << " " << i->second() << "\n";
+    }
+}
+
+void Metrics::dumpJson(ostream& os) {
+    Registry& r = registry();
+    boost::mutex::scoped_lock lk(r.mutex);
+    Histogram::Snapshot snapshot;
+    os << "{\"histograms\": {";
+    for(auto i = r.histograms.begin(); i != r.histograms.end(); ++i) {
+        i->second->snapshot(&snapshot);
+        if(i != r.histograms.begin()) {
+            os << ", ";
+        }
+        os << "\"" << i->first << "\": {\"units\": \"" <<
+              i->second->units() << "\", \"count\": " << snapshot.count <<
+              ", \"sum\": " << snapshot.sum << ", \"mean\": " <<
+              snapshot.mean() << ", \"max\": " << snapshot.max <<
+              ", \"quantiles\": {";
+        for(size_t q = 0; q < kQuantileCount; ++q) {
+            os << (q ? ", " : "") << "\"" << kQuantiles[q] << "\": " <<
+                  snapshot.percentile(kQuantiles[q]);
+        }
+        os << "}}";
+    }
+    os << "}, \"gauges\": {";
+    for(auto i = r.gauges.begin(); i != r.gauges.end(); ++i) {
+        if(i != r.gauges.begin()) {
+            os << ", ";
+        }
+        os << "\"" << i->first << "\": " << i->second();
+    }
+    os << "}}\n";
+}
+
+}  // namespace lightning
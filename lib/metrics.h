@@ -0,0 +1,127 @@
+#pragma once
+
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace lightning {
+
+//! A distribution of non-negative integers (latencies in microseconds,
+//  usually) in constant memory.
+//
+//  Buckets are log-linear like in HDR histograms: exact below
+//  kSubBuckets, then kSubBuckets / 2 buckets per power of 2, so any
+//  recorded value is reported with a relative error under 1 / 32.
+//  Values above kMaxValue are clamped.
+//
+//  record() takes no lock: each thread adds to its own shard with
+//  atomic operations (shards are only shared if there are more than
+//  kShards threads). snapshot() sums up the shards, so it may miss
+//  the records made while it runs.
+class Histogram : boost::noncopyable {
+public:
+    struct Snapshot {
+        uint64_t count;
+        uint64_t sum;
+        uint64_t max;
+        std::vector<uint64_t> buckets;
+
+        //! The value at or below which the fraction q of the records
+        //  lie, 0 if there are none.
+        uint64_t percentile(double q) const;
+
+        double mean() const;
+    };
+
+    explicit Histogram(const std::string& units);
+
+    ~Histogram();
+
+    void record(uint64_t value);
+
+    void snapshot(Snapshot* snapshot) const;
+
+    const std::string& units() const { return units_; }
+
+    static size_t bucketIndex(uint64_t value);
+
+    //! The largest value that falls into bucket index.
+    static uint64_t bucketMaxValue(size_t index);
+
+    static const size_t kSubBucketBits = 6;
+    static const size_t kSubBuckets = 1 << kSubBucketBits;
+    //! About 19 hours in microseconds.
+    static const uint64_t kMaxValue = (uint64_t(1) << 36) - 1;
+    static const size_t kBuckets = (36 - kSubBucketBits + 2) *
+                                   (kSubBuckets / 2);
+    static const size_t kShards = 16;
+private:
+    struct Shard {
+        uint64_t count;
+        uint64_t sum;
+        uint64_t max;
+        uint64_t buckets[kBuckets];
+    };
+
+    Shard* shardForThisThread();
+
+    const std::string units_;
+    Shard* shards_;
+};
+
+//! Events per second, exponentially weighted with the given time
+//  constant, in constant memory.
+//
+//  mark() only adds to a counter; once per tick (a sixteenth of the time
+//  constant) the fiber that wins a compare-and-swap on the tick time
+//  folds the counter into the average. Idle ticks are folded in on the
+//  next mark() or rate().
+class RateMeter : boost::noncopyable {
+public:
+    explicit RateMeter(uint64_t timeConstantUs);
+
+    void mark(uint64_t count = 1);
+
+    double rate();
+private:
+    void tickIfNecessary(uint64_t now);
+
+    const uint64_t tickUs_;
+    //! Weight of the last tick in the average.
+    const double alpha_;
+    volatile uint64_t uncounted_;
+    volatile uint64_t lastTickUs_;
+    //! Events per microsecond.
+    volatile double rate_;
+};
+
+//! Process-wide registry of histograms and gauges, exported for
+//  monitoring as Prometheus text or JSON. Names are dotted like Mordor
+//  statistics ("proposer.phase2_latency").
+class Metrics {
+public:
+    typedef boost::function<double ()> Gauge;
+
+    //! Registers a histogram for the lifetime of the process, meant to
+    //  initialize a static reference like Statistics::registerStatistic.
+    static Histogram& registerHistogram(const std::string& name,
+                                        const std::string& units = "us");
+
+    //! Replaces any gauge registered under the same name.
+    static void registerGauge(const std::string& name, Gauge gauge);
+
+    static void unregisterGauge(const std::string& name);
+
+    //! Histograms are exported as summaries with kQuantiles.
+    static void dumpPrometheus(std::ostream& os);
+
+    static void dumpJson(std::ostream& os);
+
+    static const double kQuantiles[];
+    static const size_t kQuantileCount;
+};
+
+}  // namespace lightning
@@ -1,13 +1,16 @@
 #pragma once
 
-#include <mordor/fibersynchronization.h>
+#include "metrics.h"
 #include <boost/noncopyable.hpp>
 #include <boost/shared_ptr.hpp>
-#include <list>
 #include <stdint.h>
 
 namespace lightning {
 
+//! Packet and byte rates of the multicast RPC traffic, exponentially
+//  weighted over sendWindowUs and recvWindowUs. Constant memory and
+//  no locks per packet; exported as metrics gauges.
+//  There must be a single instance at a time.
 class MulticastRpcStats : boost::noncopyable
 {
 public:
@@ -15,8 +18,7 @@ public:
 
     MulticastRpcStats(int sendWindowUs, int recvWindowUs);
 
-    virtual ~MulticastRpcStats()
-    {}
+    virtual ~MulticastRpcStats();
 
     //! Called after a packet has been sent.
     void sentPacket(size_t bytes);
@@ -25,31 +27,10 @@ public:
     void receivedPacket(size_t bytes);
 
 private:
-    struct Packet {
-        uint64_t sendTime;
-        uint64_t recvTime;
-        size_t bytes;
-    };
-
-    struct PacketStat {
-        uint64_t sumLatency;
-        uint64_t packetCount;
-        uint64_t lastTime;
-        size_t byteCount;
-        int windowUs;
-        std::list<Packet> window;
-    };
-
-    //! Reset all stats to zero.
-    void clearStats(PacketStat &stat, int windowUs);
-
-    //! Called when we are adding a new packet to the window.
-    void updateStats(PacketStat &stat, size_t bytes);
-
-    PacketStat sent_;
-    PacketStat received_;
-
-    mutable Mordor::FiberMutex mutex_;
+    RateMeter sentPackets_;
+    RateMeter sentBytes_;
+    RateMeter receivedPackets_;
+    RateMeter receivedBytes_;
 };
 
 }  // namespace lightning
@@ -1,9 +1,13 @@
 #include "multicast_util.h"
+#include <mordor/assert.h>
+#include <linux/filter.h>
+#include <sys/socket.h>
 
 namespace lightning {
 
 using Mordor::Socket;
 using Mordor::Address;
+using Mordor::IOManager;
 
 void joinMulticastGroup(Socket::ptr socket, Address::ptr multicastGroup) {
     struct ip_mreq mreq;
@@ -14,4 +18,66 @@ void joinMulticastGroup(Socket::ptr socket, Address::ptr multicastGroup) {
     socket->setOption(IPPROTO_IP, IP_ADD_MEMBERSHIP, mreq);
 }
 
+void setReusePort(Socket::ptr socket) {
+    int option = 1;
+    socket->setOption(SOL_SOCKET, SO_REUSEPORT, &option, sizeof(option));
+}
+
+uint32_t instanceSteeringKey(paxos::InstanceId instanceId) {
+    const uint32_t key = uint32_t(instanceId);
+    return (key >> 24) | ((key >> 8) & 0xff00) |
+           ((key << 8) & 0xff0000) | (key << 24);
+}
+
+void attachSteeringFilter(Socket::ptr socket,
+                          uint32_t socketIndex,
+                          uint32_t socketCount)
+{
+    MORDOR_ASSERT(socketIndex < socketCount);
+    struct sock_filter code[] = {
+        // A = datagram length
+        BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0),
+        // X = offset of the trailing steering key
+        BPF_STMT(BPF_ALU | BPF_SUB | BPF_K, sizeof(uint32_t)),
+        BPF_STMT(BPF_MISC | BPF_TAX, 0),
+        // A = steering key
+        BPF_STMT(BPF_LD | BPF_W | BPF_IND, 0),
+        BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, socketCount),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, socketIndex, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+        BPF_STMT(BPF_RET | BPF_K, 0),
+    };
+    struct sock_fprog program;
+    program.len = sizeof(code) / sizeof(code[0]);
+    program.filter = code;
+    socket->setOption(SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof(program));
+}
+
+Socket::ptr bindSteeredSocket(Address::ptr bindAddress,
+                              IOManager* ioManager,
+                              uint32_t socketIndex,
+                              uint32_t socketCount)
+{
+    Socket::ptr socket = bindAddress->createSocket(*ioManager, SOCK_DGRAM);
+    int option = 1;
+    socket->setOption(SOL_SOCKET, SO_REUSEADDR, &option, sizeof(option));
+    if(socketCount > 1) {
+        setReusePort(socket);
+        attachSteeringFilter(socket, socketIndex, socketCount);
+    }
+    socket->bind(bindAddress);
+    return socket;
+}
+
+uint32_t probePathMtu(Address::ptr destination) {
+    // A connected datagram socket caches the route, and with it the MTU.
+    Socket::ptr socket = destination->createSocket(SOCK_DGRAM);
+    socket->connect(destination);
+    int mtu = 0;
+    size_t length = sizeof(mtu);
+    socket->getOption(IPPROTO_IP, IP_MTU, &mtu, &length);
+    MORDOR_ASSERT(mtu > 0);
+    return uint32_t(mtu);
+}
+
 }  // namespace lightning
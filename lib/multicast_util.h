@@ -1,5 +1,7 @@
 #pragma once
 
+#include "paxos_defs.h"
+#include <mordor/iomanager.h>
 #include <mordor/socket.h>
 
 namespace lightning {
@@ -8,4 +10,44 @@ namespace lightning {
 void joinMulticastGroup(Mordor::Socket::ptr socket,
                         Mordor::Address::ptr multicastGroup);
 
+//! Allows several sockets to be bound to the same address.
+//  Must be called before bind().
+void setReusePort(Mordor::Socket::ptr socket);
+
+//! Returns the RpcMessageData steering key for messages concerning
+//  the given instance. The key is byte-swapped so that its fixed32
+//  (little endian) encoding reads as the instance id when loaded
+//  as a big endian word, which is what BPF does.
+uint32_t instanceSteeringKey(paxos::InstanceId instanceId);
+
+//! Attaches a classic BPF filter making the socket accept only
+//  the datagrams whose steering key modulo socketCount is socketIndex.
+//  The kernel hands a copy of every multicast datagram to each socket
+//  bound to the group port, SO_REUSEPORT notwithstanding, so this is
+//  what spreads the load: with one filter per socket and indices
+//  0..socketCount-1 each datagram is accepted by exactly one socket.
+//  The key is the instance id the request is about (the first of a
+//  batched phase 1), so the ballots of one instance go through the same
+//  socket and are processed in order. Commits piggybacked on a phase 2
+//  request go through the socket of the instance carrying them and may
+//  overtake a ballot of their own instance still queued on its socket:
+//  an acceptor refuses a commit for an instance it has not voted in,
+//  and a learner keeps it until the value arrives.
+void attachSteeringFilter(Mordor::Socket::ptr socket,
+                          uint32_t socketIndex,
+                          uint32_t socketCount);
+
+//! Creates and binds the socketIndex-th of socketCount datagram sockets
+//  sharing the multicast listen address. With more than one socket,
+//  each gets SO_REUSEPORT and its steering filter.
+Mordor::Socket::ptr bindSteeredSocket(Mordor::Address::ptr bindAddress,
+                                      Mordor::IOManager* ioManager,
+                                      uint32_t socketIndex,
+                                      uint32_t socketCount);
+
+//! Returns the MTU the kernel knows for the route to destination
+//  (the interface MTU, or a smaller one learned by path MTU discovery).
+//  Does not send anything.
+uint32_t probePathMtu(Mordor::Address::ptr destination);
+
 }  // namespace lightning
@@ -0,0 +1,88 @@
+#include "pending_request_table.h"
+#include <mordor/assert.h>
+#include <mordor/log.h>
+
+namespace lightning {
+
+const uint64_t PendingRequestTable::kFreeSlot;
+
+using Mordor::Log;
+using Mordor::Logger;
+
+static Logger::ptr g_log = Log::lookup("lightning:pending_request_table");
+
+PendingRequestTable::PendingRequestTable(size_t slotCount,
+                                         size_t maxSlotSkips)
+    : slotCount_(slotCount),
+      maxSlotSkips_(maxSlotSkips),
+      slots_(new Slot[slotCount]),
+      overflowCount_(0),
+      nextSeq_(kFreeSlot + 1)
+{
+    MORDOR_ASSERT(slotCount_ > 0 && (slotCount_ & (slotCount_ - 1)) == 0);
+    for(size_t i = 0; i < slotCount_; ++i) {
+        slots_[i].seq = kFreeSlot;
+    }
+}
+
+uint64_t PendingRequestTable::insert(const RpcRequest::ptr& request) {
+    for(size_t i = 0; i < maxSlotSkips_; ++i) {
+        const uint64_t seq = nextSeq_++;
+        Slot& slot = slotFor(seq);
+        if(slot.seq == kFreeSlot) {
+            MORDOR_ASSERT(!slot.timeout);
+            boost::atomic_store(&slot.request, request);
+            slot.seq = seq;
+            return seq;
+        }
+    }
+    const uint64_t seq = nextSeq_++;
+    MORDOR_LOG_DEBUG(g_log) << this << " pending table congested, " <<
+                               "request seq " << seq << " overflows";
+    overflowRequests_[seq].request = request;
+    ++overflowCount_;
+    return seq;
+}
+
+PendingRequest* PendingRequestTable::find(uint64_t seq) {
+    const PendingRequestTable* constThis = this;
+    return const_cast<PendingRequest*>(constThis->find(seq));
+}
+
+const PendingRequest* PendingRequestTable::find(uint64_t seq) const {
+    const Slot& slot = slotFor(seq);
+    if(seq != kFreeSlot && slot.seq == seq) {
+        return &slot;
+    }
+    auto requestIter = overflowRequests_.find(seq);
+    return (requestIter != overflowRequests_.end()) ?
+               &requestIter->second : NULL;
+}
+
+void PendingRequestTable::erase(uint64_t seq) {
+    Slot& slot = slotFor(seq);
+    if(seq != kFreeSlot && slot.seq == seq) {
+        slot.seq = kFreeSlot;
+        boost::atomic_store(&slot.request, RpcRequest::ptr());
+        slot.timeout = NULL;
+        slot.onComplete.clear();
+        return;
+    }
+    const size_t erased = overflowRequests_.erase(seq);
+    MORDOR_ASSERT(erased == 1);
+    --overflowCount_;
+}
+
+RpcRequest::ptr PendingRequestTable::lookupSlot(uint64_t seq) const {
+    const Slot& slot = slotFor(seq);
+    if(seq != kFreeSlot && slot.seq == seq) {
+        return boost::atomic_load(&slot.request);
+    }
+    return RpcRequest::ptr();
+}
+
+PendingRequestTable::Slot& PendingRequestTable::slotFor(uint64_t seq) const {
+    return slots_[seq & (slotCount_ - 1)];
+}
+
+}  // namespace lightning
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "rpc_request.h"
+#include "timing_wheel.h"
+#include <mordor/atomic.h>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_array.hpp>
+#include <stdint.h>
+#include <map>
+
+namespace lightning {
+
+//! A request tracked by RpcRequester.
+struct PendingRequest {
+    PendingRequest() : timeout(NULL) {}
+
+    //! Read without the requester lock via boost::atomic_load.
+    RpcRequest::ptr request;
+    //! NULL until the request is sent.
+    TimingWheel<uint64_t>::Handle timeout;
+    //! Empty for synchronous requests.
+    boost::function<void (RpcRequest::Status)> onComplete;
+};
+
+//! The requests of an RpcRequester by sequence number.
+//
+//  A request with sequence number n lives in slot n & (slotCount - 1) of
+//  a preallocated table; sequence numbers whose slot is still busy are
+//  skipped when assigning, so a lookup never has to probe. After
+//  maxSlotSkips busy slots in a row the request goes to an overflow map
+//  instead.
+//
+//  lookupSlot() and hasOverflow() are lock-free, everything else must be
+//  serialized by the caller.
+class PendingRequestTable : boost::noncopyable {
+public:
+    //! slotCount must be a power of 2.
+    PendingRequestTable(size_t slotCount, size_t maxSlotSkips);
+
+    //! Assigns a sequence number to the request and starts tracking it.
+    uint64_t insert(const RpcRequest::ptr& request);
+
+    //! Returns NULL if not found.
+    PendingRequest* find(uint64_t seq);
+    const PendingRequest* find(uint64_t seq) const;
+
+    //! The request must be pending.
+    void erase(uint64_t seq);
+
+    //! Returns the request if seq is pending in its slot, a null pointer
+    //  otherwise, in particular for overflowed requests. The slot may be
+    //  reused concurrently, callers must validate the request.
+    RpcRequest::ptr lookupSlot(uint64_t seq) const;
+
+    //! Set while some request is in the overflow map.
+    bool hasOverflow() const { return overflowCount_ > 0; }
+
+    static const uint64_t kFreeSlot = 0;
+private:
+    struct Slot : PendingRequest {
+        //! kFreeSlot or the sequence number of the request. Read without
+        //  the requester lock.
+        Mordor::Atomic<uint64_t> seq;
+    };
+
+    Slot& slotFor(uint64_t seq) const;
+
+    const size_t slotCount_;
+    const size_t maxSlotSkips_;
+    boost::scoped_array<Slot> slots_;
+    std::map<uint64_t, PendingRequest> overflowRequests_;
+    Mordor::Atomic<size_t> overflowCount_;
+    uint64_t nextSeq_;
+};
+
+}  // namespace lightning
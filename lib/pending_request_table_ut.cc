@@ -0,0 +1,120 @@
+#include "pending_request_table.h"
+#include <mordor/test/test.h>
+#include <iostream>
+#include <vector>
+
+using namespace Mordor;
+using namespace lightning;
+using std::ostream;
+using std::vector;
+
+namespace {
+
+class DummyRequest : public RpcRequest {
+public:
+    DummyRequest() : RpcRequest(Address::ptr(), 0) {}
+
+    void onReply(const Address::ptr&, const RpcMessageData&) {}
+
+    ostream& output(ostream& os) const { return os << "DummyRequest"; }
+
+    void onTimeout() {}
+};
+
+const size_t kSlots = 8;
+const size_t kMaxSkips = 4;
+
+}  // anonymous namespace
+
+MORDOR_UNITTEST(PendingRequestTableTest, InsertFindErase) {
+    PendingRequestTable table(kSlots, kMaxSkips);
+    RpcRequest::ptr request(new DummyRequest);
+    const uint64_t seq = table.insert(request);
+    MORDOR_TEST_ASSERT_NOT_EQUAL(seq, PendingRequestTable::kFreeSlot);
+    MORDOR_TEST_ASSERT(table.find(seq) != NULL);
+    MORDOR_TEST_ASSERT(table.find(seq)->request == request);
+    MORDOR_TEST_ASSERT(table.lookupSlot(seq) == request);
+    MORDOR_TEST_ASSERT(!table.hasOverflow());
+
+    table.erase(seq);
+    MORDOR_TEST_ASSERT(table.find(seq) == NULL);
+    MORDOR_TEST_ASSERT(!table.lookupSlot(seq));
+    // Free slots never match.
+    MORDOR_TEST_ASSERT(table.find(PendingRequestTable::kFreeSlot) == NULL);
+    MORDOR_TEST_ASSERT(!table.lookupSlot(PendingRequestTable::kFreeSlot));
+}
+
+MORDOR_UNITTEST(PendingRequestTableTest, WrapsAroundFreeSlots) {
+    PendingRequestTable table(kSlots, kMaxSkips);
+    RpcRequest::ptr request(new DummyRequest);
+    uint64_t previous = table.insert(request);
+    table.erase(previous);
+    // Many times around the table, reusing every slot.
+    for(size_t i = 0; i < 10 * kSlots; ++i) {
+        const uint64_t seq = table.insert(request);
+        MORDOR_TEST_ASSERT_EQUAL(seq, previous + 1);
+        // A stale sequence number mapping to the same slot is not found.
+        MORDOR_TEST_ASSERT(table.find(seq - kSlots) == NULL);
+        MORDOR_TEST_ASSERT(!table.lookupSlot(seq - kSlots));
+        table.erase(seq);
+        previous = seq;
+    }
+    MORDOR_TEST_ASSERT(!table.hasOverflow());
+}
+
+MORDOR_UNITTEST(PendingRequestTableTest, SkipsBusySlots) {
+    PendingRequestTable table(kSlots, kMaxSkips);
+    RpcRequest::ptr busy(new DummyRequest);
+    const uint64_t busySeq = table.insert(busy);
+    // Fill the rest of the table once around, then free all but busySeq.
+    vector<uint64_t> seqs;
+    for(size_t i = 1; i < kSlots; ++i) {
+        seqs.push_back(table.insert(RpcRequest::ptr(new DummyRequest)));
+    }
+    for(size_t i = 0; i < seqs.size(); ++i) {
+        table.erase(seqs[i]);
+    }
+    // The next sequence number maps to the slot of busySeq and is skipped.
+    RpcRequest::ptr request(new DummyRequest);
+    const uint64_t seq = table.insert(request);
+    MORDOR_TEST_ASSERT_EQUAL(seq, busySeq + kSlots + 1);
+    MORDOR_TEST_ASSERT(table.lookupSlot(busySeq) == busy);
+    MORDOR_TEST_ASSERT(table.lookupSlot(seq) == request);
+    MORDOR_TEST_ASSERT(!table.hasOverflow());
+}
+
+MORDOR_UNITTEST(PendingRequestTableTest, OverflowsWhenCongested) {
+    PendingRequestTable table(kSlots, kMaxSkips);
+    vector<RpcRequest::ptr> requests;
+    vector<uint64_t> seqs;
+    for(size_t i = 0; i < 3 * kSlots; ++i) {
+        requests.push_back(RpcRequest::ptr(new DummyRequest));
+        seqs.push_back(table.insert(requests.back()));
+    }
+    MORDOR_TEST_ASSERT(table.hasOverflow());
+    size_t overflowed = 0;
+    for(size_t i = 0; i < seqs.size(); ++i) {
+        // Sequence numbers are never reused.
+        if(i > 0) {
+            MORDOR_TEST_ASSERT_GREATER_THAN(seqs[i], seqs[i - 1]);
+        }
+        PendingRequest* pending = table.find(seqs[i]);
+        MORDOR_TEST_ASSERT(pending != NULL);
+        MORDOR_TEST_ASSERT(pending->request == requests[i]);
+        if(!table.lookupSlot(seqs[i])) {
+            ++overflowed;
+        }
+    }
+    // Only kSlots requests fit the table.
+    MORDOR_TEST_ASSERT_EQUAL(overflowed, 2 * kSlots);
+
+    for(size_t i = 0; i < seqs.size(); ++i) {
+        table.erase(seqs[i]);
+        MORDOR_TEST_ASSERT(table.find(seqs[i]) == NULL);
+    }
+    MORDOR_TEST_ASSERT(!table.hasOverflow());
+    // Back to the table once it has room again.
+    RpcRequest::ptr request(new DummyRequest);
+    const uint64_t seq = table.insert(request);
+    MORDOR_TEST_ASSERT(table.lookupSlot(seq) == request);
+}
@@ -1,8 +1,10 @@
 #include "phase1_batcher.h"
 #include "batch_phase1_request.h"
+#include "metrics.h"
 #include "proposer_instance.h"
 #include <mordor/log.h>
 #include <mordor/statistics.h>
+#include <mordor/timer.h>
 
 namespace lightning {
 
@@ -13,6 +15,7 @@ using Mordor::Log;
 using Mordor::Logger;
 using Mordor::Statistics;
 using Mordor::CountStatistic;
+using Mordor::TimerManager;
 using paxos::BallotId;
 using paxos::BallotGenerator;
 using paxos::kInvalidBallotId;
@@ -28,6 +31,9 @@ static CountStatistic<uint64_t>& g_batchPhase1Timeouts =
     Statistics::registerStatistic("proposer.batch_phase1_timeouts",
                                   CountStatistic<uint64_t>());
 
+static Histogram& g_batchPhase1Latency =
+    Metrics::registerHistogram("proposer.batch_phase1_latency");
+
 Phase1Batcher::Phase1Batcher(const Guid& epoch,
                              uint64_t timeoutUs,
                              uint32_t batchSize,
@@ -117,6 +123,7 @@ void Phase1Batcher::requestInstanceRange(InstanceId startInstance,
                 ring,
                 timeoutUs_));
 
+        const uint64_t startUs = TimerManager::now();
         MulticastRpcRequest::Status status = requester_->request(*request);
         if(status == MulticastRpcRequest::TIMED_OUT) {
             MORDOR_LOG_TRACE(g_log) << this << " [[" << startInstance <<
@@ -126,6 +133,7 @@ void Phase1Batcher::requestInstanceRange(InstanceId startInstance,
             g_batchPhase1Timeouts.increment();
             continue;
         } else {
+            g_batchPhase1Latency.record(TimerManager::now() - startUs);
             *successfulBallot = currentBallot;
             return;
         }
@@ -139,23 +147,22 @@ void Phase1Batcher::openInstances(InstanceId startId,
 {
     MORDOR_LOG_TRACE(g_log) << this << " opening range [" << startId <<
                                ", " << endId << ") with ballot " << ballotId;
-    auto reservedEnd = reservedInstances.end();
-    for(InstanceId iid = startId; iid < endId; ++iid) {
-        ProposerInstance::ptr instance(new ProposerInstance(iid));
-        if(reservedInstances.find(iid) == reservedEnd) {
-            MORDOR_LOG_TRACE(g_log) << this << " iid=" << iid <<
-                                       " is open with ballot=" <<
-                                       ballotId;
-            instance->setBallotId(ballotId);
-            instancePool_->pushOpenInstance(instance);
-        } else {
-            MORDOR_LOG_TRACE(g_log) << this << " iid=" << iid <<
-                                       " is reserved with ballot=" <<
-                                       ballotId;
-            instance->setBallotId(ballotId);
-            instancePool_->pushReservedInstance(instance);
-        }
+    // Open instances between the reserved ones are pushed as ranges.
+    InstanceId openStartId = startId;
+    for(auto i = reservedInstances.lower_bound(startId);
+        i != reservedInstances.end() && *i < endId;
+        ++i)
+    {
+        instancePool_->pushOpenRange(openStartId, *i, ballotId);
+        MORDOR_LOG_TRACE(g_log) << this << " iid=" << *i <<
+                                   " is reserved with ballot=" <<
+                                   ballotId;
+        ProposerInstance::ptr instance(new ProposerInstance(*i));
+        instance->setBallotId(ballotId);
+        instancePool_->pushReservedInstance(instance);
+        openStartId = *i + 1;
     }
+    instancePool_->pushOpenRange(openStartId, endId, ballotId);
 }
 
 void Phase1Batcher::resetNextInstanceId(InstanceId newStartId) {
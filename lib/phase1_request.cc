@@ -1,4 +1,5 @@
 #include "phase1_request.h"
+#include "multicast_util.h"
 #include <mordor/assert.h>
 #include <mordor/log.h>
 #include <algorithm>
@@ -42,6 +43,7 @@ Phase1Request::Phase1Request(
     request->set_ring_id(ring->ringId());
     request->set_instance(instance);
     request->set_ballot(ballot);
+    requestData_.set_steering_key(instanceSteeringKey(instance));
 
     MORDOR_LOG_TRACE(g_log) << this << " P1(" << epoch << ", " <<
                                ring->ringId() << ", " << instance << ", " <<
@@ -102,8 +104,20 @@ void Phase1Request::applyReply(uint32_t hostId,
                                            reply.last_ballot_id() << ") " <<
                                            "from " << group_->host(hostId);
                 if(reply.last_ballot_id() > lastVotedBallotId_) {
+                    Value value;
+                    if(!Value::parse(reply.value(), &value)) {
+                        // The vote cannot be ignored, have the instance
+                        // retried with a higher ballot instead.
+                        MORDOR_LOG_WARNING(g_log) << this << " malformed " <<
+                            "value from " << group_->host(hostId);
+                        result_ = (result_ == FORGOTTEN) ? result_ :
+                                                           BALLOT_TOO_LOW;
+                        lastPromisedBallotId_ = max(lastPromisedBallotId_,
+                                                    reply.last_ballot_id());
+                        break;
+                    }
                     lastVotedBallotId_ = reply.last_ballot_id();
-                    lastVotedValue_ = Value::parse(reply.value());
+                    lastVotedValue_ = value;
                 }
                 MORDOR_LOG_TRACE(g_log) << this << " lastVotedBallot=" <<
                                            lastVotedBallotId_ << "," <<
@@ -1,4 +1,5 @@
 #include "phase2_handler.h"
+#include "trace.h"
 #include <mordor/assert.h>
 #include <mordor/log.h>
 
@@ -33,8 +34,15 @@ bool Phase2Handler::handleRequest(Address::ptr,
     const uint32_t requestRingId = paxosRequest.ring_id();
     const InstanceId instance = paxosRequest.instance();
     const BallotId ballot = paxosRequest.ballot();
-    Value value = Value::parse(paxosRequest.value());
-    MORDOR_ASSERT(value.size() <= Value::kMaxValueSize);
+    Value value;
+    if(!Value::parse(paxosRequest.value(), &value)) {
+        MORDOR_LOG_WARNING(g_log) << this << " dropping request " <<
+                                     rpcGuid << " with a malformed value";
+        return false;
+    }
+    if(paxosRequest.traced()) {
+        Tracer::record(TRACE_PHASE2_RECEIVED, instance);
+    }
 
     RingConfiguration::const_ptr ringConfiguration =
         tryAcquireRingConfiguration();
@@ -64,19 +72,28 @@ bool Phase2Handler::handleRequest(Address::ptr,
         MORDOR_LOG_TRACE(g_log) << this << " initiating vote (" <<
                                    instance << ", " << ballot << ", " <<
                                    value << ")";
-        ringVoter_->send(Vote(rpcGuid,
-                              requestEpoch,
-                              ringConfiguration->ringId(),
-                              instance,
-                              ballot,
-                              value.valueId(),
-                              ringVoter_));
+        Vote vote(rpcGuid,
+                  request.request_seq(),
+                  requestEpoch,
+                  ringConfiguration->ringId(),
+                  instance,
+                  ballot,
+                  value.valueId(),
+                  ringVoter_);
+        if(paxosRequest.traced()) {
+            vote.setTraced();
+        }
+        ringVoter_->send(vote);
     }
 
     for(int i = 0; i < paxosRequest.commits_size(); ++i) {
         const CommitData& commit = paxosRequest.commits(i);
         const InstanceId instance = commit.instance();
         Guid valueId = Guid::parse(commit.value_id());
+        // Piggybacked on another instance, whose flag says nothing.
+        if(Tracer::sampled(instance)) {
+            Tracer::record(TRACE_COMMIT_RECEIVED, instance);
+        }
         AcceptorState::Status status =
             acceptorState_->commit(requestEpoch, instance, valueId);
         MORDOR_LOG_TRACE(g_log) << this << " commit(" << instance << ", " <<
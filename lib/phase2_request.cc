@@ -1,4 +1,5 @@
 #include "phase2_request.h"
+#include "multicast_util.h"
 #include <mordor/assert.h>
 #include <mordor/log.h>
 #include <algorithm>
@@ -25,6 +26,10 @@ using std::set;
 
 static Logger::ptr g_log = Log::lookup("lightning:phase2_request");
 
+const size_t Phase2Request::kFixedOverhead;
+const size_t Phase2Request::kCommitOverhead;
+const size_t Phase2Request::kReservedCommits;
+
 namespace {
 
 ostream& operator<<(ostream& os,
@@ -50,6 +55,7 @@ Phase2Request::Phase2Request(
     BallotId ballot,
     const Value& value,
     const vector<pair<InstanceId, Guid> >& commits,
+    bool traced,
     RingConfiguration::const_ptr ring,
     uint64_t timeoutUs)
     : MulticastRpcRequest(ring, timeoutUs),
@@ -66,6 +72,10 @@ Phase2Request::Phase2Request(
     request->set_ballot(ballot);
     value.serialize(request->mutable_value());
     serializeCommits(commits, request);
+    if(traced) {
+        request->set_traced(true);
+    }
+    requestData_.set_steering_key(instanceSteeringKey(instance));
 
     MORDOR_LOG_TRACE(g_log) << this << " P2(" << epoch << ", " <<
                                ringId << ", " << instance << ", " <<
@@ -108,6 +118,21 @@ void Phase2Request::applyReply(uint32_t /* hostId */,
     result_ = SUCCESS;
 }
 
+size_t Phase2Request::maxValueSize(size_t datagramBudget) {
+    const size_t overhead = kFixedOverhead +
+                            kReservedCommits * kCommitOverhead;
+    MORDOR_ASSERT(datagramBudget > overhead);
+    return min<size_t>(Value::kMaxValueSize, datagramBudget - overhead);
+}
+
+size_t Phase2Request::commitCapacity(size_t datagramBudget,
+                                     size_t valueSize)
+{
+    const size_t used = kFixedOverhead + valueSize;
+    return (used < datagramBudget) ?
+               (datagramBudget - used) / kCommitOverhead : 0;
+}
+
 void Phase2Request::serializeCommits(
     const vector<pair<InstanceId, Guid> >& commits,
     PaxosPhase2RequestData* request) const
@@ -16,6 +16,7 @@ public:
 
     //! Here the ring parameter is actually a surrogate ring
     //  containing only the last host of the current ring.
+    //  traced flags the instance for tracing on the other hosts.
     Phase2Request(const Guid& epoch,
                   uint32_t ringId,
                   paxos::InstanceId instance,
@@ -23,6 +24,7 @@ public:
                   const paxos::Value& value,
                   const std::vector<std::pair<paxos::InstanceId, Guid> >&
                       commits,
+                  bool traced,
                   RingConfiguration::const_ptr ring,
                   uint64_t timeoutUs);
 
@@ -33,6 +35,23 @@ public:
 
     Result result() const;
 
+    //! The largest value a request carries within datagramBudget bytes
+    //  with room left for kReservedCommits commits.
+    static size_t maxValueSize(size_t datagramBudget);
+
+    //! How many commits a request with a value of valueSize bytes
+    //  carries within datagramBudget bytes.
+    static size_t commitCapacity(size_t datagramBudget, size_t valueSize);
+
+    //! Bounds the encoding of a request without value data and commits:
+    //  uuid, request_seq, steering key, epoch, ring id, instance, ballot,
+    //  trace flag and the value header with its fragment data.
+    static const size_t kFixedOverhead = 160;
+    //! Bounds the encoding of one CommitData.
+    static const size_t kCommitOverhead = 32;
+    //! Every request has room for this many commits.
+    static const size_t kReservedCommits = 10;
+
 private:
     std::ostream& output(std::ostream& os) const;
 
@@ -1,16 +1,18 @@
 #include "proposer_state.h"
 #include "guid.h"
+#include "metrics.h"
 #include "phase1_request.h"
 #include "phase2_request.h"
 #include "sleep_helper.h"
+#include "trace.h"
 #include <mordor/assert.h>
 #include <mordor/log.h>
 #include <mordor/statistics.h>
+#include <mordor/timer.h>
 #include <algorithm>
 
 namespace lightning {
 
-const size_t ProposerState::kCommitBatchLimit;
 const size_t ProposerState::kPhase2RingId;
 
 using Mordor::Address;
@@ -19,14 +21,13 @@ using Mordor::IOManager;
 using Mordor::Logger;
 using Mordor::Log;
 using Mordor::Statistics;
+using Mordor::TimerManager;
 using Mordor::CountStatistic;
 using paxos::BallotId;
 using paxos::kInvalidBallotId;
 using paxos::InstanceId;
 using paxos::Value;
 using boost::shared_ptr;
-using std::find;
-using std::list;
 using std::make_pair;
 using std::min;
 using std::string;
@@ -56,6 +57,11 @@ static CountStatistic<uint64_t>& g_commitQueueSize =
     Statistics::registerStatistic("proposer.commmit_queue_size",
                                   CountStatistic<uint64_t>());
 
+static Histogram& g_phase1Latency =
+    Metrics::registerHistogram("proposer.phase1_latency");
+static Histogram& g_phase2Latency =
+    Metrics::registerHistogram("proposer.phase2_latency");
+
 ProposerState::ProposerState(GroupConfiguration::ptr group,
                              const Guid& epoch,
                              InstancePool::ptr instancePool,
@@ -67,6 +73,10 @@ ProposerState::ProposerState(GroupConfiguration::ptr group,
                              uint64_t phase1IntervalUs,
                              uint64_t phase2TimeoutUs,
                              uint64_t phase2IntervalUs,
+                             uint64_t phase2MinIntervalUs,
+                             uint64_t phase2MaxIntervalUs,
+                             SleepHelper::Backend phase2PacingBackend,
+                             size_t phase2Window,
                              uint64_t commitFlushIntervalUs)
     : group_(group),
       epoch_(epoch),
@@ -79,11 +89,24 @@ ProposerState::ProposerState(GroupConfiguration::ptr group,
       phase1IntervalUs_(phase1IntervalUs),
       phase2TimeoutUs_(phase2TimeoutUs),
       phase2IntervalUs_(phase2IntervalUs),
+      rateController_(phase2IntervalUs,
+                      phase2MinIntervalUs,
+                      phase2MaxIntervalUs),
+      phase2PacingBackend_(phase2PacingBackend),
       commitFlushIntervalUs_(commitFlushIntervalUs),
-      ballotGenerator_(group_)
+      ballotGenerator_(group_),
+      nextConnectionId_(0),
+      phase2Slots_(phase2Window),
+      phase2Window_(phase2Window)
 {
     valueCache_->updateEpoch(epoch);
     MORDOR_ASSERT(group_->thisHostId() == group_->masterId());
+    MORDOR_ASSERT(phase2Window > 0);
+    freePhase2Slots_.reserve(phase2Window);
+    for(size_t i = phase2Window; i > 0; --i) {
+        freePhase2Slots_.push_back(i - 1);
+        phase2Slots_[i - 1].commits.reserve(Phase2Request::kReservedCommits);
+    }
 }
 
 void ProposerState::processReservedInstances() {
@@ -107,21 +130,21 @@ void ProposerState::processReservedInstances() {
 void ProposerState::processClientValues() {
     SleepHelper sleeper(ioManager_,
                         phase2IntervalUs_,
-                        SleepHelper::kEpollSleepPrecision);
+                        SleepHelper::kEpollSleepPrecision,
+                        phase2PacingBackend_);
     while(true) {
         sleeper.startWaiting();
+        const size_t slot = acquirePhase2Slot();
         ProposerInstance::ptr instance = instancePool_->popOpenInstance();
         auto currentValue = clientValueQueue_->pop();
         sleeper.stopWaiting();
+        sleeper.setSleepInterval(rateController_.intervalUs());
         sleeper.wait();
         MORDOR_LOG_TRACE(g_log) << this << " submitting value " <<
                                    currentValue << " to instance " <<
                                    instance->instanceId();
         instance->setValue(currentValue, true);
-        ioManager_->schedule(boost::bind(&ProposerState::doPhase2,
-                                         shared_from_this(),
-                                         instance));
-        g_pendingPhase2.increment();
+        startPhase2(slot, instance);
     }
 }
 
@@ -148,9 +171,11 @@ void ProposerState::doPhase1(ProposerInstance::ptr instance) {
                                                  instance->instanceId(),
                                                  ring,
                                                  phase1TimeoutUs_));
+    const uint64_t startUs = TimerManager::now();
     if(requester_->request(request) ==
            MulticastRpcRequest::COMPLETED)
     {
+        g_phase1Latency.record(TimerManager::now() - startUs);
         switch(request->result()) {
             case Phase1Request::FORGOTTEN:
                 {
@@ -201,10 +226,7 @@ void ProposerState::doPhase1(ProposerInstance::ptr instance) {
                     }
 
                     instance->setValue(foundValue, foundClientValue);
-                    ioManager_->schedule(boost::bind(&ProposerState::doPhase2,
-                                                     shared_from_this(),
-                                                     instance));
-                    g_pendingPhase2.increment();
+                    startPhase2(acquirePhase2Slot(), instance);
                 } else {
                     MORDOR_LOG_TRACE(g_log) << this << " phase1 for iid=" <<
                                                instance->instanceId() <<
@@ -232,20 +254,43 @@ void ProposerState::doPhase1(ProposerInstance::ptr instance) {
     g_pendingPhase1.decrement();
 }
 
-void ProposerState::doPhase2(ProposerInstance::ptr instance) {
-    vector<Commit> commits;
+size_t ProposerState::acquirePhase2Slot() {
+    phase2Window_.wait();
+    FiberMutex::ScopedLock lk(mutex_);
+    MORDOR_ASSERT(!freePhase2Slots_.empty());
+    const size_t slot = freePhase2Slots_.back();
+    freePhase2Slots_.pop_back();
+    return slot;
+}
+
+void ProposerState::startPhase2(size_t slot, ProposerInstance::ptr instance) {
+    Phase2Slot& phase2 = phase2Slots_[slot];
+    phase2.instance = instance;
     {
         FiberMutex::ScopedLock lk(mutex_);
-        for(size_t i = 0;
-            i < min(ProposerState::kCommitBatchLimit, commitQueue_.size());
-            ++i)
-        {
-            commits.push_back(commitQueue_.front());
+        MORDOR_ASSERT(phase2.commits.empty());
+        // Piggyback as many commits as fit the datagram with the value.
+        const size_t commitLimit =
+            Phase2Request::commitCapacity(group_->datagramBudget(),
+                                          instance->value().size());
+        for(size_t i = 0; i < commitLimit && !commitQueue_.empty(); ++i) {
+            phase2.commits.push_back(commitQueue_.front());
             commitQueue_.pop_front();
         }
         g_commitQueueSize.reset();
         g_commitQueueSize.add(commitQueue_.size());
     }
+    for(size_t i = 0; i < phase2.commits.size(); ++i) {
+        if(Tracer::sampled(phase2.commits[i].first)) {
+            Tracer::record(TRACE_COMMIT_SENT, phase2.commits[i].first);
+        }
+    }
+    const bool traced = Tracer::sampled(instance->instanceId());
+    if(traced && instance->value().receivedAtUs() != 0) {
+        Tracer::record(TRACE_RECEIVED,
+                       instance->instanceId(),
+                       instance->value().receivedAtUs());
+    }
 
     RingConfiguration::const_ptr ring = acquireRingConfiguration();
     // XXX extra allocation
@@ -258,14 +303,38 @@ void ProposerState::doPhase2(ProposerInstance::ptr instance) {
                                                  instance->instanceId(),
                                                  instance->ballotId(),
                                                  instance->value(),
-                                                 commits,
+                                                 phase2.commits,
+                                                 traced,
                                                  phase2Ring,
                                                  phase2TimeoutUs_));
-    if(requester_->request(request) ==
-        MulticastRpcRequest::COMPLETED)
-    {
+    g_pendingPhase2.increment();
+    phase2.sendTimeUs = TimerManager::now();
+    if(traced) {
+        Tracer::record(TRACE_PHASE2_SENT,
+                       instance->instanceId(),
+                       phase2.sendTimeUs);
+    }
+    requester_->requestAsync(request,
+                             boost::bind(&ProposerState::onPhase2Complete,
+                                         shared_from_this(),
+                                         slot,
+                                         _1));
+}
+
+void ProposerState::onPhase2Complete(size_t slot, RpcRequest::Status status)
+{
+    Phase2Slot& phase2 = phase2Slots_[slot];
+    ProposerInstance::ptr instance;
+    instance.swap(phase2.instance);
+    if(status == RpcRequest::COMPLETED) {
         MORDOR_LOG_TRACE(g_log) << this << " phase2 for iid=" <<
                                    instance->instanceId() << " successful";
+        const uint64_t now = TimerManager::now();
+        g_phase2Latency.record(now - phase2.sendTimeUs);
+        if(Tracer::sampled(instance->instanceId())) {
+            Tracer::record(TRACE_COMMITTED, instance->instanceId(), now);
+        }
+        rateController_.onSuccess(phase2.sendTimeUs, now);
         {
             FiberMutex::ScopedLock lk(mutex_);
             commitQueue_.push_back(make_pair(instance->instanceId(),
@@ -277,13 +346,14 @@ void ProposerState::doPhase2(ProposerInstance::ptr instance) {
     } else {
         MORDOR_LOG_TRACE(g_log) << this << " phase2 for iid=" <<
                                    instance->instanceId() << " timed out";
+        rateController_.onTimeout(phase2.sendTimeUs, TimerManager::now());
         instance->setBallotId(
             ballotGenerator_.boostBallotId(instance->ballotId()));
         instancePool_->pushReservedInstance(instance);
         {
             FiberMutex::ScopedLock lk(mutex_);
-            for(size_t i = 0; i < commits.size(); ++i) {
-                commitQueue_.push_front(commits[i]);
+            for(size_t i = 0; i < phase2.commits.size(); ++i) {
+                commitQueue_.push_front(phase2.commits[i]);
             }
             g_commitQueueSize.reset();
             g_commitQueueSize.add(commitQueue_.size());
@@ -291,24 +361,54 @@ void ProposerState::doPhase2(ProposerInstance::ptr instance) {
         g_phase2Timeouts.increment();
     }
     g_pendingPhase2.decrement();
+
+    phase2.commits.clear();
+    {
+        FiberMutex::ScopedLock lk(mutex_);
+        freePhase2Slots_.push_back(slot);
+    }
+    phase2Window_.notify();
 }
 
-void ProposerState::addNotifier(
-    Notifier<ProposerInstance::ptr>* notifier)
+ProposerState::ConnectionId ProposerState::addNotifier(
+    Notifier<ValueCommit>* notifier)
 {
-    FiberMutex::ScopedLock lk(mutex_);
+    FiberMutex::ScopedLock lk(notifierMutex_);
+    const ConnectionId connection = nextConnectionId_++;
+    notifiers_[connection] = notifier;
+    return connection;
+}
 
-    notifiers_.push_back(notifier);
+void ProposerState::removeNotifier(ConnectionId connection) {
+    FiberMutex::ScopedLock lk(notifierMutex_);
+    notifiers_.erase(connection);
+    // Connections close rarely, a scan is cheaper than keeping the values
+    // of each connection on every commit.
+    for(auto it = valueOwners_.begin(); it != valueOwners_.end();) {
+        if(it->second.connection == connection) {
+            it = valueOwners_.erase(it);
+        } else {
+            ++it;
+        }
+    }
 }
 
-void ProposerState::removeNotifier(
-    Notifier<ProposerInstance::ptr>* notifier)
+void ProposerState::registerValue(ConnectionId connection,
+                                  uint64_t seq,
+                                  const Guid& valueId)
 {
-    FiberMutex::ScopedLock lk(mutex_);
-
-    auto iter = find(notifiers_.begin(), notifiers_.end(), notifier);
-    if(iter != notifiers_.end()) {
-        notifiers_.erase(iter);
+    ValueOwner owner;
+    owner.connection = connection;
+    owner.seq = seq;
+    FiberMutex::ScopedLock lk(notifierMutex_);
+    auto inserted = valueOwners_.insert(make_pair(valueId, owner));
+    if(!inserted.second) {
+        MORDOR_LOG_WARNING(g_log) << this << " value " << valueId <<
+                                     " resubmitted by connection " <<
+                                     connection << ", its commit will " <<
+                                     "not be reported to connection " <<
+                                     inserted.first->second.connection;
+        inserted.first->second = owner;
     }
 }
 
@@ -318,13 +418,28 @@ void ProposerState::onCommit(ProposerInstance::ptr instance) {
                                " value=" << instance->value();
     g_committedValues.increment();
     g_committedBytes.add(instance->value().size());
-    for(auto i = notifiers_.begin(); i != notifiers_.end(); ++i) {
-        (*i)->notify(instance);
+    {
+        // Commits complete on whatever thread processes the replies,
+        // so notifiers may be removed concurrently.
+        FiberMutex::ScopedLock lk(notifierMutex_);
+        auto ownerIter = valueOwners_.find(instance->value().valueId());
+        if(ownerIter != valueOwners_.end()) {
+            ValueCommit commit;
+            commit.seq = ownerIter->second.seq;
+            commit.instance = instance;
+            auto notifierIter = notifiers_.find(ownerIter->second.connection);
+            // Erasing also filters out repeated commits of the value.
+            valueOwners_.erase(ownerIter);
+            if(notifierIter != notifiers_.end()) {
+                notifierIter->second->notify(commit);
+            }
+        }
     }
-    valueCache_->push(instance->instanceId(),
-                      instance->ballotId(),
-                      instance->value());
-
+    // The value may be a slice of a whole client batch frame, which the
+    // cache would otherwise keep alive for as long as it holds the value.
+    Value value(instance->value());
+    value.compact();
+    valueCache_->push(instance->instanceId(), instance->ballotId(), value);
 }
 
 }  // namespace lightning
@@ -8,13 +8,17 @@
 #include "notifier.h"
 #include "rpc_requester.h"
 #include "proposer_instance.h"
+#include "rate_controller.h"
+#include "sleep_helper.h"
 #include "value_cache.h"
 #include "ring_holder.h"
 #include <mordor/fibersynchronization.h>
 #include <mordor/iomanager.h>
 #include <boost/enable_shared_from_this.hpp>
 #include <deque>
-#include <list>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace lightning {
 
@@ -28,6 +32,17 @@ public:
 
     typedef boost::shared_ptr<ProposerState> ptr;
 
+    //! Identifies a client connection that gets notified when its values
+    //  are committed.
+    typedef uint32_t ConnectionId;
+
+    //! A committed client value. seq is the per-connection sequence
+    //  number the value was registered with.
+    struct ValueCommit {
+        uint64_t seq;
+        ProposerInstance::ptr instance;
+    };
+
     ProposerState(GroupConfiguration::ptr group,
                   const Guid& epoch,
                   InstancePool::ptr instancePool,
@@ -39,10 +54,19 @@ public:
                   uint64_t phase1IntervalUs,
                   uint64_t phase2TimeoutUs,
                   uint64_t phase2IntervalUs,
+                  uint64_t phase2MinIntervalUs,
+                  uint64_t phase2MaxIntervalUs,
+                  SleepHelper::Backend phase2PacingBackend,
+                  size_t phase2Window,
                   uint64_t commitFlushIntervalUs);
     
     void processReservedInstances();
 
+    //! Assigns client values to open instances and issues phase 2 for
+    //  them without waiting for the outcome. At most phase2Window
+    //  instances are in phase 2 at any time. The interval between
+    //  instances starts at phase2Interval and is then adjusted by a
+    //  RateController within [phase2MinInterval, phase2MaxInterval].
     void processClientValues();
 
     void flushCommits();
@@ -51,18 +75,40 @@ public:
     //  for phase 2, on failure it is returned to the instance pool.
     void doPhase1(ProposerInstance::ptr instance);
 
-    //! Perform Paxos phase 2.
-    void doPhase2(ProposerInstance::ptr instance);
+    //! Blocks until the phase 2 window has room, returns the slot
+    //  to pass to startPhase2().
+    size_t acquirePhase2Slot();
+
+    //! Issues Paxos phase 2 asynchronously, onPhase2Complete() is
+    //  called when it completes or times out.
+    void startPhase2(size_t slot, ProposerInstance::ptr instance);
 
-    //! Adds an on-commit notifier.
-    void addNotifier(Notifier<ProposerInstance::ptr>*
-            notifier);
+    //! Adds an on-commit notifier for a new client connection.
+    ConnectionId addNotifier(Notifier<ValueCommit>* notifier);
 
-    //! Removes an on-commit notifier.
-    /// Slow (O(#notifiers)).
-    void removeNotifier(Notifier<ProposerInstance::ptr>*
-            notifier);
+    //! Removes an on-commit notifier and forgets the values registered
+    //  by the connection, their commits are not reported.
+    void removeNotifier(ConnectionId connection);
+
+    //! Routes the commit of valueId to the notifier of connection.
+    //  Must be called before the value is submitted.
+    void registerValue(ConnectionId connection,
+                       uint64_t seq,
+                       const Guid& valueId);
 private:
+    typedef std::pair<paxos::InstanceId, Guid> Commit;
+
+    //! State of an instance in phase 2, kept in a preallocated window
+    //  instead of on a fiber stack.
+    struct Phase2Slot {
+        ProposerInstance::ptr instance;
+        //! Commits piggybacked on the request, requeued on timeout.
+        std::vector<Commit> commits;
+        uint64_t sendTimeUs;
+    };
+
+    void onPhase2Complete(size_t slot, RpcRequest::Status status);
+
     // XXX stub
     void onCommit(ProposerInstance::ptr instance);
 
@@ -77,19 +123,36 @@ private:
     const uint64_t phase1IntervalUs_;
     const uint64_t phase2TimeoutUs_;
     const uint64_t phase2IntervalUs_;
+    RateController rateController_;
+    const SleepHelper::Backend phase2PacingBackend_;
     const uint64_t commitFlushIntervalUs_;
 
     BallotGenerator ballotGenerator_;
 
-    typedef std::pair<paxos::InstanceId, Guid> Commit;
     std::deque<Commit> commitQueue_;
-    static const size_t kCommitBatchLimit = 10;
 
-    std::list<Notifier<ProposerInstance::ptr>* > notifiers_;
+    struct ValueOwner {
+        ConnectionId connection;
+        uint64_t seq;
+    };
+
+    //! Commit routing. Each commit costs one lookup in valueOwners_ and
+    //  one in notifiers_, however many connections there are.
+    std::unordered_map<ConnectionId, Notifier<ValueCommit>*> notifiers_;
+    std::unordered_map<Guid, ValueOwner, GuidHasher> valueOwners_;
+    ConnectionId nextConnectionId_;
+    //! Guards notifiers_, valueOwners_ and nextConnectionId_.
+    Mordor::FiberMutex notifierMutex_;
 
     //! Dummy ring id for the phase 2 one-host 'ring'.
     static const size_t kPhase2RingId = 239239;
 
+    std::vector<Phase2Slot> phase2Slots_;
+    //! Indices of unused phase2Slots_, guarded by mutex_.
+    std::vector<size_t> freePhase2Slots_;
+    //! Counts the free phase 2 slots.
+    Mordor::FiberSemaphore phase2Window_;
+
     Mordor::FiberMutex mutex_;
 };
 
@@ -0,0 +1,134 @@
+#include "rate_controller.h"
+#include <mordor/assert.h>
+#include <mordor/log.h>
+#include <mordor/statistics.h>
+#include <algorithm>
+#include <limits>
+
+namespace lightning {
+
+const double RateController::kAdditiveIncrease = 10000.0;
+const double RateController::kMultiplicativeDecrease = 0.7;
+const double RateController::kQueueingDelayFactor = 2.0;
+const uint64_t RateController::kMinQueueingDelayUs;
+const uint64_t RateController::kMinRttWindowUs;
+
+using Mordor::CountStatistic;
+using Mordor::FiberMutex;
+using Mordor::Log;
+using Mordor::Logger;
+using Mordor::Statistics;
+using std::max;
+using std::min;
+using std::numeric_limits;
+
+static Logger::ptr g_log = Log::lookup("lightning:rate_controller");
+
+static CountStatistic<uint64_t>& g_intervalUs =
+    Statistics::registerStatistic("proposer.rate_controller.interval",
+                                  CountStatistic<uint64_t>("us"));
+static CountStatistic<uint64_t>& g_rate =
+    Statistics::registerStatistic("proposer.rate_controller.rate",
+                                  CountStatistic<uint64_t>("requests/s"));
+static CountStatistic<uint64_t>& g_window =
+    Statistics::registerStatistic("proposer.rate_controller.window",
+                                  CountStatistic<uint64_t>("requests"));
+static CountStatistic<uint64_t>& g_srtt =
+    Statistics::registerStatistic("proposer.rate_controller.srtt",
+                                  CountStatistic<uint64_t>("us"));
+static CountStatistic<uint64_t>& g_minRtt =
+    Statistics::registerStatistic("proposer.rate_controller.min_rtt",
+                                  CountStatistic<uint64_t>("us"));
+static CountStatistic<uint64_t>& g_decreases =
+    Statistics::registerStatistic("proposer.rate_controller.decreases",
+                                  CountStatistic<uint64_t>());
+
+RateController::RateController(uint64_t initialIntervalUs,
+                               uint64_t minIntervalUs,
+                               uint64_t maxIntervalUs)
+    : minRate_(1e6 / maxIntervalUs),
+      maxRate_(1e6 / minIntervalUs),
+      rate_(0),
+      lastIncreaseUs_(0),
+      lastDecreaseUs_(0),
+      srttUs_(0),
+      minRttUs_(numeric_limits<uint64_t>::max()),
+      windowMinRttUs_(numeric_limits<uint64_t>::max()),
+      windowStartUs_(0),
+      intervalUs_(initialIntervalUs)
+{
+    MORDOR_ASSERT(minIntervalUs > 0);
+    MORDOR_ASSERT(minIntervalUs <= initialIntervalUs);
+    MORDOR_ASSERT(initialIntervalUs <= maxIntervalUs);
+    FiberMutex::ScopedLock lk(mutex_);
+    setRate(1e6 / initialIntervalUs);
+}
+
+void RateController::onSuccess(uint64_t sendTimeUs, uint64_t nowUs) {
+    FiberMutex::ScopedLock lk(mutex_);
+    updateRtt(nowUs - sendTimeUs, nowUs);
+
+    if(lastIncreaseUs_ == 0 || nowUs < lastIncreaseUs_) {
+        lastIncreaseUs_ = nowUs;
+        return;
+    }
+    const double elapsedSec = (nowUs - lastIncreaseUs_) / 1e6;
+    lastIncreaseUs_ = nowUs;
+
+    const double queueingThresholdUs =
+        max(minRttUs_ * kQueueingDelayFactor,
+            double(minRttUs_ + kMinQueueingDelayUs));
+    if(srttUs_ > queueingThresholdUs) {
+        MORDOR_LOG_TRACE(g_log) << this << " srtt=" << srttUs_ <<
+                                   " minRtt=" << minRttUs_ <<
+                                   ", holding rate " << rate_;
+        return;
+    }
+    setRate(rate_ + kAdditiveIncrease * elapsedSec);
+}
+
+void RateController::onTimeout(uint64_t sendTimeUs, uint64_t nowUs) {
+    FiberMutex::ScopedLock lk(mutex_);
+    if(sendTimeUs < lastDecreaseUs_) {
+        // Sent at the old rate, already accounted for.
+        return;
+    }
+    lastDecreaseUs_ = nowUs;
+    setRate(rate_ * kMultiplicativeDecrease);
+    g_decreases.increment();
+    MORDOR_LOG_DEBUG(g_log) << this << " timeout, rate decreased to " <<
+                               rate_;
+}
+
+void RateController::updateRtt(uint64_t rttUs, uint64_t nowUs) {
+    srttUs_ = (srttUs_ == 0) ? rttUs : (7 * srttUs_ + rttUs) / 8;
+
+    if(nowUs - windowStartUs_ > kMinRttWindowUs) {
+        // Forget minima older than a window.
+        minRttUs_ = windowMinRttUs_;
+        windowMinRttUs_ = numeric_limits<uint64_t>::max();
+        windowStartUs_ = nowUs;
+    }
+    windowMinRttUs_ = min(windowMinRttUs_, rttUs);
+    minRttUs_ = min(minRttUs_, rttUs);
+
+    g_srtt.reset();
+    g_srtt.add(uint64_t(srttUs_));
+    g_minRtt.reset();
+    g_minRtt.add(minRttUs_);
+    g_window.reset();
+    g_window.add(uint64_t(rate_ * srttUs_ / 1e6));
+}
+
+void RateController::setRate(double rate) {
+    rate_ = min(maxRate_, max(minRate_, rate));
+    const uint64_t intervalUs = uint64_t(1e6 / rate_);
+    intervalUs_ = intervalUs;
+
+    g_rate.reset();
+    g_rate.add(uint64_t(rate_));
+    g_intervalUs.reset();
+    g_intervalUs.add(intervalUs);
+}
+
+}  // namespace lightning
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <mordor/atomic.h>
+#include <mordor/fibersynchronization.h>
+#include <boost/noncopyable.hpp>
+#include <stdint.h>
+
+namespace lightning {
+
+//! Controls the phase 2 send rate (expressed as an interval between
+//  successive requests) from the outcome of the requests.
+//
+//  The rate grows linearly with time (additive increase) while the
+//  ring round-trip time stays close to the lowest one observed recently.
+//  Once the smoothed rtt grows well above it, a queue is building up
+//  somewhere along the ring and the rate is held. A phase 2 timeout is
+//  taken as a loss and cuts the rate multiplicatively, at most once
+//  per batch of requests sent before the previous cut.
+//
+//  Fiber- and thread-safe, intervalUs() does not lock.
+class RateController : boost::noncopyable {
+public:
+    RateController(uint64_t initialIntervalUs,
+                   uint64_t minIntervalUs,
+                   uint64_t maxIntervalUs);
+
+    //! Current interval between requests.
+    uint64_t intervalUs() const { return intervalUs_; }
+
+    //! A request sent at sendTimeUs has been acked at nowUs.
+    void onSuccess(uint64_t sendTimeUs, uint64_t nowUs);
+
+    //! A request sent at sendTimeUs has timed out.
+    void onTimeout(uint64_t sendTimeUs, uint64_t nowUs);
+
+    //! Rate increase in requests per second, per second.
+    static const double kAdditiveIncrease;
+    //! The rate is multiplied by this on loss.
+    static const double kMultiplicativeDecrease;
+    //! The rate is held when srtt exceeds minRtt by this factor...
+    static const double kQueueingDelayFactor;
+    //! ... and by at least this many microseconds, to ignore jitter
+    //  at very low rtts.
+    static const uint64_t kMinQueueingDelayUs = 1000;
+    //! The min rtt estimate is refreshed this often so that it can
+    //  follow route changes.
+    static const uint64_t kMinRttWindowUs = 10000000;
+private:
+    //! Must be called with mutex_ held.
+    void setRate(double rate);
+
+    void updateRtt(uint64_t rttUs, uint64_t nowUs);
+
+    const double minRate_;
+    const double maxRate_;
+
+    Mordor::FiberMutex mutex_;
+    double rate_;
+    uint64_t lastIncreaseUs_;
+    uint64_t lastDecreaseUs_;
+    double srttUs_;
+    uint64_t minRttUs_;
+    uint64_t windowMinRttUs_;
+    uint64_t windowStartUs_;
+
+    Mordor::Atomic<uint64_t> intervalUs_;
+};
+
+}  // namespace lightning
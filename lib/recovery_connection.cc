@@ -1,4 +1,5 @@
 #include "recovery_connection.h"
+#include "metrics.h"
 #include "recovery_manager.h"
 #include "sleep_helper.h"
 #include "value.h"
@@ -7,6 +8,7 @@
 #include <mordor/log.h>
 #include <mordor/sleep.h>
 #include <mordor/statistics.h>
+#include <mordor/timer.h>
 
 namespace lightning {
 
@@ -21,12 +23,16 @@ using Mordor::Log;
 using Mordor::Logger;
 using Mordor::Socket;
 using Mordor::Statistics;
+using Mordor::TimerManager;
 using std::logic_error;
 using std::string;
 using std::vector;
 
 static Logger::ptr g_log = Log::lookup("lightning:recovery_connection");
 
+static Histogram& g_batchLatency =
+    Metrics::registerHistogram("recovery.batch_latency");
+
 const size_t RecoveryConnection::kMaxBatchSize;
 
 RecoveryConnection::RecoveryConnection(
@@ -132,6 +138,7 @@ void RecoveryConnection::processQueue() {
             batchEpoch;
 
         BatchRecoveryReplyData replyData;
+        const uint64_t startUs = TimerManager::now();
         try {
             sendRequest(batchEpoch, currentBatch);
             readReply(&replyData);
@@ -146,6 +153,7 @@ void RecoveryConnection::processQueue() {
             handoffInstances(currentBatch);
             return;
         }
+        g_batchLatency.record(TimerManager::now() - startUs);
         processReply(replyData);
         sleeper.stopWaiting();
     }
@@ -215,7 +223,20 @@ void RecoveryConnection::processReply(
     for(int i = 0; i < replyData.recovered_instances_size(); ++i) {
         const InstanceData& instanceData = replyData.recovered_instances(i);
         InstanceId instanceId = instanceData.instance_id();
-        Value value = Value::parse(instanceData.value());
+        Value value;
+        if(!Value::parse(instanceData.value(), &value)) {
+            MORDOR_LOG_WARNING(g_log) << this << " malformed value of (" <<
+                epoch << ", " << instanceId << "), scheduling retry";
+            ioManager_->registerTimer(instanceRetryIntervalUs_,
+                                      boost::bind(&RecoveryConnection::retryInstance,
+                                                  shared_from_this(),
+                                                  RecoveryRecord::ptr(
+                                                    new RecoveryRecord(
+                                                        epoch,
+                                                        instanceId))));
+            recoveryRetries_.increment();
+            continue;
+        }
         MORDOR_LOG_TRACE(g_log) << this << " recovered (" << epoch << ", " <<
             instanceId << ", " << value << ")";
         recoveryManager_->addRecoveredValue(epoch,
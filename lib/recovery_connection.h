@@ -82,7 +82,8 @@ private:
 
     mutable Mordor::FiberMutex mutex_;
 
-    // about 50M, 60 is the protobuf limit for a single message
+    // about 50M of 8000 byte values, 60 is the protobuf limit for a single
+    // message; TcpRecoveryService truncates replies with larger values.
     static const size_t kMaxBatchSize = 6000;
 };
 
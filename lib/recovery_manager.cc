@@ -5,6 +5,7 @@
 #include <mordor/log.h>
 #include <mordor/sleep.h>
 #include <algorithm>
+#include <iterator>
 #include <string>
 #include <stdlib.h>
 
@@ -13,12 +14,15 @@ namespace lightning {
 using paxos::kInvalidBallotId;
 using paxos::InstanceId;
 using paxos::Value;
+using Mordor::Address;
 using Mordor::FiberMutex;
 using Mordor::IOManager;
 using Mordor::Log;
 using Mordor::Logger;
+using std::advance;
 using std::find;
 using std::string;
+using std::vector;
 
 static Logger::ptr g_log = Log::lookup("lightning:recovery_manager");
 
@@ -70,9 +74,18 @@ RecoveryConnection::ptr RecoveryManager::getBestConnection() {
         FiberMutex::ScopedLock lk(mutex_);
         if(connections_.empty()) {
             continue;
-        } else {
-            return *connections_.begin();
         }
+        const uint32_t bestMetric = (*connections_.begin())->metric();
+        size_t bestConnections = 0;
+        for(auto i = connections_.begin();
+            i != connections_.end() && (*i)->metric() == bestMetric;
+            ++i)
+        {
+            ++bestConnections;
+        }
+        auto iter = connections_.begin();
+        advance(iter, rand_r(&randSeed_) % bestConnections);
+        return *iter;
     }
 }
 
@@ -189,23 +202,63 @@ void RecoveryManager::setupConnections(
                 groupConfiguration->host(i).datacenter == datacenter;
             uint32_t metric = isLocal ? localMetric : remoteMetric;
             if(isLocal || !groupConfiguration->isLearner()) {
-                RecoveryConnection::ptr connection(
-                    new RecoveryConnection(
-                        groupConfiguration->host(i).name,
-                        metric + i, // TODO(skywalker): be more clever
+                startConnection(groupConfiguration->host(i).name,
+                                metric,
+                                groupConfiguration->host(i).unicastAddress,
+                                ioManager,
+                                connectionPollIntervalUs,
+                                reconnectDelayUs,
+                                socketTimeoutUs,
+                                instanceRetryIntervalUs);
+            }
+        }
+    }
+}
+
+void RecoveryManager::setupPeerConnections(
+    const vector<string>& peers,
+    IOManager* ioManager,
+    uint32_t peerMetric,
+    uint64_t connectionPollIntervalUs,
+    uint64_t reconnectDelayUs,
+    uint64_t socketTimeoutUs,
+    uint64_t instanceRetryIntervalUs)
+{
+    for(size_t i = 0; i < peers.size(); ++i) {
+        startConnection(peers[i],
+                        peerMetric,
+                        Address::lookup(peers[i], AF_INET).front(),
+                        ioManager,
                         connectionPollIntervalUs,
                         reconnectDelayUs,
                         socketTimeoutUs,
-                        instanceRetryIntervalUs,
-                        groupConfiguration->host(i).unicastAddress,
-                        shared_from_this(),
-                        ioManager));
-                ioManager->schedule(
-                    boost::bind(&RecoveryConnection::run,
-                                connection));
-            }
-        }
+                        instanceRetryIntervalUs);
     }
 }
 
+void RecoveryManager::startConnection(const string& name,
+                                      uint32_t metric,
+                                      Address::ptr address,
+                                      IOManager* ioManager,
+                                      uint64_t connectionPollIntervalUs,
+                                      uint64_t reconnectDelayUs,
+                                      uint64_t socketTimeoutUs,
+                                      uint64_t instanceRetryIntervalUs)
+{
+    RecoveryConnection::ptr connection(
+        new RecoveryConnection(
+            name,
+            metric,
+            connectionPollIntervalUs,
+            reconnectDelayUs,
+            socketTimeoutUs,
+            instanceRetryIntervalUs,
+            address,
+            shared_from_this(),
+            ioManager));
+    ioManager->schedule(
+        boost::bind(&RecoveryConnection::run,
+                    connection));
+}
+
 }  // namespace lightning
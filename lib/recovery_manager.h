@@ -11,6 +11,7 @@
 #include <mordor/iomanager.h>
 #include <boost/enable_shared_from_this.hpp>
 #include <set>
+#include <string>
 #include <vector>
 
 namespace lightning {
@@ -48,6 +49,16 @@ public:
                           uint64_t socketTimeoutUs,
                           uint64_t instanceRetryDelayUs);
 
+    //! Creates connections to extra recovery sources, e.g. learners that
+    //  serve recovered values from their ValueCache.
+    void setupPeerConnections(const std::vector<std::string>& peers,
+                              Mordor::IOManager* ioManager,
+                              uint32_t peerMetric,
+                              uint64_t connectionPollIntervalUs,
+                              uint64_t reconnectDelayUs,
+                              uint64_t socketTimeoutUs,
+                              uint64_t instanceRetryDelayUs);
+
     //! Sets the recovery destination
     void setCommitTracker(boost::shared_ptr<CommitTracker> commitTracker);
 
@@ -56,15 +67,30 @@ public:
                            paxos::InstanceId instanceId,
                            const paxos::Value& value);
 private:
+    //! Picks a random connection among those with the lowest metric,
+    //  so that equally good sources share the recovery load.
     RecoveryConnection::ptr getBestConnection();
     RecoveryConnection::ptr getRandomConnection();
 
-    //! Compares connections by their metric.
+    void startConnection(const std::string& name,
+                         uint32_t metric,
+                         Mordor::Address::ptr address,
+                         Mordor::IOManager* ioManager,
+                         uint64_t connectionPollIntervalUs,
+                         uint64_t reconnectDelayUs,
+                         uint64_t socketTimeoutUs,
+                         uint64_t instanceRetryDelayUs);
+
+    //! Compares connections by their metric. Connections with equal
+    //  metrics are ordered arbitrarily.
     struct ConnectionCompare {
         bool operator()(const RecoveryConnection::ptr& a,
                         const RecoveryConnection::ptr& b)
         {
-            return a->metric() < b->metric();
+            if(a->metric() != b->metric()) {
+                return a->metric() < b->metric();
+            }
+            return a < b;
         }
     };
 
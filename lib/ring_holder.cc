@@ -1,5 +1,6 @@
 #include "ring_holder.h"
 #include <mordor/log.h>
+#include <boost/shared_ptr.hpp>
 #include <sstream>
 
 namespace lightning {
@@ -22,10 +23,10 @@ void RingHolder::resetRingConfiguration(
     RingConfiguration::const_ptr ringConfiguration)
 {
     FiberMutex::ScopedLock lk(mutex_);
-    ringConfiguration_ = ringConfiguration;
+    boost::atomic_store(&ringConfiguration_, ringConfiguration);
     MORDOR_LOG_TRACE(g_log) << this << " reset ring configuration to " <<
-                               configurationToString();
-    if(ringConfiguration_) {
+                               configurationToString(ringConfiguration);
+    if(ringConfiguration) {
         ringEvent_.set();
     } else {
         ringEvent_.reset();
@@ -35,29 +36,33 @@ void RingHolder::resetRingConfiguration(
 RingConfiguration::const_ptr RingHolder::acquireRingConfiguration() const {
     while(true) {
         ringEvent_.wait();
-        FiberMutex::ScopedLock lk(mutex_);
-        if(!ringConfiguration_) {
+        RingConfiguration::const_ptr ringConfiguration =
+            boost::atomic_load(&ringConfiguration_);
+        if(!ringConfiguration) {
             continue;
         }
         MORDOR_LOG_TRACE(g_log) << this << " acquired ring configuration " <<
-                                   configurationToString();
-        return ringConfiguration_;
+                                   configurationToString(ringConfiguration);
+        return ringConfiguration;
     }
 }
 
 RingConfiguration::const_ptr RingHolder::tryAcquireRingConfiguration() const {
-    FiberMutex::ScopedLock lk(mutex_);
+    RingConfiguration::const_ptr ringConfiguration =
+        boost::atomic_load(&ringConfiguration_);
     MORDOR_LOG_TRACE(g_log) << this << " tryAcquireRingConfiguration = " <<
-                               configurationToString();
-    return ringConfiguration_;
+                               configurationToString(ringConfiguration);
+    return ringConfiguration;
 }
 
-string RingHolder::configurationToString() const {
+string RingHolder::configurationToString(
+    const RingConfiguration::const_ptr& ringConfiguration)
+{
     ostringstream ss;
-    if(!ringConfiguration_) {
+    if(!ringConfiguration) {
         ss << "(null)";
     } else {
-        ss << *ringConfiguration_;
+        ss << *ringConfiguration;
     }
     return ss.str();
 }
@@ -9,7 +9,10 @@ namespace lightning {
 
 //! A base class for all things that rely on a valid
 //  ring configuration to work.
-//  This class is fiber-safe.
+//  This class is fiber- and thread-safe. Readers never take the mutex:
+//  the configuration pointer is read with an atomic shared_ptr load,
+//  since the receive loops on different threads look it up for
+//  every packet.
 class RingHolder {
 public:
     typedef boost::shared_ptr<RingHolder> ptr;
@@ -29,11 +32,15 @@ protected:
     RingConfiguration::const_ptr tryAcquireRingConfiguration() const;
 
 private:
-    //! For debug logging, called under lock.
-    std::string configurationToString() const;
+    //! For debug logging.
+    static std::string configurationToString(
+        const RingConfiguration::const_ptr& ringConfiguration);
 
-    mutable Mordor::FiberMutex mutex_;
+    //! Serializes writers, so that the event state matches
+    //  the stored configuration.
+    Mordor::FiberMutex mutex_;
     mutable Mordor::FiberEvent ringEvent_;
+    //! Accessed with boost::atomic_load/atomic_store only.
     RingConfiguration::const_ptr ringConfiguration_;
 };
 
@@ -1,13 +1,16 @@
 #include "ring_voter.h"
+#include "datagram.h"
+#include "metrics.h"
+#include "trace.h"
 #include <mordor/assert.h>
 #include <mordor/log.h>
 #include <mordor/statistics.h>
 #include <algorithm>
+#include <vector>
+#include <sys/time.h>
 
 namespace lightning {
 
-const size_t RingVoter::kMaxDatagramSize;
-
 using Mordor::Address;
 using Mordor::Socket;
 using Mordor::Logger;
@@ -29,6 +32,21 @@ static CountStatistic<uint64_t>& g_inBytes =
     Statistics::registerStatistic("ring_voter.in_bytes",
                                   CountStatistic<uint64_t>("bytes"));
 
+static Histogram& g_hopTime =
+    Metrics::registerHistogram("ring_voter.hop_time");
+
+namespace {
+
+//! Votes cross hosts, so unlike TimerManager::now() this must be
+//  comparable between them.
+uint64_t wallClockUs() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return uint64_t(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+}  // anonymous namespace
+
 RingVoter::RingVoter(Socket::ptr socket,
                      UdpSender::ptr udpSender,
                      AcceptorState::ptr acceptorState)
@@ -41,10 +59,10 @@ void RingVoter::run() {
     Address::ptr remoteAddress = socket_->emptyAddress();
     MORDOR_LOG_TRACE(g_log) << this << " listening at " <<
                                *(socket_->localAddress()); 
+    vector<char> buffer(kMaxDatagramSize);
     while(true) {
-        char buffer[kMaxDatagramSize];
-        ssize_t bytes = socket_->receiveFrom((void*)buffer,
-                                             sizeof(buffer),
+        ssize_t bytes = socket_->receiveFrom((void*)&buffer[0],
+                                             buffer.size(),
                                              *remoteAddress);
         g_inBytes.add(bytes);
         g_inPackets.increment();
@@ -52,7 +70,7 @@ void RingVoter::run() {
                                    *remoteAddress;
 
         boost::shared_ptr<RpcMessageData> requestData(new RpcMessageData);
-        if(!requestData->ParseFromArray(buffer, bytes)) {
+        if(!requestData->ParseFromArray(&buffer[0], bytes)) {
             MORDOR_LOG_WARNING(g_log) << this << " malformed " << bytes <<
                                          " bytes from " << *remoteAddress;
             continue;
@@ -74,8 +92,17 @@ void RingVoter::run() {
             continue;
         }
         MORDOR_LOG_TRACE(g_log) << this << " processing vote " << requestGuid;
+        if(requestData->vote().has_sent_at_us()) {
+            const uint64_t sentAtUs = requestData->vote().sent_at_us();
+            const uint64_t now = wallClockUs();
+            // Clock skew between the hosts can make it negative.
+            g_hopTime.record(now > sentAtUs ? now - sentAtUs : 0);
+        }
 
         Vote vote(requestData, shared_from_this());
+        if(vote.traced()) {
+            Tracer::record(TRACE_VOTE_RECEIVED, vote.instance());
+        }
 
         if(processVote(ringConfiguration, vote)) {
             send(vote);
@@ -94,6 +121,10 @@ void RingVoter::send(const Vote& vote) {
     Address::ptr destination = ring->nextRingAddress();
     MORDOR_LOG_TRACE(g_log) << this << " sending " << vote << " to " <<
                                *destination;
+    vote.message_->mutable_vote()->set_sent_at_us(wallClockUs());
+    if(vote.traced()) {
+        Tracer::record(TRACE_VOTE_SENT, vote.instance());
+    }
     udpSender_->send(destination, vote.message_);
 }
 
@@ -31,8 +31,6 @@ private:
     Mordor::Socket::ptr socket_;
     UdpSender::ptr udpSender_;
     AcceptorState::ptr acceptorState_;
-    
-    static const size_t kMaxDatagramSize = 8950;
 
     bool processVote(RingConfiguration::const_ptr ringConfiguration,
                      const Vote& vote);
@@ -0,0 +1,198 @@
+#include "benchmark.h"
+#include "guid.h"
+#include "proto/rpc_messages.pb.h"
+#include "value.h"
+#include <mordor/assert.h>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <string>
+#include <vector>
+
+using lightning::CommitData;
+using lightning::Guid;
+using lightning::GuidGenerator;
+using lightning::PaxosPhase1BatchReplyData;
+using lightning::PaxosPhase1ReplyData;
+using lightning::RpcMessageData;
+using lightning::benchmarkUse;
+using lightning::registerBenchmark;
+using lightning::resetBenchmarkCounters;
+using lightning::paxos::Value;
+using std::string;
+using std::vector;
+
+// Each message is encoded into a datagram buffer like UdpSender does and
+// decoded into a fresh message like the receive loops do.
+static const size_t kDatagramSize = 65536;
+//! Phase 2 requests carry a value of the default size and as many
+//  piggybacked commits.
+static const size_t kPiggybackedCommits = 8;
+static const size_t kReservedInstances = 16;
+static const uint32_t kRingSize = 5;
+
+namespace {
+
+//! In the order SampleMessages adds them.
+const char* const kMessageNames[] = {
+    "ping",
+    "set_ring",
+    "phase1_batch_request",
+    "phase1_batch_reply",
+    "phase1_request",
+    "phase1_reply",
+    "phase2_request",
+    "vote"
+};
+
+const size_t kMessageCount = sizeof(kMessageNames) / sizeof(kMessageNames[0]);
+
+//! Built on first use rather than during static initialization, which
+//  would depend on the order of the protobuf descriptors.
+struct SampleMessages {
+    SampleMessages();
+
+    void add(const string& name);
+
+    GuidGenerator guidGenerator;
+    Guid epoch;
+    vector<RpcMessageData> messages;
+};
+
+SampleMessages::SampleMessages()
+    : epoch(guidGenerator.generate())
+{
+    RpcMessageData* message;
+
+    add("ping");
+    message = &messages.back();
+    message->set_type(RpcMessageData::PING);
+    message->mutable_ping()->set_id(1);
+    message->mutable_ping()->set_sender_now(1000000);
+
+    add("set_ring");
+    message = &messages.back();
+    message->set_type(RpcMessageData::SET_RING);
+    guidGenerator.generate().serialize(
+        message->mutable_set_ring()->mutable_group_guid());
+    message->mutable_set_ring()->set_ring_id(1);
+    for(uint32_t i = 0; i < kRingSize; ++i) {
+        message->mutable_set_ring()->add_ring_host_ids(i);
+    }
+
+    add("phase1_batch_request");
+    message = &messages.back();
+    message->set_type(RpcMessageData::PAXOS_BATCH_PHASE1);
+    epoch.serialize(message->mutable_phase1_batch_request()->mutable_epoch());
+    message->mutable_phase1_batch_request()->set_ring_id(1);
+    message->mutable_phase1_batch_request()->set_ballot_id(1);
+    message->mutable_phase1_batch_request()->set_start_instance_id(1 << 20);
+    message->mutable_phase1_batch_request()->set_end_instance_id(2 << 20);
+
+    add("phase1_batch_reply");
+    message = &messages.back();
+    message->set_type(RpcMessageData::PAXOS_BATCH_PHASE1);
+    message->mutable_phase1_batch_reply()->set_type(
+        PaxosPhase1BatchReplyData::OK);
+    for(size_t i = 0; i < kReservedInstances; ++i) {
+        message->mutable_phase1_batch_reply()->add_reserved_instances(
+            (1 << 20) + i * 97);
+    }
+
+    add("phase1_request");
+    message = &messages.back();
+    message->set_type(RpcMessageData::PAXOS_PHASE1);
+    epoch.serialize(message->mutable_phase1_request()->mutable_epoch());
+    message->mutable_phase1_request()->set_ring_id(1);
+    message->mutable_phase1_request()->set_instance(1 << 20);
+    message->mutable_phase1_request()->set_ballot(2);
+
+    const Value value(guidGenerator.generate(),
+                      boost::shared_ptr<string>(
+                          new string(Value::kDefaultValueSize, 'x')));
+
+    add("phase1_reply");
+    message = &messages.back();
+    message->set_type(RpcMessageData::PAXOS_PHASE1);
+    message->mutable_phase1_reply()->set_type(PaxosPhase1ReplyData::OK);
+    message->mutable_phase1_reply()->set_last_ballot_id(1);
+    value.serialize(message->mutable_phase1_reply()->mutable_value());
+
+    add("phase2_request");
+    message = &messages.back();
+    message->set_type(RpcMessageData::PAXOS_PHASE2);
+    epoch.serialize(message->mutable_phase2_request()->mutable_epoch());
+    message->mutable_phase2_request()->set_ring_id(1);
+    message->mutable_phase2_request()->set_instance(1 << 20);
+    message->mutable_phase2_request()->set_ballot(1);
+    value.serialize(message->mutable_phase2_request()->mutable_value());
+    for(size_t i = 0; i < kPiggybackedCommits; ++i) {
+        CommitData* commit = message->mutable_phase2_request()->add_commits();
+        commit->set_instance((1 << 20) - kPiggybackedCommits + i);
+        guidGenerator.generate().serialize(commit->mutable_value_id());
+    }
+
+    add("vote");
+    message = &messages.back();
+    message->set_type(RpcMessageData::PAXOS_PHASE2);
+    epoch.serialize(message->mutable_vote()->mutable_epoch());
+    message->mutable_vote()->set_ring_id(1);
+    message->mutable_vote()->set_instance(1 << 20);
+    message->mutable_vote()->set_ballot(1);
+    value.valueId().serialize(message->mutable_vote()->mutable_value_id());
+    message->mutable_vote()->set_sent_at_us(1000000);
+    MORDOR_ASSERT(messages.size() == kMessageCount);
+}
+
+//! Appends a message with the fields every RPC carries.
+void SampleMessages::add(const string& name) {
+    MORDOR_ASSERT(name == kMessageNames[messages.size()]);
+    messages.push_back(RpcMessageData());
+    guidGenerator.generate().serialize(messages.back().mutable_uuid());
+    messages.back().set_request_seq(messages.size());
+    messages.back().set_steering_key(1);
+}
+
+const SampleMessages& sampleMessages() {
+    static SampleMessages messages;
+    return messages;
+}
+
+void encode(size_t index, size_t iterations) {
+    const RpcMessageData& message = sampleMessages().messages[index];
+    vector<char> buffer(kDatagramSize);
+    resetBenchmarkCounters();
+
+    for(size_t i = 0; i < iterations; ++i) {
+        const bool serialized =
+            message.SerializeToArray(&buffer[0], buffer.size());
+        MORDOR_ASSERT(serialized);
+        benchmarkUse(buffer[0]);
+    }
+}
+
+void decode(size_t index, size_t iterations) {
+    string datagram;
+    sampleMessages().messages[index].SerializeToString(&datagram);
+    resetBenchmarkCounters();
+
+    for(size_t i = 0; i < iterations; ++i) {
+        boost::shared_ptr<RpcMessageData> message(new RpcMessageData);
+        const bool parsed =
+            message->ParseFromArray(datagram.data(), datagram.size());
+        MORDOR_ASSERT(parsed);
+    }
+}
+
+bool registerMessageBenchmarks() {
+    for(size_t i = 0; i < kMessageCount; ++i) {
+        registerBenchmark(string("rpc_message_encode_") + kMessageNames[i],
+                          boost::bind(&encode, i, _1));
+        registerBenchmark(string("rpc_message_decode_") + kMessageNames[i],
+                          boost::bind(&decode, i, _1));
+    }
+    return true;
+}
+
+}  // anonymous namespace
+
+static bool g_registered = registerMessageBenchmarks();
@@ -4,7 +4,6 @@ namespace lightning {
 
 using Mordor::Address;
 using Mordor::FiberMutex;
-using Mordor::Timer;
 
 RpcRequest::RpcRequest(Address::ptr destination,
                        uint64_t timeoutUs)
@@ -19,30 +18,25 @@ void RpcRequest::wait() {
     //! XXX lock here?
 }
 
-void RpcRequest::setTimeoutTimer(const Timer::ptr& timer) {
+void RpcRequest::setRpcGuid(const Guid& guid) {
     FiberMutex::ScopedLock lk(mutex_);
-    timeoutTimer_ = timer;
+    rpcGuid_ = guid;
+    rpcGuid_.serialize(requestData_.mutable_uuid());
 }
 
-void RpcRequest::cancelTimeoutTimer() 
-{
+const Guid& RpcRequest::rpcGuid() const {
     FiberMutex::ScopedLock lk(mutex_);
-
-    if(timeoutTimer_.get()) {
-        timeoutTimer_->cancel();
-        timeoutTimer_.reset();
-    }
+    return rpcGuid_;
 }
 
-void RpcRequest::setRpcGuid(const Guid& guid) {
+void RpcRequest::setRequestSeq(uint64_t seq) {
     FiberMutex::ScopedLock lk(mutex_);
-    rpcGuid_ = guid;
-    rpcGuid_.serialize(requestData_.mutable_uuid());
+    requestData_.set_request_seq(seq);
 }
 
-const Guid& RpcRequest::rpcGuid() const {
+uint64_t RpcRequest::requestSeq() const {
     FiberMutex::ScopedLock lk(mutex_);
-    return rpcGuid_;
+    return requestData_.request_seq();
 }
 
 RpcRequest::Status RpcRequest::status() const {
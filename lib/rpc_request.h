@@ -4,7 +4,6 @@
 #include "proto/rpc_messages.pb.h"
 #include <mordor/fibersynchronization.h>
 #include <mordor/socket.h>
-#include <mordor/timer.h>
 #include <boost/shared_ptr.hpp>
 #include <iostream>
 
@@ -50,18 +49,16 @@ public:
     //! The timeout for this request in microseconds.
     uint64_t timeoutUs() const { return timeoutUs_; }
 
-    //! Set the timer that tracks the timeout expiration for this request
-    //  so it can be canceled later.
-    void setTimeoutTimer(const Mordor::Timer::ptr& timer);
-
-    //! Cancel the pending timeout timer (if any).
-    void cancelTimeoutTimer();
-
     //! Set the RPC GUID for this request.
     void setRpcGuid(const Guid& guid);
 
     const Guid& rpcGuid() const;
 
+    //! Set the sequence number the requester tracks this request by.
+    void setRequestSeq(uint64_t seq);
+
+    uint64_t requestSeq() const;
+
     //! Current status.
     Status status() const;
 
@@ -79,7 +76,6 @@ protected:
 private:
     const Mordor::Address::ptr destination_;
     const uint64_t timeoutUs_;
-    Mordor::Timer::ptr timeoutTimer_;
     Guid rpcGuid_;
 };
 
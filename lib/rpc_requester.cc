@@ -1,15 +1,18 @@
 #include "rpc_requester.h"
+#include "datagram.h"
 #include "proto/rpc_messages.pb.h"
 #include <mordor/assert.h>
 #include <mordor/log.h>
 #include <mordor/statistics.h>
 #include <mordor/timer.h>
+#include <boost/shared_ptr.hpp>
 #include <set>
 #include <sstream>
 
 namespace lightning {
 
-const size_t RpcRequester::kMaxDatagramSize;
+const size_t RpcRequester::kPendingTableSize;
+const size_t RpcRequester::kMaxSlotSkips;
 
 using Mordor::Address;
 using Mordor::FiberMutex;
@@ -19,7 +22,6 @@ using Mordor::Log;
 using Mordor::Socket;
 using Mordor::Statistics;
 using Mordor::CountStatistic;
-using Mordor::Timer;
 using Mordor::TimerManager;
 using std::ostringstream;
 using std::set;
@@ -41,28 +43,39 @@ RpcRequester::RpcRequester(
     UdpSender::ptr udpSender,
     Socket::ptr socket,
     GroupConfiguration::ptr groupConfiguration,
-    MulticastRpcStats::ptr rpcStats)
+    MulticastRpcStats::ptr rpcStats,
+    uint64_t timeoutTickUs)
     : ioManager_(ioManager),
       guidGenerator_(guidGenerator),
       udpSender_(udpSender),
       socket_(socket),
       groupConfiguration_(groupConfiguration),
-      rpcStats_(rpcStats)
+      rpcStats_(rpcStats),
+      pendingRequests_(kPendingTableSize, kMaxSlotSkips),
+      timeoutWheel_(timeoutTickUs, TimerManager::now())
 {
+    tickTimer_ = ioManager_->registerTimer(timeoutTickUs,
+                                           boost::bind(&RpcRequester::onTick,
+                                                       this),
+                                           true);
+}
+
+RpcRequester::~RpcRequester() {
+    tickTimer_->cancel();
 }
 
 void RpcRequester::processReplies() {
     Address::ptr currentSourceAddress = socket_->emptyAddress();
+    vector<char> buffer(kMaxDatagramSize);
     while(true) {
-        char buffer[kMaxDatagramSize + 1];
-        ssize_t bytes = socket_->receiveFrom((void*) buffer,
-                                             kMaxDatagramSize,
+        ssize_t bytes = socket_->receiveFrom((void*) &buffer[0],
+                                             buffer.size(),
                                              *currentSourceAddress);
         g_inPackets.increment();
         g_inBytes.add(bytes);
 
         RpcMessageData reply;
-        if(!reply.ParseFromArray(buffer, bytes)) {
+        if(!reply.ParseFromArray(&buffer[0], bytes)) {
             MORDOR_LOG_WARNING(g_log) << this << " failed to parse reply " <<
                                          "from " <<
                                          groupConfiguration_->addressToServiceName(currentSourceAddress);
@@ -73,12 +86,8 @@ void RpcRequester::processReplies() {
 
         Guid replyGuid = Guid::parse(reply.uuid());
         RpcRequest::ptr request;
-        {
-            FiberMutex::ScopedLock lk(mutex_);
-            auto requestIter = pendingRequests_.find(replyGuid);
-            if(requestIter != pendingRequests_.end()) {
-                request = requestIter->second;
-            }
+        if(reply.has_request_seq()) {
+            request = lookupReply(reply.request_seq(), replyGuid);
         }
         if(!request) {
             MORDOR_LOG_DEBUG(g_log) << this << " stale reply for request " <<
@@ -90,80 +99,166 @@ void RpcRequester::processReplies() {
                                    replyGuid << ", " << *request << ") from " <<
                                    groupConfiguration_->addressToServiceName(currentSourceAddress);
         request->onReply(currentSourceAddress, reply);
+        if(request->status() != RpcRequest::IN_PROGRESS) {
+            finishAsync(reply.request_seq(), request);
+        }
+    }
+}
+
+RpcRequest::ptr RpcRequester::lookupReply(uint64_t seq,
+                                          const Guid& guid) const
+{
+    RpcRequest::ptr request = pendingRequests_.lookupSlot(seq);
+    if(!request && pendingRequests_.hasOverflow()) {
+        FiberMutex::ScopedLock lk(mutex_);
+        const PendingRequest* pending = pendingRequests_.find(seq);
+        if(pending) {
+            request = pending->request;
+        }
+    }
+    // The slot might have been reused since we checked the sequence number.
+    if(request && request->rpcGuid() != guid) {
+        request.reset();
     }
+    return request;
 }
 
-void RpcRequester::timeoutRequest(const Guid& requestId) {
-    RpcRequest::ptr request;
+void RpcRequester::onTick() {
+    vector<RpcRequest::ptr> timedOut;
+    vector<CompletionCallback> callbacks;
     {
         FiberMutex::ScopedLock lk(mutex_);
-        auto requestIter = pendingRequests_.find(requestId);
-        if(requestIter == pendingRequests_.end()) {
-            MORDOR_LOG_TRACE(g_log) << this << " timeout request " <<
-                                       requestId << " not found";
-            return;
+        expiredRequests_.clear();
+        timeoutWheel_.advance(TimerManager::now(), &expiredRequests_);
+        for(size_t i = 0; i < expiredRequests_.size(); ++i) {
+            PendingRequest* pending =
+                pendingRequests_.find(expiredRequests_[i]);
+            MORDOR_ASSERT(pending);
+            RpcRequest::ptr request = pending->request;
+            MORDOR_LOG_TRACE(g_log) << this << " timed out request " <<
+                                       request->rpcGuid() << " = " <<
+                                       *request;
+            // The wheel has already released the handle.
+            pending->timeout = NULL;
+            timedOut.push_back(request);
+            callbacks.push_back(pending->onComplete);
+            pendingRequests_.erase(expiredRequests_[i]);
+        }
+    }
+    for(size_t i = 0; i < timedOut.size(); ++i) {
+        timedOut[i]->onTimeout();
+        if(callbacks[i]) {
+            rpcStats_->sentPacket(timedOut[i]->requestData()->ByteSize());
+            callbacks[i](timedOut[i]->status());
         }
-        request = requestIter->second;
-        MORDOR_LOG_TRACE(g_log) << this << " timed out request " <<
-                                   requestId << " = " <<
-                                   *request;
-        pendingRequests_.erase(requestIter);
     }
-    request->onTimeout();
 }
 
-void RpcRequester::startTimeoutTimer(
-    RpcRequest::ptr request)
-{
-    MORDOR_LOG_TRACE(g_log) << this << " request (" <<
-                               request->rpcGuid() << ", " << *request <<
-                               ") sent";
-    Timer::ptr timeoutTimer = ioManager_->registerTimer(request->timeoutUs(),
-                                  boost::bind(
-                                  &RpcRequester::timeoutRequest,
-                                  this,
-                                  request->rpcGuid()));
-    request->setTimeoutTimer(timeoutTimer);
+void RpcRequester::startTimeout(RpcRequest::ptr request) {
+    const uint64_t seq = request->requestSeq();
+    MORDOR_LOG_TRACE(g_log) << this << " request (" << request->rpcGuid() <<
+                               ", " << *request << ") sent";
+    FiberMutex::ScopedLock lk(mutex_);
+    PendingRequest* pending = pendingRequests_.find(seq);
+    if(!pending) {
+        // Already completed before the send callback fired.
+        return;
+    }
+    MORDOR_ASSERT(!pending->timeout);
+    pending->timeout = timeoutWheel_.schedule(request->timeoutUs(), seq);
 }
 
-void RpcRequester::onSendFail(RpcRequest::ptr request) {
+void RpcRequester::onSendFail(RpcRequest::ptr request, uint64_t seq) {
     MORDOR_LOG_TRACE(g_log) << this << " failed to send " << *request;
     request->onTimeout();
+    finishAsync(seq, request);
 }
 
-RpcRequest::Status RpcRequester::request(
-    RpcRequest::ptr request)
+uint64_t RpcRequester::beginRequest(const RpcRequest::ptr& request,
+                                    const CompletionCallback& onComplete)
 {
     Guid requestGuid = guidGenerator_->generate();
-    request->setRpcGuid(requestGuid);
-
-    MORDOR_LOG_TRACE(g_log) << this << " new request (" << requestGuid <<
-                               ", " << *request << ")";
+    uint64_t requestSeq;
     {
         FiberMutex::ScopedLock lk(mutex_);
-        pendingRequests_[requestGuid] = request;
+        // The guid must be set before the request becomes visible to
+        // lookupReply().
+        request->setRpcGuid(requestGuid);
+        requestSeq = pendingRequests_.insert(request);
+        request->setRequestSeq(requestSeq);
+        pendingRequests_.find(requestSeq)->onComplete = onComplete;
     }
+    MORDOR_LOG_TRACE(g_log) << this << " new request (" << requestGuid <<
+                               ", " << requestSeq << ", " << *request << ")";
+    return requestSeq;
+}
 
+void RpcRequester::sendRequest(const RpcRequest::ptr& request) {
     udpSender_->send(request->destination(),
                      boost::shared_ptr<const RpcMessageData>(
                          request,
                          request->requestData()),
-                     boost::bind(&RpcRequester::startTimeoutTimer,
+                     boost::bind(&RpcRequester::startTimeout,
                                  this,
                                  request),
                      boost::bind(&RpcRequester::onSendFail,
                                  this,
-                                 request));
+                                 request,
+                                 request->requestSeq()));
+}
+
+void RpcRequester::finishAsync(uint64_t seq, const RpcRequest::ptr& request)
+{
+    CompletionCallback onComplete;
+    {
+        FiberMutex::ScopedLock lk(mutex_);
+        PendingRequest* pending = pendingRequests_.find(seq);
+        if(!pending || pending->request != request || !pending->onComplete) {
+            // Synchronous, or already completed by someone else.
+            return;
+        }
+        if(pending->timeout) {
+            timeoutWheel_.cancel(pending->timeout);
+        }
+        onComplete.swap(pending->onComplete);
+        pendingRequests_.erase(seq);
+    }
+    MORDOR_LOG_TRACE(g_log) << this << " completed request (" <<
+                               request->rpcGuid() << ", " << *request << ")";
+    rpcStats_->sentPacket(request->requestData()->ByteSize());
+    onComplete(request->status());
+}
+
+void RpcRequester::requestAsync(RpcRequest::ptr request,
+                                CompletionCallback onComplete)
+{
+    MORDOR_ASSERT(onComplete);
+    beginRequest(request, onComplete);
+    sendRequest(request);
+}
+
+RpcRequest::Status RpcRequester::request(
+    RpcRequest::ptr request)
+{
+    const uint64_t requestSeq = beginRequest(request, CompletionCallback());
+    const Guid requestGuid = request->rpcGuid();
+    sendRequest(request);
     request->wait();
-    request->cancelTimeoutTimer();
     rpcStats_->sentPacket(request->requestData()->ByteSize());
 
     {
         FiberMutex::ScopedLock lk(mutex_);
-        pendingRequests_.erase(requestGuid);
-        MORDOR_LOG_TRACE(g_log) << this << " removed request (" <<
-                                   requestGuid << ", " << *request <<
-                                   ") from pending";
+        PendingRequest* pending = pendingRequests_.find(requestSeq);
+        // Not found if the request has timed out.
+        if(pending) {
+            if(pending->timeout) {
+                timeoutWheel_.cancel(pending->timeout);
+            }
+            pendingRequests_.erase(requestSeq);
+            MORDOR_LOG_TRACE(g_log) << this << " removed request (" <<
+                                       requestGuid << ", " << *request <<
+                                       ") from pending";
+        }
     }
     RpcRequest::Status status = request->status();
     MORDOR_ASSERT(status != RpcRequest::IN_PROGRESS);
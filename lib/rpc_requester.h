@@ -4,13 +4,16 @@
 #include "host_configuration.h"
 #include "rpc_request.h"
 #include "multicast_rpc_stats.h"
+#include "pending_request_table.h"
+#include "timing_wheel.h"
 #include "udp_sender.h"
 #include <mordor/atomic.h>
 #include <mordor/fibersynchronization.h>
 #include <mordor/iomanager.h>
 #include <mordor/socket.h>
+#include <mordor/timer.h>
+#include <boost/function.hpp>
 #include <boost/noncopyable.hpp>
-#include <ext/hash_map>
 #include <utility>
 #include <vector>
 
@@ -19,8 +22,10 @@ namespace lightning {
 //! Provides a generic way to synchronously execute a command on a group
 //  of hosts within a specified timeout.
 //
-//  Each request is assigned a guid and sent to a specified multicast
-//  address.
+//  Each request is assigned a guid and a sequence number and sent to a
+//  specified multicast address. Replies echo both; the sequence number
+//  locates the request in a PendingRequestTable, usually without taking
+//  a lock, the guid is only used to validate the match.
 //  The requester is continuously listening to new incoming packets
 //  (which contain the request ids and replies) and applies them to the
 //  commands which are in-progress (i.e. have not timed out yet).
@@ -35,7 +40,9 @@ namespace lightning {
 //  method.
 //
 //  If needed replies are not received within a given timeout, a user-supplied
-//  onTimeout() is invoked.
+//  onTimeout() is invoked. Timeouts of all pending requests are tracked
+//  in a single timing wheel driven by one recurring timer, so that
+//  they are only precise up to the wheel tick.
 //
 //  Important note:
 //  * This synchronous request mechanism is even less safe that
@@ -66,10 +73,10 @@ public:
                  UdpSender::ptr udpSender,
                  Mordor::Socket::ptr socket,
                  GroupConfiguration::ptr groupConfiguration,
-                 MulticastRpcStats::ptr rpcStats);
+                 MulticastRpcStats::ptr rpcStats,
+                 uint64_t timeoutTickUs);
 
-    virtual ~RpcRequester()
-    {}
+    virtual ~RpcRequester();
 
     //! Collects reply datagrams.
     void processReplies();
@@ -77,18 +84,46 @@ public:
     //! Blocks until request is completed or until the timeout expires;
     RpcRequest::Status request(RpcRequest::ptr request);
 
+    typedef boost::function<void (RpcRequest::Status)> CompletionCallback;
+
+    //! Sends the request and returns immediately. onComplete is called
+    //  exactly once with the final status, either from processReplies()
+    //  or from the timeout tick, so it must not block for long.
+    void requestAsync(RpcRequest::ptr request,
+                      CompletionCallback onComplete);
+
 private:
-    //! Registers a timer that will time the request out.
+    typedef TimingWheel<uint64_t> TimeoutWheel;
+
+    //! Assigns the request id and starts tracking the request.
+    uint64_t beginRequest(const RpcRequest::ptr& request,
+                          const CompletionCallback& onComplete);
+
+    //! Hands the request over to udpSender_.
+    void sendRequest(const RpcRequest::ptr& request);
+
+    //! Completes an asynchronous request unless someone already did.
+    void finishAsync(uint64_t seq, const RpcRequest::ptr& request);
+
+    //! Lock-free in the common case. Returns a null pointer if there is
+    //  no pending request matching both seq and guid.
+    RpcRequest::ptr lookupReply(uint64_t seq, const Guid& guid) const;
+
+    //! Starts tracking the request timeout.
     //  Called as an onSend callback by UdpSender.
-    void startTimeoutTimer(RpcRequest::ptr request);
+    void startTimeout(RpcRequest::ptr request);
 
     //! onFail callback for UdpSender. Times out the request immediately.
-    void onSendFail(RpcRequest::ptr request);
+    void onSendFail(RpcRequest::ptr request, uint64_t seq);
 
-    //! Stop tracking a timed-out request.
-    void timeoutRequest(const Guid& requestId);
+    //! Advances the timeout wheel and times out the expired requests.
+    void onTick();
 
-    static const size_t kMaxDatagramSize = 8950;
+    //! Must be a power of 2, comfortably above the number of requests
+    //  in flight (about 8000 phase 2 requests at full rate).
+    static const size_t kPendingTableSize = 1 << 16;
+    //! How many busy slots are skipped before a request overflows.
+    static const size_t kMaxSlotSkips = 16;
 
     Mordor::IOManager* ioManager_;
     GuidGenerator::ptr guidGenerator_;
@@ -98,7 +133,12 @@ private:
     MulticastRpcStats::ptr rpcStats_;
 
     mutable Mordor::FiberMutex mutex_;
-    __gnu_cxx::hash_map<Guid, RpcRequest::ptr, GuidHasher> pendingRequests_;
+    //! Only lookupReply() reads it without mutex_.
+    PendingRequestTable pendingRequests_;
+    TimeoutWheel timeoutWheel_;
+    //! Reused by onTick() to avoid allocating on every tick.
+    std::vector<uint64_t> expiredRequests_;
+    Mordor::Timer::ptr tickTimer_;
 };
 
 }  // namespace lightning
@@ -1,18 +1,19 @@
 #include "rpc_responder.h"
+#include "datagram.h"
 #include "guid.h"
 #include "multicast_util.h"
 #include <mordor/log.h>
+#include <vector>
 
 namespace lightning {
 
-const size_t RpcResponder::kMaxDatagramSize;
-
 using Mordor::Address;
 using Mordor::Log;
 using Mordor::Logger;
 using Mordor::Socket;
 using std::string;
 using std::map;
+using std::vector;
 
 static Logger::ptr g_log = Log::lookup("lightning:multicast_rpc_responder");
 
@@ -32,13 +33,13 @@ void RpcResponder::run() {
                                ", replying @" <<
                                *replySocket_->localAddress();
     Address::ptr remoteAddress = listenSocket_->emptyAddress();
+    vector<char> buffer(kMaxDatagramSize);
     while(true) {
-        char buffer[kMaxDatagramSize];
-        ssize_t bytes = listenSocket_->receiveFrom((void*)buffer,
-                                                   sizeof(buffer),
+        ssize_t bytes = listenSocket_->receiveFrom((void*)&buffer[0],
+                                                   buffer.size(),
                                                    *remoteAddress);
         RpcMessageData requestData;
-        if(!requestData.ParseFromArray(buffer, bytes)) {
+        if(!requestData.ParseFromArray(&buffer[0], bytes)) {
             MORDOR_LOG_WARNING(g_log) << this << " malformed " << bytes <<
                                          " bytes from " << *remoteAddress;
             continue;
@@ -63,6 +64,9 @@ void RpcResponder::run() {
                                               &replyData))
         {
             requestGuid.serialize(replyData.mutable_uuid());
+            if(requestData.has_request_seq()) {
+                replyData.set_request_seq(requestData.request_seq());
+            }
             if(!replyData.SerializeToArray(buffer, sizeof(buffer))) {
                 MORDOR_LOG_WARNING(g_log) << this <<
                                              " failed to serialize reply " <<
@@ -7,6 +7,10 @@
 
 namespace lightning {
 
+//! Serves RPC requests arriving at one listen socket.
+//  An acceptor may run several responders, each on its own thread and
+//  listen socket, sharing the same handlers, which must therefore be
+//  thread-safe.
 class RpcResponder {
 public:
     typedef boost::shared_ptr<RpcResponder> ptr;
@@ -25,8 +29,6 @@ public:
     void addHandler(RpcMessageData::Type type,
                     RpcHandler::ptr handler);
 private:
-    static const size_t kMaxDatagramSize = 8950;
-
     Mordor::Socket::ptr listenSocket_;
     Mordor::Address::ptr multicastGroup_;
     Mordor::Socket::ptr replySocket_;
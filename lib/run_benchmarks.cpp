@@ -0,0 +1,35 @@
+#include <iostream>
+#include <string>
+
+#include "benchmark.h"
+#include "mordor/config.h"
+#include "mordor/iomanager.h"
+#include "mordor/main.h"
+#include <boost/bind.hpp>
+
+using namespace Mordor;
+using namespace lightning;
+
+static void runAll(int argc, char *argv[], size_t* benchmarksRun) {
+    if(argc > 1) {
+        for(int i = 1; i < argc; ++i) {
+            *benchmarksRun += runBenchmarks(argv[i], std::cout);
+        }
+    } else {
+        *benchmarksRun = runBenchmarks("", std::cout);
+    }
+}
+
+//! Usage: run_benchmarks [name prefix]...
+MORDOR_MAIN(int argc, char *argv[])
+{
+    Config::loadFromEnvironment();
+
+    size_t benchmarksRun = 0;
+    // Fiber synchronization needs a scheduler. A single thread keeps the
+    // numbers free of contention and cross-thread wakeups.
+    IOManager ioManager(1, true);
+    ioManager.schedule(boost::bind(&runAll, argc, argv, &benchmarksRun));
+    ioManager.stop();
+    return benchmarksRun > 0 ? 0 : 1;
+}
@@ -1,27 +1,71 @@
 #include "sleep_helper.h"
 #include <mordor/assert.h>
+#include <mordor/exception.h>
+#include <mordor/log.h>
 #include <mordor/sleep.h>
 #include <mordor/timer.h>
 #include <algorithm>
+#include <stdexcept>
+#include <errno.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
 
 namespace lightning {
 
 using Mordor::IOManager;
+using Mordor::Log;
+using Mordor::Logger;
+using Mordor::Scheduler;
 using Mordor::TimerManager;
 using Mordor::sleep;
+using std::invalid_argument;
 using std::max;
+using std::string;
+
+static Logger::ptr g_log = Log::lookup("lightning:sleep_helper");
 
 const int64_t SleepHelper::kEpollSleepPrecision;
+const int64_t SleepHelper::kSpinThreshold;
 
 SleepHelper::SleepHelper(IOManager* ioManager,
                          int64_t sleepInterval,
-                         int64_t sleepPrecision)
+                         int64_t sleepPrecision,
+                         Backend backend)
     : ioManager_(ioManager),
       sleepInterval_(sleepInterval),
       sleepPrecision_(sleepPrecision),
+      backend_(backend),
       accumulatedSleepTime_(0),
-      waitStartTime_(0)
-{}
+      waitStartTime_(0),
+      lastDeadline_(0),
+      timerFd_(-1)
+{
+    if(backend_ == TIMERFD) {
+        timerFd_ = timerfd_create(CLOCK_MONOTONIC,
+                                  TFD_NONBLOCK | TFD_CLOEXEC);
+        if(timerFd_ < 0) {
+            MORDOR_THROW_EXCEPTION_FROM_LAST_ERROR_API("timerfd_create");
+        }
+    }
+}
+
+SleepHelper::~SleepHelper() {
+    if(timerFd_ >= 0) {
+        close(timerFd_);
+    }
+}
+
+SleepHelper::Backend SleepHelper::parseBackend(const string& name) {
+    if(name == "epoll") {
+        return EPOLL;
+    } else if(name == "timerfd") {
+        return TIMERFD;
+    } else if(name == "busy_poll") {
+        return BUSY_POLL;
+    }
+    throw invalid_argument("unknown sleep backend " + name);
+}
 
 void SleepHelper::startWaiting() {
     MORDOR_ASSERT(waitStartTime_ == 0);
@@ -36,6 +80,20 @@ void SleepHelper::stopWaiting() {
 }
 
 void SleepHelper::wait() {
+    if(backend_ == EPOLL) {
+        waitAccumulated();
+    } else {
+        // Time spent waiting for external events is accounted for
+        // by the deadlines being absolute.
+        waitDeadline();
+    }
+}
+
+void SleepHelper::setSleepInterval(int64_t sleepInterval) {
+    sleepInterval_ = sleepInterval;
+}
+
+void SleepHelper::waitAccumulated() {
     accumulatedSleepTime_ += sleepInterval_;
     if(accumulatedSleepTime_ > sleepPrecision_) {
         startWaiting();
@@ -44,4 +102,52 @@ void SleepHelper::wait() {
     }
 }
 
+void SleepHelper::waitDeadline() {
+    const int64_t now = TimerManager::now();
+    const int64_t deadline =
+        (lastDeadline_ == 0) ?
+            now :
+            max(lastDeadline_ + sleepInterval_, now - sleepInterval_);
+    lastDeadline_ = deadline;
+    if(deadline <= now) {
+        return;
+    }
+
+    if(backend_ == TIMERFD) {
+        waitTimerFd(deadline - now);
+        return;
+    }
+
+    MORDOR_ASSERT(backend_ == BUSY_POLL);
+    if(deadline - now > kSpinThreshold) {
+        const int64_t sleepUs = deadline - now - kSpinThreshold;
+        struct timespec ts;
+        ts.tv_sec = sleepUs / 1000000;
+        ts.tv_nsec = (sleepUs % 1000000) * 1000;
+        while(clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, &ts) == EINTR) {}
+    }
+    while(int64_t(TimerManager::now()) < deadline) {}
+}
+
+void SleepHelper::waitTimerFd(int64_t timeoutUs) {
+    struct itimerspec spec;
+    spec.it_interval.tv_sec = 0;
+    spec.it_interval.tv_nsec = 0;
+    spec.it_value.tv_sec = timeoutUs / 1000000;
+    spec.it_value.tv_nsec = (timeoutUs % 1000000) * 1000;
+    if(timerfd_settime(timerFd_, 0, &spec, NULL) != 0) {
+        MORDOR_LOG_WARNING(g_log) << this << " timerfd_settime failed, " <<
+                                     "errno=" << errno;
+        sleep(*ioManager_, timeoutUs);
+        return;
+    }
+    ioManager_->registerEvent(timerFd_, IOManager::READ);
+    Scheduler::yieldTo();
+
+    uint64_t expirations;
+    while(read(timerFd_, &expirations, sizeof(expirations)) < 0 &&
+          errno == EINTR)
+    {}
+}
+
 }  // namespace lightning
@@ -1,39 +1,83 @@
 #pragma once
 
 #include <mordor/iomanager.h>
+#include <boost/noncopyable.hpp>
+#include <string>
 
 namespace lightning {
 
 //! Sometimes we need to perform some action (i.e. send a packet)
 //  repeatedly within some fixed rate. At high rates we are hampered
-//  by the limited precision of epoll (1ms) and don't yet care enough
-//  to utilize something more precise like timerfd.
-//  This class approximates low-latency sleep by accumulating unused sleep
-//  time and not sleeping if the accumulated sleep time is lower than the
-//  sleep precision.
-class SleepHelper {
+//  by the limited precision of epoll (1ms).
+//
+//  The EPOLL backend approximates low-latency sleep by accumulating unused
+//  sleep time and not sleeping if the accumulated sleep time is lower
+//  than the sleep precision. This keeps the average rate but releases
+//  the actions in bursts of sleepPrecision / sleepInterval.
+//
+//  The other backends pace against absolute deadlines spaced
+//  sleepInterval apart, so that the actions are evenly spread:
+//    * TIMERFD waits for a timerfd(2) in the IOManager, yielding the
+//      fiber. Its precision is that of hrtimers (tens of us).
+//    * BUSY_POLL sleeps in clock_nanosleep(2) and spins for the last
+//      kSpinThreshold us. It blocks the whole thread, so it must only
+//      be used on a DedicatedThread.
+//  If the caller falls behind, at most one action is released early to
+//  catch up, the rest of the backlog is forgotten.
+class SleepHelper : boost::noncopyable {
 public:
+    enum Backend {
+        EPOLL,
+        TIMERFD,
+        BUSY_POLL
+    };
+
+    //! sleepPrecision is only used by the EPOLL backend.
     SleepHelper(Mordor::IOManager* ioManager,
                 int64_t sleepInterval,
-                int64_t sleepPrecision);
+                int64_t sleepPrecision,
+                Backend backend = EPOLL);
+
+    ~SleepHelper();
 
     //! Accounts for waiting for external events, decreases the sleeping time.
     void startWaiting();
     void stopWaiting();
 
-    //! Waits for sleepInterval us using the approximation algorithm above.
+    //! Waits for sleepInterval us using the backend's algorithm above.
     void wait();
 
+    //! Changes sleepInterval for subsequent wait() calls.
+    void setSleepInterval(int64_t sleepInterval);
+
+    //! "epoll", "timerfd" or "busy_poll". Throws std::invalid_argument
+    //  on anything else.
+    static Backend parseBackend(const std::string& name);
+
     //! sleep precision of epoll_wait(2).
     static const int64_t kEpollSleepPrecision = 1000;
+    //! BUSY_POLL spins for this many us before a deadline.
+    static const int64_t kSpinThreshold = 50;
 private:
+    void waitAccumulated();
+
+    void waitDeadline();
+
+    //! Blocks the calling fiber until the timerfd fires in timeoutUs.
+    void waitTimerFd(int64_t timeoutUs);
+
     Mordor::IOManager* ioManager_;
 
-    const int64_t sleepInterval_;
+    int64_t sleepInterval_;
     const int64_t sleepPrecision_;
+    const Backend backend_;
     int64_t accumulatedSleepTime_;
 
     int64_t waitStartTime_;
+
+    //! Absolute time of the previous release, 0 before the first one.
+    int64_t lastDeadline_;
+    int timerFd_;
 };
 
 }  // namespace lightning
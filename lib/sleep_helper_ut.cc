@@ -0,0 +1,101 @@
+#include "sleep_helper.h"
+#include <mordor/assert.h>
+#include <mordor/iomanager.h>
+#include <mordor/test/test.h>
+#include <mordor/timer.h>
+#include <boost/bind.hpp>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+using namespace Mordor;
+using namespace lightning;
+using std::cout;
+using std::endl;
+using std::vector;
+
+namespace {
+
+const int64_t kInterval = 100;
+const size_t kReleases = 5000;
+//! Bound on the mean gap, in intervals. Generous: only catches a
+//  helper that does not pace at all or sleeps far too long.
+const double kMaxSlowdown = 10;
+
+struct GapStats {
+    double mean;
+    double stddev;
+    //! Fraction of gaps shorter than half the interval, i.e. releases
+    //  that went out back to back.
+    double burstFraction;
+};
+
+void releaseLoop(IOManager* ioManager,
+                 SleepHelper::Backend backend,
+                 vector<uint64_t>* releaseTimes)
+{
+    SleepHelper sleeper(ioManager,
+                        kInterval,
+                        SleepHelper::kEpollSleepPrecision,
+                        backend);
+    for(size_t i = 0; i < kReleases; ++i) {
+        sleeper.wait();
+        releaseTimes->push_back(TimerManager::now());
+    }
+}
+
+GapStats measureGaps(SleepHelper::Backend backend, const char* name) {
+    vector<uint64_t> releaseTimes;
+    {
+        IOManager ioManager(1, false);
+        ioManager.schedule(boost::bind(&releaseLoop,
+                                       &ioManager,
+                                       backend,
+                                       &releaseTimes));
+        ioManager.stop();
+    }
+    MORDOR_ASSERT(releaseTimes.size() == kReleases);
+
+    GapStats stats;
+    const size_t gaps = releaseTimes.size() - 1;
+    stats.mean = double(releaseTimes.back() - releaseTimes.front()) / gaps;
+    double squares = 0;
+    size_t bursts = 0;
+    for(size_t i = 1; i < releaseTimes.size(); ++i) {
+        const double gap = double(releaseTimes[i] - releaseTimes[i - 1]);
+        squares += (gap - stats.mean) * (gap - stats.mean);
+        if(gap < kInterval / 2) {
+            ++bursts;
+        }
+    }
+    stats.stddev = sqrt(squares / gaps);
+    stats.burstFraction = double(bursts) / gaps;
+    cout << name << ": mean gap " << stats.mean << "us, jitter " <<
+            stats.stddev << "us, back to back " <<
+            stats.burstFraction * 100 << "%" << endl;
+    return stats;
+}
+
+}  // anonymous namespace
+
+// Gaps are wall clock measurements, so only sanity bounds are checked
+// here: a loaded host delays releases, but never makes them early on
+// average. The jitter and burst figures are printed for a quick look.
+
+MORDOR_UNITTEST(SleepHelperTest, EpollKeepsAverageRate) {
+    GapStats stats = measureGaps(SleepHelper::EPOLL, "epoll");
+    MORDOR_TEST_ASSERT_GREATER_THAN_OR_EQUAL(stats.mean, kInterval * 0.8);
+    MORDOR_TEST_ASSERT_LESS_THAN_OR_EQUAL(stats.mean, kInterval * kMaxSlowdown);
+}
+
+MORDOR_UNITTEST(SleepHelperTest, TimerFdKeepsAverageRate) {
+    GapStats stats = measureGaps(SleepHelper::TIMERFD, "timerfd");
+    MORDOR_TEST_ASSERT_GREATER_THAN_OR_EQUAL(stats.mean, kInterval * 0.8);
+    MORDOR_TEST_ASSERT_LESS_THAN_OR_EQUAL(stats.mean, kInterval * kMaxSlowdown);
+}
+
+MORDOR_UNITTEST(SleepHelperTest, BusyPollKeepsAverageRate) {
+    GapStats stats = measureGaps(SleepHelper::BUSY_POLL, "busy_poll");
+    MORDOR_TEST_ASSERT_GREATER_THAN_OR_EQUAL(stats.mean, kInterval * 0.8);
+    MORDOR_TEST_ASSERT_LESS_THAN_OR_EQUAL(stats.mean, kInterval * kMaxSlowdown);
+}
@@ -0,0 +1,279 @@
+#include "snapshot_file_writer.h"
+#include "proto/rpc_messages.pb.h"
+#include <mordor/assert.h>
+#include <mordor/exception.h>
+#include <mordor/log.h>
+#include <mordor/statistics.h>
+#include <boost/noncopyable.hpp>
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace lightning {
+
+using Mordor::CountStatistic;
+using Mordor::FiberMutex;
+using Mordor::Log;
+using Mordor::Logger;
+using Mordor::Statistics;
+using std::make_pair;
+using std::max;
+using std::pair;
+using std::string;
+
+static Logger::ptr g_log = Log::lookup("lightning:snapshot_file_writer");
+
+static CountStatistic<uint64_t>& g_writtenBytes =
+    Statistics::registerStatistic("snapshot_file_writer.written_bytes",
+                                  CountStatistic<uint64_t>("bytes"));
+static CountStatistic<uint64_t>& g_writtenChunks =
+    Statistics::registerStatistic("snapshot_file_writer.written_chunks",
+                                  CountStatistic<uint64_t>());
+static CountStatistic<uint64_t>& g_reusedBytes =
+    Statistics::registerStatistic("snapshot_file_writer.reused_bytes",
+                                  CountStatistic<uint64_t>("bytes"));
+static CountStatistic<uint64_t>& g_corruptRanges =
+    Statistics::registerStatistic("snapshot_file_writer.corrupt_ranges",
+                                  CountStatistic<uint64_t>());
+
+static const char kManifestSuffix[] = ".manifest";
+static const char kCoverageSuffix[] = ".coverage";
+static const char kMissingSuffix[] = ".missing";
+
+//! Reads length bytes at offset, returns false on a short file.
+static bool readAt(int fd, uint64_t offset, size_t length, string* buffer) {
+    buffer->resize(length);
+    size_t done = 0;
+    while(done < length) {
+        const ssize_t bytes =
+            pread(fd, &(*buffer)[done], length - done, off_t(offset + done));
+        if(bytes < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            MORDOR_THROW_EXCEPTION_FROM_LAST_ERROR_API("pread");
+        }
+        if(bytes == 0) {
+            return false;
+        }
+        done += bytes;
+    }
+    return true;
+}
+
+namespace {
+
+//! Closes the file descriptor on scope exit.
+class FdCloser : boost::noncopyable {
+public:
+    explicit FdCloser(int fd) : fd_(fd) {}
+
+    ~FdCloser() {
+        close(fd_);
+    }
+private:
+    const int fd_;
+};
+
+}  // anonymous namespace
+
+const uint64_t SnapshotFileWriter::kUnknownEnd;
+
+SnapshotFileWriter::SnapshotFileWriter(const string& path)
+    : path_(path),
+      resuming_(manifest_.load(path + kManifestSuffix)),
+      reassembler_(path, resuming_),
+      endKnown_(false),
+      fileSnapshot_(false),
+      endedSubstreams_(0),
+      manifestComplete_(false)
+{
+    if(!resuming_) {
+        return;
+    }
+    endKnown_ = true;
+    fileSnapshot_ = true;
+    manifestComplete_.set();
+    reassembler_.setEnd(manifest_.totalSize());
+
+    StreamReassembler::Intervals written;
+    readByteRanges(path_ + kCoverageSuffix, &written);
+    ByteRanges missing;
+    checkRanges(written, &missing);
+    writeByteRanges(path_ + kMissingSuffix, missing);
+    uint64_t missingBytes = 0;
+    for(size_t i = 0; i < missing.size(); ++i) {
+        missingBytes += missing[i].second - missing[i].first;
+    }
+    g_reusedBytes.add(manifest_.totalSize() - missingBytes);
+    MORDOR_LOG_INFO(g_log) << this << " resuming " << path_ << ", " <<
+                              missingBytes << " of " <<
+                              manifest_.totalSize() << " bytes missing";
+}
+
+void SnapshotFileWriter::addChunk(const SnapshotStreamData& chunk) {
+    const uint32_t streamId = chunk.stream_id();
+    const uint32_t streamCount = chunk.stream_count();
+    if(streamCount == 0 || streamId >= streamCount) {
+        MORDOR_LOG_WARNING(g_log) << this << " bad substream " << streamId <<
+                                     " of " << streamCount;
+        return;
+    }
+    {
+        FiberMutex::ScopedLock lk(mutex_);
+        if(!endKnown_ && chunk.has_total_size()) {
+            // Also preallocates the file.
+            reassembler_.setEnd(chunk.total_size());
+            endKnown_ = true;
+            fileSnapshot_ = true;
+        }
+    }
+    if(chunk.has_manifest()) {
+        addManifestPart(chunk);
+        return;
+    }
+    if(!chunk.has_data()) {
+        endSubstream(chunk);
+        return;
+    }
+    const string& data = chunk.data();
+    reassembler_.addChunk(chunk.stream_offset() + chunk.position(),
+                          data.data(),
+                          data.length());
+    g_writtenBytes.add(data.length());
+    g_writtenChunks.increment();
+}
+
+uint64_t SnapshotFileWriter::waitComplete() {
+    const uint64_t size = reassembler_.waitComplete();
+    bool fileSnapshot;
+    {
+        FiberMutex::ScopedLock lk(mutex_);
+        fileSnapshot = fileSnapshot_;
+    }
+    if(fileSnapshot) {
+        manifestComplete_.wait();
+    }
+    return size;
+}
+
+bool SnapshotFileWriter::verify() {
+    FiberMutex::ScopedLock lk(mutex_);
+    if(!manifest_.complete()) {
+        return true;
+    }
+    StreamReassembler::Intervals everything(
+        1, make_pair(uint64_t(0), manifest_.totalSize()));
+    ByteRanges corrupt;
+    checkRanges(everything, &corrupt);
+    if(!corrupt.empty()) {
+        MORDOR_LOG_ERROR(g_log) << this << " " << corrupt.size() <<
+                                   " corrupt ranges in " << path_;
+        writeByteRanges(path_ + kMissingSuffix, corrupt);
+        return false;
+    }
+    unlink((path_ + kManifestSuffix).c_str());
+    unlink((path_ + kCoverageSuffix).c_str());
+    unlink((path_ + kMissingSuffix).c_str());
+    return true;
+}
+
+void SnapshotFileWriter::saveProgress() {
+    StreamReassembler::Intervals written;
+    // Only what has been synced may be recorded as written.
+    reassembler_.getCoverage(&written);
+    reassembler_.sync();
+    writeByteRanges(path_ + kCoverageSuffix, written);
+    MORDOR_LOG_DEBUG(g_log) << this << " saved " << written.size() <<
+                               " written intervals";
+}
+
+void SnapshotFileWriter::endSubstream(const SnapshotStreamData& chunk) {
+    const uint64_t end = chunk.stream_offset() + chunk.position();
+    MORDOR_LOG_DEBUG(g_log) << this << " substream " << chunk.stream_id() <<
+                               " ends at " << end;
+    FiberMutex::ScopedLock lk(mutex_);
+    if(substreamEnds_.empty()) {
+        substreamEnds_.resize(chunk.stream_count(), kUnknownEnd);
+    } else if(substreamEnds_.size() != chunk.stream_count()) {
+        MORDOR_LOG_WARNING(g_log) << this << " substream count " <<
+                                     chunk.stream_count() << " != " <<
+                                     substreamEnds_.size();
+        return;
+    }
+    uint64_t& substreamEnd = substreamEnds_[chunk.stream_id()];
+    if(substreamEnd == kUnknownEnd) {
+        substreamEnd = end;
+        ++endedSubstreams_;
+    }
+    if(endKnown_ || endedSubstreams_ < substreamEnds_.size()) {
+        return;
+    }
+    uint64_t snapshotEnd = 0;
+    for(size_t i = 0; i < substreamEnds_.size(); ++i) {
+        snapshotEnd = max(snapshotEnd, substreamEnds_[i]);
+    }
+    reassembler_.setEnd(snapshotEnd);
+    endKnown_ = true;
+}
+
+void SnapshotFileWriter::addManifestPart(const SnapshotStreamData& chunk) {
+    FiberMutex::ScopedLock lk(mutex_);
+    const bool wasComplete = manifest_.complete();
+    if(!manifest_.merge(chunk.manifest())) {
+        // Most likely resuming into a different snapshot, verify() will
+        // tell which ranges do not match.
+        MORDOR_LOG_WARNING(g_log) << this << " manifest part at " <<
+                                     chunk.manifest().first_range() <<
+                                     " does not match";
+        return;
+    }
+    if(!wasComplete && manifest_.complete()) {
+        MORDOR_LOG_INFO(g_log) << this << " got manifest of " <<
+                                  manifest_.rangeCount() << " ranges";
+        manifest_.save(path_ + kManifestSuffix);
+        manifestComplete_.set();
+    }
+}
+
+void SnapshotFileWriter::checkRanges(
+    const StreamReassembler::Intervals& written,
+    ByteRanges* bad)
+{
+    MORDOR_ASSERT(manifest_.complete());
+    const int fd = open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        MORDOR_THROW_EXCEPTION_FROM_LAST_ERROR_API("open");
+    }
+    // readAt throws on I/O errors.
+    FdCloser fdCloser(fd);
+    string buffer;
+    size_t j = 0;
+    for(size_t i = 0; i < manifest_.rangeCount(); ++i) {
+        const pair<uint64_t, uint64_t> range = manifest_.range(i);
+        while(j < written.size() && written[j].second < range.second) {
+            ++j;
+        }
+        const bool present = j < written.size() &&
+                             written[j].first <= range.first;
+        if(present &&
+           readAt(fd, range.first, range.second - range.first, &buffer) &&
+           manifest_.verify(i, buffer.data()))
+        {
+            reassembler_.addCovered(range.first, range.second);
+            continue;
+        }
+        if(present) {
+            g_corruptRanges.increment();
+        }
+        // Neighbouring ranges are sent as one.
+        if(!bad->empty() && bad->back().second == range.first) {
+            bad->back().second = range.second;
+        } else {
+            bad->push_back(range);
+        }
+    }
+}
+
+}  // namespace lightning
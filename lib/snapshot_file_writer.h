@@ -0,0 +1,88 @@
+#pragma once
+
+#include "snapshot_manifest.h"
+#include "stream_reassembler.h"
+#include <mordor/fibersynchronization.h>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace lightning {
+
+class SnapshotStreamData;
+
+//! Reassembles a snapshot split into several substreams directly into
+//  a file. Chunks are translated to snapshot offsets and handed to a
+//  file-backed StreamReassembler, so substreams never wait for each
+//  other and nothing is buffered in memory.
+//
+//  A chunk without data marks the end of its substream, its position
+//  being the substream length. The snapshot length is total_size if
+//  the producer knew it, otherwise the end of the furthest substream
+//  once all of them have ended.
+//
+//  File snapshots (those with total_size) come with a manifest of range
+//  digests, which is kept in path.manifest. Together with the coverage
+//  saved in path.coverage by saveProgress() it lets a restarted writer
+//  keep the ranges already on disk that still match their digests. The
+//  ranges left to transfer are then listed in path.missing, in the
+//  format submit_snapshot accepts.
+//
+//  Resuming is manual: the learner does not fetch the missing ranges
+//  itself. It saves its progress and exits on a transfer timeout or an
+//  epoch change; the operator then restarts it with the same output
+//  file and reruns submit_snapshot with path.missing as ranges file.
+class SnapshotFileWriter : boost::noncopyable {
+public:
+    typedef boost::shared_ptr<SnapshotFileWriter> ptr;
+
+    //! Resumes the transfer into path if there is a saved manifest,
+    //  otherwise creates or truncates the file.
+    SnapshotFileWriter(const std::string& path);
+
+    void addChunk(const SnapshotStreamData& chunk);
+
+    //! Blocks until the snapshot and its manifest, if any, are
+    //  complete, returns the snapshot size.
+    uint64_t waitComplete();
+
+    //! Checks the complete file against the manifest. Returns false and
+    //  lists the corrupt ranges in path.missing if there are any,
+    //  otherwise removes the resumption files.
+    bool verify();
+
+    //! Persists the coverage, so that a restarted writer can resume.
+    void saveProgress();
+
+private:
+    void endSubstream(const SnapshotStreamData& chunk);
+
+    void addManifestPart(const SnapshotStreamData& chunk);
+
+    //! Marks as covered the manifest ranges within written that match
+    //  their digests, adds all the others to bad.
+    void checkRanges(const StreamReassembler::Intervals& written,
+                     ByteRanges* bad);
+
+    static const uint64_t kUnknownEnd = ~0ull;
+
+    const std::string path_;
+    SnapshotManifest manifest_;
+    //! Set if manifest_ has been loaded from a previous run.
+    const bool resuming_;
+    StreamReassembler reassembler_;
+
+    bool endKnown_;
+    //! Set once total_size is seen, a manifest is then expected.
+    bool fileSnapshot_;
+    //! Snapshot offset of the end of each substream.
+    std::vector<uint64_t> substreamEnds_;
+    size_t endedSubstreams_;
+
+    Mordor::FiberEvent manifestComplete_;
+    Mordor::FiberMutex mutex_;
+};
+
+}  // namespace lightning
@@ -0,0 +1,193 @@
+#include "snapshot_manifest.h"
+#include "MurmurHash3.h"
+#include "proto/rpc_messages.pb.h"
+#include <mordor/assert.h>
+#include <mordor/exception.h>
+#include <mordor/log.h>
+#include <algorithm>
+#include <fstream>
+#include <stdio.h>
+
+namespace lightning {
+
+using Mordor::Log;
+using Mordor::Logger;
+using std::ifstream;
+using std::ios;
+using std::make_pair;
+using std::min;
+using std::ofstream;
+using std::pair;
+using std::string;
+using std::vector;
+
+static Logger::ptr g_log = Log::lookup("lightning:snapshot_manifest");
+
+const uint64_t SnapshotManifest::kDefaultRangeSize;
+const size_t SnapshotManifest::kMaxHashesPerValue;
+const uint32_t SnapshotManifest::kHashSeed;
+
+bool readByteRanges(const string& path, ByteRanges* ranges) {
+    ifstream in(path.c_str());
+    if(!in) {
+        return false;
+    }
+    ranges->clear();
+    uint64_t start, end;
+    while(in >> start >> end) {
+        if(start > end) {
+            MORDOR_LOG_WARNING(g_log) << " bad range [" << start << ", " <<
+                                         end << ") in " << path;
+            return false;
+        }
+        ranges->push_back(make_pair(start, end));
+    }
+    return in.eof();
+}
+
+void writeByteRanges(const string& path, const ByteRanges& ranges) {
+    const string tmpPath = path + ".tmp";
+    {
+        ofstream out(tmpPath.c_str(), ios::trunc);
+        for(size_t i = 0; i < ranges.size(); ++i) {
+            out << ranges[i].first << " " << ranges[i].second << "\n";
+        }
+        out.flush();
+        if(!out) {
+            MORDOR_THROW_EXCEPTION_FROM_LAST_ERROR_API("write");
+        }
+    }
+    if(rename(tmpPath.c_str(), path.c_str()) != 0) {
+        MORDOR_THROW_EXCEPTION_FROM_LAST_ERROR_API("rename");
+    }
+}
+
+SnapshotManifest::SnapshotManifest()
+    : totalSize_(0),
+      rangeSize_(0),
+      knownCount_(0)
+{}
+
+SnapshotManifest SnapshotManifest::build(const char* data,
+                                         uint64_t size,
+                                         uint64_t rangeSize)
+{
+    SnapshotManifest manifest;
+    manifest.reset(size, rangeSize);
+    for(size_t i = 0; i < manifest.rangeCount(); ++i) {
+        pair<uint64_t, uint64_t> r = manifest.range(i);
+        manifest.hashes_[i] = hash(data + r.first, r.second - r.first);
+        manifest.known_[i] = true;
+    }
+    manifest.knownCount_ = manifest.rangeCount();
+    return manifest;
+}
+
+void SnapshotManifest::serialize(size_t maxHashes,
+                                 vector<SnapshotManifestData>* parts) const
+{
+    MORDOR_ASSERT(complete());
+    MORDOR_ASSERT(maxHashes > 0);
+    parts->clear();
+    size_t i = 0;
+    do {
+        SnapshotManifestData part;
+        part.set_total_size(totalSize_);
+        part.set_range_size(rangeSize_);
+        part.set_first_range(i);
+        const size_t end = min(hashes_.size(), i + maxHashes);
+        for(; i < end; ++i) {
+            part.add_range_hashes(hashes_[i]);
+        }
+        parts->push_back(part);
+    } while(i < hashes_.size());
+}
+
+bool SnapshotManifest::merge(const SnapshotManifestData& part) {
+    if(rangeSize_ == 0) {
+        if(part.range_size() == 0 ||
+           part.range_size() > kDefaultRangeSize * 1024)
+        {
+            return false;
+        }
+        reset(part.total_size(), part.range_size());
+    }
+    if(part.total_size() != totalSize_ || part.range_size() != rangeSize_ ||
+       part.first_range() + size_t(part.range_hashes_size()) > hashes_.size())
+    {
+        return false;
+    }
+    bool consistent = true;
+    for(int j = 0; j < part.range_hashes_size(); ++j) {
+        const size_t i = part.first_range() + j;
+        if(known_[i]) {
+            consistent = consistent && (hashes_[i] == part.range_hashes(j));
+            continue;
+        }
+        hashes_[i] = part.range_hashes(j);
+        known_[i] = true;
+        ++knownCount_;
+    }
+    return consistent;
+}
+
+bool SnapshotManifest::complete() const {
+    return rangeSize_ != 0 && knownCount_ == hashes_.size();
+}
+
+pair<uint64_t, uint64_t> SnapshotManifest::range(size_t i) const {
+    MORDOR_ASSERT(i < hashes_.size());
+    const uint64_t start = i * rangeSize_;
+    return make_pair(start, min(totalSize_, start + rangeSize_));
+}
+
+bool SnapshotManifest::verify(size_t i, const char* data) const {
+    MORDOR_ASSERT(known_[i]);
+    pair<uint64_t, uint64_t> r = range(i);
+    return hash(data, r.second - r.first) == hashes_[i];
+}
+
+void SnapshotManifest::save(const string& path) const {
+    vector<SnapshotManifestData> parts;
+    serialize(hashes_.size() + 1, &parts);
+    MORDOR_ASSERT(parts.size() == 1);
+    const string tmpPath = path + ".tmp";
+    {
+        ofstream out(tmpPath.c_str(), ios::trunc | ios::binary);
+        if(!parts[0].SerializeToOstream(&out)) {
+            MORDOR_THROW_EXCEPTION_FROM_LAST_ERROR_API("write");
+        }
+    }
+    if(rename(tmpPath.c_str(), path.c_str()) != 0) {
+        MORDOR_THROW_EXCEPTION_FROM_LAST_ERROR_API("rename");
+    }
+}
+
+bool SnapshotManifest::load(const string& path) {
+    ifstream in(path.c_str(), ios::binary);
+    SnapshotManifestData data;
+    if(!in || !data.ParseFromIstream(&in)) {
+        return false;
+    }
+    *this = SnapshotManifest();
+    return merge(data) && complete();
+}
+
+uint64_t SnapshotManifest::hash(const char* data, size_t length) {
+    MORDOR_ASSERT(length <= kDefaultRangeSize * 1024);
+    uint64_t digest[2];
+    MurmurHash3_x64_128(data, int(length), kHashSeed, digest);
+    return digest[0];
+}
+
+void SnapshotManifest::reset(uint64_t totalSize, uint64_t rangeSize) {
+    MORDOR_ASSERT(rangeSize > 0);
+    totalSize_ = totalSize;
+    rangeSize_ = rangeSize;
+    const size_t ranges = size_t((totalSize + rangeSize - 1) / rangeSize);
+    hashes_.assign(ranges, 0);
+    known_.assign(ranges, false);
+    knownCount_ = 0;
+}
+
+}  // namespace lightning
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace lightning {
+
+class SnapshotManifestData;
+
+//! Byte intervals [first, second) of a snapshot.
+typedef std::vector<std::pair<uint64_t, uint64_t> > ByteRanges;
+
+//! Reads ranges stored by writeByteRanges. Returns false if the file
+//  does not exist or is malformed.
+bool readByteRanges(const std::string& path, ByteRanges* ranges);
+
+//! Stores one "start end" line per range, atomically replacing the file.
+void writeByteRanges(const std::string& path, const ByteRanges& ranges);
+
+//! Per-range digests of a snapshot, used by learners to check what they
+//  have written and to find out what is left to transfer after a
+//  restart.
+//  Not fiber-safe.
+class SnapshotManifest {
+public:
+    //! Empty manifest, to be filled by merge() or load().
+    SnapshotManifest();
+
+    //! Hashes size bytes at data in ranges of rangeSize bytes.
+    static SnapshotManifest build(const char* data,
+                                  uint64_t size,
+                                  uint64_t rangeSize);
+
+    //! Splits the manifest into parts of at most maxHashes digests.
+    void serialize(size_t maxHashes,
+                   std::vector<SnapshotManifestData>* parts) const;
+
+    //! Adds the digests from a part. Returns false if the part does not
+    //  match the manifest or contradicts digests already known.
+    bool merge(const SnapshotManifestData& part);
+
+    //! True once every range digest is known.
+    bool complete() const;
+
+    uint64_t totalSize() const { return totalSize_; }
+    uint64_t rangeSize() const { return rangeSize_; }
+    size_t rangeCount() const { return hashes_.size(); }
+
+    //! Byte interval of range i.
+    std::pair<uint64_t, uint64_t> range(size_t i) const;
+
+    //! Checks range(i) of the snapshot, data pointing to its first byte.
+    bool verify(size_t i, const char* data) const;
+
+    //! Stores a complete manifest.
+    void save(const std::string& path) const;
+
+    //! Returns false if there is no valid complete manifest at path.
+    bool load(const std::string& path);
+
+    static uint64_t hash(const char* data, size_t length);
+
+    //! Ranges must fit in an int for MurmurHash3.
+    static const uint64_t kDefaultRangeSize = 1 << 20;
+    //! Fits a part into a single value.
+    static const size_t kMaxHashesPerValue = 900;
+private:
+    void reset(uint64_t totalSize, uint64_t rangeSize);
+
+    uint64_t totalSize_;
+    uint64_t rangeSize_;
+    std::vector<uint64_t> hashes_;
+    std::vector<bool> known_;
+    size_t knownCount_;
+
+    static const uint32_t kHashSeed = 239;
+};
+
+}  // namespace lightning
@@ -1,6 +1,11 @@
 #include "stream_reassembler.h"
 #include <mordor/assert.h>
+#include <mordor/exception.h>
 #include <mordor/log.h>
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 namespace lightning {
 
@@ -9,6 +14,7 @@ using Mordor::FiberMutex;
 using Mordor::Log;
 using Mordor::Logger;
 using std::make_pair;
+using std::max;
 using std::string;
 
 static Logger::ptr g_log = Log::lookup("lightning:stream_reassembler");
@@ -18,12 +24,39 @@ const uint64_t StreamReassembler::kUnknownEndPosition;
 StreamReassembler::StreamReassembler()
     : readPosition_(0),
       endPosition_(kUnknownEndPosition),
+      fd_(-1),
+      streamComplete_(false),
       nextChunkAvailable_(false)
 {}
 
+StreamReassembler::StreamReassembler(const string& path, bool keepContents)
+    : readPosition_(0),
+      endPosition_(kUnknownEndPosition),
+      fd_(-1),
+      streamComplete_(false),
+      nextChunkAvailable_(false)
+{
+    fd_ = open(path.c_str(),
+               O_WRONLY | O_CREAT | O_CLOEXEC | (keepContents ? 0 : O_TRUNC),
+               0644);
+    if(fd_ < 0) {
+        MORDOR_THROW_EXCEPTION_FROM_LAST_ERROR_API("open");
+    }
+}
+
+StreamReassembler::~StreamReassembler() {
+    if(fd_ >= 0) {
+        close(fd_);
+    }
+}
+
 void StreamReassembler::addChunk(uint64_t position,
                                  boost::shared_ptr<string> data)
 {
+    if(fd_ >= 0) {
+        addChunk(position, data->data(), data->length());
+        return;
+    }
     MORDOR_LOG_TRACE(g_log) << this << " addChunk(" << position <<
         ", " << data->length() << "), readPosition=" << readPosition_;
     FiberMutex::ScopedLock lk(mutex_);
@@ -36,14 +69,147 @@ void StreamReassembler::addChunk(uint64_t position,
     }
 }
 
+void StreamReassembler::addChunk(uint64_t position,
+                                 const char* data,
+                                 size_t length)
+{
+    MORDOR_ASSERT(fd_ >= 0);
+    MORDOR_LOG_TRACE(g_log) << this << " addChunk(" << position <<
+        ", " << length << ") to file";
+    // Chunks never overlap in practice, and a repeated one rewrites
+    // the same bytes, so the write needs no lock.
+    writeAt(position, data, length);
+    FiberMutex::ScopedLock lk(mutex_);
+    cover(position, position + length);
+    if(covered()) {
+        streamComplete_.set();
+    }
+}
+
 void StreamReassembler::setEnd(uint64_t endPosition) {
     FiberMutex::ScopedLock lk(mutex_);
-    MORDOR_ASSERT(endPosition_ == kUnknownEndPosition);
     MORDOR_LOG_TRACE(g_log) << this << " setEnd(" << endPosition << ")";
+    if(fd_ < 0) {
+        MORDOR_ASSERT(endPosition_ == kUnknownEndPosition);
+        endPosition_ = endPosition;
+        return;
+    }
+    if(endPosition_ != kUnknownEndPosition) {
+        MORDOR_ASSERT(endPosition_ == endPosition);
+        return;
+    }
     endPosition_ = endPosition;
+    preallocate(endPosition_);
+    if(covered()) {
+        streamComplete_.set();
+    }
+}
+
+uint64_t StreamReassembler::waitComplete() {
+    MORDOR_ASSERT(fd_ >= 0);
+    streamComplete_.wait();
+    sync();
+    FiberMutex::ScopedLock lk(mutex_);
+    MORDOR_LOG_TRACE(g_log) << this << " stream of " << endPosition_ <<
+        " bytes written";
+    return endPosition_;
+}
+
+void StreamReassembler::addCovered(uint64_t start, uint64_t end) {
+    MORDOR_ASSERT(fd_ >= 0);
+    MORDOR_LOG_TRACE(g_log) << this << " addCovered(" << start << ", " <<
+        end << ")";
+    FiberMutex::ScopedLock lk(mutex_);
+    cover(start, end);
+    if(covered()) {
+        streamComplete_.set();
+    }
+}
+
+void StreamReassembler::getCoverage(Intervals* intervals) {
+    MORDOR_ASSERT(fd_ >= 0);
+    FiberMutex::ScopedLock lk(mutex_);
+    intervals->assign(covered_.begin(), covered_.end());
+}
+
+void StreamReassembler::sync() {
+    MORDOR_ASSERT(fd_ >= 0);
+    if(fdatasync(fd_) != 0) {
+        MORDOR_THROW_EXCEPTION_FROM_LAST_ERROR_API("fdatasync");
+    }
+}
+
+void StreamReassembler::writeAt(uint64_t position,
+                                const char* data,
+                                size_t length)
+{
+    while(length > 0) {
+        const ssize_t written = pwrite(fd_, data, length, off_t(position));
+        if(written < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            MORDOR_THROW_EXCEPTION_FROM_LAST_ERROR_API("pwrite");
+        }
+        data += written;
+        length -= written;
+        position += written;
+    }
+}
+
+void StreamReassembler::preallocate(uint64_t size) {
+    if(size == 0) {
+        return;
+    }
+    const int error = posix_fallocate(fd_, 0, off_t(size));
+    if(error == 0) {
+        return;
+    }
+    // Not every filesystem supports fallocate, at least set the size.
+    MORDOR_LOG_WARNING(g_log) << this << " posix_fallocate failed, " <<
+                                 "errno=" << error;
+    if(ftruncate(fd_, off_t(size)) != 0) {
+        MORDOR_THROW_EXCEPTION_FROM_LAST_ERROR_API("ftruncate");
+    }
+}
+
+void StreamReassembler::cover(uint64_t start, uint64_t end) {
+    if(start >= end) {
+        return;
+    }
+    // Absorb an interval that starts before and reaches start.
+    auto iter = covered_.upper_bound(start);
+    if(iter != covered_.begin()) {
+        auto prev = iter;
+        --prev;
+        if(prev->second >= start) {
+            start = prev->first;
+            end = max(end, prev->second);
+            iter = covered_.erase(prev);
+        }
+    }
+    // And all the intervals starting within [start, end].
+    while(iter != covered_.end() && iter->first <= end) {
+        end = max(end, iter->second);
+        iter = covered_.erase(iter);
+    }
+    covered_[start] = end;
+}
+
+bool StreamReassembler::covered() const {
+    if(endPosition_ == kUnknownEndPosition) {
+        return false;
+    }
+    if(endPosition_ == 0) {
+        return true;
+    }
+    return covered_.size() == 1 &&
+           covered_.begin()->first == 0 &&
+           covered_.begin()->second >= endPosition_;
 }
 
 boost::shared_ptr<string> StreamReassembler::nextChunk() {
+    MORDOR_ASSERT(fd_ < 0);
     nextChunkAvailable_.wait();
     FiberMutex::ScopedLock lk(mutex_);
 
@@ -2,25 +2,70 @@
 
 #include <mordor/fibersynchronization.h>
 #include <boost/shared_ptr.hpp>
+#include <map>
 #include <queue>
 #include <string>
 #include <utility>
+#include <vector>
 
 namespace lightning {
 
+//! Puts a stream delivered as chunks in arbitrary order back together.
+//
+//  By default chunks are buffered until everything before them has
+//  arrived and are then read in order with nextChunk().
+//
+//  In file-backed mode each chunk is written at its final offset as
+//  soon as it arrives and only the set of covered intervals is kept,
+//  so memory use is proportional to the number of gaps rather than to
+//  the amount of data received out of order. Chunks may then overlap
+//  or repeat, and waitComplete() returns once [0, end) is covered.
 class StreamReassembler {
 public:
     typedef boost::shared_ptr<StreamReassembler> ptr;
+    //! Byte intervals [first, second).
+    typedef std::vector<std::pair<uint64_t, uint64_t> > Intervals;
 
     StreamReassembler();
+    //! File-backed mode, creates the file at path. An existing file is
+    //  truncated unless keepContents is set.
+    StreamReassembler(const std::string& path, bool keepContents = false);
+    ~StreamReassembler();
 
     void addChunk(uint64_t position,
                   boost::shared_ptr<std::string> data);
 
+    //! File-backed mode only, data is not retained.
+    void addChunk(uint64_t position, const char* data, size_t length);
+
+    //! In file-backed mode also preallocates the file. May be called
+    //  again with the same position.
     void setEnd(uint64_t endPosition);
 
+    //! Not available in file-backed mode.
     boost::shared_ptr<std::string> nextChunk();
+
+    //! File-backed mode only. Blocks until the whole stream has been
+    //  written and synced to disk, returns its length.
+    uint64_t waitComplete();
+
+    //! File-backed mode only. Declares [start, end) as already present
+    //  in the file, e.g. verified after a restart.
+    void addCovered(uint64_t start, uint64_t end);
+
+    //! File-backed mode only. Intervals written so far, in order.
+    void getCoverage(Intervals* intervals);
+
+    //! File-backed mode only. Flushes the file to disk.
+    void sync();
 private:
+    void writeAt(uint64_t position, const char* data, size_t length);
+    void preallocate(uint64_t size);
+
+    //! Adds [start, end) to covered_, merging adjacent intervals.
+    void cover(uint64_t start, uint64_t end);
+    bool covered() const;
+
     typedef std::pair<uint64_t, boost::shared_ptr<std::string> > Chunk;
     struct ChunkCompare {
         bool operator()(const Chunk& a, const Chunk& b) const {
@@ -39,6 +84,12 @@ private:
 
     static const uint64_t kUnknownEndPosition = ~0ull;
 
+    //! -1 unless file-backed.
+    int fd_;
+    //! Disjoint, non-adjacent written intervals, start -> end.
+    std::map<uint64_t, uint64_t> covered_;
+    Mordor::FiberEvent streamComplete_;
+
     Mordor::FiberEvent nextChunkAvailable_;
     Mordor::FiberMutex mutex_;
 };
@@ -0,0 +1,46 @@
+#include "benchmark.h"
+#include "stream_reassembler.h"
+#include <mordor/assert.h>
+#include <boost/shared_ptr.hpp>
+#include <algorithm>
+#include <string>
+
+using lightning::StreamReassembler;
+using lightning::resetBenchmarkCounters;
+using std::min;
+using std::string;
+
+// One snapshot value worth of data per chunk.
+static const size_t kChunkSize = 8000;
+
+//! Adds chunks in windows of reorderWindow, each window in reverse, and
+//  reads every window once it is complete. In memory, the file-backed
+//  mode is bound by the writes.
+static void addReordered(size_t reorderWindow, size_t iterations) {
+    StreamReassembler reassembler;
+    boost::shared_ptr<string> data(new string(kChunkSize, 'x'));
+    resetBenchmarkCounters();
+
+    for(size_t start = 0; start < iterations; start += reorderWindow) {
+        const size_t end = min(start + reorderWindow, iterations);
+        for(size_t i = end; i > start; --i) {
+            reassembler.addChunk((i - 1) * kChunkSize, data);
+        }
+        for(size_t i = start; i < end; ++i) {
+            const boost::shared_ptr<string> chunk = reassembler.nextChunk();
+            MORDOR_ASSERT(chunk.get() == data.get());
+        }
+    }
+}
+
+LIGHTNING_BENCHMARK(stream_reassembler_in_order) {
+    addReordered(1, iterations);
+}
+
+LIGHTNING_BENCHMARK(stream_reassembler_reorder_16) {
+    addReordered(16, iterations);
+}
+
+LIGHTNING_BENCHMARK(stream_reassembler_reorder_1024) {
+    addReordered(1024, iterations);
+}
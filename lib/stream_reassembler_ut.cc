@@ -0,0 +1,138 @@
+#include "stream_reassembler.h"
+#include <mordor/test/test.h>
+#include <mordor/workerpool.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+using namespace Mordor;
+using namespace lightning;
+using std::ifstream;
+using std::istreambuf_iterator;
+using std::string;
+
+namespace {
+
+//! A temporary file, removed with the object.
+class TempFile {
+public:
+    TempFile() {
+        char path[] = "/tmp/stream_reassembler_ut.XXXXXX";
+        const int fd = mkstemp(path);
+        MORDOR_TEST_ASSERT(fd >= 0);
+        close(fd);
+        path_ = path;
+    }
+
+    ~TempFile() {
+        unlink(path_.c_str());
+    }
+
+    const string& path() const { return path_; }
+
+    string contents() const {
+        ifstream file(path_.c_str(), std::ios::binary);
+        return string(istreambuf_iterator<char>(file),
+                      istreambuf_iterator<char>());
+    }
+private:
+    string path_;
+};
+
+//! Adds [start, end) of stream to reassembler.
+void addRange(StreamReassembler* reassembler,
+              const string& stream,
+              size_t start,
+              size_t end)
+{
+    reassembler->addChunk(start, stream.data() + start, end - start);
+}
+
+}  // anonymous namespace
+
+MORDOR_UNITTEST(StreamReassemblerTest, FileModeReordersAndMerges) {
+    WorkerPool workerPool;
+    TempFile file;
+    const string stream = "0123456789abcdefghij";
+    StreamReassembler::Intervals coverage;
+    {
+        StreamReassembler reassembler(file.path());
+        addRange(&reassembler, stream, 15, 20);
+        addRange(&reassembler, stream, 5, 10);
+        reassembler.getCoverage(&coverage);
+        MORDOR_TEST_ASSERT_EQUAL(coverage.size(), 2u);
+        MORDOR_TEST_ASSERT_EQUAL(coverage[0].first, 5u);
+        MORDOR_TEST_ASSERT_EQUAL(coverage[0].second, 10u);
+        MORDOR_TEST_ASSERT_EQUAL(coverage[1].first, 15u);
+        MORDOR_TEST_ASSERT_EQUAL(coverage[1].second, 20u);
+
+        // Overlapping and repeated chunks.
+        addRange(&reassembler, stream, 8, 16);
+        addRange(&reassembler, stream, 5, 10);
+        reassembler.getCoverage(&coverage);
+        MORDOR_TEST_ASSERT_EQUAL(coverage.size(), 1u);
+        MORDOR_TEST_ASSERT_EQUAL(coverage[0].first, 5u);
+        MORDOR_TEST_ASSERT_EQUAL(coverage[0].second, 20u);
+
+        reassembler.setEnd(stream.length());
+        // Adjacent to the covered interval.
+        addRange(&reassembler, stream, 0, 5);
+        MORDOR_TEST_ASSERT_EQUAL(reassembler.waitComplete(), stream.length());
+    }
+    MORDOR_TEST_ASSERT_EQUAL(file.contents(), stream);
+}
+
+MORDOR_UNITTEST(StreamReassemblerTest, FileModeCompletesOnSetEnd) {
+    WorkerPool workerPool;
+    TempFile file;
+    const string stream = "abcdefgh";
+    {
+        StreamReassembler reassembler(file.path());
+        addRange(&reassembler, stream, 4, 8);
+        addRange(&reassembler, stream, 0, 4);
+        // The end may be learned last, and repeated.
+        reassembler.setEnd(stream.length());
+        reassembler.setEnd(stream.length());
+        MORDOR_TEST_ASSERT_EQUAL(reassembler.waitComplete(), stream.length());
+    }
+    MORDOR_TEST_ASSERT_EQUAL(file.contents(), stream);
+}
+
+MORDOR_UNITTEST(StreamReassemblerTest, FileModeEmptyStream) {
+    WorkerPool workerPool;
+    TempFile file;
+    StreamReassembler reassembler(file.path());
+    reassembler.setEnd(0);
+    MORDOR_TEST_ASSERT_EQUAL(reassembler.waitComplete(), 0u);
+}
+
+MORDOR_UNITTEST(StreamReassemblerTest, FileModeResumesCoveredRanges) {
+    WorkerPool workerPool;
+    TempFile file;
+    const string stream = "resumed transfer";
+    {
+        StreamReassembler reassembler(file.path());
+        reassembler.setEnd(stream.length());
+        addRange(&reassembler, stream, 0, 4);
+        addRange(&reassembler, stream, 10, 16);
+    }
+    {
+        // As after a restart, with the ranges verified by the caller.
+        StreamReassembler reassembler(file.path(), true);
+        reassembler.addCovered(0, 4);
+        reassembler.addCovered(10, 16);
+        reassembler.setEnd(stream.length());
+        StreamReassembler::Intervals coverage;
+        reassembler.getCoverage(&coverage);
+        MORDOR_TEST_ASSERT_EQUAL(coverage.size(), 2u);
+        addRange(&reassembler, stream, 4, 10);
+        MORDOR_TEST_ASSERT_EQUAL(reassembler.waitComplete(), stream.length());
+    }
+    MORDOR_TEST_ASSERT_EQUAL(file.contents(), stream);
+
+    // Without keepContents the file starts over.
+    StreamReassembler reassembler(file.path());
+    MORDOR_TEST_ASSERT_EQUAL(file.contents(), string());
+}
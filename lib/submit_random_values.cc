@@ -1,57 +1,181 @@
+#include "bench_value.h"
+#include "metrics.h"
 #include "value.h"
-#include "proto/rpc_messages.pb.h"
+#include "value_stream_client.h"
+#include <mordor/fibersynchronization.h>
 #include <mordor/iomanager.h>
+#include <mordor/sleep.h>
 #include <mordor/socket.h>
 #include <boost/lexical_cast.hpp>
 #include <iostream>
+#include <map>
+#include <vector>
 
 using namespace lightning;
 using namespace paxos;
 using namespace Mordor;
 using namespace std;
 
-void writeToSocket(Socket::ptr s, const char* data, size_t length) {
-    size_t sent = 0;
-    while(sent < length) {
-        sent += s->send(data + sent, length - sent);
+//! Measures the time from sending a value to receiving its commit ack.
+class CommitLatencyTracker {
+public:
+    CommitLatencyTracker(size_t expectedAcks)
+        : expectedAcks_(expectedAcks),
+          acks_(0),
+          ackedBytes_(0),
+          firstSendUs_(0),
+          lastAckUs_(0),
+          latency_("us"),
+          allAcked_(false)
+    {
+        if(expectedAcks_ == 0) {
+            allAcked_.set();
+        }
+    }
+
+    void onSend(const Guid& valueId, uint64_t sendTimeUs, size_t bytes) {
+        FiberMutex::ScopedLock lk(mutex_);
+        if(firstSendUs_ == 0) {
+            firstSendUs_ = sendTimeUs;
+        }
+        sendTimes_[valueId] = make_pair(sendTimeUs, bytes);
+    }
+
+    void onAck(const Guid& valueId, InstanceId) {
+        FiberMutex::ScopedLock lk(mutex_);
+        auto iter = sendTimes_.find(valueId);
+        if(iter == sendTimes_.end()) {
+            return;
+        }
+        lastAckUs_ = TimerManager::now();
+        latency_.record(lastAckUs_ - iter->second.first);
+        ackedBytes_ += iter->second.second;
+        sendTimes_.erase(iter);
+        if(++acks_ == expectedAcks_) {
+            allAcked_.set();
+        }
+    }
+
+    void waitAll() {
+        allAcked_.wait();
+    }
+
+    //! A human readable summary, then the same as one line of JSON for
+    //  tools/loopback_bench.py.
+    void print() {
+        FiberMutex::ScopedLock lk(mutex_);
+        Histogram::Snapshot snapshot;
+        latency_.snapshot(&snapshot);
+        const double seconds = (lastAckUs_ - firstSendUs_) / 1000000.;
+        const double valuesPerSec = seconds > 0 ? acks_ / seconds : 0;
+        const double bytesPerSec = seconds > 0 ? ackedBytes_ / seconds : 0;
+        cout << acks_ << " values committed in " << seconds << "s, " <<
+                uint64_t(valuesPerSec) << " values/s, " <<
+                uint64_t(bytesPerSec) << " bytes/s" << endl;
+        cout << "commit latency p50 " << snapshot.percentile(0.5) <<
+                "us, p99 " << snapshot.percentile(0.99) << "us, p99.9 " <<
+                snapshot.percentile(0.999) << "us, max " << snapshot.max <<
+                "us" << endl;
+        cout << "{\"committed\": " << acks_ <<
+                ", \"seconds\": " << seconds <<
+                ", \"values_per_sec\": " << valuesPerSec <<
+                ", \"bytes_per_sec\": " << bytesPerSec <<
+                ", \"commit_latency_us\": {\"p50\": " <<
+                snapshot.percentile(0.5) << ", \"p99\": " <<
+                snapshot.percentile(0.99) << ", \"p999\": " <<
+                snapshot.percentile(0.999) << ", \"max\": " <<
+                snapshot.max << "}}" << endl;
+    }
+private:
+    const size_t expectedAcks_;
+    //! Send time and size of the values in flight.
+    map<Guid, pair<uint64_t, size_t> > sendTimes_;
+    size_t acks_;
+    uint64_t ackedBytes_;
+    uint64_t firstSendUs_;
+    uint64_t lastAckUs_;
+    Histogram latency_;
+    FiberEvent allAcked_;
+    FiberMutex mutex_;
+};
+
+void readAcks(ValueStreamClient::ptr client) {
+    try {
+        client->readControlStream();
+    } catch(...) {
     }
 }
 
-void submitValues(Socket::ptr s, size_t n) {
+//! Sends n values of valueSize bytes, at most rate per second if rate is
+//  not 0. Values large enough carry a bench_value.h header, for the
+//  learners to measure delivery latency.
+void submitValues(IOManager* ioManager,
+                  Socket::ptr s,
+                  ValueStreamClient::ptr client,
+                  CommitLatencyTracker* tracker,
+                  size_t n,
+                  size_t batchSize,
+                  size_t valueSize,
+                  uint64_t rate)
+{
     GuidGenerator g;
     uint64_t startT = TimerManager::now();
-    size_t bytesSent = 0;
+    vector<Value> batch;
     for(size_t i = 0; i < n; ++i) {
-        boost::shared_ptr<string> data(new string(8000, ' '));
+        if(rate != 0) {
+            const uint64_t due = startT + i * 1000000 / rate;
+            const uint64_t now = TimerManager::now();
+            if(due > now) {
+                sleep(*ioManager, due - now);
+            }
+        }
+        boost::shared_ptr<string> data(new string(valueSize, ' '));
+        const uint64_t now = TimerManager::now();
+        if(valueSize >= kBenchValueHeaderSize) {
+            stampBenchValue(now, data.get());
+        }
         Guid valueId = g.generate();
         Value v(valueId, data);
-        ValueData valueData;
-        v.serialize(&valueData);
-
-        FixedSizeHeaderData header;
-        header.set_size(valueData.ByteSize());
-        char wireData[header.ByteSize() + valueData.ByteSize()];
-        header.SerializeToArray(wireData, header.ByteSize());
-        valueData.SerializeToArray(wireData + header.ByteSize(), valueData.ByteSize());
-        writeToSocket(s, wireData, header.ByteSize() + valueData.ByteSize());
-        bytesSent += header.ByteSize() + valueData.ByteSize();
+        tracker->onSend(valueId, now, valueSize);
+        if(batchSize <= 1) {
+            client->send(v);
+            continue;
+        }
+        batch.push_back(v);
+        if(batch.size() == batchSize || i + 1 == n) {
+            client->sendBatch(batch);
+            batch.clear();
+        }
     }
+    uint64_t bytesSent = client->sentBytes();
     uint64_t timeElapsed = TimerManager::now() - startT;
     cout << "done, sent " << bytesSent << " bytes in " << timeElapsed << "us, avg throughput " << int(bytesSent / (timeElapsed / 1000000.)) << " bps" << endl;
+    tracker->waitAll();
+    tracker->print();
+    s->shutdown();
 }
 
 int main(int argc, char **argv) {
     if(argc < 3) {
-        cout << " usage: send master_addr:port n" << endl;
+        cout << " usage: send master_addr:port n [batch_size [value_size [values_per_sec]]]" << endl;
         return 1;
     }
     const size_t instances = boost::lexical_cast<size_t>(argv[2]);
+    const size_t batchSize = (argc > 3) ? boost::lexical_cast<size_t>(argv[3]) : 1;
+    const size_t valueSize = (argc > 4) ? boost::lexical_cast<size_t>(argv[4]) : 8000;
+    const uint64_t rate = (argc > 5) ? boost::lexical_cast<uint64_t>(argv[5]) : 0;
     try {
         IOManager ioManager;
         Address::ptr masterAddress = Address::lookup(argv[1], AF_INET).front();
         Socket::ptr s = masterAddress->createSocket(ioManager, SOCK_STREAM);
         s->connect(masterAddress);
-        ioManager.schedule(boost::bind(submitValues, s, instances));
+        CommitLatencyTracker tracker(instances);
+        ValueStreamClient::ptr client(
+            new ValueStreamClient(s,
+                                  boost::bind(&CommitLatencyTracker::onAck,
+                                              &tracker, _1, _2)));
+        ioManager.schedule(boost::bind(readAcks, client));
+        ioManager.schedule(boost::bind(submitValues, &ioManager, s, client, &tracker, instances, batchSize, valueSize, rate));
         ioManager.dispatch();
     } catch(...) {
         cout << boost::current_exception_diagnostic_information();
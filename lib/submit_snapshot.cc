@@ -1,16 +1,26 @@
 #include "blocking_queue.h"
 #include "guid.h"
+#include "snapshot_manifest.h"
 #include "value.h"
+#include "value_stream_client.h"
 #include "proto/rpc_messages.pb.h"
 #include <mordor/config.h>
+#include <mordor/exception.h>
 #include <mordor/fibersynchronization.h>
 #include <mordor/iomanager.h>
 #include <mordor/log.h>
+#include <mordor/sleep.h>
 #include <mordor/socket.h>
 #include <mordor/streams/std.h>
 #include <boost/lexical_cast.hpp>
+#include <algorithm>
 #include <iostream>
 #include <set>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace lightning;
 using namespace paxos;
@@ -20,6 +30,26 @@ using boost::shared_ptr;
 
 static Logger::ptr g_log = Log::lookup("lightning:main");
 
+static const uint64_t kAckPollInterval = 10000;
+
+// Set SNAPSHOT_COMPRESS=1 in the environment to enable.
+static ConfigVar<bool>::ptr g_compress =
+    Config::lookup("snapshot.compress", false,
+                   "LZ4 compress snapshot chunks before submitting them");
+
+// Best set to what the master proposes in one instance for the group's
+// path MTU, larger chunks get fragmented.
+static ConfigVar<uint32_t>::ptr g_valueSize =
+    Config::lookup("snapshot.valuesize", uint32_t(Value::kDefaultValueSize),
+                   "Size of the values snapshot chunks are submitted in");
+
+//! Chunk size leaving overhead bytes of each value for the stream fields.
+size_t chunkSize(size_t overhead) {
+    const size_t valueSize = min<size_t>(g_valueSize->val(),
+                                         Value::kMaxValueSize);
+    return (valueSize > 2 * overhead) ? valueSize - overhead : overhead;
+}
+
 class SubmitBuffer {
 public:
     SubmitBuffer(size_t bufferSize,
@@ -35,7 +65,8 @@ public:
         canPush_.wait();
         FiberMutex::ScopedLock lk(mutex_);
         pendingIds_.insert(value.valueId());
-        if(pendingIds_.size() == bufferSize_) {
+        // Several producers may get past canPush_ at once.
+        if(pendingIds_.size() >= bufferSize_) {
             MORDOR_LOG_INFO(g_log) << this << " buffer full";
             canPush_.reset();
         }
@@ -47,7 +78,7 @@ public:
         FiberMutex::ScopedLock lk(mutex_);
         pendingIds_.erase(valueId);
         MORDOR_LOG_TRACE(g_log) << this << " buffer notify(" << valueId << "), buffered=" << pendingIds_.size();
-        if(pendingIds_.size() + 1 == bufferSize_) {
+        if(pendingIds_.size() < bufferSize_) {
             MORDOR_LOG_INFO(g_log) << this << " buffer ready for new values";
             canPush_.set();
         }
@@ -63,7 +94,15 @@ private:
 };
 
 
-Value createValue(const Guid& valueId, uint64_t snapshotId, uint64_t position, const char* data, size_t dataLength) {
+//! Substream layout of a file snapshot.
+struct StreamInfo {
+    uint32_t streamId;
+    uint32_t streamCount;
+    uint64_t streamOffset;
+    uint64_t totalSize;
+};
+
+Value createValue(const Guid& valueId, uint64_t snapshotId, uint64_t position, const char* data, size_t dataLength, const StreamInfo* streamInfo = NULL) {
     boost::shared_ptr<string> valueData(new string);
     SnapshotStreamData streamData;
     streamData.set_snapshot_id(snapshotId);
@@ -71,11 +110,21 @@ Value createValue(const Guid& valueId, uint64_t snapshotId, uint64_t position, c
     if(dataLength > 0) {
         streamData.set_data(data, dataLength);
     }
+    if(streamInfo) {
+        streamData.set_stream_id(streamInfo->streamId);
+        streamData.set_stream_count(streamInfo->streamCount);
+        streamData.set_stream_offset(streamInfo->streamOffset);
+        streamData.set_total_size(streamInfo->totalSize);
+    }
     streamData.SerializeToString(valueData.get());
-    if(valueData->length() > Value::kMaxValueSize) {
+    if(valueData->length() > g_valueSize->val()) {
         MORDOR_LOG_ERROR(g_log) << " bad value " << valueId << " with " << valueData->length() << " bytes";
     }
-    return Value(valueId, valueData);
+    Value value(valueId, valueData);
+    if(g_compress->val() && dataLength > 0) {
+        value.compress();
+    }
+    return value;
 }
 
 void readData(SubmitBuffer* submitBuffer,
@@ -83,17 +132,17 @@ void readData(SubmitBuffer* submitBuffer,
               IOManager* ioManager)
 {
     GuidGenerator g;
-    const size_t kChunkSize = Value::kMaxValueSize - 2 * sizeof(uint64_t) - 2;
+    const size_t kChunkSize = chunkSize(2 * sizeof(uint64_t) + 2);
     StdinStream inputStream(*ioManager);
 
-    char buffer[kChunkSize];
+    vector<char> buffer(kChunkSize);
     uint64_t position = 0;
     uint64_t startT = TimerManager::now();
     while(true) {
-        size_t bytes = inputStream.read(buffer, kChunkSize);
+        size_t bytes = inputStream.read(&buffer[0], kChunkSize);
         Guid valueId = g.generate();
 
-        Value v = createValue(valueId, snapshotId, position, buffer, bytes);
+        Value v = createValue(valueId, snapshotId, position, &buffer[0], bytes);
         submitBuffer->pushValue(v);
 
         if(bytes == 0) {
@@ -107,16 +156,200 @@ void readData(SubmitBuffer* submitBuffer,
     cout << "Read " << position << " bytes in " << timeElapsed << "us, " << int(position / (timeElapsed / 1000000.)) << " bps" << endl;
 }
 
-void writeToSocket(Socket::ptr s, const char* data, size_t length) {
-    size_t sent = 0;
-    while(sent < length) {
-        sent += s->send(data + sent, length - sent);
+//! Tracks the producers of a file snapshot, the last one to finish
+//  terminates the submit queue.
+class ProducerGroup {
+public:
+    ProducerGroup(size_t producers)
+        : runningProducers_(producers),
+          totalBytes_(0),
+          startTime_(TimerManager::now())
+    {}
+
+    //! Returns true for the last producer.
+    bool finish(uint64_t bytes) {
+        FiberMutex::ScopedLock lk(mutex_);
+        totalBytes_ += bytes;
+        if(--runningProducers_ > 0) {
+            return false;
+        }
+        uint64_t timeElapsed = TimerManager::now() - startTime_;
+        cout << "Read " << totalBytes_ << " bytes in " << timeElapsed << "us, " << int(totalBytes_ / (timeElapsed / 1000000.)) << " bps" << endl;
+        return true;
+    }
+
+private:
+    size_t runningProducers_;
+    uint64_t totalBytes_;
+    const uint64_t startTime_;
+    FiberMutex mutex_;
+};
+
+//! Pushes length bytes at data as chunks of one substream, positions
+//  starting from zero. Returns the number of bytes pushed.
+uint64_t pushChunks(SubmitBuffer* submitBuffer,
+                    GuidGenerator* g,
+                    uint64_t snapshotId,
+                    const char* data,
+                    uint64_t length,
+                    const StreamInfo& streamInfo)
+{
+    // Leaves room for the substream fields on top of the snapshot id,
+    // position and data length.
+    const size_t kChunkSize = chunkSize(64);
+    uint64_t position = 0;
+    while(position < length) {
+        const size_t bytes = size_t(min(uint64_t(kChunkSize), length - position));
+        submitBuffer->pushValue(createValue(g->generate(), snapshotId, position, data + position, bytes, &streamInfo));
+        position += bytes;
+    }
+    return position;
+}
+
+//! Submits [streamOffset, streamOffset + length) of the mapped file as
+//  one substream with positions starting from zero.
+void readFileRange(SubmitBuffer* submitBuffer,
+                   uint64_t snapshotId,
+                   const char* fileData,
+                   uint64_t length,
+                   StreamInfo streamInfo,
+                   ProducerGroup* producers)
+{
+    GuidGenerator g;
+    const uint64_t position = pushChunks(submitBuffer, &g, snapshotId, fileData + streamInfo.streamOffset, length, streamInfo);
+    // End of substream marker.
+    submitBuffer->pushValue(createValue(g.generate(), snapshotId, position, NULL, 0, &streamInfo));
+    MORDOR_LOG_INFO(g_log) << " substream " << streamInfo.streamId << " done, " << position << " bytes";
+
+    if(producers->finish(position)) {
+        // XXX hack
+        submitBuffer->pushValue(Value(Guid(), boost::shared_ptr<string>(new string)));
     }
 }
 
-void submitValues(Socket::ptr s, BlockingQueue<Value>::ptr submitQueue, SubmitBuffer* submitBuffer) {
+//! Resends the given ranges of the mapped file, each one starting its
+//  own position space. No end markers are needed since the learner
+//  knows the total size.
+void resendFileRanges(SubmitBuffer* submitBuffer,
+                      uint64_t snapshotId,
+                      const char* fileData,
+                      ByteRanges ranges,
+                      StreamInfo streamInfo,
+                      ProducerGroup* producers)
+{
+    GuidGenerator g;
+    uint64_t bytes = 0;
+    for(size_t i = 0; i < ranges.size(); ++i) {
+        streamInfo.streamOffset = ranges[i].first;
+        bytes += pushChunks(submitBuffer, &g, snapshotId, fileData + ranges[i].first, ranges[i].second - ranges[i].first, streamInfo);
+    }
+    MORDOR_LOG_INFO(g_log) << " substream " << streamInfo.streamId << " resent " << ranges.size() << " ranges, " << bytes << " bytes";
+
+    if(producers->finish(bytes)) {
+        // XXX hack
+        submitBuffer->pushValue(Value(Guid(), boost::shared_ptr<string>(new string)));
+    }
+}
+
+//! Publishes the range digests of the snapshot ahead of its data.
+void pushManifest(SubmitBuffer* submitBuffer,
+                  uint64_t snapshotId,
+                  const char* fileData,
+                  uint64_t totalSize)
+{
+    GuidGenerator g;
+    uint64_t startT = TimerManager::now();
+    SnapshotManifest manifest = SnapshotManifest::build(fileData, totalSize, SnapshotManifest::kDefaultRangeSize);
+    vector<SnapshotManifestData> parts;
+    manifest.serialize(SnapshotManifest::kMaxHashesPerValue, &parts);
+    for(size_t i = 0; i < parts.size(); ++i) {
+        boost::shared_ptr<string> valueData(new string);
+        SnapshotStreamData streamData;
+        streamData.set_snapshot_id(snapshotId);
+        streamData.set_position(0);
+        streamData.set_total_size(totalSize);
+        *streamData.mutable_manifest() = parts[i];
+        streamData.SerializeToString(valueData.get());
+        submitBuffer->pushValue(Value(g.generate(), valueData));
+    }
+    MORDOR_LOG_INFO(g_log) << " manifest of " << manifest.rangeCount() << " ranges in " << parts.size() << " values built in " << TimerManager::now() - startT << "us";
+}
+
+//! Maps the whole file and starts one producer per substream. Given a
+//  ranges file, only sends the ranges listed there.
+void readFile(SubmitBuffer* submitBuffer,
+              uint64_t snapshotId,
+              const char* path,
+              uint32_t streams,
+              const char* rangesPath,
+              IOManager* ioManager)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        MORDOR_THROW_EXCEPTION_FROM_LAST_ERROR_API("open");
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        MORDOR_THROW_EXCEPTION_FROM_LAST_ERROR_API("fstat");
+    }
+    const uint64_t totalSize = st.st_size;
+    const char* fileData = NULL;
+    if(totalSize > 0) {
+        void* mapping = mmap(NULL, totalSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapping == MAP_FAILED) {
+            MORDOR_THROW_EXCEPTION_FROM_LAST_ERROR_API("mmap");
+        }
+        madvise(mapping, totalSize, MADV_SEQUENTIAL);
+        fileData = (const char*) mapping;
+    }
+    // The mapping stays alive until the process exits.
+    close(fd);
+
+    ByteRanges ranges;
+    if(rangesPath && !readByteRanges(rangesPath, &ranges)) {
+        cout << "Can't read ranges from " << rangesPath << endl;
+        exit(1);
+    }
+    for(size_t i = 0; i < ranges.size(); ++i) {
+        if(ranges[i].second > totalSize) {
+            cout << "Range [" << ranges[i].first << ", " << ranges[i].second << ") is past the end of " << path << endl;
+            exit(1);
+        }
+    }
+
+    pushManifest(submitBuffer, snapshotId, fileData, totalSize);
+
+    MORDOR_LOG_INFO(g_log) << " sending " << path << ", " << totalSize << " bytes in " << streams << " substreams";
+    ProducerGroup* producers = new ProducerGroup(streams);
+    const uint64_t rangeSize = (totalSize + streams - 1) / streams;
+    for(uint32_t i = 0; i < streams; ++i) {
+        StreamInfo streamInfo;
+        streamInfo.streamId = i;
+        streamInfo.streamCount = streams;
+        streamInfo.streamOffset = min(totalSize, i * rangeSize);
+        streamInfo.totalSize = totalSize;
+        if(rangesPath) {
+            ByteRanges producerRanges;
+            for(size_t j = i; j < ranges.size(); j += streams) {
+                producerRanges.push_back(ranges[j]);
+            }
+            ioManager->schedule(boost::bind(resendFileRanges, submitBuffer, snapshotId, fileData, producerRanges, streamInfo, producers));
+            continue;
+        }
+        const uint64_t length = min(rangeSize, totalSize - streamInfo.streamOffset);
+        ioManager->schedule(boost::bind(readFileRange, submitBuffer, snapshotId, fileData, length, streamInfo, producers));
+    }
+}
+
+void readAcks(ValueStreamClient::ptr client) {
+    try {
+        client->readControlStream();
+    } catch(...) {
+    }
+}
+
+void submitValues(Socket::ptr s, ValueStreamClient::ptr client, BlockingQueue<Value>::ptr submitQueue, SubmitBuffer* submitBuffer, IOManager* ioManager) {
     uint64_t startT = TimerManager::now();
-    size_t bytesSent = 0;
     size_t totalValueLength = 0;
     while(true) {
         Value v = submitQueue->pop();
@@ -127,32 +360,41 @@ void submitValues(Socket::ptr s, BlockingQueue<Value>::ptr submitQueue, SubmitBu
         }
         totalValueLength += v.size();
 
-        ValueData valueData;
-        v.serialize(&valueData);
-        FixedSizeHeaderData header;
-        header.set_size(valueData.ByteSize());
-        char wireData[header.ByteSize() + valueData.ByteSize()];
-        header.SerializeToArray(wireData, header.ByteSize());
-        valueData.SerializeToArray(wireData + header.ByteSize(), valueData.ByteSize());
-        writeToSocket(s, wireData, header.ByteSize() + valueData.ByteSize());
-        bytesSent += header.ByteSize() + valueData.ByteSize();
+        client->send(v);
         submitBuffer->notify(v.valueId());
-        MORDOR_LOG_TRACE(g_log) << " submit sent " << v.valueId() << ", sent=" << bytesSent;
+        MORDOR_LOG_TRACE(g_log) << " submit sent " << v.valueId() << ", sent=" << client->sentBytes();
     }
+    uint64_t bytesSent = client->sentBytes();
     uint64_t timeElapsed = TimerManager::now() - startT;
     cout << "done. " << totalValueLength << " value bytes, " << bytesSent << " wire bytes in " << timeElapsed << "us, avg throughput " << int(bytesSent / (timeElapsed / 1000000.)) << " bps" << endl;
+    while(client->ackedValues() < client->sentValues()) {
+        sleep(*ioManager, kAckPollInterval);
+    }
+    timeElapsed = TimerManager::now() - startT;
+    cout << "committed " << client->ackedValues() << " values in " << timeElapsed << "us" << endl;
+    s->shutdown();
 }
 
 int main(int argc, char **argv) {
     Config::loadFromEnvironment();
     const size_t kBufferSize = 10000;
-    if(argc < 3) {
-        cout << " usage: send master_addr:port snapshot_id" << endl;
+    if(argc < 3 || argc == 4 || argc > 6) {
+        cout << " usage: send master_addr:port snapshot_id [input_file streams [ranges_file]]" << endl;
         return 1;
     }
     const uint64_t snapshotId = boost::lexical_cast<uint64_t>(argv[2]); 
+    const char* inputFile = (argc >= 5) ? argv[3] : NULL;
+    const uint32_t streams = (argc >= 5) ? boost::lexical_cast<uint32_t>(argv[4]) : 1;
+    // Typically the .missing file left by a restarted learner, which
+    // does not fetch the missing ranges by itself.
+    const char* rangesFile = (argc == 6) ? argv[5] : NULL;
+    if(streams == 0) {
+        cout << " streams must be positive" << endl;
+        return 1;
+    }
     try {
-        IOManager ioManager;
+        // Substream producers run in parallel.
+        IOManager ioManager(streams);
         Address::ptr masterAddress = Address::lookup(argv[1], AF_INET).front();
         Socket::ptr s = masterAddress->createSocket(ioManager, SOCK_STREAM);
         s->connect(masterAddress);
@@ -160,8 +402,14 @@ int main(int argc, char **argv) {
         BlockingQueue<Value>::ptr queue(new BlockingQueue<Value>("snapshot_stream"));
         SubmitBuffer submitBuffer(kBufferSize, queue);
 
-        ioManager.schedule(boost::bind(readData, &submitBuffer, snapshotId, &ioManager));
-        ioManager.schedule(boost::bind(submitValues, s, queue, &submitBuffer));
+        if(inputFile) {
+            ioManager.schedule(boost::bind(readFile, &submitBuffer, snapshotId, inputFile, streams, rangesFile, &ioManager));
+        } else {
+            ioManager.schedule(boost::bind(readData, &submitBuffer, snapshotId, &ioManager));
+        }
+        ValueStreamClient::ptr client(new ValueStreamClient(s, NULL));
+        ioManager.schedule(boost::bind(readAcks, client));
+        ioManager.schedule(boost::bind(submitValues, s, client, queue, &submitBuffer, &ioManager));
         ioManager.dispatch();
     } catch(...) {
         cout << boost::current_exception_diagnostic_information();
@@ -24,12 +24,23 @@ using std::vector;
 
 static Logger::ptr g_log = Log::lookup("lightning:tcp_recovery_service");
 
+static CountStatistic<uint64_t>& g_servedValues =
+    Statistics::registerStatistic("recovery_service.served_values",
+                                  CountStatistic<uint64_t>());
+static CountStatistic<uint64_t>& g_servedRecoveredValues =
+    Statistics::registerStatistic("recovery_service.served_recovered_values",
+                                  CountStatistic<uint64_t>());
+
+const size_t TcpRecoveryService::kMaxReplyValueBytes;
+
 TcpRecoveryService::TcpRecoveryService(IOManager* ioManager,
                                        Socket::ptr listenSocket,
-                                       ValueCache::ptr valueCache)
+                                       ValueCache::ptr valueCache,
+                                       bool authoritative)
     : ioManager_(ioManager),
       listenSocket_(listenSocket),
-      valueCache_(valueCache)
+      valueCache_(valueCache),
+      authoritative_(authoritative)
 {}
 
 void TcpRecoveryService::run() {
@@ -147,6 +158,7 @@ void TcpRecoveryService::handleRequest(Socket::ptr socket,
     MORDOR_LOG_DEBUG(g_log) << this << " recover " <<
         request.instances_size() << " instances for epoch " <<
         requestEpoch << " from " << *(socket->remoteAddress());
+    size_t replyValueBytes = 0;
     for(int i = 0; i < request.instances_size(); ++i) {
         InstanceId instanceId = request.instances(i);
         MORDOR_LOG_TRACE(g_log) << this << " recover(" << requestEpoch <<
@@ -154,12 +166,30 @@ void TcpRecoveryService::handleRequest(Socket::ptr socket,
 
 
         Value value;
-        auto result = valueCache_->query(requestEpoch, instanceId, &value);
+        bool recovered = false;
+        auto result = valueCache_->query(requestEpoch,
+                                         instanceId,
+                                         &value,
+                                         &recovered);
         switch(result) {
-            case ValueCache::TOO_OLD: case ValueCache::WRONG_EPOCH: // XXX
+            case ValueCache::TOO_OLD:
                 MORDOR_LOG_TRACE(g_log) << this << " iid " << instanceId <<
                     " forgotten";
-                reply->add_forgotten_instances(instanceId);
+                if(authoritative_) {
+                    reply->add_forgotten_instances(instanceId);
+                } else {
+                    // The acceptors may still have it.
+                    reply->add_not_committed_instances(instanceId);
+                }
+                break;
+            case ValueCache::WRONG_EPOCH:
+                // This host may not have caught up with the epoch yet
+                // (e.g. a learner serving its peers). The requester
+                // retries elsewhere and drops the instance by itself
+                // once its epoch is obsolete.
+                MORDOR_LOG_TRACE(g_log) << this << " iid " << instanceId <<
+                    " from another epoch";
+                reply->add_not_committed_instances(instanceId);
                 break;
             case ValueCache::NOT_YET:
                 MORDOR_LOG_TRACE(g_log) << this << " iid " << instanceId <<
@@ -168,11 +198,22 @@ void TcpRecoveryService::handleRequest(Socket::ptr socket,
                 break;
             case ValueCache::OK:
             {
+                if(replyValueBytes + value.size() > kMaxReplyValueBytes) {
+                    MORDOR_LOG_TRACE(g_log) << this << " iid " <<
+                        instanceId << " does not fit the reply";
+                    reply->add_not_committed_instances(instanceId);
+                    break;
+                }
+                replyValueBytes += value.size();
                 MORDOR_LOG_TRACE(g_log) << this << " iid " << instanceId <<
                     " -> " << value;
                 InstanceData* instanceData = reply->add_recovered_instances();
                 instanceData->set_instance_id(instanceId);
                 value.serialize(instanceData->mutable_value());
+                g_servedValues.increment();
+                if(recovered) {
+                    g_servedRecoveredValues.increment();
+                }
                 break;
             }
             default:
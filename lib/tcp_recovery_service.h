@@ -16,9 +16,14 @@ class TcpRecoveryService
 public:
     typedef boost::shared_ptr<TcpRecoveryService> ptr;
 
+    //! A learner cache is not authoritative: it may have evicted, or
+    //  never received, instances the acceptors still hold. It reports
+    //  those as not committed so that the requester retries elsewhere,
+    //  only an authoritative cache reports instances as forgotten.
     TcpRecoveryService(Mordor::IOManager* ioManager,
                        Mordor::Socket::ptr listenSocket,
-                       ValueCache::ptr valueCache);
+                       ValueCache::ptr valueCache,
+                       bool authoritative = true);
 
     void run();
 private:
@@ -39,6 +44,12 @@ private:
     Mordor::IOManager* ioManager_;
     Mordor::Socket::ptr listenSocket_;
     ValueCache::ptr valueCache_;
+    const bool authoritative_;
+
+    //! Keeps replies under the protobuf message size limit whatever the
+    //  value size; the instances that do not fit are reported as not
+    //  committed, and the requester asks for them again.
+    static const size_t kMaxReplyValueBytes = 48 * 1024 * 1024;
 };
 
 }  // namespace lightning
@@ -1,34 +1,66 @@
 #include "tcp_value_receiver.h"
 #include "proto/rpc_messages.pb.h"
-#include "value_buffer.h"
+#include <mordor/assert.h>
 #include <mordor/exception.h>
 #include <mordor/log.h>
+#include <mordor/statistics.h>
+#include <mordor/timer.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
 #include <vector>
 
 namespace lightning {
 
+using Mordor::CountStatistic;
 using Mordor::Exception;
 using Mordor::IOManager;
 using Mordor::Log;
 using Mordor::Logger;
 using Mordor::Socket;
+using Mordor::Statistics;
+using Mordor::TimerManager;
+using boost::shared_ptr;
+using google::protobuf::io::CodedInputStream;
+using google::protobuf::internal::WireFormatLite;
 using paxos::Value;
+using std::string;
 using std::vector;
 
 static Logger::ptr g_log = Log::lookup("lightning:tcp_value_receiver");
 
+static CountStatistic<uint64_t>& g_compressedValues =
+    Statistics::registerStatistic("tcp_value_receiver.compressed_values",
+                                  CountStatistic<uint64_t>());
+static CountStatistic<uint64_t>& g_savedBytes =
+    Statistics::registerStatistic("tcp_value_receiver.compression_saved_bytes",
+                                  CountStatistic<uint64_t>("bytes"));
+static CountStatistic<uint64_t>& g_fragmentedValues =
+    Statistics::registerStatistic("tcp_value_receiver.fragmented_values",
+                                  CountStatistic<uint64_t>());
+
+const uint32_t TcpValueReceiver::kBatchFrameFlag;
+const size_t TcpValueReceiver::kMaxFrameSize;
+const size_t TcpValueReceiver::kReadBufferSize;
+
 TcpValueReceiver::TcpValueReceiver(
     size_t valueBufferSize,
     ProposerState::ptr proposer,
     BlockingQueue<Value>::ptr submitQueue,
     IOManager* ioManager,
-    Socket::ptr listenSocket)
+    Socket::ptr listenSocket,
+    size_t maxValueSize,
+    bool compressValues)
     : valueBufferSize_(valueBufferSize),
       proposer_(proposer),
       submitQueue_(submitQueue),
       ioManager_(ioManager),
-      listenSocket_(listenSocket)
-{}
+      listenSocket_(listenSocket),
+      maxValueSize_(maxValueSize),
+      compressValues_(compressValues)
+{
+    MORDOR_ASSERT(maxValueSize_ > 0 &&
+                  maxValueSize_ <= Value::kMaxValueSize);
+}
 
 void TcpValueReceiver::run() {
     while(true) {
@@ -39,6 +71,7 @@ void TcpValueReceiver::run() {
             MORDOR_LOG_ERROR(g_log) << this << " exception on accept: " <<
                 e.what() << " || " <<
                 boost::current_exception_diagnostic_information();
+            continue;
         }
 
         MORDOR_LOG_DEBUG(g_log) << this << " new value stream from " <<
@@ -55,66 +88,226 @@ void TcpValueReceiver::run() {
 void TcpValueReceiver::handleValueStream(Socket::ptr socket) {
     MORDOR_LOG_DEBUG(g_log) << this << " handling value stream from " <<
         *socket->remoteAddress();
-    ValueBuffer valueBuffer(valueBufferSize_,
-                            proposer_,
-                            submitQueue_);
+    ValueBuffer::ptr valueBuffer(new ValueBuffer(valueBufferSize_,
+                                                 proposer_,
+                                                 submitQueue_));
+    ioManager_->schedule(
+        boost::bind(
+            &TcpValueReceiver::writeControlStream,
+            shared_from_this(),
+            socket,
+            valueBuffer));
+    BufferedSocketReader reader(socket, kReadBufferSize);
+    vector<Value> values;
+    vector<Value> fragments;
     while(true) {
-        Value value;
+        values.clear();
         try {
-            if(!readValue(socket, &value)) {
+            if(!readValues(&reader, &values)) {
                 MORDOR_LOG_WARNING(g_log) << this <<
                     " cannot read request, closing connection to " <<
                     *(socket->remoteAddress());
-                return;
+                break;
             }
         } catch(Exception& e) {
             MORDOR_LOG_ERROR(g_log) << this << " socket exception on " <<
                 *socket->remoteAddress() << ": " << e.what();
+            break;
+        }
+        const uint64_t receivedAtUs = TimerManager::now();
+        for(size_t i = 0; i < values.size(); ++i) {
+            MORDOR_LOG_TRACE(g_log) << this << " read " << values[i] <<
+                " from " << *(socket->remoteAddress());
+            values[i].setReceivedAtUs(receivedAtUs);
+            if(values[i].size() > maxValueSize_) {
+                values[i].split(maxValueSize_, &fragments);
+                g_fragmentedValues.increment();
+                for(size_t j = 0; j < fragments.size(); ++j) {
+                    maybeCompress(&fragments[j]);
+                }
+                valueBuffer->pushFragments(values[i].valueId(), fragments);
+                continue;
+            }
+            maybeCompress(&values[i]);
+            valueBuffer->pushValue(values[i]);
+        }
+    }
+    valueBuffer->close();
+    socket->cancelSend();
+}
+
+void TcpValueReceiver::maybeCompress(Value* value) {
+    if(!compressValues_ || value->compressed()) {
+        return;
+    }
+    const size_t size = value->size();
+    if(value->compress()) {
+        g_compressedValues.increment();
+        g_savedBytes.add(size - value->size());
+    }
+}
+
+void TcpValueReceiver::writeControlStream(Socket::ptr socket,
+                                          ValueBuffer::ptr valueBuffer)
+{
+    vector<ValueBuffer::Ack> acks;
+    uint64_t creditLimit;
+    ValueStreamControlData control;
+    FixedSizeHeaderData header;
+    string wireData;
+    while(valueBuffer->popAcks(&acks, &creditLimit)) {
+        control.Clear();
+        control.set_credit_limit(creditLimit);
+        for(size_t i = 0; i < acks.size(); ++i) {
+            ValueAckData* ack = control.add_acks();
+            acks[i].valueId.serialize(ack->mutable_value_id());
+            ack->set_instance_id(acks[i].instanceId);
+        }
+        header.set_size(control.ByteSize());
+        wireData.clear();
+        header.AppendToString(&wireData);
+        control.AppendToString(&wireData);
+        try {
+            writeToSocket(socket, wireData.data(), wireData.size());
+        } catch(Exception& e) {
+            MORDOR_LOG_DEBUG(g_log) << this << " cannot write to " <<
+                *socket->remoteAddress() << ": " << e.what();
             return;
         }
-        MORDOR_LOG_TRACE(g_log) << this << " read Value(" <<
-            value.valueId() << ", " << value.size() << ") from " <<
-            *(socket->remoteAddress());
-        valueBuffer.pushValue(value);
+        MORDOR_LOG_TRACE(g_log) << this << " sent " << acks.size() <<
+            " acks, credit " << creditLimit << " to " <<
+            *socket->remoteAddress();
     }
 }
 
-bool TcpValueReceiver::readValue(Socket::ptr socket, Value* value) {
+bool TcpValueReceiver::readValues(BufferedSocketReader* reader,
+                                  vector<Value>* values)
+{
     FixedSizeHeaderData header;
     header.set_size(0);
     char messageHeaderData[header.ByteSize()];
-    readFromSocket(socket, header.ByteSize(), messageHeaderData);
+    reader->read(messageHeaderData, header.ByteSize());
     if(!header.ParseFromArray(messageHeaderData, header.ByteSize())) {
         MORDOR_LOG_WARNING(g_log) << this << " cannot parse request from [" <<
-                                     *(socket->remoteAddress()) << "]";
+            *(reader->socket()->remoteAddress()) << "]";
         return false;
     }
-    vector<char> rawValueData(header.size(), 0);
-    readFromSocket(socket, header.size(), &rawValueData[0]);
-    ValueData valueData;
-    if(!valueData.ParseFromArray(&rawValueData[0], header.size())) {
-        MORDOR_LOG_WARNING(g_log) << this << " cannot parse value from [" <<
-            *(socket->remoteAddress()) << "]";
+    const bool isBatch = (header.size() & kBatchFrameFlag) != 0;
+    const size_t frameSize = header.size() & ~kBatchFrameFlag;
+    if(frameSize > kMaxFrameSize) {
+        MORDOR_LOG_WARNING(g_log) << this << " frame of " << frameSize <<
+            " bytes from [" << *(reader->socket()->remoteAddress()) << "]";
         return false;
     }
-    *value = Value::parse(valueData);
-    return true;
+    // Values are sliced out of this buffer without copying.
+    shared_ptr<string> frame(new string(frameSize, '\0'));
+    reader->read(&(*frame)[0], frameSize);
+
+    CodedInputStream input(reinterpret_cast<const uint8_t*>(frame->data()),
+                           frameSize);
+    if(!isBatch) {
+        Value value;
+        if(!parseValue(frame, &input, &value)) {
+            MORDOR_LOG_WARNING(g_log) << this << " cannot parse value from [" <<
+                *(reader->socket()->remoteAddress()) << "]";
+            return false;
+        }
+        values->push_back(value);
+        return true;
+    }
+
+    while(uint32_t tag = input.ReadTag()) {
+        if(WireFormatLite::GetTagFieldNumber(tag) !=
+               ValueBatchData::kValuesFieldNumber ||
+           WireFormatLite::GetTagWireType(tag) !=
+               WireFormatLite::WIRETYPE_LENGTH_DELIMITED)
+        {
+            if(!WireFormatLite::SkipField(&input, tag)) {
+                return false;
+            }
+            continue;
+        }
+        uint32_t valueSize;
+        if(!input.ReadVarint32(&valueSize)) {
+            return false;
+        }
+        CodedInputStream::Limit limit = input.PushLimit(valueSize);
+        Value value;
+        if(!parseValue(frame, &input, &value)) {
+            MORDOR_LOG_WARNING(g_log) << this << " cannot parse batched " <<
+                "value from [" << *(reader->socket()->remoteAddress()) << "]";
+            return false;
+        }
+        input.PopLimit(limit);
+        values->push_back(value);
+    }
+    return input.ConsumedEntireMessage();
 }
 
-void TcpValueReceiver::readFromSocket(Socket::ptr socket,
-                                      size_t bytes,
-                                      char* destination)
+bool TcpValueReceiver::parseValue(const shared_ptr<string>& frame,
+                                  CodedInputStream* input,
+                                  Value* value)
 {
-    size_t bytesRead = 0;
-    while(bytesRead < bytes) {
-        size_t currentRead =
-            socket->receive(destination + bytesRead, bytes - bytesRead);
-        if(currentRead == 0) {
-            MORDOR_LOG_DEBUG(g_log) << this << " connection to " <<
-                *(socket->remoteAddress()) << " went down";
-            MORDOR_THROW_EXCEPTION_FROM_LAST_ERROR_API("recv");
+    string valueId;
+    size_t dataOffset = 0;
+    uint32_t dataSize = 0;
+    uint32_t uncompressedSize = 0;
+    bool hasId = false, hasData = false;
+    while(uint32_t tag = input->ReadTag()) {
+        const int field = WireFormatLite::GetTagFieldNumber(tag);
+        if(field == ValueData::kIdFieldNumber) {
+            // Guid::parse() reads sizeof(Guid) bytes whatever the length.
+            if(!WireFormatLite::ReadBytes(input, &valueId) ||
+               valueId.length() != sizeof(Guid))
+            {
+                return false;
+            }
+            hasId = true;
+        } else if(field == ValueData::kDataFieldNumber) {
+            if(!input->ReadVarint32(&dataSize)) {
+                return false;
+            }
+            dataOffset = input->CurrentPosition();
+            if(dataSize > Value::kMaxLargeValueSize ||
+               !input->Skip(dataSize))
+            {
+                return false;
+            }
+            hasData = true;
+        } else if(field == ValueData::kUncompressedSizeFieldNumber) {
+            if(!input->ReadVarint32(&uncompressedSize) ||
+               uncompressedSize == 0 ||
+               uncompressedSize > Value::kMaxUncompressedSize)
+            {
+                return false;
+            }
+        } else if(!WireFormatLite::SkipField(input, tag)) {
+            return false;
         }
-        bytesRead += currentRead;
+    }
+    if(!hasId || !hasData) {
+        return false;
+    }
+    // Only uncompressed values can be split into fragments.
+    if(uncompressedSize != 0 && dataSize > maxValueSize_) {
+        return false;
+    }
+    *value = Value(Guid::parse(valueId), frame, dataOffset, dataSize);
+    if(uncompressedSize != 0 && !value->setCompressed(uncompressedSize)) {
+        return false;
+    }
+    // Checked once here: nothing downstream can do anything about a
+    // corrupt block but drop it on every learner.
+    return value->verifyCompressed();
+}
+
+void TcpValueReceiver::writeToSocket(Socket::ptr socket,
+                                     const char* data,
+                                     size_t bytes)
+{
+    size_t bytesSent = 0;
+    while(bytesSent < bytes) {
+        bytesSent += socket->send(data + bytesSent, bytes - bytesSent);
     }
 }
 
@@ -1,13 +1,43 @@
 #pragma once
 
 #include "blocking_queue.h"
+#include "buffered_socket_reader.h"
 #include "proposer_state.h"
 #include "value.h"
+#include "value_buffer.h"
 #include <mordor/iomanager.h>
 #include <mordor/socket.h>
+#include <string>
+#include <vector>
+
+namespace google {
+namespace protobuf {
+namespace io {
+class CodedInputStream;
+}  // namespace io
+}  // namespace protobuf
+}  // namespace google
 
 namespace lightning {
 
+//! Accepts client connections on the value port and submits the values
+//  read from them.
+//
+//  Each connection is bidirectional: the client sends values framed as
+//  FixedSizeHeaderData + ValueData, the master sends back
+//  FixedSizeHeaderData + ValueStreamControlData messages granting credit
+//  and acking committed values with their instance ids. A client must
+//  not send more values than the credit allows; if it does, the
+//  connection reader stalls until enough values commit.
+//
+//  A client may also send many values in one frame: if the header size
+//  has kBatchFrameFlag set, the remaining bits give the size of a
+//  ValueBatchData. Values are sliced out of the frame without copying.
+//
+//  Values larger than maxValueSize, which should come from
+//  Phase2Request::maxValueSize for the group, are proposed as fragments.
+//  With compressValues, values (or fragments) the client did not
+//  compress itself are LZ4 compressed before being proposed.
 class TcpValueReceiver
     : public boost::enable_shared_from_this<TcpValueReceiver>
 {
@@ -18,18 +48,39 @@ public:
                      ProposerState::ptr proposerState,
                      BlockingQueue<paxos::Value>::ptr submitQueue,
                      Mordor::IOManager* ioManager,
-                     Mordor::Socket::ptr listenSocket);
+                     Mordor::Socket::ptr listenSocket,
+                     size_t maxValueSize,
+                     bool compressValues = false);
 
     void run();
+
+    //! Marks a batch frame in FixedSizeHeaderData.size.
+    static const uint32_t kBatchFrameFlag = 0x80000000;
+    static const size_t kMaxFrameSize = 16 * 1024 * 1024;
 private:
+    static const size_t kReadBufferSize = 64 * 1024;
+
     void handleValueStream(Mordor::Socket::ptr socket);
 
-    bool readValue(Mordor::Socket::ptr socket,
-                   paxos::Value* value);
+    void maybeCompress(paxos::Value* value);
+
+    //! Sends credit and acks to the client until valueBuffer is closed.
+    void writeControlStream(Mordor::Socket::ptr socket,
+                            ValueBuffer::ptr valueBuffer);
+
+    //! Reads one frame, appending its values to values.
+    bool readValues(BufferedSocketReader* reader,
+                    std::vector<paxos::Value>* values);
+
+    //! Parses a ValueData from input up to its current limit, slicing
+    //  the data out of frame.
+    bool parseValue(const boost::shared_ptr<std::string>& frame,
+                    google::protobuf::io::CodedInputStream* input,
+                    paxos::Value* value);
 
-    void readFromSocket(Mordor::Socket::ptr socket,
-                        size_t bytes,
-                        char* destination);
+    void writeToSocket(Mordor::Socket::ptr socket,
+                       const char* data,
+                       size_t bytes);
 
     const size_t valueBufferSize_;
     ProposerState::ptr proposer_;
@@ -37,6 +88,8 @@ private:
 
     Mordor::IOManager* ioManager_;
     Mordor::Socket::ptr listenSocket_;
+    const size_t maxValueSize_;
+    const bool compressValues_;
 };
 
 }  // namespace lightning
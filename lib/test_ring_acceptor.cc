@@ -12,7 +12,11 @@
 #include "ring_change_notifier.h"
 #include "set_ring_handler.h"
 #include "tcp_recovery_service.h"
+#include "trace.h"
 #include "commit_tracker.h"
+#include "dedicated_thread.h"
+#include "metrics.h"
+#include "multicast_util.h"
 #include "value_cache.h"
 #include "ponger.h"
 #include "udp_sender.h"
@@ -45,6 +49,12 @@ using boost::lexical_cast;
 
 static Logger::ptr g_log = Log::lookup("lightning:main");
 
+// The config is the same for all hosts, this tells apart several hosts
+// on one machine (see tools/loopback_bench.py).
+static ConfigVar<uint32_t>::ptr g_monitoringPort =
+    Config::lookup("monitoring.port", uint32_t(0),
+                   "Overrides monitoring_port of the config if not 0");
+
 void readConfig(const char* configString,
                 Guid* configHash,
                 JSON::Value* config)
@@ -59,17 +69,31 @@ void readConfig(const char* configString,
 
 class DummyRingHolder : public RingHolder {};
 
-Socket::ptr bindSocket(Address::ptr bindAddress, IOManager* ioManager, int protocol = SOCK_DGRAM) {
+Socket::ptr bindSocket(Address::ptr bindAddress, IOManager* ioManager, int protocol = SOCK_DGRAM, bool reusePort = false) {
     Socket::ptr s = bindAddress->createSocket(*ioManager, protocol);
     int option = 1;
     s->setOption(SOL_SOCKET, SO_REUSEADDR, &option, sizeof(option));
+    if(reusePort) {
+        setReusePort(s);
+    }
     s->bind(bindAddress);
     return s;
 }
 
+//! /metrics and /metrics.json export the histograms and rates, /trace
+//  the trace buffer, any other path the Mordor statistics.
 void httpRequest(HTTP::ServerRequest::ptr request) {
     ostringstream ss;
-    ss << Statistics::dump();
+    const string path = request->request().requestLine.uri.path.toString();
+    if(path == "/metrics") {
+        Metrics::dumpPrometheus(ss);
+    } else if(path == "/metrics.json") {
+        Metrics::dumpJson(ss);
+    } else if(path == "/trace") {
+        Tracer::dump(ss);
+    } else {
+        ss << Statistics::dump();
+    }
     MemoryStream::ptr responseStream(new MemoryStream);
     string response(ss.str());
     responseStream->write(response.c_str(), response.length());
@@ -92,18 +116,40 @@ void serveStats(IOManager* ioManager, uint16_t port) {
     }
 }
 
+//! Extra recovery sources (host:port) besides the other acceptors.
+void readRecoveryPeers(const JSON::Value& config, vector<string>* peers) {
+    const JSON::Array& peerData = config["recovery_peers"].get<JSON::Array>();
+    for(size_t i = 0; i < peerData.size(); ++i) {
+        peers->push_back(peerData[i].get<string>());
+    }
+}
+
 void setupEverything(IOManager* ioManager, 
+                     const vector<IOManager*>& responderIoManagers,
+                     IOManager* ringVoterIoManager,
                      const Guid& configHash,
                      const JSON::Value& config,
                      uint32_t ourId,
-                     RpcResponder::ptr* responder,
+                     vector<RpcResponder::ptr>* responders,
                      RingVoter::ptr* ringVoter,
                      uint16_t* monPort)
 {
     Address::ptr multicastGroup = Address::lookup(config["mcast_group"].get<string>(), AF_INET).front();
-    GroupConfiguration::ptr groupConfig = GroupConfiguration::parseAcceptorConfig(config["hosts"], ourId, multicastGroup);
+    uint32_t pathMtu = config["path_mtu"].get<long long>();
+    if(pathMtu == 0) {
+        pathMtu = probePathMtu(multicastGroup);
+        MORDOR_LOG_INFO(g_log) << " probed path mtu " << pathMtu;
+    }
+    GroupConfiguration::ptr groupConfig = GroupConfiguration::parseAcceptorConfig(config["hosts"], ourId, multicastGroup, pathMtu);
 
     *monPort = uint16_t(config["monitoring_port"].get<long long>());
+    if(g_monitoringPort->val() != 0) {
+        *monPort = uint16_t(g_monitoringPort->val());
+    }
+
+    Tracer::configure("acceptor." + lexical_cast<string>(ourId),
+                      config["trace_buffer_size"].get<long long>(),
+                      config["trace_sample_every"].get<long long>());
 
     //-------------------------------------------------------------------------
     // recovery manager
@@ -125,6 +171,17 @@ void setupEverything(IOManager* ioManager,
                                       socketTimeoutUs,
                                       retryDelayUs);
 
+    const uint32_t peerMetric = config["recovery_peer_metric"].get<long long>();
+    vector<string> recoveryPeers;
+    readRecoveryPeers(config, &recoveryPeers);
+    recoveryManager->setupPeerConnections(recoveryPeers,
+                                          ioManager,
+                                          peerMetric,
+                                          queuePollIntervalUs,
+                                          reconnectDelayUs,
+                                          socketTimeoutUs,
+                                          retryDelayUs);
+
     //-------------------------------------------------------------------------
     // value cache
     uint64_t valueCacheSize = config["value_cache_size"].get<long long>();
@@ -139,7 +196,8 @@ void setupEverything(IOManager* ioManager,
     //-------------------------------------------------------------------------
     // acceptor state
     uint64_t pendingSpan = config["acceptor_pending_instances_span"].get<long long>();
-    AcceptorState::ptr acceptorState(new AcceptorState(pendingSpan, ioManager, recoveryManager, commitTracker, valueCache)); 
+    uint32_t stateShards = config["acceptor_state_shards"].get<long long>();
+    AcceptorState::ptr acceptorState(new AcceptorState(pendingSpan, stateShards, ioManager, recoveryManager, commitTracker, valueCache)); 
 
     //-------------------------------------------------------------------------
     // recovery service
@@ -151,9 +209,10 @@ void setupEverything(IOManager* ioManager,
 
     //-------------------------------------------------------------------------
     // ring voter
-    Socket::ptr ringSocket = bindSocket(groupConfig->thisHostConfiguration().ringAddress, ioManager);
-    UdpSender::ptr udpSender(new UdpSender("ring_voter", ringSocket));
-    ioManager->schedule(boost::bind(&UdpSender::run, udpSender));
+    Socket::ptr ringSocket = bindSocket(groupConfig->thisHostConfiguration().ringAddress, ringVoterIoManager);
+    UdpSender::ptr udpSender(new UdpSender("ring_voter", ringSocket, groupConfig->datagramBudget()));
+    // On the IOManager of its socket, see UdpSender.
+    ringVoterIoManager->schedule(boost::bind(&UdpSender::run, udpSender));
     *ringVoter = RingVoter::ptr(new RingVoter(ringSocket, udpSender, acceptorState));
 
     //-------------------------------------------------------------------------
@@ -173,15 +232,19 @@ void setupEverything(IOManager* ioManager,
 
     const HostConfiguration& hostConfig = groupConfig->thisHostConfiguration();
 
-    Socket::ptr listenSocket = bindSocket(hostConfig.multicastListenAddress, ioManager);
-    Socket::ptr replySocket = bindSocket(hostConfig.multicastReplyAddress, ioManager);
+    const size_t listenSockets = responderIoManagers.size();
+    for(size_t i = 0; i < listenSockets; ++i) {
+        Socket::ptr listenSocket = bindSteeredSocket(hostConfig.multicastListenAddress, responderIoManagers[i], i, listenSockets);
+        Socket::ptr replySocket = bindSocket(hostConfig.multicastReplyAddress, responderIoManagers[i], SOCK_DGRAM, listenSockets > 1);
 
-    *responder = RpcResponder::ptr(new RpcResponder(listenSocket, multicastGroup, replySocket));
-    (*responder)->addHandler(RpcMessageData::PING, ponger);
-    (*responder)->addHandler(RpcMessageData::SET_RING, setRingHandler);
-    (*responder)->addHandler(RpcMessageData::PAXOS_BATCH_PHASE1, batchPhase1Handler);
-    (*responder)->addHandler(RpcMessageData::PAXOS_PHASE1, phase1Handler);
-    (*responder)->addHandler(RpcMessageData::PAXOS_PHASE2, phase2Handler);
+        RpcResponder::ptr responder(new RpcResponder(listenSocket, multicastGroup, replySocket));
+        responder->addHandler(RpcMessageData::PING, ponger);
+        responder->addHandler(RpcMessageData::SET_RING, setRingHandler);
+        responder->addHandler(RpcMessageData::PAXOS_BATCH_PHASE1, batchPhase1Handler);
+        responder->addHandler(RpcMessageData::PAXOS_PHASE1, phase1Handler);
+        responder->addHandler(RpcMessageData::PAXOS_PHASE2, phase2Handler);
+        responders->push_back(responder);
+    }
 }
 
 int getPidFd(const char* pidFile) {
@@ -218,14 +281,26 @@ int main(int argc, char** argv) {
     }
     writePidFile(pidFd);
     try {
-        IOManager ioManager;
+        const size_t ioThreads = config["io_threads"].get<long long>();
+        IOManager ioManager(ioThreads);
+        const size_t listenSockets = config["multicast_listen_sockets"].get<long long>();
+        vector<DedicatedThread::ptr> responderThreads;
+        vector<IOManager*> responderIoManagers;
+        for(size_t i = 0; i < listenSockets; ++i) {
+            DedicatedThread::ptr thread(new DedicatedThread("rpc_responder", receiveLoopCpu(config, i)));
+            responderThreads.push_back(thread);
+            responderIoManagers.push_back(thread->ioManager());
+        }
+        DedicatedThread ringVoterThread("ring_voter", receiveLoopCpu(config, listenSockets));
 
-        RpcResponder::ptr responder;
+        vector<RpcResponder::ptr> responders;
         RingVoter::ptr ringVoter;
         uint16_t monPort;
-        setupEverything(&ioManager, configGuid, config, id, &responder, &ringVoter, &monPort);
-        ioManager.schedule(boost::bind(&RpcResponder::run, responder));
-        ioManager.schedule(boost::bind(&RingVoter::run, ringVoter));
+        setupEverything(&ioManager, responderIoManagers, ringVoterThread.ioManager(), configGuid, config, id, &responders, &ringVoter, &monPort);
+        for(size_t i = 0; i < responders.size(); ++i) {
+            responderThreads[i]->schedule(boost::bind(&RpcResponder::run, responders[i]));
+        }
+        ringVoterThread.schedule(boost::bind(&RingVoter::run, ringVoter));
         ioManager.schedule(boost::bind(serveStats, &ioManager, monPort));
         MORDOR_LOG_INFO(g_log) << " Acceptor starting.";
         ioManager.dispatch();
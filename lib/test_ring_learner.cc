@@ -1,21 +1,31 @@
 #include "acceptor_state.h"
 #include "batch_phase1_handler.h"
+#include "bench_value.h"
 #include "phase1_handler.h"
 #include "phase2_handler.h"
 #include "guid.h"
 #include "host_configuration.h"
 #include "instance_sink.h"
+#include "learner_phase2_handler.h"
+#include "learner_state.h"
 #include "recovery_manager.h"
 #include "rpc_responder.h"
 #include "ring_holder.h"
 #include "ring_voter.h"
 #include "ring_change_notifier.h"
 #include "set_ring_handler.h"
+#include "snapshot_file_writer.h"
 #include "stream_reassembler.h"
+#include "tcp_recovery_service.h"
+#include "trace.h"
 #include "ponger.h"
 #include "udp_sender.h"
 #include "value_cache.h"
 #include "commit_tracker.h"
+#include "dedicated_thread.h"
+#include "fragment_reassembly_sink.h"
+#include "metrics.h"
+#include "multicast_util.h"
 #include <iostream>
 #include <fstream>
 #include <streambuf>
@@ -34,6 +44,7 @@
 #include <mordor/iomanager.h>
 #include <mordor/timer.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 using namespace std;
 using namespace Mordor;
@@ -42,19 +53,40 @@ using boost::lexical_cast;
 
 static Logger::ptr g_log = Log::lookup("lightning:main");
 
+// The config is the same for all hosts, this tells apart several hosts
+// on one machine (see tools/loopback_bench.py).
+static ConfigVar<uint32_t>::ptr g_monitoringPort =
+    Config::lookup("monitoring.port", uint32_t(0),
+                   "Overrides monitoring_port of the config if not 0");
+
+static ConfigVar<bool>::ptr g_benchValues =
+    Config::lookup("learner.benchvalues", false,
+                   "Sample the delivery latency of benchmark values "
+                   "(see bench_value.h) instead of treating them as "
+                   "snapshot data");
+
+static const uint64_t kProgressSaveIntervalUs = 1000000;
+
+//! From submit_random_values on the same machine to delivery here.
+static Histogram& g_deliveryLatency =
+    Metrics::registerHistogram("learner.delivery_latency");
+
 class SnapshotLearnerSink : public InstanceSink {
 public:
     SnapshotLearnerSink(uint64_t snapshotId,
                         uint64_t transferTimeoutUs,
                         StreamReassembler::ptr streamReassembler,
+                        SnapshotFileWriter::ptr fileWriter,
                         IOManager* ioManager)
         : snapshotId_(snapshotId),
           transferTimeoutUs_(transferTimeoutUs),
           streamReassembler_(streamReassembler),
-          ioManager_(ioManager)
+          fileWriter_(fileWriter),
+          ioManager_(ioManager),
+          endKnown_(false)
     {
         timeoutTimer_ = ioManager_->registerTimer(transferTimeoutUs_,
-                                                  &SnapshotLearnerSink::onTransferTimeout);
+                                                  boost::bind(&SnapshotLearnerSink::onTransferTimeout, this));
     }
 
     void updateEpoch(const Guid& newEpoch) {
@@ -62,6 +94,7 @@ public:
         MORDOR_LOG_INFO(g_log) << " new epoch " << newEpoch;
         if(!epoch_.empty()) {
             MORDOR_LOG_ERROR(g_log) << " non-empty previous epoch, killing lingering learner";
+            saveProgress();
             cerr << Statistics::dump() << endl;
             exit(1);
         }
@@ -76,7 +109,7 @@ public:
             }
 
             timeoutTimer_ = ioManager_->registerTimer(transferTimeoutUs_,
-                                                      &SnapshotLearnerSink::onTransferTimeout);
+                                                      boost::bind(&SnapshotLearnerSink::onTransferTimeout, this));
         }
 
         MORDOR_LOG_TRACE(g_log) << " (" << iid << ", " << ballot << ", " << v << ")";
@@ -85,37 +118,114 @@ public:
         }
         Guid valueId;
         boost::shared_ptr<string> valueData;
-        v.release(&valueId, &valueData);
+        if(!v.release(&valueId, &valueData)) {
+            MORDOR_LOG_ERROR(g_log) << " dropping corrupt value at " << iid;
+            return;
+        }
         SnapshotStreamData snapshotStreamData;
         if(snapshotStreamData.ParseFromString(*valueData.get())) {
             if(snapshotStreamData.snapshot_id() == snapshotId_) {
-                if(!snapshotStreamData.has_data()) {
-                    streamReassembler_->setEnd(snapshotStreamData.position());
+                if(fileWriter_) {
+                    fileWriter_->addChunk(snapshotStreamData);
                 } else {
-                    boost::shared_ptr<string> chunkData(new string(snapshotStreamData.data()));
-                    streamReassembler_->addChunk(snapshotStreamData.position(), chunkData);
+                    addToStream(snapshotStreamData);
                 }
             }
         }
     }
 
-    static void onTransferTimeout() {
+    //! Without an output file the snapshot is reassembled in memory for
+    //  stdout, which only needs the data and the end of the snapshot.
+    //  File snapshots give their size in every chunk; manifests and the
+    //  end markers of their substreams are not needed then.
+    void addToStream(const SnapshotStreamData& chunk) {
+        {
+            FiberMutex::ScopedLock lk(mutex_);
+            if(!endKnown_ && chunk.has_total_size()) {
+                streamReassembler_->setEnd(chunk.total_size());
+                endKnown_ = true;
+            }
+            if(chunk.has_manifest()) {
+                return;
+            }
+            if(!chunk.has_data()) {
+                if(!endKnown_) {
+                    streamReassembler_->setEnd(chunk.stream_offset() +
+                                               chunk.position());
+                    endKnown_ = true;
+                }
+                return;
+            }
+        }
+        boost::shared_ptr<string> chunkData(new string(chunk.data()));
+        streamReassembler_->addChunk(chunk.stream_offset() + chunk.position(),
+                                     chunkData);
+    }
+
+    void onTransferTimeout() {
         MORDOR_LOG_INFO(g_log) << " snapshot timed out, exiting.";
+        saveProgress();
         cerr << Statistics::dump() << endl;
         exit(1);
     }
+
+    //! Lets a restarted learner keep what it already wrote. The rest is
+    //  resent by rerunning submit_snapshot with the .missing file.
+    void saveProgress() {
+        if(fileWriter_) {
+            fileWriter_->saveProgress();
+        }
+    }
 private:
     const uint64_t snapshotId_;
     const uint64_t transferTimeoutUs_;
     Guid epoch_;
     StreamReassembler::ptr streamReassembler_;
+    SnapshotFileWriter::ptr fileWriter_;
     IOManager* ioManager_;
+    //! Whether the end was given to streamReassembler_.
+    bool endKnown_;
 
     Timer::ptr timeoutTimer_;
 
     FiberMutex mutex_;
 };
     
+//! Samples the delivery latency of benchmark values and passes an empty
+//  value on in their place, which still counts as progress of the
+//  transfer. Everything else is passed on as is.
+class DeliveryLatencySink : public InstanceSink {
+public:
+    DeliveryLatencySink(InstanceSink::ptr next)
+        : next_(next)
+    {}
+
+    void updateEpoch(const Guid& newEpoch) {
+        next_->updateEpoch(newEpoch);
+    }
+
+    void push(paxos::InstanceId iid, paxos::BallotId ballot, paxos::Value v) {
+        if(!v.valueId().empty()) {
+            // release() decompresses, and empties the copy only.
+            paxos::Value copy(v);
+            Guid valueId;
+            boost::shared_ptr<string> valueData;
+            uint64_t submittedUs;
+            if(copy.release(&valueId, &valueData) &&
+               parseBenchValue(*valueData, &submittedUs))
+            {
+                const uint64_t now = TimerManager::now();
+                g_deliveryLatency.record(now > submittedUs ? now - submittedUs : 0);
+                next_->push(iid, ballot, paxos::Value());
+                return;
+            }
+        }
+        next_->push(iid, ballot, v);
+    }
+private:
+    InstanceSink::ptr next_;
+};
+
 void readConfig(const char* configString,
                 Guid* configHash,
                 JSON::Value* config)
@@ -127,18 +237,58 @@ void readConfig(const char* configString,
     MORDOR_LOG_INFO(g_log) << " config hash is " << *configHash;
 }
 
+//! Feeds committed instances to two sinks.
+class TeeSink : public InstanceSink {
+public:
+    TeeSink(InstanceSink::ptr first, InstanceSink::ptr second)
+        : first_(first),
+          second_(second)
+    {}
+
+    void updateEpoch(const Guid& newEpoch) {
+        first_->updateEpoch(newEpoch);
+        second_->updateEpoch(newEpoch);
+    }
+
+    void push(paxos::InstanceId iid, paxos::BallotId ballot, paxos::Value v) {
+        first_->push(iid, ballot, v);
+        second_->push(iid, ballot, v);
+    }
+private:
+    InstanceSink::ptr first_;
+    InstanceSink::ptr second_;
+};
+
 class DummyRingHolder : public RingHolder {};
 
-Socket::ptr bindSocket(Address::ptr bindAddress, IOManager* ioManager) {
-    Socket::ptr s = bindAddress->createSocket(*ioManager, SOCK_DGRAM);
+Socket::ptr bindSocket(Address::ptr bindAddress, IOManager* ioManager, int protocol = SOCK_DGRAM, bool reusePort = false) {
+    Socket::ptr s = bindAddress->createSocket(*ioManager, protocol);
+    if(protocol == SOCK_STREAM) {
+        int option = 1;
+        s->setOption(SOL_SOCKET, SO_REUSEADDR, &option, sizeof(option));
+    }
+    if(reusePort) {
+        setReusePort(s);
+    }
     s->bind(bindAddress);
     return s;
 }
 
 
+//! /metrics and /metrics.json export the histograms and rates, /trace
+//  the trace buffer, any other path the Mordor statistics.
 void httpRequest(HTTP::ServerRequest::ptr request) {
     ostringstream ss;
-    ss << Statistics::dump();
+    const string path = request->request().requestLine.uri.path.toString();
+    if(path == "/metrics") {
+        Metrics::dumpPrometheus(ss);
+    } else if(path == "/metrics.json") {
+        Metrics::dumpJson(ss);
+    } else if(path == "/trace") {
+        Tracer::dump(ss);
+    } else {
+        ss << Statistics::dump();
+    }
     MemoryStream::ptr responseStream(new MemoryStream);
     string response(ss.str());
     responseStream->write(response.c_str(), response.length());
@@ -161,6 +311,26 @@ void serveStats(IOManager* ioManager, uint16_t port) {
     }
 }
 
+void waitSnapshotFile(IOManager* ioManager,
+                      SnapshotFileWriter::ptr fileWriter)
+{
+    const uint64_t startTime = TimerManager::now();
+    const uint64_t written = fileWriter->waitComplete();
+    if(!fileWriter->verify()) {
+        fileWriter->saveProgress();
+        cerr << "Snapshot is corrupt, see the .missing file for the ranges to resend" << endl;
+        exit(1);
+    }
+    ioManager->stop();
+    cerr << Statistics::dump() << endl;
+    uint64_t endTime = TimerManager::now();
+    MORDOR_LOG_INFO(g_log) << " Received " << written << " data bytes";
+    cerr << "Received " << written << " bytes" << endl;
+    cerr << "Time: " << endTime - startTime << " us" << endl;
+    cerr << "Speed: " << int(written / ((endTime - startTime) / 1000000.)) << " bps." << endl;
+    exit(0); // HACK
+}
+
 void dumpStream(IOManager* ioManager,
                 StreamReassembler::ptr streamReassembler)
 {
@@ -198,21 +368,47 @@ void dumpStream(IOManager* ioManager,
 }
 
 
+//! Extra recovery sources (host:port) besides the acceptors.
+void readRecoveryPeers(const JSON::Value& config, vector<string>* peers) {
+    const JSON::Array& peerData = config["recovery_peers"].get<JSON::Array>();
+    for(size_t i = 0; i < peerData.size(); ++i) {
+        peers->push_back(peerData[i].get<string>());
+    }
+}
+
 void setupEverything(IOManager* ioManager, 
+                     const vector<IOManager*>& responderIoManagers,
+                     IOManager* ringVoterIoManager,
                      const Guid& configHash,
                      const JSON::Value& config,
                      const string& datacenter,
                      uint64_t snapshotId,
                      uint64_t timeoutUs,
                      StreamReassembler::ptr streamReassembler,
-                     RpcResponder::ptr* responder,
+                     SnapshotFileWriter::ptr fileWriter,
+                     vector<RpcResponder::ptr>* responders,
                      RingVoter::ptr* ringVoter,
                      uint16_t* monPort)
 {
     Address::ptr multicastGroup = Address::lookup(config["mcast_group"].get<string>(), AF_INET).front();
-    GroupConfiguration::ptr groupConfig = GroupConfiguration::parseLearnerConfig(config["hosts"], datacenter, multicastGroup);
+    uint32_t pathMtu = config["path_mtu"].get<long long>();
+    if(pathMtu == 0) {
+        pathMtu = probePathMtu(multicastGroup);
+        MORDOR_LOG_INFO(g_log) << " probed path mtu " << pathMtu;
+    }
+    GroupConfiguration::ptr groupConfig = GroupConfiguration::parseLearnerConfig(config["hosts"], datacenter, multicastGroup, pathMtu);
 
     *monPort = uint16_t(config["monitoring_port"].get<long long>());
+    if(g_monitoringPort->val() != 0) {
+        *monPort = uint16_t(g_monitoringPort->val());
+    }
+
+    char hostname[256] = "";
+    gethostname(hostname, sizeof(hostname) - 1);
+    Tracer::configure("learner." + string(hostname) + ":" +
+                          lexical_cast<string>(*monPort),
+                      config["trace_buffer_size"].get<long long>(),
+                      config["trace_sample_every"].get<long long>());
 
     //-------------------------------------------------------------------------
     // recovery manager
@@ -233,23 +429,76 @@ void setupEverything(IOManager* ioManager,
                                       reconnectDelayUs,
                                       socketTimeoutUs,
                                       retryDelayUs);
+    const uint32_t peerMetric = config["recovery_peer_metric"].get<long long>();
+    vector<string> recoveryPeers;
+    readRecoveryPeers(config, &recoveryPeers);
+    recoveryManager->setupPeerConnections(recoveryPeers,
+                                          ioManager,
+                                          peerMetric,
+                                          queuePollIntervalUs,
+                                          reconnectDelayUs,
+                                          socketTimeoutUs,
+                                          retryDelayUs);
     //-------------------------------------------------------------------------
     // commit tracker
     uint64_t recoveryGracePeriod = config["recovery_grace_period"].get<long long>();
-    boost::shared_ptr<InstanceSink> sink(new SnapshotLearnerSink(snapshotId, timeoutUs, streamReassembler, ioManager));
+    InstanceSink::ptr snapshotSink(new SnapshotLearnerSink(snapshotId, timeoutUs, streamReassembler, fileWriter, ioManager));
+    if(g_benchValues->val()) {
+        snapshotSink.reset(new DeliveryLatencySink(snapshotSink));
+    }
+    // Large values are delivered whole, but cached and served to
+    // recovery as fragments.
+    boost::shared_ptr<InstanceSink> sink(new FragmentReassemblySink(snapshotSink));
+    // Everything committed or recovered here is also served to the
+    // peers that recover from this learner.
+    const uint64_t valueCacheSize = config["learner_value_cache_size"].get<long long>();
+    if(valueCacheSize > 0) {
+        ValueCache::ptr valueCache(new ValueCache(valueCacheSize));
+        sink.reset(new TeeSink(valueCache, sink));
+        Socket::ptr recoverySocket = bindSocket(groupConfig->thisHostConfiguration().unicastAddress, ioManager, SOCK_STREAM);
+        recoverySocket->listen();
+        TcpRecoveryService::ptr tcpRecoveryService(
+            new TcpRecoveryService(ioManager, recoverySocket, valueCache,
+                                   false));
+        ioManager->schedule(boost::bind(&TcpRecoveryService::run, tcpRecoveryService));
+    }
     CommitTracker::ptr commitTracker(new CommitTracker(recoveryGracePeriod, sink, recoveryManager, ioManager));
     recoveryManager->setCommitTracker(commitTracker);
 
+    const HostConfiguration& hostConfig = groupConfig->thisHostConfiguration();
+    //cout << hostConfig << endl;
+    const size_t listenSockets = responderIoManagers.size();
+
+    if(config["learner_lightweight_delivery"].get<long long>()) {
+        //---------------------------------------------------------------------
+        // learner state
+        const size_t reorderBufferSize = config["learner_reorder_buffer_size"].get<long long>();
+        LearnerState::ptr learnerState(new LearnerState(reorderBufferSize, ioManager, recoveryManager, commitTracker));
+        RpcHandler::ptr phase2Handler(new LearnerPhase2Handler(learnerState));
+
+        for(size_t i = 0; i < listenSockets; ++i) {
+            Socket::ptr listenSocket = bindSteeredSocket(hostConfig.multicastListenAddress, responderIoManagers[i], i, listenSockets);
+            Socket::ptr replySocket = bindSocket(hostConfig.multicastReplyAddress, responderIoManagers[i], SOCK_DGRAM, listenSockets > 1);
+
+            RpcResponder::ptr responder(new RpcResponder(listenSocket, multicastGroup, replySocket));
+            responder->addHandler(RpcMessageData::PAXOS_PHASE2, phase2Handler);
+            responders->push_back(responder);
+        }
+        return;
+    }
+
     //-------------------------------------------------------------------------
     // acceptor state
     uint64_t pendingSpan = config["acceptor_pending_instances_span"].get<long long>();
-    AcceptorState::ptr acceptorState(new AcceptorState(pendingSpan, ioManager, recoveryManager, commitTracker, ValueCache::ptr()));
+    uint32_t stateShards = config["acceptor_state_shards"].get<long long>();
+    AcceptorState::ptr acceptorState(new AcceptorState(pendingSpan, stateShards, ioManager, recoveryManager, commitTracker, ValueCache::ptr()));
 
     //-------------------------------------------------------------------------
     // ring voter
-    Socket::ptr ringSocket = bindSocket(groupConfig->thisHostConfiguration().ringAddress, ioManager);
-    UdpSender::ptr udpSender(new UdpSender("ring_voter", ringSocket));
-    ioManager->schedule(boost::bind(&UdpSender::run, udpSender));
+    Socket::ptr ringSocket = bindSocket(groupConfig->thisHostConfiguration().ringAddress, ringVoterIoManager);
+    UdpSender::ptr udpSender(new UdpSender("ring_voter", ringSocket, groupConfig->datagramBudget()));
+    // On the IOManager of its socket, see UdpSender.
+    ringVoterIoManager->schedule(boost::bind(&UdpSender::run, udpSender));
     *ringVoter = RingVoter::ptr(new RingVoter(ringSocket, udpSender, acceptorState));
 
     //-------------------------------------------------------------------------
@@ -267,27 +516,27 @@ void setupEverything(IOManager* ioManager,
     RingChangeNotifier::ptr notifier(new RingChangeNotifier(holders));
     RpcHandler::ptr setRingHandler(new SetRingHandler(configHash, notifier, groupConfig));
 
-    const HostConfiguration& hostConfig = groupConfig->thisHostConfiguration();
-    //cout << hostConfig << endl;
-
-    Socket::ptr listenSocket = bindSocket(hostConfig.multicastListenAddress, ioManager);
-    Socket::ptr replySocket = bindSocket(hostConfig.multicastReplyAddress, ioManager);
+    for(size_t i = 0; i < listenSockets; ++i) {
+        Socket::ptr listenSocket = bindSteeredSocket(hostConfig.multicastListenAddress, responderIoManagers[i], i, listenSockets);
+        Socket::ptr replySocket = bindSocket(hostConfig.multicastReplyAddress, responderIoManagers[i], SOCK_DGRAM, listenSockets > 1);
 
-    *responder = RpcResponder::ptr(new RpcResponder(listenSocket, multicastGroup, replySocket));
-//  Learners don't have to respond to pings
-//    (*responder)->addHandler(RpcMessageData::PING, ponger);
-    (*responder)->addHandler(RpcMessageData::SET_RING, setRingHandler);
-    (*responder)->addHandler(RpcMessageData::PAXOS_BATCH_PHASE1, batchPhase1Handler);
-    (*responder)->addHandler(RpcMessageData::PAXOS_PHASE1, phase1Handler);
-    (*responder)->addHandler(RpcMessageData::PAXOS_PHASE2, phase2Handler);
+        RpcResponder::ptr responder(new RpcResponder(listenSocket, multicastGroup, replySocket));
+//      Learners don't have to respond to pings
+//        responder->addHandler(RpcMessageData::PING, ponger);
+        responder->addHandler(RpcMessageData::SET_RING, setRingHandler);
+        responder->addHandler(RpcMessageData::PAXOS_BATCH_PHASE1, batchPhase1Handler);
+        responder->addHandler(RpcMessageData::PAXOS_PHASE1, phase1Handler);
+        responder->addHandler(RpcMessageData::PAXOS_PHASE2, phase2Handler);
+        responders->push_back(responder);
+    }
 }
 
 int main(int argc, char** argv) {
     google::protobuf::LogSilencer logSilencer;
     try {
         Config::loadFromEnvironment();
-        if(argc != 5) {
-            cout << "Usage: learner datacenter snapshot_id timeout_sec config_json" << endl;
+        if(argc != 5 && argc != 6) {
+            cout << "Usage: learner datacenter snapshot_id timeout_sec config_json [output_file]" << endl;
             return 1;
         }
         Guid configGuid;
@@ -296,17 +545,42 @@ int main(int argc, char** argv) {
         const string datacenter(argv[1]);
         const uint64_t snapshotId = boost::lexical_cast<uint64_t>(argv[2]);
         const uint64_t timeoutUs = 1000000 * boost::lexical_cast<uint64_t>(argv[3]);
-        IOManager ioManager;
+        const size_t ioThreads = config["io_threads"].get<long long>();
+        IOManager ioManager(ioThreads);
+        const size_t listenSockets = config["multicast_listen_sockets"].get<long long>();
+        vector<DedicatedThread::ptr> responderThreads;
+        vector<IOManager*> responderIoManagers;
+        for(size_t i = 0; i < listenSockets; ++i) {
+            DedicatedThread::ptr thread(new DedicatedThread("rpc_responder", receiveLoopCpu(config, i)));
+            responderThreads.push_back(thread);
+            responderIoManagers.push_back(thread->ioManager());
+        }
+        DedicatedThread ringVoterThread("ring_voter", receiveLoopCpu(config, listenSockets));
 
         StreamReassembler::ptr streamReassembler(new StreamReassembler);
-        RpcResponder::ptr responder;
+        // With an output file, substreams are written there in parallel
+        // instead of being reassembled in order to stdout.
+        SnapshotFileWriter::ptr fileWriter;
+        if(argc == 6) {
+            fileWriter.reset(new SnapshotFileWriter(argv[5]));
+        }
+        vector<RpcResponder::ptr> responders;
         RingVoter::ptr ringVoter;
         uint16_t monPort;
-        setupEverything(&ioManager, configGuid, config, datacenter, snapshotId, timeoutUs, streamReassembler, &responder, &ringVoter, &monPort);
-        ioManager.schedule(boost::bind(&RpcResponder::run, responder));
-        ioManager.schedule(boost::bind(&RingVoter::run, ringVoter));
+        setupEverything(&ioManager, responderIoManagers, ringVoterThread.ioManager(), configGuid, config, datacenter, snapshotId, timeoutUs, streamReassembler, fileWriter, &responders, &ringVoter, &monPort);
+        for(size_t i = 0; i < responders.size(); ++i) {
+            responderThreads[i]->schedule(boost::bind(&RpcResponder::run, responders[i]));
+        }
+        if(ringVoter) {
+            ringVoterThread.schedule(boost::bind(&RingVoter::run, ringVoter));
+        }
         ioManager.schedule(boost::bind(serveStats, &ioManager, monPort));
-        ioManager.schedule(boost::bind(dumpStream, &ioManager, streamReassembler));
+        if(fileWriter) {
+            ioManager.registerTimer(kProgressSaveIntervalUs, boost::bind(&SnapshotFileWriter::saveProgress, fileWriter), true);
+            ioManager.schedule(boost::bind(waitSnapshotFile, &ioManager, fileWriter));
+        } else {
+            ioManager.schedule(boost::bind(dumpStream, &ioManager, streamReassembler));
+        }
         MORDOR_LOG_INFO(g_log) << " Learner starting.";
         ioManager.dispatch();
     } catch(...) {
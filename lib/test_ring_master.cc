@@ -1,10 +1,15 @@
 #include "guid.h"
 #include "ballot_generator.h"
+#include "dedicated_thread.h"
+#include "metrics.h"
+#include "multicast_util.h"
 #include "proposer_state.h"
 #include "phase1_batcher.h"
+#include "phase2_request.h"
 #include "sleep_helper.h"
 #include "tcp_recovery_service.h"
 #include "tcp_value_receiver.h"
+#include "trace.h"
 #include "udp_sender.h"
 #include <iostream>
 #include <string>
@@ -12,6 +17,7 @@
 #include <streambuf>
 #include <boost/bind.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <mordor/config.h>
 #include <mordor/json.h>
 #include <mordor/socket.h>
@@ -46,6 +52,12 @@ using boost::shared_ptr;
 
 static Logger::ptr g_log = Log::lookup("lightning:main");
 
+// The config is the same for all hosts, this tells apart several hosts
+// on one machine (see tools/loopback_bench.py).
+static ConfigVar<uint32_t>::ptr g_monitoringPort =
+    Config::lookup("monitoring.port", uint32_t(0),
+                   "Overrides monitoring_port of the config if not 0");
+
 void readConfig(const char* configString,
                 Guid* configHash,
                 JSON::Value* config)
@@ -59,16 +71,19 @@ void readConfig(const char* configString,
 }
 
 RpcRequester::ptr setupRequester(IOManager* ioManager,
+                                          IOManager* replyIoManager,
                                           GuidGenerator::ptr guidGenerator,
                                           GroupConfiguration::ptr groupConfiguration,
-                                          MulticastRpcStats::ptr rpcStats)
+                                          MulticastRpcStats::ptr rpcStats,
+                                          uint64_t timeoutTickUs)
 {
     Address::ptr bindAddr = groupConfiguration->thisHostConfiguration().multicastSourceAddress;
-    Socket::ptr s = bindAddr->createSocket(*ioManager, SOCK_DGRAM);
+    Socket::ptr s = bindAddr->createSocket(*replyIoManager, SOCK_DGRAM);
     s->bind(bindAddr);
-    UdpSender::ptr sender(new UdpSender("rpc_requester", s));
-    ioManager->schedule(boost::bind(&UdpSender::run, sender));
-    return RpcRequester::ptr(new RpcRequester(ioManager, guidGenerator, sender, s, groupConfiguration, rpcStats));
+    UdpSender::ptr sender(new UdpSender("rpc_requester", s, groupConfiguration->datagramBudget()));
+    // On the IOManager of its socket, see UdpSender.
+    replyIoManager->schedule(boost::bind(&UdpSender::run, sender));
+    return RpcRequester::ptr(new RpcRequester(ioManager, guidGenerator, sender, s, groupConfiguration, rpcStats, timeoutTickUs));
 }
 
 Socket::ptr bindSocket(Address::ptr bindAddress, IOManager* ioManager, int protocol = SOCK_DGRAM) {
@@ -85,6 +100,7 @@ void setupEverything(uint32_t hostId,
                      const Guid& configHash,
                      const JSON::Value& config,
                      IOManager* ioManager,
+                     DedicatedThread* replyThread,
                      Pinger::ptr* pinger,
                      RingManager::ptr* ringManager,
                      Phase1Batcher::ptr* phase1Batcher,
@@ -95,11 +111,24 @@ void setupEverything(uint32_t hostId,
 {
     Address::ptr groupMcastAddress =
         Address::lookup(config["mcast_group"].get<string>(), AF_INET).front();;
+    uint32_t pathMtu = config["path_mtu"].get<long long>();
+    if(pathMtu == 0) {
+        pathMtu = probePathMtu(groupMcastAddress);
+        MORDOR_LOG_INFO(g_log) << " probed path mtu " << pathMtu;
+    }
     GroupConfiguration::ptr groupConfiguration = GroupConfiguration::parseAcceptorConfig(config["hosts"],
                                                                                          hostId,
-                                                                                         groupMcastAddress);
+                                                                                         groupMcastAddress,
+                                                                                         pathMtu);
 
     *monPort = uint16_t(config["monitoring_port"].get<long long>());
+    if(g_monitoringPort->val() != 0) {
+        *monPort = uint16_t(g_monitoringPort->val());
+    }
+
+    Tracer::configure("master." + lexical_cast<string>(hostId),
+                      config["trace_buffer_size"].get<long long>(),
+                      config["trace_sample_every"].get<long long>());
 
     const uint64_t pingWindow = config["ping_window"].get<long long>();
     const uint64_t pingTimeout = config["ping_timeout"].get<long long>();
@@ -116,8 +145,9 @@ void setupEverything(uint32_t hostId,
     const uint64_t recvWindowUs = config["recv_window"].get<long long>();
     MulticastRpcStats::ptr rpcStats(new MulticastRpcStats(sendWindowUs, recvWindowUs));
 
-    RpcRequester::ptr requester = setupRequester(ioManager, guidGenerator, groupConfiguration, rpcStats);
-    ioManager->schedule(boost::bind(&RpcRequester::processReplies, requester));
+    const uint64_t rpcTimeoutTick = config["rpc_timeout_tick"].get<long long>();
+    RpcRequester::ptr requester = setupRequester(ioManager, replyThread->ioManager(), guidGenerator, groupConfiguration, rpcStats, rpcTimeoutTick);
+    replyThread->schedule(boost::bind(&RpcRequester::processReplies, requester));
 
     PingTracker::ptr pingTracker(new PingTracker(groupConfiguration, pingWindow, pingTimeout, hostTimeout, event, ioManager));
     *pinger = Pinger::ptr(new Pinger(ioManager, requester, groupConfiguration, pingInterval, pingTimeout, pingTracker));
@@ -153,6 +183,15 @@ void setupEverything(uint32_t hostId,
         config["phase2_timeout"].get<long long>();
     const uint64_t phase2IntervalUs =
         config["phase2_interval"].get<long long>();
+    const uint64_t phase2MinIntervalUs =
+        config["phase2_min_interval"].get<long long>();
+    const uint64_t phase2MaxIntervalUs =
+        config["phase2_max_interval"].get<long long>();
+    const SleepHelper::Backend phase2PacingBackend =
+        SleepHelper::parseBackend(
+            config["phase2_pacing_backend"].get<string>());
+    const uint64_t phase2Window =
+        config["phase2_window"].get<long long>();
     const uint64_t commitFlushIntervalUs =
         config["commit_flush_interval"].get<long long>();
     const uint64_t valueCacheSize =
@@ -172,6 +211,10 @@ void setupEverything(uint32_t hostId,
                                              phase1IntervalUs,
                                              phase2TimeoutUs,
                                              phase2IntervalUs,
+                                             phase2MinIntervalUs,
+                                             phase2MaxIntervalUs,
+                                             phase2PacingBackend,
+                                             phase2Window,
                                              commitFlushIntervalUs));
 
     Socket::ptr recoverySocket = bindSocket(groupConfiguration->thisHostConfiguration().unicastAddress, ioManager, SOCK_STREAM);
@@ -187,7 +230,10 @@ void setupEverything(uint32_t hostId,
     valueSocket->bind(valueAddress);
     valueSocket->listen();
 
-    tcpValueReceiver->reset(new TcpValueReceiver(valueBufferSize, *proposerState, *valueQueue, ioManager, valueSocket));
+    const bool compressValues = config["value_compression"].get<long long>();
+    const size_t maxValueSize = Phase2Request::maxValueSize(groupConfiguration->datagramBudget());
+    MORDOR_LOG_INFO(g_log) << " proposing values of up to " << maxValueSize << " bytes";
+    tcpValueReceiver->reset(new TcpValueReceiver(valueBufferSize, *proposerState, *valueQueue, ioManager, valueSocket, maxValueSize, compressValues));
 
     vector<RingHolder::ptr> ringHolders;
     ringHolders.push_back(*phase1Batcher);
@@ -203,9 +249,20 @@ void setupEverything(uint32_t hostId,
 //    }
 //}
 
+//! /metrics and /metrics.json export the histograms and rates, /trace
+//  the trace buffer, any other path the Mordor statistics.
 void httpRequest(HTTP::ServerRequest::ptr request) {
     ostringstream ss;
-    ss << Statistics::dump();
+    const string path = request->request().requestLine.uri.path.toString();
+    if(path == "/metrics") {
+        Metrics::dumpPrometheus(ss);
+    } else if(path == "/metrics.json") {
+        Metrics::dumpJson(ss);
+    } else if(path == "/trace") {
+        Tracer::dump(ss);
+    } else {
+        ss << Statistics::dump();
+    }
     MemoryStream::ptr responseStream(new MemoryStream);
     string response(ss.str());
     responseStream->write(response.c_str(), response.length());
@@ -280,7 +337,9 @@ int main(int argc, char** argv) {
     writePidFile(pidFd);
 
     try {
-        IOManager ioManager;
+        const size_t ioThreads = config["io_threads"].get<long long>();
+        IOManager ioManager(ioThreads);
+        DedicatedThread replyThread("rpc_requester", receiveLoopCpu(config, 0));
         Pinger::ptr pinger;
         RingManager::ptr ringManager;
         Phase1Batcher::ptr phase1Batcher;
@@ -288,7 +347,7 @@ int main(int argc, char** argv) {
         BlockingQueue<Value>::ptr clientValueQueue;
         TcpValueReceiver::ptr tcpValueReceiver;
         uint16_t monPort;
-        setupEverything(hostId, configHash, config, &ioManager, &pinger, &ringManager, &phase1Batcher, &proposerState, &clientValueQueue, &tcpValueReceiver, &monPort);
+        setupEverything(hostId, configHash, config, &ioManager, &replyThread, &pinger, &ringManager, &phase1Batcher, &proposerState, &clientValueQueue, &tcpValueReceiver, &monPort);
         GuidGenerator::ptr guidGenerator(new GuidGenerator);
         ioManager.schedule(boost::bind(&serveStats, &ioManager, monPort));
         ioManager.schedule(boost::bind(&Pinger::run, pinger));
@@ -296,7 +355,16 @@ int main(int argc, char** argv) {
         ioManager.schedule(boost::bind(&RingManager::broadcastRing, ringManager));
         ioManager.schedule(boost::bind(&Phase1Batcher::run, phase1Batcher));
         ioManager.schedule(boost::bind(&ProposerState::processReservedInstances, proposerState));
-        ioManager.schedule(boost::bind(&ProposerState::processClientValues, proposerState));
+        // BUSY_POLL pacing blocks its thread, see SleepHelper.
+        boost::scoped_ptr<DedicatedThread> issuerThread;
+        if(SleepHelper::parseBackend(config["phase2_pacing_backend"].get<string>()) ==
+               SleepHelper::BUSY_POLL)
+        {
+            issuerThread.reset(new DedicatedThread("phase2_issuer", receiveLoopCpu(config, 1)));
+            issuerThread->schedule(boost::bind(&ProposerState::processClientValues, proposerState));
+        } else {
+            ioManager.schedule(boost::bind(&ProposerState::processClientValues, proposerState));
+        }
         ioManager.schedule(boost::bind(&ProposerState::flushCommits, proposerState));
         ioManager.schedule(boost::bind(&TcpValueReceiver::run, tcpValueReceiver));
 //        ioManager.schedule(boost::bind(dumpStats, &ioManager));
@@ -0,0 +1,242 @@
+#pragma once
+
+#include <mordor/assert.h>
+#include <boost/noncopyable.hpp>
+#include <stdint.h>
+#include <vector>
+
+namespace lightning {
+
+//! A hierarchical timing wheel for large numbers of short-lived
+//  timeouts that are usually canceled before they expire (e.g. one per
+//  outstanding RPC request).
+//
+//  Time is measured in ticks of tickUs microseconds. There are kLevels
+//  wheels of kSlots slots each; a slot of level L covers kSlots^L ticks.
+//  An entry is put into the lowest level whose span covers its expiry;
+//  whenever a lower level wraps around, the corresponding slot of the
+//  level above is cascaded down. Scheduling and canceling are O(1),
+//  advancing is O(1) per tick plus O(1) per expired or cascaded entry.
+//
+//  Entries are taken from a free list which only grows, so that a
+//  wheel in steady state does not allocate.
+//
+//  This class is not synchronized.
+template<typename T>
+class TimingWheel : boost::noncopyable {
+public:
+    struct Entry;
+    //! Identifies a scheduled entry until it expires or is canceled.
+    typedef Entry* Handle;
+
+    //! startUs is the current time, tickUs the resolution.
+    TimingWheel(uint64_t tickUs, uint64_t startUs);
+
+    ~TimingWheel();
+
+    //! Schedules payload to expire after timeoutUs rounded up to the
+    //  tick. Never expires early.
+    Handle schedule(uint64_t timeoutUs, const T& payload);
+
+    //! The handle must not have expired or been canceled before.
+    void cancel(Handle handle);
+
+    //! Moves the wheel to nowUs, appending the payloads of all expired
+    //  entries to expired.
+    void advance(uint64_t nowUs, std::vector<T>* expired);
+
+    //! Number of scheduled entries.
+    size_t size() const { return size_; }
+
+    uint64_t tickUs() const { return tickUs_; }
+
+    static const size_t kSlotBits = 8;
+    static const size_t kSlots = 1 << kSlotBits;
+    static const size_t kLevels = 4;
+private:
+    struct Link {
+        Link* prev;
+        Link* next;
+    };
+
+public:
+    struct Entry : Link {
+        uint64_t expiryTick;
+        T payload;
+    };
+
+private:
+    static const size_t kEntriesPerChunk = 1024;
+
+    void insert(Entry* entry);
+
+    //! Reinserts all entries of the slot relative to the current tick.
+    void cascade(size_t level, size_t slot);
+
+    void expire(size_t slot, std::vector<T>* expired);
+
+    static void unlink(Link* link);
+
+    Entry* allocate();
+
+    void release(Entry* entry);
+
+    const uint64_t tickUs_;
+    uint64_t currentTick_;
+    size_t size_;
+
+    //! Circular list heads.
+    Link slots_[kLevels][kSlots];
+
+    std::vector<Entry*> chunks_;
+    Entry* freeList_;
+};
+
+template<typename T>
+TimingWheel<T>::TimingWheel(uint64_t tickUs, uint64_t startUs)
+    : tickUs_(tickUs),
+      currentTick_(startUs / tickUs),
+      size_(0),
+      freeList_(NULL)
+{
+    MORDOR_ASSERT(tickUs_ > 0);
+    for(size_t level = 0; level < kLevels; ++level) {
+        for(size_t slot = 0; slot < kSlots; ++slot) {
+            slots_[level][slot].prev = &slots_[level][slot];
+            slots_[level][slot].next = &slots_[level][slot];
+        }
+    }
+}
+
+template<typename T>
+TimingWheel<T>::~TimingWheel() {
+    for(size_t i = 0; i < chunks_.size(); ++i) {
+        delete [] chunks_[i];
+    }
+}
+
+template<typename T>
+typename TimingWheel<T>::Handle TimingWheel<T>::schedule(uint64_t timeoutUs,
+                                                         const T& payload)
+{
+    Entry* entry = allocate();
+    // The current tick may already be partially over, hence the extra one.
+    entry->expiryTick = currentTick_ + (timeoutUs + tickUs_ - 1) / tickUs_ + 1;
+    entry->payload = payload;
+    insert(entry);
+    ++size_;
+    return entry;
+}
+
+template<typename T>
+void TimingWheel<T>::cancel(Handle handle) {
+    unlink(handle);
+    release(handle);
+    --size_;
+}
+
+template<typename T>
+void TimingWheel<T>::advance(uint64_t nowUs, std::vector<T>* expired) {
+    const uint64_t targetTick = nowUs / tickUs_;
+    if(size_ == 0 && targetTick > currentTick_) {
+        currentTick_ = targetTick;
+        return;
+    }
+    while(currentTick_ < targetTick) {
+        ++currentTick_;
+        for(size_t level = 1; level < kLevels; ++level) {
+            const size_t lowerSlot =
+                (currentTick_ >> (kSlotBits * (level - 1))) & (kSlots - 1);
+            if(lowerSlot != 0) {
+                break;
+            }
+            cascade(level,
+                    (currentTick_ >> (kSlotBits * level)) & (kSlots - 1));
+        }
+        expire(currentTick_ & (kSlots - 1), expired);
+    }
+}
+
+template<typename T>
+void TimingWheel<T>::insert(Entry* entry) {
+    const uint64_t kMaxDelta = (uint64_t(1) << (kSlotBits * kLevels)) - 1;
+    uint64_t delta = (entry->expiryTick > currentTick_) ?
+                         entry->expiryTick - currentTick_ : 0;
+    uint64_t slotTick = entry->expiryTick;
+    if(delta > kMaxDelta) {
+        // Parked in the top level, will be reinserted on cascade.
+        delta = kMaxDelta;
+        slotTick = currentTick_ + kMaxDelta;
+    }
+    size_t level = 0;
+    while(level + 1 < kLevels &&
+          delta >= (uint64_t(1) << (kSlotBits * (level + 1))))
+    {
+        ++level;
+    }
+    Link* head =
+        &slots_[level][(slotTick >> (kSlotBits * level)) & (kSlots - 1)];
+    entry->prev = head->prev;
+    entry->next = head;
+    head->prev->next = entry;
+    head->prev = entry;
+}
+
+template<typename T>
+void TimingWheel<T>::cascade(size_t level, size_t slot) {
+    Link* head = &slots_[level][slot];
+    Link* link = head->next;
+    head->prev = head;
+    head->next = head;
+    while(link != head) {
+        Link* next = link->next;
+        insert(static_cast<Entry*>(link));
+        link = next;
+    }
+}
+
+template<typename T>
+void TimingWheel<T>::expire(size_t slot, std::vector<T>* expired) {
+    Link* head = &slots_[0][slot];
+    Link* link = head->next;
+    while(link != head) {
+        Link* next = link->next;
+        Entry* entry = static_cast<Entry*>(link);
+        if(entry->expiryTick <= currentTick_) {
+            unlink(entry);
+            expired->push_back(entry->payload);
+            release(entry);
+            --size_;
+        }
+        link = next;
+    }
+}
+
+template<typename T>
+void TimingWheel<T>::unlink(Link* link) {
+    link->prev->next = link->next;
+    link->next->prev = link->prev;
+}
+
+template<typename T>
+typename TimingWheel<T>::Entry* TimingWheel<T>::allocate() {
+    if(!freeList_) {
+        Entry* chunk = new Entry[kEntriesPerChunk];
+        chunks_.push_back(chunk);
+        for(size_t i = 0; i < kEntriesPerChunk; ++i) {
+            release(&chunk[i]);
+        }
+    }
+    Entry* entry = freeList_;
+    freeList_ = static_cast<Entry*>(entry->next);
+    return entry;
+}
+
+template<typename T>
+void TimingWheel<T>::release(Entry* entry) {
+    entry->payload = T();
+    entry->next = freeList_;
+    freeList_ = entry;
+}
+
+}  // namespace lightning
@@ -0,0 +1,54 @@
+#include "benchmark.h"
+#include "timing_wheel.h"
+#include <mordor/timer.h>
+#include <boost/bind.hpp>
+#include <vector>
+
+using Mordor::Timer;
+using Mordor::TimerManager;
+using lightning::TimingWheel;
+using std::vector;
+
+// Models the phase 2 steady state: a request every 64us with a 500ms
+// timeout keeps about 8000 timeouts live, and almost every one of them is
+// canceled when the reply arrives.
+static const size_t kLiveTimeouts = 8000;
+static const uint64_t kTimeoutUs = 500000;
+static const uint64_t kTickUs = 1000;
+
+static void noop() {}
+
+LIGHTNING_BENCHMARK(rpc_timeout_mordor_timer) {
+    TimerManager timerManager;
+    vector<Timer::ptr> timers(kLiveTimeouts);
+    for(size_t i = 0; i < kLiveTimeouts; ++i) {
+        timers[i] = timerManager.registerTimer(kTimeoutUs, &noop);
+    }
+    for(size_t i = 0; i < iterations; ++i) {
+        Timer::ptr& timer = timers[i % kLiveTimeouts];
+        timer->cancel();
+        timer = timerManager.registerTimer(kTimeoutUs, &noop);
+    }
+    for(size_t i = 0; i < kLiveTimeouts; ++i) {
+        timers[i]->cancel();
+    }
+}
+
+LIGHTNING_BENCHMARK(rpc_timeout_timing_wheel) {
+    uint64_t nowUs = 0;
+    TimingWheel<uint64_t> wheel(kTickUs, nowUs);
+    vector<TimingWheel<uint64_t>::Handle> handles(kLiveTimeouts);
+    vector<uint64_t> expired;
+    for(size_t i = 0; i < kLiveTimeouts; ++i) {
+        handles[i] = wheel.schedule(kTimeoutUs, i);
+    }
+    for(size_t i = 0; i < iterations; ++i) {
+        TimingWheel<uint64_t>::Handle& handle = handles[i % kLiveTimeouts];
+        wheel.cancel(handle);
+        handle = wheel.schedule(kTimeoutUs, i);
+        // Simulated time, so that ticking is included in the cost.
+        // Each timeout is canceled halfway through, before it expires.
+        nowUs += kTimeoutUs / kLiveTimeouts / 2;
+        wheel.advance(nowUs, &expired);
+    }
+}
@@ -0,0 +1,111 @@
+#include "timing_wheel.h"
+#include <mordor/test/test.h>
+#include <stdint.h>
+#include <map>
+#include <vector>
+
+using namespace Mordor;
+using namespace lightning;
+using std::map;
+using std::vector;
+
+namespace {
+
+typedef TimingWheel<int> Wheel;
+
+const uint64_t kTickUs = 100;
+const uint64_t kStartUs = 1000 * kTickUs;
+
+//! Advances the wheel tick by tick up to endUs, recording the time at
+//  which each payload expires.
+void advanceByTicks(Wheel* wheel, uint64_t endUs, map<int, uint64_t>* expiredAt) {
+    vector<int> expired;
+    for(uint64_t nowUs = kStartUs; nowUs <= endUs; nowUs += kTickUs) {
+        expired.clear();
+        wheel->advance(nowUs, &expired);
+        for(size_t i = 0; i < expired.size(); ++i) {
+            MORDOR_TEST_ASSERT(expiredAt->find(expired[i]) == expiredAt->end());
+            (*expiredAt)[expired[i]] = nowUs;
+        }
+    }
+}
+
+}  // anonymous namespace
+
+MORDOR_UNITTEST(TimingWheelTest, NeverExpiresEarly) {
+    Wheel wheel(kTickUs, kStartUs);
+    wheel.schedule(250, 1);
+    vector<int> expired;
+    wheel.advance(kStartUs + 250, &expired);
+    MORDOR_TEST_ASSERT(expired.empty());
+    // Rounded up to 3 ticks, plus the partial current one.
+    wheel.advance(kStartUs + 4 * kTickUs, &expired);
+    MORDOR_TEST_ASSERT_EQUAL(expired.size(), 1u);
+    MORDOR_TEST_ASSERT_EQUAL(expired[0], 1);
+    MORDOR_TEST_ASSERT_EQUAL(wheel.size(), 0u);
+}
+
+MORDOR_UNITTEST(TimingWheelTest, CascadesThroughAllLevels) {
+    Wheel wheel(kTickUs, kStartUs);
+    // Around the span boundaries of each level.
+    const uint64_t timeoutTicks[] = {
+        1, 254, 255, 256, 257, 1000,
+        65534, 65535, 65536, 65537, 100000,
+        (1 << 24) - 1, (1 << 24) + 5
+    };
+    const size_t count = sizeof(timeoutTicks) / sizeof(timeoutTicks[0]);
+    for(size_t i = 0; i < count; ++i) {
+        wheel.schedule(timeoutTicks[i] * kTickUs, int(i));
+    }
+    MORDOR_TEST_ASSERT_EQUAL(wheel.size(), count);
+
+    map<int, uint64_t> expiredAt;
+    advanceByTicks(&wheel,
+                   kStartUs + (timeoutTicks[count - 1] + 2) * kTickUs,
+                   &expiredAt);
+    MORDOR_TEST_ASSERT_EQUAL(expiredAt.size(), count);
+    MORDOR_TEST_ASSERT_EQUAL(wheel.size(), 0u);
+    for(size_t i = 0; i < count; ++i) {
+        // Exactly one tick late: the tick of schedule() counts as over.
+        MORDOR_TEST_ASSERT_EQUAL(expiredAt[int(i)],
+                                 kStartUs + (timeoutTicks[i] + 1) * kTickUs);
+    }
+}
+
+MORDOR_UNITTEST(TimingWheelTest, CanceledEntriesNeverExpire) {
+    Wheel wheel(kTickUs, kStartUs);
+    vector<Wheel::Handle> handles;
+    for(int i = 0; i < 3000; ++i) {
+        handles.push_back(wheel.schedule(uint64_t(i) * 50 * kTickUs, i));
+    }
+    // Every other entry, on all levels they were put in.
+    for(size_t i = 0; i < handles.size(); i += 2) {
+        wheel.cancel(handles[i]);
+    }
+    MORDOR_TEST_ASSERT_EQUAL(wheel.size(), 1500u);
+
+    map<int, uint64_t> expiredAt;
+    advanceByTicks(&wheel, kStartUs + 3000 * 50 * kTickUs + 2 * kTickUs,
+                   &expiredAt);
+    MORDOR_TEST_ASSERT_EQUAL(expiredAt.size(), 1500u);
+    for(map<int, uint64_t>::const_iterator it = expiredAt.begin();
+        it != expiredAt.end();
+        ++it)
+    {
+        MORDOR_TEST_ASSERT_EQUAL(it->first % 2, 1);
+    }
+    MORDOR_TEST_ASSERT_EQUAL(wheel.size(), 0u);
+}
+
+MORDOR_UNITTEST(TimingWheelTest, IdleWheelSkipsAhead) {
+    Wheel wheel(kTickUs, kStartUs);
+    vector<int> expired;
+    // Nothing scheduled, the wheel jumps instead of walking the ticks.
+    wheel.advance(kStartUs + 1000000 * kTickUs, &expired);
+    wheel.schedule(kTickUs, 7);
+    wheel.advance(kStartUs + 1000001 * kTickUs, &expired);
+    MORDOR_TEST_ASSERT(expired.empty());
+    wheel.advance(kStartUs + 1000002 * kTickUs, &expired);
+    MORDOR_TEST_ASSERT_EQUAL(expired.size(), 1u);
+    MORDOR_TEST_ASSERT_EQUAL(expired[0], 7);
+}
@@ -16,7 +16,7 @@ def addPort(host, port):
     return host + ":" + str(port)
 
 def loadHosts(filename):
-    with file(filename, 'r') as f:
+    with open(filename, 'r') as f:
         return json.load(f)
 
 def genHostConfiguration(hosts):
@@ -38,6 +38,41 @@ def genHostConfiguration(hosts):
                           addPort("0.0.0.0", UCAST_LISTEN_PORT)])
     return configuration
 
+# Ports of the index-th host on loopback, where the hosts cannot share them.
+LOOPBACK_PORT_STRIDE = 10
+
+def loopbackPort(port, index):
+    return port + LOOPBACK_PORT_STRIDE * index
+
+def genLoopbackHostConfiguration(acceptors):
+    """The master (host 0) and acceptors 1..acceptors on 127.0.0.1, all
+    listening to the group on the same port."""
+    configuration = []
+    for i in range(acceptors + 2):
+        configuration.append(["127.0.0.1" if i <= acceptors else "LEARNER",
+                              "LOOPBACK" if i <= acceptors else "ANY",
+                              addPort("0.0.0.0", MCAST_LISTEN_PORT),
+                              addPort("127.0.0.1",
+                                      loopbackPort(MCAST_REPLY_PORT, i)),
+                              addPort("127.0.0.1",
+                                      loopbackPort(MCAST_SRC_PORT, i)),
+                              addPort("127.0.0.1", loopbackPort(RING_PORT, i)),
+                              addPort("127.0.0.1",
+                                      loopbackPort(UCAST_LISTEN_PORT, i))])
+    return configuration
+
+# Settings for a whole cluster on one machine (see loopback_bench.py).
+loopbackConfiguration = {
+    # learners would compete for the recovery port.
+    "learner_value_cache_size" : 0,
+    "recovery_peers" : [],
+    # don't pin the hosts to the same cpus.
+    "receive_loop_cpus" : [],
+    "io_threads" : 2,
+    # lo has a 64k mtu, stay with what real networks use.
+    "path_mtu" : 9000,
+}
+
 configuration = {
     "ping_timeout" : 30000,
     "host_timeout" : 500000,
@@ -48,7 +83,9 @@ configuration = {
     "ring_timeout" : 50000,
     "ring_retry_interval" : 500000,
     "ring_broadcast_interval" : 500000,
+    "rpc_timeout_tick" : 1000, # resolution of all rpc request timeouts
     "acceptor_pending_instances_span" : 200000,
+    "acceptor_state_shards" : 16,
     "value_cache_size" : 1000000,
     "batch_phase1_timeout" : 300000,
     "phase1_batch_size" : 1000,
@@ -57,7 +94,11 @@ configuration = {
     "phase1_timeout" : 100000,
     "phase1_interval" : 640, # much more expensive that phase 2
     "phase2_timeout" : 500000,
-    "phase2_interval" : 64, # 15625 * 8000 bytes = 1 Gbit/s
+    "phase2_interval" : 64, # initial, 15625 * 8000 bytes = 1 Gbit/s
+    "phase2_min_interval" : 16, # rate controller bounds
+    "phase2_max_interval" : 10000,
+    "phase2_pacing_backend" : "timerfd", # or "epoll" (bursty), "busy_poll"
+    "phase2_window" : 8192, # > phase2_timeout / phase2_interval
     "recovery_grace_period" : 1500000,
     "recovery_local_metric" : 1,
     "recovery_remote_metric" : 10,
@@ -65,20 +106,64 @@ configuration = {
     "recovery_reconnect_delay" : 1000000,
     "recovery_socket_timeout" : 2000000,
     "recovery_retry_delay" : 750000,
+    # extra recovery sources, e.g. learners serving their value cache;
+    # sources with the same metric share the recovery load.
+    "recovery_peers" : [], # ["learner1:23335", ...]
+    "recovery_peer_metric" : 1,
+    "learner_value_cache_size" : 100000, # 0: learners serve no recovery
+    # 1: learners outside the ring skip the acceptor state and deliver
+    # through a reorder buffer (power of 2, > instances in flight).
+    "learner_lightweight_delivery" : 0,
+    "learner_reorder_buffer_size" : 262144,
     "commit_flush_interval" : 500000,
     "initial_backoff" : 10000,
     "max_backoff" : 2000000,
     "mcast_group" : "239.3.0.1" + ":" + str(MCAST_LISTEN_PORT),
+    # smallest mtu between the group hosts, 0: ask the kernel for the mtu
+    # of the route to mcast_group. Values and commit batches are sized to
+    # fit one unfragmented datagram.
+    "path_mtu" : 9000, # 1500 without jumbo frames
     "master_value_port" : 30000,
-    "value_buffer_size" : 30000
+    # http statistics, /metrics and /trace of every host.
+    "monitoring_port" : 8080,
+    "value_buffer_size" : 30000,
+    # lz4 compress client values that are not compressed yet; they stay
+    # compressed until a learner delivers them.
+    "value_compression" : 0,
+    # the master traces 1 in trace_sample_every instances (0: none) through
+    # the ring and the learners, every process keeps its last
+    # trace_buffer_size events for GET /trace on its monitoring port (see
+    # tools/merge_traces.py).
+    "trace_sample_every" : 1024,
+    "trace_buffer_size" : 65536,
+    "io_threads" : 4,
+    # sockets (and reader threads) on the multicast listen address,
+    # datagrams are steered between them by instance id.
+    "multicast_listen_sockets" : 1,
+    # cpus for the hot receive loops, in order: rpc responders (one per
+    # listen socket) and ring voter on acceptors and learners, rpc requester
+    # replies and, with busy_poll pacing, the phase 2 issuer on the master.
+    # Loops without a cpu here still get a thread, just not a pinned one.
+    "receive_loop_cpus" : [1, 2]
 }
 
+def genLoopbackConfiguration(acceptors):
+    result = dict(configuration)
+    result.update(loopbackConfiguration)
+    result["hosts"] = genLoopbackHostConfiguration(acceptors)
+    return result
+
 def main(argv):
     global configuration
+    if len(argv) == 3 and argv[1] == "--loopback":
+        print(json.dumps(genLoopbackConfiguration(int(argv[2])), indent=1))
+        return
     if len(argv) != 2:
-        print "usage: gen_config metaconfig.json"
+        print("usage: gen_config metaconfig.json")
+        print("       gen_config --loopback acceptors")
+        return
     configuration["hosts"] = genHostConfiguration(loadHosts(argv[1]))
-    print json.dumps(configuration, indent=1)
+    print(json.dumps(configuration, indent=1))
 
 if __name__=='__main__':
     main(sys.argv)
@@ -0,0 +1,197 @@
+#!/usr/bin/python
+#
+# Runs a master, N acceptors and M learners on loopback, drives values
+# through the master value port with submit_random_values and reports
+# the committed values/s, bytes/s and the commit and delivery latency
+# percentiles. `make loopback_bench` runs it with the defaults.
+#
+# usage: loopback_bench.py [--acceptors N] [--learners M] [--values N]
+#            [--batch N] [--value-size BYTES] [--rate VALUES_PER_SEC]
+#            [--drop-rate FRACTION] [--delay-us US] [--settle SEC]
+#            [--timeout SEC] [--bin-dir DIR] [--work-dir DIR] [--json]
+#
+# --drop-rate and --delay-us make every host drop and delay its outgoing
+# phase 2 requests and votes (the udpsender.* config vars), to catch
+# regressions in lossy or slow networks without one.
+#
+# The group is multicast, which needs a route on lo:
+#     ip route add 239.0.0.0/8 dev lo
+# Logs of all hosts end up in the work directory.
+
+from __future__ import print_function
+
+import json
+import optparse
+import os
+import signal
+import subprocess
+import sys
+import tempfile
+import time
+
+try:
+    from urllib2 import urlopen
+except ImportError:
+    from urllib.request import urlopen
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import gen_config
+
+class Cluster(object):
+    def __init__(self, options):
+        self.options = options
+        self.config = gen_config.genLoopbackConfiguration(options.acceptors)
+        # Every host hashes the config string, it must be the same.
+        self.configString = json.dumps(self.config)
+        self.monitoringPort = self.config["monitoring_port"]
+        self.processes = []
+        self.pidFiles = []
+        self.learnerPorts = []
+
+    def binary(self, name):
+        return os.path.join(self.options.bin_dir, name)
+
+    def environment(self, name, index):
+        env = dict(os.environ)
+        env["MONITORING_PORT"] = str(self.monitoringPort + index)
+        env["LOG_FILE"] = os.path.join(self.options.work_dir, name + ".log")
+        env["UDPSENDER_DROPRATE"] = str(self.options.drop_rate)
+        env["UDPSENDER_DELAY"] = str(self.options.delay_us)
+        # Only learners read it: the values submit_random_values stamps
+        # are sampled for learner.delivery_latency.
+        env["LEARNER_BENCHVALUES"] = "1"
+        return env
+
+    def startDaemon(self, binary, name, hostId, index):
+        # The master and the acceptors daemonize and write pid files.
+        pidFile = os.path.join(self.options.work_dir, name + ".pid")
+        self.pidFiles.append(pidFile)
+        subprocess.check_call([self.binary(binary), str(hostId), pidFile,
+                               self.configString],
+                              env=self.environment(name, index))
+
+    def start(self):
+        self.startDaemon("test_ring_master", "master", 0, 0)
+        for i in range(1, self.options.acceptors + 1):
+            self.startDaemon("test_ring_acceptor", "acceptor%d" % i, i, i)
+        for i in range(self.options.learners):
+            index = self.options.acceptors + 1 + i
+            name = "learner%d" % i
+            output = open(os.path.join(self.options.work_dir,
+                                       name + ".out"), 'w')
+            self.processes.append(subprocess.Popen(
+                [self.binary("test_ring_learner"), "LOOPBACK", "0",
+                 str(self.options.timeout), self.configString],
+                stdout=output, stderr=subprocess.STDOUT,
+                env=self.environment(name, index)))
+            self.learnerPorts.append(self.monitoringPort + index)
+
+    def stop(self):
+        for process in self.processes:
+            if process.poll() is None:
+                process.kill()
+        for pidFile in self.pidFiles:
+            try:
+                with open(pidFile, 'r') as f:
+                    os.kill(int(f.read().strip()), signal.SIGKILL)
+            except (IOError, OSError, ValueError):
+                pass
+
+    def submit(self):
+        """Returns the JSON summary of submit_random_values, None if it
+        failed or timed out."""
+        address = "127.0.0.1:%d" % self.config["master_value_port"]
+        output = open(os.path.join(self.options.work_dir, "client.out"), 'w+')
+        client = subprocess.Popen(
+            [self.binary("submit_random_values"), address,
+             str(self.options.values), str(self.options.batch),
+             str(self.options.value_size), str(self.options.rate)],
+            stdout=output, stderr=subprocess.STDOUT)
+        deadline = time.time() + self.options.timeout
+        while client.poll() is None and time.time() < deadline:
+            time.sleep(0.1)
+        if client.poll() is None:
+            client.kill()
+            return None
+        output.seek(0)
+        for line in output.read().splitlines():
+            if line.startswith("{"):
+                return json.loads(line)
+        return None
+
+    def deliveryLatencies(self):
+        latencies = {}
+        for port in self.learnerPorts:
+            url = "http://127.0.0.1:%d/metrics.json" % port
+            try:
+                metrics = json.loads(urlopen(url).read())
+            except Exception as e:
+                print("cannot read %s: %s" % (url, e), file=sys.stderr)
+                continue
+            latencies[port] = \
+                metrics["histograms"]["learner.delivery_latency"]
+        return latencies
+
+def report(options, result, latencies):
+    if options.json:
+        print(json.dumps({"client": result,
+                          "delivery_latency_us": latencies}))
+        return
+    print("%d acceptors, %d learners, %d values of %d bytes in batches "
+          "of %d, drop rate %g, delay %dus" %
+          (options.acceptors, options.learners, options.values,
+           options.value_size, options.batch, options.drop_rate,
+           options.delay_us))
+    print("committed %d values in %.2fs: %d values/s, %d bytes/s" %
+          (result["committed"], result["seconds"],
+           result["values_per_sec"], result["bytes_per_sec"]))
+    commit = result["commit_latency_us"]
+    print("commit latency   p50 %8dus  p99 %8dus  p99.9 %8dus" %
+          (commit["p50"], commit["p99"], commit["p999"]))
+    for (port, histogram) in sorted(latencies.items()):
+        quantiles = histogram["quantiles"]
+        print("delivery latency p50 %8dus  p99 %8dus  p99.9 %8dus "
+              "(learner :%d, %d values)" %
+              (quantiles["0.5"], quantiles["0.99"], quantiles["0.999"],
+               port, histogram["count"]))
+
+def main(argv):
+    parser = optparse.OptionParser()
+    parser.add_option("--acceptors", type="int", default=3)
+    parser.add_option("--learners", type="int", default=1)
+    parser.add_option("--values", type="int", default=100000)
+    parser.add_option("--batch", type="int", default=16)
+    parser.add_option("--value-size", type="int", default=8000)
+    parser.add_option("--rate", type="int", default=0,
+                      help="values per second, 0: as fast as possible")
+    parser.add_option("--drop-rate", type="float", default=0.0)
+    parser.add_option("--delay-us", type="int", default=0)
+    parser.add_option("--settle", type="float", default=5.0,
+                      help="seconds to let the ring form")
+    parser.add_option("--timeout", type="int", default=300)
+    parser.add_option("--bin-dir", default=os.path.join(
+        os.path.dirname(os.path.abspath(__file__)), ".."))
+    parser.add_option("--work-dir", default=None)
+    parser.add_option("--json", action="store_true", default=False)
+    (options, args) = parser.parse_args(argv[1:])
+    if options.work_dir is None:
+        options.work_dir = tempfile.mkdtemp(prefix="loopback_bench.")
+
+    cluster = Cluster(options)
+    try:
+        cluster.start()
+        time.sleep(options.settle)
+        result = cluster.submit()
+        if result is None:
+            print("the client failed or timed out, see %s" %
+                  options.work_dir, file=sys.stderr)
+            return 1
+        # Let the learners catch up with the last commits.
+        time.sleep(1)
+        report(options, result, cluster.deliveryLatencies())
+    finally:
+        cluster.stop()
+    return 0 if result["committed"] == options.values else 1
+
+if __name__=='__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,119 @@
+#!/usr/bin/python
+#
+# Merges the trace dumps of all hosts (GET /trace on their monitoring
+# ports, see trace.h) into per-stage latency percentiles of the traced
+# instances.
+#
+# usage: merge_traces.py dump_or_url...
+#
+# Every dump carries its monotonic and wall clock at the time of the dump;
+# events are moved to the wall clock with that offset. Stages within one
+# host are exact, stages across hosts (multicast, ring hops, commit
+# propagation) are off by the clock skew between them.
+
+from __future__ import print_function
+
+import json
+import sys
+
+try:
+    from urllib2 import urlopen
+except ImportError:
+    from urllib.request import urlopen
+
+def loadDump(source):
+    if source.startswith("http://"):
+        return json.loads(urlopen(source).read())
+    with open(source, 'r') as f:
+        return json.load(f)
+
+def loadEvents(sources):
+    """Returns {instance: {(node, stage): wall clock us}}, the last event
+    wins when an instance is retried."""
+    instances = {}
+    for source in sources:
+        dump = loadDump(source)
+        offset = dump["wall_clock_us"] - dump["monotonic_us"]
+        node = dump["node"]
+        for (instance, stage, timeUs) in dump["events"]:
+            events = instances.setdefault(instance, {})
+            events[(node, stage)] = timeUs + offset
+    return instances
+
+def nodesWith(events, stage):
+    return sorted([node for (node, s) in events if s == stage],
+                  key=lambda node: events[(node, stage)])
+
+def addSample(stages, name, start, end):
+    if start is not None and end is not None:
+        stages.setdefault(name, []).append(end - start)
+
+def breakDown(events, stages):
+    def at(node, stage):
+        return events.get((node, stage))
+
+    masters = nodesWith(events, "committed") or nodesWith(events, "phase2_sent")
+    if not masters:
+        return
+    master = masters[0]
+    addSample(stages, "master queueing",
+              at(master, "received"), at(master, "phase2_sent"))
+    for node in nodesWith(events, "phase2_received"):
+        addSample(stages, "phase2 multicast -> " + node,
+                  at(master, "phase2_sent"), at(node, "phase2_received"))
+
+    # The ring order is the order in which the acceptors sent the vote on.
+    ring = nodesWith(events, "vote_sent")
+    for (i, node) in enumerate(ring):
+        if i == 0:
+            addSample(stages, "vote start at " + node,
+                      at(node, "phase2_received"), at(node, "vote_sent"))
+        else:
+            addSample(stages, "ring hop %s -> %s" % (ring[i - 1], node),
+                      at(ring[i - 1], "vote_sent"), at(node, "vote_received"))
+            addSample(stages, "vote processing at " + node,
+                      at(node, "vote_received"), at(node, "vote_sent"))
+    if ring:
+        addSample(stages, "ring hop %s -> %s" % (ring[-1], master),
+                  at(ring[-1], "vote_sent"), at(master, "committed"))
+    addSample(stages, "phase2 round trip",
+              at(master, "phase2_sent"), at(master, "committed"))
+    addSample(stages, "commit batching",
+              at(master, "committed"), at(master, "commit_sent"))
+
+    for node in nodesWith(events, "delivered"):
+        addSample(stages, "commit multicast -> " + node,
+                  at(master, "commit_sent"), at(node, "commit_received"))
+        addSample(stages, "delivery at " + node,
+                  at(node, "commit_received"), at(node, "delivered"))
+        addSample(stages, "end to end -> " + node,
+                  at(master, "received"), at(node, "delivered"))
+
+def percentile(samples, q):
+    return samples[min(len(samples) - 1, int(q * len(samples)))]
+
+def main(argv):
+    if len(argv) < 2:
+        print("usage: merge_traces.py dump_or_url...")
+        return 1
+    instances = loadEvents(argv[1:])
+    stages = {}
+    for events in instances.values():
+        breakDown(events, stages)
+
+    print("%d traced instances, latencies in us" % len(instances))
+    print("%-48s %8s %8s %8s %8s %8s" %
+          ("stage", "count", "p50", "p90", "p99", "max"))
+    for samples in stages.values():
+        samples.sort()
+    # Slowest median first, that is where to look.
+    for name in sorted(stages, key=lambda name: -percentile(stages[name], 0.5)):
+        samples = stages[name]
+        print("%-48s %8d %8d %8d %8d %8d" %
+              (name, len(samples), percentile(samples, 0.5),
+               percentile(samples, 0.9), percentile(samples, 0.99),
+               samples[-1]))
+    return 0
+
+if __name__=='__main__':
+    sys.exit(main(sys.argv))
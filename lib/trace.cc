@@ -0,0 +1,128 @@
+#include "trace.h"
+#include <mordor/assert.h>
+#include <mordor/atomic.h>
+#include <mordor/timer.h>
+#include <sys/time.h>
+
+namespace lightning {
+
+using Mordor::atomicIncrement;
+using Mordor::TimerManager;
+using paxos::InstanceId;
+using std::ostream;
+using std::string;
+
+namespace {
+
+struct TraceEvent {
+    //! 1 + the number of events recorded before this one, 0 while the
+    //  event is being written.
+    volatile uint64_t seq;
+    uint64_t timeUs;
+    InstanceId instanceId;
+    uint32_t stage;
+};
+
+const char* const kStageNames[TRACE_STAGE_COUNT] = {
+    "received",
+    "phase2_sent",
+    "phase2_received",
+    "vote_received",
+    "vote_sent",
+    "committed",
+    "commit_sent",
+    "commit_received",
+    "delivered"
+};
+
+string g_node;
+TraceEvent* g_events = NULL;
+size_t g_capacity = 0;
+uint64_t g_sampleEvery = 0;
+volatile uint64_t g_recorded = 0;
+
+uint64_t wallClockUs() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return uint64_t(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+}  // anonymous namespace
+
+void Tracer::configure(const string& node,
+                       size_t capacity,
+                       uint64_t sampleEvery)
+{
+    MORDOR_ASSERT(!g_events);
+    MORDOR_ASSERT(capacity > 0);
+    g_node = node;
+    g_capacity = capacity;
+    g_sampleEvery = sampleEvery;
+    g_events = new TraceEvent[capacity]();
+}
+
+bool Tracer::sampled(InstanceId instanceId) {
+    return g_events && g_sampleEvery != 0 &&
+           instanceId % g_sampleEvery == 0;
+}
+
+void Tracer::record(TraceStage stage, InstanceId instanceId) {
+    record(stage, instanceId, TimerManager::now());
+}
+
+void Tracer::record(TraceStage stage, InstanceId instanceId, uint64_t timeUs)
+{
+    if(!g_events) {
+        return;
+    }
+    const uint64_t seq = atomicIncrement(g_recorded);
+    TraceEvent& event = g_events[(seq - 1) % g_capacity];
+    event.seq = 0;
+    __sync_synchronize();
+    event.timeUs = timeUs;
+    event.instanceId = instanceId;
+    event.stage = stage;
+    __sync_synchronize();
+    event.seq = seq;
+}
+
+void Tracer::dump(ostream& os) {
+    os << "{\"node\": \"" << g_node << "\", \"monotonic_us\": " <<
+          TimerManager::now() << ", \"wall_clock_us\": " << wallClockUs() <<
+          ", \"events\": [";
+    if(g_events) {
+        // Oldest first, starting at the slot the next event overwrites.
+        const uint64_t recorded = g_recorded;
+        const uint64_t first = (recorded > g_capacity) ?
+                               recorded - g_capacity : 0;
+        bool separate = false;
+        for(uint64_t i = first; i < recorded; ++i) {
+            const TraceEvent& slot = g_events[i % g_capacity];
+            const uint64_t seq = slot.seq;
+            __sync_synchronize();
+            TraceEvent event;
+            event.timeUs = slot.timeUs;
+            event.instanceId = slot.instanceId;
+            event.stage = slot.stage;
+            __sync_synchronize();
+            // Skip events being written or overwritten meanwhile.
+            if(seq != i + 1 || slot.seq != seq ||
+               event.stage >= TRACE_STAGE_COUNT)
+            {
+                continue;
+            }
+            os << (separate ? ", " : "") << "[" << event.instanceId <<
+                  ", \"" << kStageNames[event.stage] << "\", " <<
+                  event.timeUs << "]";
+            separate = true;
+        }
+    }
+    os << "]}\n";
+}
+
+const char* Tracer::stageName(TraceStage stage) {
+    MORDOR_ASSERT(stage < TRACE_STAGE_COUNT);
+    return kStageNames[stage];
+}
+
+}  // namespace lightning
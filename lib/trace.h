@@ -0,0 +1,71 @@
+#pragma once
+
+#include "paxos_defs.h"
+#include <iostream>
+#include <string>
+#include <stdint.h>
+
+namespace lightning {
+
+//! Where a traced instance is, in pipeline order.
+enum TraceStage {
+    //! The master read the value from its client.
+    TRACE_RECEIVED = 0,
+    TRACE_PHASE2_SENT,
+    //! An acceptor or learner got the phase 2 multicast.
+    TRACE_PHASE2_RECEIVED,
+    //! A ring acceptor got the vote from its predecessor.
+    TRACE_VOTE_RECEIVED,
+    TRACE_VOTE_SENT,
+    //! The master got the vote of the last ring acceptor.
+    TRACE_COMMITTED,
+    //! The master piggybacked the commit on a phase 2 request.
+    TRACE_COMMIT_SENT,
+    TRACE_COMMIT_RECEIVED,
+    //! A learner or acceptor handed the value over to the commit tracker.
+    TRACE_DELIVERED,
+    TRACE_STAGE_COUNT
+};
+
+//! Sampled per-instance tracing across the master, the ring and the
+//  learners.
+//
+//  The master traces one in sampleEvery instances and flags their
+//  phase 2 requests and votes, every process records a monotonic
+//  timestamp for each stage of a flagged instance it sees. Events go to
+//  a per-process ring buffer which keeps the last capacity of them:
+//  recording is a single atomic increment plus a few stores, there is
+//  no lock. dump() writes the buffer as JSON with a wall clock reference
+//  so that tools/merge_traces.py can put the dumps of all hosts on one
+//  time line (which is only as good as their clock synchronization).
+//
+//  Instance ids restart with every epoch, so dumps should not span a
+//  master change.
+class Tracer {
+public:
+    //! Call once at startup, before any fiber records. Until then
+    //  nothing is traced. 0 traces no instance. All processes should
+    //  use the same sampleEvery: the master flags the phase 2 requests
+    //  of the instances it samples, the others use sampled() where no
+    //  flag comes along, e.g. for piggybacked commits.
+    static void configure(const std::string& node,
+                          size_t capacity,
+                          uint64_t sampleEvery);
+
+    //! Whether the master traces instanceId.
+    static bool sampled(paxos::InstanceId instanceId);
+
+    static void record(TraceStage stage, paxos::InstanceId instanceId);
+
+    //! Records an event which happened at timeUs (TimerManager::now()).
+    static void record(TraceStage stage,
+                       paxos::InstanceId instanceId,
+                       uint64_t timeUs);
+
+    //! Events being recorded meanwhile may be left out.
+    static void dump(std::ostream& os);
+
+    static const char* stageName(TraceStage stage);
+};
+
+}  // namespace lightning
@@ -1,49 +1,114 @@
 #include "udp_sender.h"
+#include <mordor/assert.h>
+#include <mordor/config.h>
 #include <mordor/log.h>
+#include <mordor/scheduler.h>
+#include <mordor/sleep.h>
+#include <mordor/timer.h>
+#include <stdlib.h>
 
 namespace lightning {
 
-const size_t UdpSender::kMaxDatagramSize;
-
 using Mordor::Address;
+using Mordor::Config;
+using Mordor::ConfigVar;
 using Mordor::CountStatistic;
 using Mordor::Log;
 using Mordor::Logger;
+using Mordor::Scheduler;
 using Mordor::Socket;
 using Mordor::Statistics;
+using Mordor::TimerManager;
 
 static Logger::ptr g_log = Log::lookup("lightning:udp_sender");
 
+static ConfigVar<double>::ptr g_dropRate =
+    Config::lookup("udpsender.droprate", 0.0,
+                   "Fraction of outgoing datagrams to drop, for testing");
+
+static ConfigVar<uint64_t>::ptr g_delayUs =
+    Config::lookup("udpsender.delay", uint64_t(0),
+                   "Microseconds to hold outgoing datagrams, for testing");
+
 UdpSender::UdpSender(const std::string& name,
-                     Socket::ptr socket)
+                     Socket::ptr socket,
+                     size_t datagramBudget)
     : name_(name),
       socket_(socket),
+      datagramBudget_(datagramBudget),
+      dropRate_(g_dropRate->val()),
+      delayUs_(g_delayUs->val()),
+      randomState_(uint32_t(TimerManager::now())),
+      buffer_(kMaxDatagramSize),
       queue_(name + "_queue"),
+      runningLoops_(0),
       outPackets_(Statistics::registerStatistic(name_ + ".out_packets",
                                                 CountStatistic<uint64_t>())),
       outBytes_(Statistics::registerStatistic(name_ + ".out_bytes",
-                                              CountStatistic<uint64_t>()))
-{}
+                                              CountStatistic<uint64_t>())),
+      oversizedPackets_(
+          Statistics::registerStatistic(name_ + ".oversized_packets",
+                                        CountStatistic<uint64_t>())),
+      droppedPackets_(
+          Statistics::registerStatistic(name_ + ".dropped_packets",
+                                        CountStatistic<uint64_t>()))
+{
+    MORDOR_ASSERT(datagramBudget_ <= kMaxDatagramSize);
+    if(dropRate_ > 0 || delayUs_ > 0) {
+        MORDOR_LOG_WARNING(g_log) << name_ << " dropping " << dropRate_ <<
+                                     " of the datagrams, delaying by " <<
+                                     delayUs_ << "us";
+    }
+}
 
 void UdpSender::run() {
+    const uint32_t runningLoops = ++runningLoops_;
+    if(runningLoops != 1) {
+        MORDOR_LOG_ERROR(g_log) << name_ << " started " << runningLoops <<
+                                   " times, only the first run() sends";
+        MORDOR_ASSERT(runningLoops == 1);
+        return;
+    }
     setupSocket();
+    // The delay is the same for all datagrams, so waiting for the oldest
+    // one delays the others just as much.
+    TimerManager* timerManager =
+        dynamic_cast<TimerManager*>(Scheduler::getThis());
+    MORDOR_ASSERT(delayUs_ == 0 || timerManager);
     while(true) {
         auto request = queue_.pop();
-        
-        char buffer[kMaxDatagramSize];
+        if(delayUs_ > 0) {
+            const uint64_t now = TimerManager::now();
+            if(now < request.enqueuedUs + delayUs_) {
+                Mordor::sleep(*timerManager,
+                              request.enqueuedUs + delayUs_ - now);
+            }
+        }
+
         size_t commandSize = request.message->ByteSize();
         MORDOR_ASSERT(commandSize <= kMaxDatagramSize);
-        if(!request.message->SerializeToArray(buffer, kMaxDatagramSize)) {
+        if(commandSize > datagramBudget_) {
+            MORDOR_LOG_DEBUG(g_log) << name_ << " " << commandSize <<
+                                       " byte datagram exceeds the budget of " <<
+                                       datagramBudget_;
+            oversizedPackets_.increment();
+        }
+        if(!request.message->SerializeToArray(&buffer_[0], buffer_.size())) {
             MORDOR_LOG_WARNING(g_log) << name_ << " failed to serialize";
             if(request.onFail) {
                 request.onFail();
             }
             continue;
         }
-        socket_->sendTo((const void*)buffer,
-                        commandSize,
-                        0,
-                        *request.destination);
+        if(dropNext()) {
+            // Lost on the way as far as the sender can tell.
+            droppedPackets_.increment();
+        } else {
+            socket_->sendTo((const void*)&buffer_[0],
+                            commandSize,
+                            0,
+                            *request.destination);
+        }
         outPackets_.increment();
         outBytes_.add(commandSize);
         if(request.onSend) {
@@ -57,7 +122,16 @@ void UdpSender::send(const Address::ptr& destination,
                      boost::function<void()> onSend,
                      boost::function<void()> onFail)
 {
-    queue_.push(PendingMessage(destination, message, onSend, onFail));
+    queue_.push(PendingMessage(destination,
+                               message,
+                               onSend,
+                               onFail,
+                               delayUs_ ? TimerManager::now() : 0));
+}
+
+bool UdpSender::dropNext() {
+    return dropRate_ > 0 &&
+           rand_r(&randomState_) < dropRate_ * (double(RAND_MAX) + 1);
 }
 
 void UdpSender::setupSocket() {
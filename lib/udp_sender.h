@@ -1,13 +1,16 @@
 #pragma once
 
 #include "blocking_queue.h"
+#include "datagram.h"
 #include "proto/rpc_messages.pb.h"
+#include <mordor/atomic.h>
 #include <mordor/socket.h>
 #include <mordor/statistics.h>
 #include <boost/bind.hpp>
 #include <iostream>
 #include <string>
 #include <utility>
+#include <vector>
 
 namespace lightning {
 
@@ -16,7 +19,19 @@ namespace lightning {
 //  (high send rate from several fibers can lead to an attempt to
 //  simultaneously wait on the socket, which will assert inside
 //  the IOManager.
+//  send() may be called from any fiber on any thread. Only the run()
+//  fiber touches the socket: start it exactly once per sender, on the
+//  IOManager the socket was created on. That fiber may resume on any
+//  thread of the IOManager but never runs concurrently with itself,
+//  which is all the socket needs. A second run() is refused, see run().
 //  May be made throttled in the future.
+//
+//  Messages larger than datagramBudget are still sent, but get IP
+//  fragmented on the way; they are counted as oversized.
+//
+//  To emulate a real network on loopback, the udpsender.droprate and
+//  udpsender.delay config vars make every sender drop that fraction of
+//  its datagrams and send the others that many microseconds late.
 class UdpSender {
 public:
     typedef boost::shared_ptr<UdpSender> ptr;
@@ -25,9 +40,12 @@ public:
     //  the statistics.
     //  Socket MUST NOT be used for sending packets by anyone else.
     UdpSender(const std::string& name,
-              Mordor::Socket::ptr socket);
+              Mordor::Socket::ptr socket,
+              size_t datagramBudget = kMaxDatagramSize);
 
-    //! Sends the enqueued packets.
+    //! Sends the enqueued packets, never returns. Must be called once
+    //  per sender: a second call asserts, and returns right away in
+    //  builds without assertions.
     void run();
 
     //! Enqueues a message.
@@ -41,30 +59,45 @@ private:
     //! Sets the multicast TTL on the socket to max (255).
     void setupSocket();
 
-    static const size_t kMaxDatagramSize = 8950;
-
     struct PendingMessage {
         Mordor::Address::ptr destination;
         boost::shared_ptr<const RpcMessageData> message;
         boost::function<void()> onSend;
         boost::function<void()> onFail;
+        //! Only set if datagrams are delayed.
+        uint64_t enqueuedUs;
 
         PendingMessage(Mordor::Address::ptr _destination,
                        boost::shared_ptr<const RpcMessageData> _message,
                        boost::function<void()> _onSend,
-                       boost::function<void()> _onFail)
+                       boost::function<void()> _onFail,
+                       uint64_t _enqueuedUs)
             : destination(_destination),
               message(_message),
               onSend(_onSend),
-              onFail(_onFail)
+              onFail(_onFail),
+              enqueuedUs(_enqueuedUs)
         {}
     };
+
+    //! Whether the next datagram is lost on the emulated network.
+    bool dropNext();
     
     const std::string name_;
     Mordor::Socket::ptr socket_;
+    const size_t datagramBudget_;
+    const double dropRate_;
+    const uint64_t delayUs_;
+    //! For dropNext(), only touched by run().
+    unsigned int randomState_;
+    //! Only touched by run().
+    std::vector<char> buffer_;
     BlockingQueue<PendingMessage> queue_;
+    Mordor::Atomic<uint32_t> runningLoops_;
     Mordor::CountStatistic<uint64_t>& outPackets_;
     Mordor::CountStatistic<uint64_t>& outBytes_;
+    Mordor::CountStatistic<uint64_t>& oversizedPackets_;
+    Mordor::CountStatistic<uint64_t>& droppedPackets_;
 
     friend std::ostream& operator<<(std::ostream&, const PendingMessage&);
 };
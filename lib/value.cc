@@ -1,50 +1,246 @@
 #include "value.h"
 #include "proto/rpc_messages.pb.h"
 #include <mordor/assert.h>
+#include <mordor/log.h>
+#include <mordor/statistics.h>
+#include <lz4.h>
+#include <algorithm>
 #include <string.h>
 
 namespace lightning {
 namespace paxos {
 
+using Mordor::CountStatistic;
+using Mordor::Log;
+using Mordor::Logger;
+using Mordor::Statistics;
+using std::min;
 using std::string;
+using std::vector;
 using boost::shared_ptr;
 
+static Logger::ptr g_log = Log::lookup("lightning:value");
+
+static CountStatistic<uint64_t>& g_malformedValues =
+    Statistics::registerStatistic("value.malformed",
+                                  CountStatistic<uint64_t>());
+
 const uint32_t Value::kMaxValueSize;
+const uint32_t Value::kMaxUncompressedSize;
+const uint32_t Value::kMinCompressSize;
+const uint32_t Value::kMaxLargeValueSize;
+const uint32_t Value::kDefaultValueSize;
 
 Value::Value()
+    : offset_(0),
+      length_(0),
+      uncompressedSize_(0),
+      fragmentIndex_(0),
+      fragmentCount_(0),
+      receivedAtUs_(0)
 {}
 
 Value::Value(const Guid& valueId,
              shared_ptr<string> data)
     : valueId_(valueId),
-      data_(data)
+      data_(data),
+      offset_(0),
+      length_(data ? data->length() : 0),
+      uncompressedSize_(0),
+      fragmentIndex_(0),
+      fragmentCount_(0),
+      receivedAtUs_(0)
 {
     MORDOR_ASSERT(!!data);
-    MORDOR_ASSERT(data->length() <= kMaxValueSize);
+    MORDOR_ASSERT(data->length() <= kMaxLargeValueSize);
+}
+
+Value::Value(const Guid& valueId,
+             shared_ptr<string> buffer,
+             size_t offset,
+             size_t length)
+    : valueId_(valueId),
+      data_(buffer),
+      offset_(offset),
+      length_(length),
+      uncompressedSize_(0),
+      fragmentIndex_(0),
+      fragmentCount_(0),
+      receivedAtUs_(0)
+{
+    MORDOR_ASSERT(!!buffer);
+    MORDOR_ASSERT(offset <= buffer->length());
+    MORDOR_ASSERT(length <= buffer->length() - offset);
+    MORDOR_ASSERT(length <= kMaxLargeValueSize);
 }
 
 void Value::set(const Guid& valueId,
                 shared_ptr<string> data)
 {
     MORDOR_ASSERT(!!data);
-    MORDOR_ASSERT(data->length() <= kMaxValueSize);
+    MORDOR_ASSERT(data->length() <= kMaxLargeValueSize);
     valueId_ = valueId;
     data_ = data;
+    offset_ = 0;
+    length_ = data->length();
+    uncompressedSize_ = 0;
+    fragmentOf_ = Guid();
+    fragmentIndex_ = 0;
+    fragmentCount_ = 0;
+    receivedAtUs_ = 0;
 }
 
-void Value::release(Guid* valueId,
+bool Value::release(Guid* valueId,
                     shared_ptr<string>* data)
 {
     MORDOR_ASSERT(!!data_);
     *valueId = valueId_;
     valueId_ = Guid();
-    *data = data_;
-    data_.reset();
+    bool result = true;
+    if(uncompressedSize_ != 0) {
+        data->reset(new string);
+        if(!decompress(data->get())) {
+            MORDOR_LOG_ERROR(g_log) << this << " corrupt compressed value " <<
+                                       *valueId;
+            data->reset();
+            result = false;
+        }
+    } else if(offset_ == 0 && length_ == data_->length()) {
+        *data = data_;
+    } else {
+        data->reset(new string(data_->data() + offset_, length_));
+    }
+    reset();
+    return result;
+}
+
+bool Value::decompress(string* out) const {
+    out->resize(uncompressedSize_);
+    const int bytes = LZ4_decompress_safe(data_->data() + offset_,
+                                          &(*out)[0],
+                                          int(length_),
+                                          int(uncompressedSize_));
+    return bytes == int(uncompressedSize_);
+}
+
+void Value::compact() {
+    MORDOR_ASSERT(!!data_);
+    if(offset_ == 0 && length_ == data_->length()) {
+        return;
+    }
+    data_.reset(new string(data_->data() + offset_, length_));
+    offset_ = 0;
+}
+
+bool Value::compress() {
+    MORDOR_ASSERT(!!data_);
+    if(uncompressedSize_ != 0) {
+        return true;
+    }
+    if(length_ < kMinCompressSize || length_ > kMaxUncompressedSize) {
+        return false;
+    }
+    shared_ptr<string> compressed(
+        new string(LZ4_compressBound(int(length_)), '\0'));
+    const int bytes = LZ4_compress_default(data_->data() + offset_,
+                                           &(*compressed)[0],
+                                           int(length_),
+                                           int(compressed->length()));
+    if(bytes <= 0 || size_t(bytes) >= length_) {
+        return false;
+    }
+    compressed->resize(bytes);
+    uncompressedSize_ = length_;
+    data_ = compressed;
+    offset_ = 0;
+    length_ = bytes;
+    return true;
+}
+
+bool Value::setCompressed(uint32_t uncompressedSize) {
+    if(uncompressedSize == 0 || uncompressedSize > kMaxUncompressedSize) {
+        return false;
+    }
+    uncompressedSize_ = uncompressedSize;
+    return true;
+}
+
+bool Value::compressed() const {
+    return uncompressedSize_ != 0;
+}
+
+bool Value::verifyCompressed() const {
+    if(uncompressedSize_ == 0) {
+        return true;
+    }
+    MORDOR_ASSERT(!!data_);
+    string scratch;
+    return decompress(&scratch);
+}
+
+void Value::split(size_t fragmentSize, vector<Value>* fragments) const {
+    MORDOR_ASSERT(!!data_);
+    MORDOR_ASSERT(uncompressedSize_ == 0);
+    MORDOR_ASSERT(fragmentCount_ == 0);
+    MORDOR_ASSERT(fragmentSize > 0 && fragmentSize <= kMaxValueSize);
+    fragments->clear();
+    const uint32_t count =
+        std::max<uint32_t>(1, (length_ + fragmentSize - 1) / fragmentSize);
+    string idData;
+    valueId_.serialize(&idData);
+    const size_t idLength = idData.length();
+    for(uint32_t i = 0; i < count; ++i) {
+        // Fragment ids only have to be unique, derive them from the
+        // value id.
+        idData.resize(idLength);
+        idData.append(reinterpret_cast<const char*>(&i), sizeof(i));
+        const size_t fragmentOffset = size_t(i) * fragmentSize;
+        Value fragment(Guid::fromData(idData.data(), idData.length()),
+                       data_,
+                       offset_ + fragmentOffset,
+                       min(fragmentSize, length_ - fragmentOffset));
+        fragment.fragmentOf_ = valueId_;
+        fragment.fragmentIndex_ = i;
+        fragment.fragmentCount_ = count;
+        fragment.receivedAtUs_ = receivedAtUs_;
+        fragments->push_back(fragment);
+    }
+}
+
+bool Value::isFragment() const {
+    return fragmentCount_ != 0;
+}
+
+const Guid& Value::fragmentOf() const {
+    return fragmentOf_;
+}
+
+uint32_t Value::fragmentIndex() const {
+    return fragmentIndex_;
+}
+
+uint32_t Value::fragmentCount() const {
+    return fragmentCount_;
+}
+
+uint64_t Value::receivedAtUs() const {
+    return receivedAtUs_;
+}
+
+void Value::setReceivedAtUs(uint64_t receivedAtUs) {
+    receivedAtUs_ = receivedAtUs;
 }
 
 void Value::reset() {
     valueId_ = Guid();
     data_.reset();
+    offset_ = 0;
+    length_ = 0;
+    uncompressedSize_ = 0;
+    fragmentOf_ = Guid();
+    fragmentIndex_ = 0;
+    fragmentCount_ = 0;
+    receivedAtUs_ = 0;
 }
 
 const Guid& Value::valueId() const {
@@ -53,28 +249,80 @@ const Guid& Value::valueId() const {
 
 size_t Value::size() const {
     MORDOR_ASSERT(!!data_);
-    return data_->length();
+    return length_;
+}
+
+const char* Value::data() const {
+    MORDOR_ASSERT(!!data_);
+    return data_->data() + offset_;
 }
 
-Value Value::parse(const ValueData& valueData) {
-    Guid valueId = Guid::parse(valueData.id());
+bool Value::parse(const ValueData& valueData, Value* value) {
+    // Everything here comes off the wire: a corrupted or malicious
+    // datagram must not take the process down.
+    bool valid = valueData.id().length() == sizeof(Guid) &&
+                 valueData.data().length() <= kMaxValueSize;
+    if(valid && valueData.has_fragment()) {
+        const FragmentData& fragment = valueData.fragment();
+        valid = fragment.value_id().length() == sizeof(Guid) &&
+                fragment.index() < fragment.count();
+    }
+    if(!valid) {
+        MORDOR_LOG_WARNING(g_log) << "malformed value of " <<
+                                     valueData.data().length() << " bytes";
+        g_malformedValues.increment();
+        return false;
+    }
     // TODO(skywalker): release_data with newer protobuf.
     shared_ptr<string> data(new string(valueData.data()));
-    MORDOR_ASSERT(!!data && data->length() <= kMaxValueSize);
-    return Value(valueId, data);
+    Value parsed(Guid::parse(valueData.id()), data);
+    if(valueData.has_uncompressed_size() &&
+       !parsed.setCompressed(valueData.uncompressed_size()))
+    {
+        MORDOR_LOG_WARNING(g_log) << "malformed compressed value " <<
+                                     parsed.valueId() << ", uncompressed " <<
+                                     "size " << valueData.uncompressed_size();
+        g_malformedValues.increment();
+        return false;
+    }
+    if(valueData.has_fragment()) {
+        const FragmentData& fragment = valueData.fragment();
+        parsed.fragmentOf_ = Guid::parse(fragment.value_id());
+        parsed.fragmentIndex_ = fragment.index();
+        parsed.fragmentCount_ = fragment.count();
+    }
+    *value = parsed;
+    return true;
 }
 
 void Value::serialize(ValueData* data) const {
     MORDOR_ASSERT(!!data_);
     valueId_.serialize(data->mutable_id());
-    data->set_data(*data_);
+    data->set_data(data_->data() + offset_, length_);
+    if(uncompressedSize_ != 0) {
+        data->set_uncompressed_size(uncompressedSize_);
+    }
+    if(fragmentCount_ != 0) {
+        FragmentData* fragment = data->mutable_fragment();
+        fragmentOf_.serialize(fragment->mutable_value_id());
+        fragment->set_index(fragmentIndex_);
+        fragment->set_count(fragmentCount_);
+    }
 }
 
 std::ostream& Value::output(std::ostream& os) const {
     if(!data_) {
         os << "(null value)";
     } else {
-        os << "Value(" << valueId_ << ", size=" << data_->length() << ")";
+        os << "Value(" << valueId_ << ", size=" << length_;
+        if(uncompressedSize_ != 0) {
+            os << ", uncompressed=" << uncompressedSize_;
+        }
+        if(fragmentCount_ != 0) {
+            os << ", fragment " << fragmentIndex_ << "/" << fragmentCount_ <<
+                  " of " << fragmentOf_;
+        }
+        os << ")";
     }
     return os;
 }
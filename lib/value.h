@@ -6,6 +6,7 @@
 #include <boost/shared_ptr.hpp>
 #include <iostream>
 #include <string>
+#include <vector>
 
 namespace lightning {
 
@@ -14,6 +15,17 @@ class ValueData;
 namespace paxos {
 
 //! A string of bytes together with a GUID.
+//  The bytes may be a slice of a larger shared buffer (e.g. a batch
+//  frame read from a client), which is then kept alive by the value.
+//
+//  The bytes may also be LZ4 compressed. A compressed value travels,
+//  gets cached and is served to recovery as is; size() and data() refer
+//  to the compressed bytes, only release() decompresses.
+//
+//  Values of up to kMaxLargeValueSize bytes are accepted from clients,
+//  but only those that fit a single datagram of the group fit an
+//  instance (see Phase2Request::maxValueSize). Larger ones are split into
+//  fragments, which are values of their own.
 //  Not fiber-safe.
 class Value {
 public:
@@ -22,16 +34,60 @@ public:
     //! Value with given id and data.
     Value(const Guid& valueId,
           boost::shared_ptr<std::string> data);
+    //! Value with given id and data[offset, offset + length).
+    Value(const Guid& valueId,
+          boost::shared_ptr<std::string> buffer,
+          size_t offset,
+          size_t length);
 
     //! Overwrites the previous id and data.
     void set(const Guid& valueId,
              boost::shared_ptr<std::string> data);
 
     //! Extracts id and data from the value, leaving it empty.
-    //  Asserts on empty data.
-    void release(Guid* valueId,
+    //  Asserts on empty data. Copies the data if it is a slice,
+    //  decompresses it if compressed. Returns false, with a null data
+    //  pointer, if the compressed data is corrupt.
+    bool release(Guid* valueId,
                  boost::shared_ptr<std::string>* data);
 
+    //! Copies the data if it is a slice, so that the value stops
+    //  keeping the larger buffer alive. Compressed data stays compressed.
+    void compact();
+
+    //! Compresses the data if that makes it smaller. Returns true if
+    //  the value is compressed.
+    bool compress();
+
+    //! Declares the data an LZ4 block expanding to uncompressedSize
+    //  bytes. Returns false, leaving the value as is, unless
+    //  0 < uncompressedSize <= kMaxUncompressedSize.
+    bool setCompressed(uint32_t uncompressedSize);
+
+    bool compressed() const;
+
+    //! Returns false if the value is compressed but its data does not
+    //  expand to the declared size. Decompresses to find out, so it is
+    //  meant for untrusted input, e.g. values compressed by clients.
+    bool verifyCompressed() const;
+
+    //! Splits the value into fragments of at most fragmentSize bytes,
+    //  which share its data. Asserts the value is not compressed.
+    void split(size_t fragmentSize, std::vector<Value>* fragments) const;
+
+    //! Set on fragments produced by split().
+    bool isFragment() const;
+    //! The id of the value this is a fragment of.
+    const Guid& fragmentOf() const;
+    uint32_t fragmentIndex() const;
+    uint32_t fragmentCount() const;
+
+    //! When the master read the value from its client
+    //  (TimerManager::now()), 0 if unknown. Kept in memory only, for
+    //  tracing; fragments inherit it.
+    uint64_t receivedAtUs() const;
+    void setReceivedAtUs(uint64_t receivedAtUs);
+
     //! Release data, reset guid to zero.
     void reset();
 
@@ -41,19 +97,46 @@ public:
     //! Current value size. Asserts on empty data.
     size_t size() const;
 
+    //! Pointer to size() bytes of data. Asserts on empty data.
+    const char* data() const;
+
     //! Serialize to protobuf.
     void serialize(ValueData* data) const;
 
-    //! Parse from protobuf.
-    static Value parse(const ValueData& data);
+    //! Parse from protobuf. Returns false if the data is malformed,
+    //  which is counted in value.malformed; callers drop the message.
+    static bool parse(const ValueData& data, Value* value);
 
     //! For debug output
     std::ostream& output(std::ostream& os) const;
 
-    static const uint32_t kMaxValueSize = 8000;
+    //! No instance value is larger, whatever the path MTU: the value
+    //  must leave room for the rest of a phase 2 request in the largest
+    //  UDP datagram.
+    static const uint32_t kMaxValueSize = 65000;
+    //! What values were limited to before the datagram size became
+    //  configurable; fits the default jumbo frame path MTU.
+    static const uint32_t kDefaultValueSize = 8000;
+    //! Limits what a compressed value may expand to.
+    static const uint32_t kMaxUncompressedSize = 512 * 1024;
+    //! Smaller values are not worth compressing.
+    static const uint32_t kMinCompressSize = 256;
+    static const uint32_t kMaxLargeValueSize = 4 * 1024 * 1024;
 private:
+    //! Expands the compressed data into out, returns false if corrupt.
+    bool decompress(std::string* out) const;
+
     Guid valueId_;
     boost::shared_ptr<std::string> data_;
+    size_t offset_;
+    size_t length_;
+    //! 0 if the data is not compressed.
+    uint32_t uncompressedSize_;
+    Guid fragmentOf_;
+    uint32_t fragmentIndex_;
+    //! 0 if not a fragment.
+    uint32_t fragmentCount_;
+    uint64_t receivedAtUs_;
 };
 
 inline
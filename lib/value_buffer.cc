@@ -1,5 +1,6 @@
 #include "value_buffer.h"
 #include "blocking_queue.h"
+#include <mordor/assert.h>
 #include <mordor/log.h>
 
 namespace lightning {
@@ -10,6 +11,7 @@ using Mordor::Log;
 using Mordor::Logger;
 using paxos::ProposerInstance;
 using paxos::Value;
+using std::vector;
 
 static Logger::ptr g_log = Log::lookup("lightning:value_buffer");
 
@@ -17,42 +19,105 @@ ValueBuffer::ValueBuffer(size_t uncommittedLimit,
                          ProposerState::ptr proposerState,
                          BlockingQueue<Value>::ptr submitQueue)
     : uncommittedLimit_(uncommittedLimit),
+      nextSeq_(0),
+      committedValues_(0),
+      closed_(false),
       proposerState_(proposerState),
       submitQueue_(submitQueue),
       canPush_(false)
 {
-    proposerState->addNotifier(this);
+    connectionId_ = proposerState->addNotifier(this);
     canPush_.set();
+    // The initial credit.
+    acksReady_.set();
 }
 
 ValueBuffer::~ValueBuffer() {
-    proposerState_->removeNotifier(this);
+    proposerState_->removeNotifier(connectionId_);
 }
 
 void ValueBuffer::pushValue(const paxos::Value& value) {
-    MORDOR_LOG_TRACE(g_log) << this << " push(" << value.valueId() <<
-        ") waiting";
+    const uint64_t seq = nextSeq(value.valueId());
+    proposerState_->registerValue(connectionId_, seq, value.valueId());
+    submitQueue_->push(value);
+}
+
+void ValueBuffer::pushFragments(const Guid& valueId,
+                                const vector<Value>& fragments)
+{
+    MORDOR_ASSERT(!fragments.empty());
+    const uint64_t seq = nextSeq(valueId);
+    {
+        FiberMutex::ScopedLock lk(mutex_);
+        FragmentedValue& fragmented = fragmentedValues_[seq];
+        fragmented.valueId = valueId;
+        fragmented.uncommittedFragments = fragments.size();
+    }
+    for(size_t i = 0; i < fragments.size(); ++i) {
+        proposerState_->registerValue(connectionId_,
+                                      seq,
+                                      fragments[i].valueId());
+        submitQueue_->push(fragments[i]);
+    }
+}
+
+uint64_t ValueBuffer::nextSeq(const Guid& valueId) {
+    MORDOR_LOG_TRACE(g_log) << this << " push(" << valueId << ") waiting";
     canPush_.wait();
-    MORDOR_LOG_TRACE(g_log) << this << " push(" << value.valueId() << ")";
-    
+    MORDOR_LOG_TRACE(g_log) << this << " push(" << valueId << ")";
+
     FiberMutex::ScopedLock lk(mutex_);
-    uncommittedValueIds_.insert(value.valueId());
-    if(uncommittedValueIds_.size() >= uncommittedLimit_) {
+    const uint64_t seq = nextSeq_++;
+    if(nextSeq_ - committedValues_ >= uncommittedLimit_) {
         MORDOR_LOG_TRACE(g_log) << this << " buffer is full";
         canPush_.reset();
     }
-    submitQueue_->push(value);
+    return seq;
 }
 
-void ValueBuffer::notify(const ProposerInstance::ptr& instance) {
+void ValueBuffer::notify(const ProposerState::ValueCommit& commit) {
+    const ProposerInstance::ptr& instance = commit.instance;
     FiberMutex::ScopedLock lk(mutex_);
-    MORDOR_LOG_TRACE(g_log) << this << " notify(" <<
+    MORDOR_LOG_TRACE(g_log) << this << " notify(" << commit.seq << ", " <<
         instance->value().valueId() << ")";
-    uncommittedValueIds_.erase(instance->value().valueId());
-    if(uncommittedValueIds_.size() + 1 == uncommittedLimit_) {
+    MORDOR_ASSERT(commit.seq < nextSeq_);
+    Ack ack;
+    ack.valueId = instance->value().valueId();
+    ack.instanceId = instance->instanceId();
+    auto fragmentedIter = fragmentedValues_.find(commit.seq);
+    if(fragmentedIter != fragmentedValues_.end()) {
+        if(--fragmentedIter->second.uncommittedFragments > 0) {
+            return;
+        }
+        // Acked with the instance of the last fragment to commit.
+        ack.valueId = fragmentedIter->second.valueId;
+        fragmentedValues_.erase(fragmentedIter);
+    }
+    ++committedValues_;
+    pendingAcks_.push_back(ack);
+    acksReady_.set();
+    if(nextSeq_ - committedValues_ + 1 == uncommittedLimit_) {
         MORDOR_LOG_TRACE(g_log) << this << " buffer no longer full";
         canPush_.set();
     }
-}   
+}
+
+bool ValueBuffer::popAcks(vector<Ack>* acks, uint64_t* creditLimit) {
+    acksReady_.wait();
+    FiberMutex::ScopedLock lk(mutex_);
+    if(closed_) {
+        return false;
+    }
+    acks->clear();
+    acks->swap(pendingAcks_);
+    *creditLimit = committedValues_ + uncommittedLimit_;
+    return true;
+}
+
+void ValueBuffer::close() {
+    FiberMutex::ScopedLock lk(mutex_);
+    closed_ = true;
+    acksReady_.set();
+}
 
 }  // namespace lightning
@@ -3,19 +3,41 @@
 #include "blocking_queue.h"
 #include "guid.h"
 #include "notifier.h"
+#include "paxos_defs.h"
 #include "proposer_instance.h"
 #include "proposer_state.h"
 #include "value.h"
 #include <mordor/fibersynchronization.h>
-#include <set>
+#include <map>
+#include <vector>
 
 namespace lightning {
 
-class ValueBuffer : public Notifier<paxos::ProposerInstance::ptr>
+//! Tracks the values a single client connection has in flight.
+//
+//  Values are numbered in the order they are pushed; ProposerState
+//  routes the commit of each value straight to the buffer of its
+//  connection, so the number of values in flight is just the difference
+//  of two counters. pushValue() blocks once uncommittedLimit values are
+//  uncommitted.
+//  Well-behaved clients never get there: the buffer grants them credit
+//  (the cumulative number of values they may send) and queues an ack
+//  for every committed value; both are handed to the connection writer
+//  by popAcks().
+//
+//  A value too large for one instance is pushed as its fragments, which
+//  take up a single sequence number, and is acked once they have all
+//  committed.
+class ValueBuffer : public Notifier<ProposerState::ValueCommit>
 {
 public:
     typedef boost::shared_ptr<ValueBuffer> ptr;
 
+    struct Ack {
+        Guid valueId;
+        paxos::InstanceId instanceId;
+    };
+
     ValueBuffer(size_t uncommittedLimit,
                 ProposerState::ptr proposerState,
                 BlockingQueue<paxos::Value>::ptr submitQueue);
@@ -24,14 +46,42 @@ public:
 
     void pushValue(const paxos::Value& value);
 
-    virtual void notify(const paxos::ProposerInstance::ptr& instance);
+    //! Pushes the fragments of valueId as one value.
+    void pushFragments(const Guid& valueId,
+                       const std::vector<paxos::Value>& fragments);
+
+    virtual void notify(const ProposerState::ValueCommit& commit);
+
+    //! Blocks until there are new acks (or, on the first call, returns
+    //  the initial credit immediately). Swaps the pending acks into acks.
+    //  Returns false once the buffer is closed.
+    bool popAcks(std::vector<Ack>* acks, uint64_t* creditLimit);
+
+    //! Releases popAcks() for good.
+    void close();
 private:
+    struct FragmentedValue {
+        Guid valueId;
+        size_t uncommittedFragments;
+    };
+
+    //! Takes the next sequence number, blocking while the buffer is full.
+    uint64_t nextSeq(const Guid& valueId);
+
     const size_t uncommittedLimit_;
-    std::set<Guid> uncommittedValueIds_;
+    ProposerState::ConnectionId connectionId_;
+    //! The sequence number of the next pushed value.
+    uint64_t nextSeq_;
+    uint64_t committedValues_;
+    std::vector<Ack> pendingAcks_;
+    //! Values in flight as fragments, by sequence number.
+    std::map<uint64_t, FragmentedValue> fragmentedValues_;
+    bool closed_;
     ProposerState::ptr proposerState_;
     BlockingQueue<paxos::Value>::ptr submitQueue_;
 
     Mordor::FiberEvent canPush_;
+    Mordor::FiberEvent acksReady_;
     Mordor::FiberMutex mutex_;
 };
 
@@ -1,19 +1,27 @@
 #include "value_cache.h"
 #include <mordor/assert.h>
 #include <mordor/log.h>
+#include <mordor/statistics.h>
 
 namespace lightning {
 
+using Mordor::CountStatistic;
 using Mordor::FiberMutex;
 using Mordor::Log;
 using Mordor::Logger;
 using paxos::InstanceId;
 using paxos::BallotId;
+using paxos::kInvalidBallotId;
 using paxos::Value;
+using Mordor::Statistics;
 using std::make_pair;
 
 static Logger::ptr g_log = Log::lookup("lightning:value_cache");
 
+static CountStatistic<uint64_t>& g_recoveredValues =
+    Statistics::registerStatistic("value_cache.recovered_values",
+                                  CountStatistic<uint64_t>());
+
 ValueCache::ValueCache(uint64_t cacheSize)
     : cacheSize_(cacheSize),
       firstNotForgottenInstanceId_(0)
@@ -29,16 +37,18 @@ void ValueCache::updateEpoch(const Guid& newEpoch) {
         firstNotForgottenInstanceId_ = 0;
         emptyValueMap.swap(valueMap_);
         epoch_ = newEpoch;
+        g_recoveredValues.reset();
     }
 }
 
 void ValueCache::push(InstanceId instanceId,
-                      BallotId,
+                      BallotId   ballotId,
                       Value      value)
 {
     FiberMutex::ScopedLock lk(mutex_);
+    const bool recovered = (ballotId == kInvalidBallotId);
     MORDOR_LOG_TRACE(g_log) << this << " push(" << instanceId << ", " <<
-        value << ")";
+        value << ", " << (recovered ? "recovered" : "committed") << ")";
     if(instanceId < firstNotForgottenInstanceId_) {
         MORDOR_LOG_WARNING(g_log) << this << " iid " << instanceId <<
             " already forgotten";
@@ -50,20 +60,32 @@ void ValueCache::push(InstanceId instanceId,
         forgetEarliestInstance();
         MORDOR_ASSERT(valueMap_.size() < cacheSize_);
     }
-    valueMap_.insert(make_pair(instanceId, value));
+    CachedValue cachedValue;
+    cachedValue.value = value;
+    cachedValue.recovered = recovered;
+    valueMap_.insert(make_pair(instanceId, cachedValue));
+    if(recovered) {
+        g_recoveredValues.increment();
+    }
 }
 
 void ValueCache::forgetEarliestInstance() {
     MORDOR_ASSERT(!valueMap_.empty());
     auto iter = valueMap_.begin();
-    MORDOR_ASSERT(iter->first == firstNotForgottenInstanceId_);
+    // Recovered values arrive out of order, so there may be holes
+    // before the earliest cached instance. They are forgotten as well.
+    MORDOR_ASSERT(iter->first >= firstNotForgottenInstanceId_);
+    firstNotForgottenInstanceId_ = iter->first + 1;
+    if(iter->second.recovered) {
+        g_recoveredValues.decrement();
+    }
     valueMap_.erase(iter);
-    ++firstNotForgottenInstanceId_;
 }
 
 ValueCache::QueryResult ValueCache::query(const Guid& epoch,
                                           InstanceId instanceId,
-                                          Value* value) const
+                                          Value* value,
+                                          bool* recovered) const
 {
     FiberMutex::ScopedLock lk(mutex_);
     if(epoch != epoch_) {
@@ -80,7 +102,10 @@ ValueCache::QueryResult ValueCache::query(const Guid& epoch,
 
     auto iter = valueMap_.find(instanceId);
     if(iter != valueMap_.end()) {
-        *value = iter->second;
+        *value = iter->second.value;
+        if(recovered) {
+            *recovered = iter->second.recovered;
+        }
         MORDOR_LOG_TRACE(g_log) << this << " query(" <<
             epoch << ", " << instanceId << ") = OK(" <<
             *value << ")";
@@ -9,7 +9,12 @@
 
 namespace lightning {
 
-//! Caches committed values on an acceptor for recovery.
+//! Caches committed values for recovery.
+//
+//  Values that were themselves recovered from a peer (pushed with
+//  kInvalidBallotId, see RecoveryManager::addRecoveredValue) are cached
+//  just like the ones committed here, only tagged as recovered, so that
+//  any host that has caught up, including a learner, can serve them.
 class ValueCache : public InstanceSink {
 public:
     typedef boost::shared_ptr<ValueCache> ptr;
@@ -29,14 +34,22 @@ public:
         WRONG_EPOCH = 3
     };
 
+    //! If recovered is not NULL, it is set to whether an OK value was
+    //  recovered from a peer.
     QueryResult query(const Guid& epoch,
                       paxos::InstanceId instanceId,
-                      paxos::Value* value) const;
+                      paxos::Value* value,
+                      bool* recovered = NULL) const;
 
 private:
     void forgetEarliestInstance();
 
-    typedef std::map<paxos::InstanceId, paxos::Value> ValueMap;
+    struct CachedValue {
+        paxos::Value value;
+        bool recovered;
+    };
+
+    typedef std::map<paxos::InstanceId, CachedValue> ValueMap;
 
     const uint64_t cacheSize_;
 
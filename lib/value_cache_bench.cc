@@ -0,0 +1,88 @@
+#include "benchmark.h"
+#include "guid.h"
+#include "value.h"
+#include "value_cache.h"
+#include <mordor/assert.h>
+#include <boost/shared_ptr.hpp>
+#include <string>
+#include <vector>
+
+using lightning::Guid;
+using lightning::GuidGenerator;
+using lightning::ValueCache;
+using lightning::resetBenchmarkCounters;
+using lightning::paxos::Value;
+using std::string;
+using std::vector;
+
+// A full cache, so that every push also forgets the earliest instance.
+static const uint64_t kCacheSize = 1 << 16;
+static const size_t kDistinctValues = 1024;
+static const size_t kValueSize = 1000;
+
+static void fillValues(GuidGenerator* guidGenerator, vector<Value>* values) {
+    boost::shared_ptr<string> data(new string(kValueSize, 'x'));
+    for(size_t i = 0; i < kDistinctValues; ++i) {
+        values->push_back(Value(guidGenerator->generate(), data));
+    }
+}
+
+LIGHTNING_BENCHMARK(value_cache_push) {
+    GuidGenerator guidGenerator;
+    vector<Value> values;
+    fillValues(&guidGenerator, &values);
+    ValueCache valueCache(kCacheSize);
+    valueCache.updateEpoch(guidGenerator.generate());
+    for(size_t i = 0; i < kCacheSize; ++i) {
+        valueCache.push(i, 1, values[i % kDistinctValues]);
+    }
+    resetBenchmarkCounters();
+
+    for(size_t i = kCacheSize; i < kCacheSize + iterations; ++i) {
+        valueCache.push(i, 1, values[i % kDistinctValues]);
+    }
+}
+
+// Recovery requests and recommits look up recent instances, the
+// acceptor state does so for every instance it handles.
+LIGHTNING_BENCHMARK(value_cache_query) {
+    GuidGenerator guidGenerator;
+    vector<Value> values;
+    fillValues(&guidGenerator, &values);
+    ValueCache valueCache(kCacheSize);
+    const Guid epoch = guidGenerator.generate();
+    valueCache.updateEpoch(epoch);
+    for(size_t i = 0; i < kCacheSize; ++i) {
+        valueCache.push(i, 1, values[i % kDistinctValues]);
+    }
+    resetBenchmarkCounters();
+
+    Value value;
+    for(size_t i = 0; i < iterations; ++i) {
+        // Strided, so that consecutive lookups do not share tree nodes.
+        const ValueCache::QueryResult result =
+            valueCache.query(epoch, (i * 4099) % kCacheSize, &value);
+        MORDOR_ASSERT(result == ValueCache::OK);
+    }
+}
+
+// Instances the acceptor state has not seen committed yet.
+LIGHTNING_BENCHMARK(value_cache_query_not_yet) {
+    GuidGenerator guidGenerator;
+    vector<Value> values;
+    fillValues(&guidGenerator, &values);
+    ValueCache valueCache(kCacheSize);
+    const Guid epoch = guidGenerator.generate();
+    valueCache.updateEpoch(epoch);
+    for(size_t i = 0; i < kCacheSize; ++i) {
+        valueCache.push(i, 1, values[i % kDistinctValues]);
+    }
+    resetBenchmarkCounters();
+
+    Value value;
+    for(size_t i = 0; i < iterations; ++i) {
+        const ValueCache::QueryResult result =
+            valueCache.query(epoch, kCacheSize + i, &value);
+        MORDOR_ASSERT(result == ValueCache::NOT_YET);
+    }
+}
@@ -0,0 +1,180 @@
+#include "value_stream_client.h"
+#include "proto/rpc_messages.pb.h"
+#include "tcp_value_receiver.h"
+#include <mordor/assert.h>
+#include <mordor/exception.h>
+#include <mordor/log.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace lightning {
+
+using Mordor::FiberMutex;
+using Mordor::Log;
+using Mordor::Logger;
+using Mordor::Socket;
+using paxos::Value;
+using std::string;
+using std::vector;
+
+static Logger::ptr g_log = Log::lookup("lightning:value_stream_client");
+
+const size_t ValueStreamClient::kMaxBatchValues;
+const size_t ValueStreamClient::kMaxBatchBytes;
+
+ValueStreamClient::ValueStreamClient(Socket::ptr socket, AckCallback onAck)
+    : socket_(socket),
+      onAck_(onAck),
+      hasCredit_(false),
+      sentValues_(0),
+      sentBytes_(0),
+      ackedValues_(0),
+      creditLimit_(0)
+{}
+
+size_t ValueStreamClient::acquireCredit(size_t maxValues) {
+    while(true) {
+        hasCredit_.wait();
+        FiberMutex::ScopedLock lk(mutex_);
+        if(sentValues_ < creditLimit_) {
+            const size_t granted =
+                std::min(uint64_t(maxValues), creditLimit_ - sentValues_);
+            sentValues_ += granted;
+            if(sentValues_ == creditLimit_) {
+                MORDOR_LOG_TRACE(g_log) << this << " out of credit at " <<
+                                           sentValues_;
+                hasCredit_.reset();
+            }
+            return granted;
+        }
+    }
+}
+
+void ValueStreamClient::send(const Value& value) {
+    acquireCredit(1);
+
+    ValueData valueData;
+    value.serialize(&valueData);
+    FixedSizeHeaderData header;
+    header.set_size(valueData.ByteSize());
+    string wireData;
+    header.AppendToString(&wireData);
+    valueData.AppendToString(&wireData);
+    writeToSocket(wireData.data(), wireData.size());
+
+    FiberMutex::ScopedLock lk(mutex_);
+    sentBytes_ += wireData.size();
+}
+
+void ValueStreamClient::sendBatch(const vector<Value>& values) {
+    ValueBatchData batch;
+    FixedSizeHeaderData header;
+    string wireData;
+    size_t next = 0;
+    while(next < values.size()) {
+        // Large values may fill a frame long before kMaxBatchValues.
+        size_t candidates = 0;
+        size_t candidateBytes = 0;
+        while(next + candidates < values.size() &&
+              candidates < kMaxBatchValues &&
+              (candidates == 0 ||
+               candidateBytes + values[next + candidates].size() <=
+                   kMaxBatchBytes))
+        {
+            candidateBytes += values[next + candidates].size();
+            ++candidates;
+        }
+        const size_t count = acquireCredit(candidates);
+        batch.Clear();
+        for(size_t i = next; i < next + count; ++i) {
+            values[i].serialize(batch.add_values());
+        }
+        next += count;
+        MORDOR_ASSERT(uint32_t(batch.ByteSize()) <
+                      TcpValueReceiver::kBatchFrameFlag);
+        header.set_size(batch.ByteSize() | TcpValueReceiver::kBatchFrameFlag);
+        wireData.clear();
+        header.AppendToString(&wireData);
+        batch.AppendToString(&wireData);
+        writeToSocket(wireData.data(), wireData.size());
+
+        FiberMutex::ScopedLock lk(mutex_);
+        sentBytes_ += wireData.size();
+    }
+}
+
+bool ValueStreamClient::readControlStream() {
+    FixedSizeHeaderData header;
+    header.set_size(0);
+    const size_t headerSize = header.ByteSize();
+    vector<char> buffer;
+    ValueStreamControlData control;
+    while(true) {
+        buffer.resize(headerSize);
+        readFromSocket(&buffer[0], headerSize);
+        if(!header.ParseFromArray(&buffer[0], headerSize)) {
+            MORDOR_LOG_WARNING(g_log) << this << " bad control header";
+            return false;
+        }
+        buffer.resize(header.size());
+        readFromSocket(&buffer[0], header.size());
+        if(!control.ParseFromArray(&buffer[0], header.size())) {
+            MORDOR_LOG_WARNING(g_log) << this << " bad control message";
+            return false;
+        }
+        {
+            FiberMutex::ScopedLock lk(mutex_);
+            ackedValues_ += control.acks_size();
+            if(control.credit_limit() > creditLimit_) {
+                creditLimit_ = control.credit_limit();
+            }
+            if(sentValues_ < creditLimit_) {
+                hasCredit_.set();
+            }
+        }
+        for(int i = 0; i < control.acks_size(); ++i) {
+            const ValueAckData& ack = control.acks(i);
+            if(onAck_) {
+                onAck_(Guid::parse(ack.value_id()), ack.instance_id());
+            }
+        }
+    }
+}
+
+uint64_t ValueStreamClient::sentValues() const {
+    FiberMutex::ScopedLock lk(mutex_);
+    return sentValues_;
+}
+
+uint64_t ValueStreamClient::sentBytes() const {
+    FiberMutex::ScopedLock lk(mutex_);
+    return sentBytes_;
+}
+
+uint64_t ValueStreamClient::ackedValues() const {
+    FiberMutex::ScopedLock lk(mutex_);
+    return ackedValues_;
+}
+
+void ValueStreamClient::writeToSocket(const char* data, size_t bytes) {
+    size_t sent = 0;
+    while(sent < bytes) {
+        sent += socket_->send(data + sent, bytes - sent);
+    }
+}
+
+void ValueStreamClient::readFromSocket(char* destination, size_t bytes) {
+    size_t bytesRead = 0;
+    while(bytesRead < bytes) {
+        size_t currentRead =
+            socket_->receive(destination + bytesRead, bytes - bytesRead);
+        if(currentRead == 0) {
+            MORDOR_LOG_DEBUG(g_log) << this << " connection closed";
+            MORDOR_THROW_EXCEPTION_FROM_LAST_ERROR_API("recv");
+        }
+        bytesRead += currentRead;
+    }
+}
+
+}  // namespace lightning
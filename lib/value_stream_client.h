@@ -0,0 +1,71 @@
+#pragma once
+
+#include "guid.h"
+#include "paxos_defs.h"
+#include "value.h"
+#include <mordor/fibersynchronization.h>
+#include <mordor/socket.h>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <vector>
+
+namespace lightning {
+
+//! The client side of the master value port protocol
+//  (see TcpValueReceiver).
+//
+//  send() may be called from one fiber while readControlStream() runs
+//  in another; send() blocks while the master has not granted credit
+//  for another value.
+class ValueStreamClient : boost::noncopyable {
+public:
+    typedef boost::shared_ptr<ValueStreamClient> ptr;
+
+    //! Called from readControlStream() for every committed value.
+    typedef boost::function<void (const Guid&, paxos::InstanceId)>
+        AckCallback;
+
+    ValueStreamClient(Mordor::Socket::ptr socket, AckCallback onAck);
+
+    //! Blocks until there is credit, then writes the value.
+    void send(const paxos::Value& value);
+
+    //! Writes the values in as few batch frames as the available credit
+    //  allows, blocking for credit as needed.
+    void sendBatch(const std::vector<paxos::Value>& values);
+
+    //! Reads credit updates and acks. Returns false if the stream was
+    //  malformed, throws when the connection goes down.
+    bool readControlStream();
+
+    uint64_t sentValues() const;
+
+    uint64_t sentBytes() const;
+
+    uint64_t ackedValues() const;
+
+    //! Keep batch frames under TcpValueReceiver::kMaxFrameSize.
+    static const size_t kMaxBatchValues = 1024;
+    static const size_t kMaxBatchBytes = 8 * 1024 * 1024;
+private:
+    //! Blocks until there is credit for at least one value, takes it for
+    //  up to maxValues values and returns how many.
+    size_t acquireCredit(size_t maxValues);
+
+    void writeToSocket(const char* data, size_t bytes);
+
+    void readFromSocket(char* destination, size_t bytes);
+
+    Mordor::Socket::ptr socket_;
+    AckCallback onAck_;
+
+    mutable Mordor::FiberMutex mutex_;
+    Mordor::FiberEvent hasCredit_;
+    uint64_t sentValues_;
+    uint64_t sentBytes_;
+    uint64_t ackedValues_;
+    uint64_t creditLimit_;
+};
+
+}  // namespace lightning
@@ -0,0 +1,162 @@
+#include "value.h"
+#include "guid.h"
+#include "proto/rpc_messages.pb.h"
+#include <mordor/test/test.h>
+#include <boost/shared_ptr.hpp>
+#include <stdlib.h>
+#include <string>
+
+using namespace Mordor;
+using namespace lightning;
+using lightning::paxos::Value;
+using boost::shared_ptr;
+using std::string;
+
+namespace {
+
+string compressibleData(size_t length) {
+    string data;
+    while(data.length() < length) {
+        data += "lightning ring paxos ";
+    }
+    data.resize(length);
+    return data;
+}
+
+string randomData(size_t length) {
+    string data(length, '\0');
+    for(size_t i = 0; i < length; ++i) {
+        data[i] = char(rand());
+    }
+    return data;
+}
+
+//! Serializes and parses the value, as when it travels.
+Value roundTrip(const Value& value) {
+    ValueData valueData;
+    value.serialize(&valueData);
+    Value parsed;
+    MORDOR_TEST_ASSERT(Value::parse(valueData, &parsed));
+    return parsed;
+}
+
+string releaseData(Value* value) {
+    Guid valueId;
+    shared_ptr<string> data;
+    MORDOR_TEST_ASSERT(value->release(&valueId, &data));
+    return *data;
+}
+
+//! Whether release() refuses the value, checking what it leaves behind.
+bool releaseFails(Value* value) {
+    Guid valueId;
+    shared_ptr<string> data(new string);
+    if(value->release(&valueId, &data)) {
+        return false;
+    }
+    MORDOR_TEST_ASSERT(!data);
+    MORDOR_TEST_ASSERT(value->valueId().empty());
+    return true;
+}
+
+}  // anonymous namespace
+
+MORDOR_UNITTEST(ValueTest, CompressionRoundTrip) {
+    GuidGenerator guidGenerator;
+    const string original = compressibleData(8000);
+    Value value(guidGenerator.generate(),
+                shared_ptr<string>(new string(original)));
+    MORDOR_TEST_ASSERT(value.compress());
+    MORDOR_TEST_ASSERT(value.compressed());
+    MORDOR_TEST_ASSERT_LESS_THAN(value.size(), original.length());
+
+    Value parsed = roundTrip(value);
+    MORDOR_TEST_ASSERT(parsed.compressed());
+    MORDOR_TEST_ASSERT(parsed.valueId() == value.valueId());
+    MORDOR_TEST_ASSERT_EQUAL(releaseData(&parsed), original);
+}
+
+MORDOR_UNITTEST(ValueTest, SkipsCompressionUnlessSmaller) {
+    GuidGenerator guidGenerator;
+    const string small = compressibleData(Value::kMinCompressSize - 1);
+    Value smallValue(guidGenerator.generate(),
+                     shared_ptr<string>(new string(small)));
+    MORDOR_TEST_ASSERT(!smallValue.compress());
+    MORDOR_TEST_ASSERT_EQUAL(releaseData(&smallValue), small);
+
+    const string random = randomData(8000);
+    Value randomValue(guidGenerator.generate(),
+                      shared_ptr<string>(new string(random)));
+    MORDOR_TEST_ASSERT(!randomValue.compress());
+    MORDOR_TEST_ASSERT(!randomValue.compressed());
+    MORDOR_TEST_ASSERT_EQUAL(releaseData(&randomValue), random);
+}
+
+MORDOR_UNITTEST(ValueTest, CorruptCompressedDataIsReported) {
+    GuidGenerator guidGenerator;
+    const string original = compressibleData(8000);
+    Value value(guidGenerator.generate(),
+                shared_ptr<string>(new string(original)));
+    MORDOR_TEST_ASSERT(value.compress());
+    MORDOR_TEST_ASSERT(value.verifyCompressed());
+    ValueData valueData;
+    value.serialize(&valueData);
+
+    // Garbage instead of an LZ4 block.
+    ValueData garbage(valueData);
+    garbage.set_data(randomData(valueData.data().length()));
+    Value parsed;
+    MORDOR_TEST_ASSERT(Value::parse(garbage, &parsed));
+    MORDOR_TEST_ASSERT(!parsed.verifyCompressed());
+    MORDOR_TEST_ASSERT(releaseFails(&parsed));
+
+    // A truncated block.
+    ValueData truncated(valueData);
+    truncated.mutable_data()->resize(valueData.data().length() / 2);
+    MORDOR_TEST_ASSERT(Value::parse(truncated, &parsed));
+    MORDOR_TEST_ASSERT(!parsed.verifyCompressed());
+    MORDOR_TEST_ASSERT(releaseFails(&parsed));
+
+    // A block claiming to expand to more than it does.
+    ValueData inflated(valueData);
+    inflated.set_uncompressed_size(valueData.uncompressed_size() + 1);
+    MORDOR_TEST_ASSERT(Value::parse(inflated, &parsed));
+    MORDOR_TEST_ASSERT(!parsed.verifyCompressed());
+    MORDOR_TEST_ASSERT(releaseFails(&parsed));
+}
+
+MORDOR_UNITTEST(ValueTest, ParseRejectsMalformedFields) {
+    GuidGenerator guidGenerator;
+    Value value(guidGenerator.generate(),
+                shared_ptr<string>(new string(compressibleData(8000))));
+    MORDOR_TEST_ASSERT(value.compress());
+    ValueData valueData;
+    value.serialize(&valueData);
+    Value parsed;
+
+    ValueData tooLarge(valueData);
+    tooLarge.set_uncompressed_size(Value::kMaxUncompressedSize + 1);
+    MORDOR_TEST_ASSERT(!Value::parse(tooLarge, &parsed));
+
+    ValueData zeroSize(valueData);
+    zeroSize.set_uncompressed_size(0);
+    MORDOR_TEST_ASSERT(!Value::parse(zeroSize, &parsed));
+
+    ValueData badId(valueData);
+    badId.set_id("short");
+    MORDOR_TEST_ASSERT(!Value::parse(badId, &parsed));
+
+    ValueData oversized(valueData);
+    oversized.set_data(string(Value::kMaxValueSize + 1, 'x'));
+    MORDOR_TEST_ASSERT(!Value::parse(oversized, &parsed));
+
+    ValueData badFragment(valueData);
+    FragmentData* fragment = badFragment.mutable_fragment();
+    value.valueId().serialize(fragment->mutable_value_id());
+    fragment->set_index(3);
+    fragment->set_count(3);
+    MORDOR_TEST_ASSERT(!Value::parse(badFragment, &parsed));
+    fragment->set_index(2);
+    MORDOR_TEST_ASSERT(Value::parse(badFragment, &parsed));
+    MORDOR_TEST_ASSERT(parsed.isFragment());
+}
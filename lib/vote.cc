@@ -8,6 +8,7 @@ using paxos::InstanceId;
 using std::ostream;
 
 Vote::Vote(const Guid& rpcGuid,
+           uint64_t requestSeq,
            const Guid& epoch,
            uint32_t ringId,
            InstanceId instance,
@@ -19,6 +20,7 @@ Vote::Vote(const Guid& rpcGuid,
 {
     message_->set_type(RpcMessageData::PAXOS_PHASE2);
     rpcGuid.serialize(message_->mutable_uuid());
+    message_->set_request_seq(requestSeq);
     VoteData* voteData = message_->mutable_vote();
     epoch.serialize(voteData->mutable_epoch());
     voteData->set_ring_id(ringId);
@@ -49,6 +51,14 @@ const Guid Vote::valueId() const {
     return Guid::parse(message_->vote().value_id());
 }
 
+bool Vote::traced() const {
+    return message_->vote().traced();
+}
+
+void Vote::setTraced() {
+    message_->mutable_vote()->set_traced(true);
+}
+
 ostream& Vote::output(ostream& os) const {
     const VoteData& vote = message_->vote();
     os << "Vote(" << Guid::parse(message_->uuid()) << ", " << epoch() <<
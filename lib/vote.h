@@ -14,6 +14,7 @@ class Vote {
 public:
     //! A new vote.
     Vote(const Guid& rpcGuid,
+         uint64_t requestSeq,
          const Guid& epoch,
          uint32_t ringId,
          paxos::InstanceId instance,
@@ -36,6 +37,11 @@ public:
 
     const Guid valueId() const;
 
+    //! Whether the instance is sampled for tracing.
+    bool traced() const;
+
+    void setTraced();
+
     //! For debug logging.
     std::ostream& output(std::ostream& os) const;
 private: